@@ -17,6 +17,10 @@
 
 #include "httpd/acceptor.hpp"
 #include "httpd/http_stream.hpp"
+#include "httpd/send_queue.hpp"
+#include "httpd/inflight_limit.hpp"
+#include "httpd/binary_json.hpp"
+#include "httpd/http2/connection.hpp"
 
 #include "utils/time_clock.hpp"
 
@@ -24,26 +28,32 @@ namespace cmall {
 
 	using ws_stream = websocket::stream<boost::beast::tcp_stream>;
 
+	// websocket 连接的状态. websocket::stream 本身按具体的 stream 类型放在处理连接的协程里,
+	// 见 cmall_service::serve_http1.
 	struct websocket_connection
 	{
 		websocket_connection(websocket_connection&& c) = delete;
 
-		websocket_connection(httpd::http_any_stream& tcp_stream_)
-			: ws_stream_(tcp_stream_)
-			, message_channel(tcp_stream_.get_executor(), 1)
+		template<typename Executor>
+		websocket_connection(Executor&& io, const httpd::send_queue_config& config, httpd::send_queue_counters& counters, std::size_t inflight_limit)
+			: send_queue(io, config, &counters)
+			, inflight(std::forward<Executor>(io), inflight_limit)
 		{}
 
 		void close(auto connection_id)
 		{
 			LOG_FMT("ws client close() called: [{}]", connection_id);
 
-			boost::system::error_code ignore_ec;
-			message_channel.close();
+			send_queue.close();
 		}
 
-		websocket::stream<httpd::http_any_stream&> ws_stream_;
-		boost::asio::experimental::concurrent_channel<void(boost::system::error_code, std::string)> message_channel;
+		// 待发送的消息, 由 do_ws_write 按批取出.
+		httpd::send_queue send_queue;
+		// 正在处理的请求占用的额度, 只在连接的 io_context 线程上访问.
+		httpd::inflight_limit inflight;
 		bool m_disable_ping = false;
+		// 协商了二进制子协议的连接, JSON-RPC 消息用 MessagePack/CBOR 编码, 走 binary 帧.
+		std::optional<httpd::binary_json::format> binary_format;
 		std::string baseurl_;
 	};
 
@@ -63,6 +73,17 @@ namespace cmall {
 
 		std::map<std::uint64_t, std::shared_ptr<boost::asio::cancellation_signal>> cancel_signals_;
 
+		// client_disconnected 里置上, 之后不再接受订阅. 只在持有 catalog_subscribers 的锁时读写.
+		bool disconnected_ = false;
+
+		// 以下只在连接的 executor 上访问.
+		// HTTP/1.1 连接正在等 keep-alive 的下一个请求, 这时关闭不会打断请求.
+		bool http_idle_ = false;
+		// drain() 以后处理完当前请求就断开, 不再 keep-alive.
+		bool draining_ = false;
+		// HTTP/2 连接, serve_http2 里设置.
+		std::weak_ptr<httpd::http2::server_connection> http2_;
+
 		auto get_executor()
 		{
 			return tcp_stream.get_executor();
@@ -86,6 +107,19 @@ namespace cmall {
 			LOG_DBG << (ws_client? "ws" : "http" ) <<  " client leave: " << connection_id_ << ", remote: " << x_real_ip;
 		}
 
+		// 交接给新进程时由 acceptor 调用: websocket 发完排队的消息后以 1012 (service restart) 关闭,
+		// HTTP/2 发 GOAWAY 等已有的 stream 处理完, HTTP/1.1 空闲的直接关, 处理中的做完这个请求再关.
+		void drain()
+		{
+			draining_ = true;
+			if (ws_client)
+				ws_client->send_queue.shutdown(boost::beast::websocket::close_code::service_restart);
+			else if (auto h2 = http2_.lock())
+				h2->shutdown();
+			else if (http_idle_)
+				tcp_stream.close();
+		}
+
 		void close()
 		{
 			for (auto & cs: cancel_signals_)
@@ -109,6 +143,15 @@ namespace cmall {
 		{
 		}
 
+		// 握手后尝试把 TLS 交给内核 (kTLS) 的 ssl 连接.
+		template<typename Executor>
+		client_connection(Executor&& io, boost::asio::ssl::context& sslctx, int64_t connection_id, int ktls_stream)
+			: tcp_stream(boost::variant2::in_place_type<httpd::ktls_stream>, std::forward<Executor>(io), sslctx)
+			, connection_id_(connection_id)
+		{
+			boost::ignore_unused(ktls_stream);
+		}
+
 		template<typename Executor>
 		client_connection(Executor&& io, int64_t connection_id, int unix_stream)
 			: tcp_stream(boost::variant2::in_place_type<httpd::unix_stream>, std::forward<Executor>(io))
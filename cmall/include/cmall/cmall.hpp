@@ -12,6 +12,7 @@
 #include <boost/multi_index/global_fun.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
 #include <boost/multi_index/tag.hpp>
 
 #include "boost/asio/thread_pool.hpp"
@@ -23,10 +24,13 @@
 #include <boost/asio/experimental/promise.hpp>
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/co_spawn.hpp>
+#include <map>
+#include <memory_resource>
 #include <vector>
 
 #include "cmall/error_code.hpp"
 #include "cmall/misc.hpp"
+#include "cmall/rpc_registry.hpp"
 #include "services/verifycode.hpp"
 #include "services/persist_session.hpp"
 #include "services/payment_service.hpp"
@@ -35,10 +39,15 @@
 #include "services/gitea_service.hpp"
 #include "services/search_service.hpp"
 #include "services/wxpay_service.hpp"
+#include "services/notify_bus.hpp"
 
 #include "httpd/acceptor.hpp"
 #include "httpd/ssl_acceptor.hpp"
 #include "httpd/unix_acceptor.hpp"
+#include "httpd/tls_session.hpp"
+#include "httpd/admission.hpp"
+#include "httpd/send_queue.hpp"
+#include "httpd/timer_wheel.hpp"
 
 #include "httpd/http_stream.hpp"
 
@@ -73,6 +82,61 @@ namespace cmall {
 
 		std::string tencent_secret_id;
 		std::string tencent_secret_key;
+
+		// wss 上通过 ALPN 协商 h2, ws/ws_unix 上接受 prior-knowledge 的 h2c.
+		bool enable_http2_ = true;
+
+		// wss 连接握手后尝试使用内核 TLS (kTLS), 内核或 cipher 不支持时自动退回用户态加密.
+		bool enable_ktls_ = false;
+
+		// wss 的 session cache, session ticket 和 ECDHE 曲线.
+		httpd::tls_session_config tls_session_;
+
+		// io 线程绑定 CPU, 并用 cBPF 把新连接交给收包 CPU 上的 acceptor.
+		bool cpu_affinity_ = false;
+
+		// 连接数上限和后端积压时暂停 accept.
+		httpd::admission_config admission_;
+
+		// HTTP/1.1 连接读请求头, 读 body 和 keep-alive 空闲的超时.
+		std::chrono::seconds http_header_timeout_{ 15 };
+		std::chrono::seconds http_body_timeout_{ 30 };
+		std::chrono::seconds http_keepalive_timeout_{ 60 };
+
+		// 重启交接用的 unix socket. 启动时从这里接过旧进程的监听 fd, 之后在这里等下一个进程来接.
+		std::string handoff_socket_;
+		// 交接后旧进程等进行中的请求做完的最长时间.
+		std::chrono::seconds handoff_drain_timeout_{ 30 };
+
+		// websocket 发送队列的水位线, 合并写的大小和积压时的处理.
+		httpd::send_queue_config ws_send_queue_;
+
+		// websocket 的 permessage-deflate 参数, server_enable 为 false 时不压缩.
+		// 每个连接各有一对 zlib 上下文, 窗口和 memLevel 决定它们的大小.
+		boost::beast::websocket::permessage_deflate ws_deflate_;
+
+		// 单个 websocket 连接上同时处理的请求的总开销上限, 0 表示不限制.
+		// 达到上限时暂停读新消息, 直到有请求处理完.
+		std::size_t ws_inflight_limit_ = 32;
+
+		// 单条 websocket 消息的上限. 图片走 /api/upload 上传, 不用为它放大这个值.
+		std::size_t ws_max_message_size_ = 6 * 1024 * 1024;
+
+		// POST/PUT /api/upload 的 body 上限, 上传的内容用 upload_id 在 RPC 里引用.
+		std::size_t upload_max_size_ = 6 * 1024 * 1024;
+		// 没登录, 只有 session 的客户端的上传上限.
+		std::size_t anonymous_upload_max_size_ = 2 * 1024 * 1024;
+		// 上传的内容存在这个目录下等 RPC 取走. 多实例部署时指向所有实例共享的目录.
+		std::string upload_dir_;
+		// 上传目录里的总量上限, 超过时拒绝新的上传.
+		std::uint64_t upload_total_size_ = 512 * 1024 * 1024;
+
+		// 覆盖方法描述里的开销等级, 由 --rpc_cost 设置.
+		std::map<std::string, std::size_t, std::less<>> rpc_costs_;
+
+		// 多实例部署时, 通过 PostgreSQL 的 LISTEN/NOTIFY 把推送转发给其他实例上的连接.
+		// 空字符串表示不启用, 否则是 NOTIFY 用的频道名, 所有实例要一致.
+		std::string notify_channel_;
 	};
 
 
@@ -109,6 +173,42 @@ namespace cmall {
 		>
 	> active_session_map;
 
+	// 连接订阅了哪些商户的商品变化.
+	struct catalog_subscription
+	{
+		std::uint64_t merchant_id;
+		std::int64_t connection_id;
+		client_connection_weakptr connection;
+	};
+
+	typedef boost::multi_index_container<
+		catalog_subscription,
+		boost::multi_index::indexed_by<
+			boost::multi_index::hashed_non_unique<
+				boost::multi_index::tag<tag::merchant_uid_tag>,
+				boost::multi_index::member<catalog_subscription, std::uint64_t, &catalog_subscription::merchant_id>
+			>,
+			boost::multi_index::hashed_non_unique<
+				boost::multi_index::tag<tag::connection_id_tag>,
+				boost::multi_index::member<catalog_subscription, std::int64_t, &catalog_subscription::connection_id>
+			>
+		>
+	> catalog_subscription_map;
+
+	// 订单状态的变化, 推送的 topic 和推给谁见 notify_order_event.
+	enum class order_event
+	{
+		created, // new_order_for_merchant, 推给卖家.
+		paid, // order_paid, 推给买家和卖家.
+		shipped, // order_shipped, 推给买家.
+		closed, // order_closed, 推给买家和卖家.
+	};
+
+	// cmall_3rd_kv_store 里 cmall 自己用的键的前缀, user_3rd_kv_put 不能写.
+	inline constexpr std::string_view reserved_kv_prefix = "cmall.";
+	// 购物车版本号存在这个键下, 每次增删改加一.
+	inline constexpr std::string_view cart_version_kv_key = "cmall.cart_version";
+
 	inline std::int64_t merchant_get_rank(std::shared_ptr<services::merchant_git_repo>)
 	{
 		return 0;
@@ -135,102 +235,6 @@ namespace cmall {
 		>
 	> loaded_merchant_map;
 
-	enum class req_method {
-		recover_session,
-
-		ping,
-
-		user_fastlogin,
-		user_prelogin,
-		user_login,
-		user_logout,
-		user_islogin,
-		user_info,
-		user_apply_merchant,
-		user_apply_info, // 审核状态.
-
-		user_add_face,
-		user_search_by_face, // demo
-
-		user_list_recipient_address,
-		user_add_recipient_address,
-		user_modify_receipt_address,
-		user_erase_receipt_address,
-		user_get_wx_openid,
-		user_3rd_kv_put,
-		user_3rd_kv_get,
-		user_3rd_kv_put_pubkey,
-		user_3rd_kv_get_pubkey,
-
-		cart_add,
-		cart_mod,
-		cart_del,
-		cart_list,
-
-		fav_add,
-		fav_del,
-		fav_list,
-
-		order_create_cart,
-		order_create_direct,
-		order_detail,
-		order_list,
-		order_close,
-
-		order_get_paymethods, // 获取支持的支付方式.
-		order_get_pay_url,
-		order_check_payment,
-		order_get_wxpay_prepay_id, // 获取微信预支付 id
-		order_get_wxpay_object, // 获取一个用于调用 wx.requestPayment(OBJECT) 的 OBJECT
-
-
-		search_goods,
-		goods_list,
-		goods_detail,
-		goods_markdown,
-		goods_merchant_index,
-
-		merchant_info,
-		merchant_get_sold_order_detail,
-		merchant_sold_orders_check_payment,
-		merchant_sold_orders_mark_payed,
-		merchant_alter_order_price,
-		merchant_goods_list,
-		merchant_keywords_list,
-		merchant_list_sold_orders,
-		merchant_sold_orders_add_kuaidi,
-		merchant_delete_sold_orders,
-		merchant_get_gitea_password,
-		merchant_reset_gitea_password,
-		merchant_create_apptoken,
-		merchant_list_apptoken,
-		merchant_delete_apptoken,
-		merchant_alter_name,
-		merchant_user_kv_get,
-
-		admin_user_detail,
-		admin_user_list,
-		admin_user_ban,
-		admin_list_applicants,
-		admin_approve_merchant,
-		admin_deny_applicant,
-		admin_list_merchants,
-		admin_disable_merchants,
-		admin_reenable_merchants,
-		admin_set_merchant_wxpay_submchid,
-		admin_set_wxpay_detail,
-		admin_sudo,
-		admin_sudo_cancel,
-		admin_list_index_goods,
-		admin_set_index_goods,
-		admin_add_index_goods,
-		admin_remove_index_goods,
-
-		admin_set_profit_sharing,
-
-		wx_direct_pay,
-	};
-
 	class cmall_service
 	{
 		// c++11 noncopyable.
@@ -253,6 +257,14 @@ namespace cmall {
 		awaitable<void> run_httpd();
 		awaitable<void> stop();
 
+		// 监听 fd 的继承和交接. 继承来的 fd 在 init_*_acceptors 里按地址认领, 不再 bind.
+		void inherit_listen_fds(std::vector<int> fds);
+		bool take_over_listeners();
+		void listeners_ready();
+		awaitable<void> serve_listener_handoff();
+		// 交接以后调用: 停止 accept, 让所有连接收尾后退出, 最多等 handoff_drain_timeout_.
+		awaitable<void> drain_connections();
+
 	private:
 		awaitable<bool> load_merchant_git(const cmall_merchant& merchant); // false if no git repo for merchant
 		std::shared_ptr<services::merchant_git_repo> get_merchant_git_repo(std::uint64_t merchant_uid, boost::system::error_code& ec) const;
@@ -270,46 +282,93 @@ namespace cmall {
 		awaitable<void> client_connected(client_connection_ptr);
 		awaitable<void> client_disconnected(client_connection_ptr);
 
-		awaitable<int> render_git_repo_files(size_t connection_id, std::string merchant, std::string path_in_repo, httpd::http_any_stream& client, boost::beast::http::request<boost::beast::http::string_body>);
-		awaitable<int> render_goods_detail_content(std::string merchant, std::string goods_id, httpd::http_any_stream& client, const boost::beast::http::request<boost::beast::http::string_body>& req);
-		awaitable<void> do_ws_read(size_t connection_id, client_connection_ptr);
-		awaitable<void> do_ws_write(size_t connection_id, client_connection_ptr);
+		// HTTP/1.1 和 HTTP/2 共用的请求处理. 返回 false 表示连接不应该继续 keep-alive.
+		awaitable<void> serve_http2(client_connection_ptr, boost::beast::flat_buffer& buffer);
+		awaitable<void> update_client_info(client_connection_ptr, const boost::beast::http::request<boost::beast::http::string_body>& req);
+		awaitable<bool> handle_http_request(client_connection_ptr, httpd::http_any_stream& stream, boost::beast::http::request<boost::beast::http::string_body>& req, std::pmr::memory_resource* arena);
+		// POST/PUT /api/upload, 暂存 body, 回复 upload_id.
+		awaitable<bool> handle_upload(client_connection_ptr, httpd::http_any_stream& stream, boost::beast::http::request<boost::beast::http::string_body>& req, std::pmr::memory_resource* arena);
+
+		awaitable<int> render_git_repo_files(size_t connection_id, std::string merchant, std::string path_in_repo, httpd::http_any_stream& client, std::pmr::memory_resource* arena, const boost::beast::http::request<boost::beast::http::string_body>& req);
+		awaitable<int> render_goods_detail_content(std::string merchant, std::string goods_id, httpd::http_any_stream& client, std::pmr::memory_resource* arena, const boost::beast::http::request<boost::beast::http::string_body>& req);
+		// 按连接的具体 stream 类型实例化, 每种 listener 一份.
+		template <typename Stream>
+		awaitable<void> serve_http1(client_connection_ptr, Stream& stream, boost::beast::flat_buffer& buffer, httpd::deadline& read_deadline);
+		template <typename WsStream>
+		awaitable<void> do_ws_read(size_t connection_id, client_connection_ptr, WsStream& ws);
+		template <typename WsStream>
+		awaitable<void> do_ws_write(size_t connection_id, client_connection_ptr, WsStream& ws);
 
 		awaitable<void> close_all_ws();
 
+		template <typename Acceptors, typename Emplace>
+		bool adopt_listen_fds(Acceptors& acceptors, const std::string& address, bool unix_socket, Emplace&& emplace);
+
 		promise<void(std::exception_ptr)> websocket_write(client_connection_ptr, std::string message);
 
 		awaitable<void> alloca_sessionid(client_connection_ptr);
 		awaitable<void> load_user_info(client_connection_ptr);
 
-		awaitable<boost::json::object> handle_jsonrpc_call(client_connection_ptr, const std::string& method, boost::json::object params);
-
-		awaitable<boost::json::object> handle_jsonrpc_user_api(client_connection_ptr, const req_method method, boost::json::object params);
-		awaitable<boost::json::object> handle_jsonrpc_order_api(client_connection_ptr, const req_method method, boost::json::object params);
-		awaitable<boost::json::object> handle_jsonrpc_cart_api(client_connection_ptr, const req_method method, boost::json::object params);
-		awaitable<boost::json::object> handle_jsonrpc_fav_api(client_connection_ptr, const req_method method, boost::json::object params);
-		awaitable<boost::json::object> handle_jsonrpc_goods_api(client_connection_ptr, const req_method method, boost::json::object params);
-
-		awaitable<boost::json::object> handle_jsonrpc_merchant_api(client_connection_ptr, const req_method method, boost::json::object params);
-		awaitable<boost::json::object> handle_jsonrpc_admin_api(client_connection_ptr, const req_method method, boost::json::object params);
-		awaitable<boost::json::object> handle_jsonrpc_misc_api(client_connection_ptr, const req_method method, boost::json::object params);
+		awaitable<boost::json::object> handle_jsonrpc_call(client_connection_ptr, std::string_view method, const boost::json::object& params);
+		// 处理一个 JSON-RPC 请求, 出错时也返回应答 (带上请求的 id).
+		awaitable<boost::json::object> handle_jsonrpc_request(client_connection_ptr, const boost::json::value& request);
+		// 处理一个批量请求, 各项占完额度派发出去后返回, 应答收齐后一起发.
+		awaitable<void> handle_jsonrpc_batch(client_connection_ptr, boost::json::value batch);
+		// 一次调用占用连接的多少并发额度.
+		std::size_t rpc_cost(std::string_view method) const;
+
+		awaitable<boost::json::object> handle_jsonrpc_session_api(client_connection_ptr, const req_method method, const boost::json::object& params);
+		awaitable<boost::json::object> handle_jsonrpc_user_api(client_connection_ptr, const req_method method, const boost::json::object& params);
+		awaitable<boost::json::object> handle_jsonrpc_order_api(client_connection_ptr, const req_method method, const boost::json::object& params);
+		awaitable<boost::json::object> handle_jsonrpc_cart_api(client_connection_ptr, const req_method method, const boost::json::object& params);
+		awaitable<boost::json::object> handle_jsonrpc_fav_api(client_connection_ptr, const req_method method, const boost::json::object& params);
+		awaitable<boost::json::object> handle_jsonrpc_goods_api(client_connection_ptr, const req_method method, const boost::json::object& params);
+
+		awaitable<boost::json::object> handle_jsonrpc_merchant_api(client_connection_ptr, const req_method method, const boost::json::object& params);
+		awaitable<boost::json::object> handle_jsonrpc_admin_api(client_connection_ptr, const req_method method, const boost::json::object& params);
+		awaitable<boost::json::object> handle_jsonrpc_misc_api(client_connection_ptr, const req_method method, const boost::json::object& params);
 
 		awaitable<bool> handle_order_wx_callback(services::weixin::notify_message msg);
 
 		awaitable<std::vector<services::product>> list_index_goods(std::string baseurl);
 
 		awaitable<void> send_notify_message(std::uint64_t uid_, const std::string&, std::int64_t exclude_connection);
+		// 只推给本实例上 uid 的连接. 从 notify bus 收到的转发也走这里.
+		void deliver_notify_message(std::uint64_t uid_, httpd::shared_message msg);
+		// 推给订阅了这个商户的连接, 带上改过和删掉的商品 id.
+		void notify_catalog_changed(std::uint64_t merchant_id, const std::vector<std::string>& changed, const std::vector<std::string>& removed);
+		// 购物车的增删改推给这个用户的其他连接, 带上改动的条目和新的版本号.
+		awaitable<void> notify_cart_changed(const client_connection& c, std::string_view op, boost::json::object item, std::uint64_t version);
+		// 在同一个事务里改购物车并把版本号加一. 先锁住用户行, 同一个用户的改动 (包括其他实例上的)
+		// 按提交的顺序拿版本号. mutate 返回 false 时回滚, 返回空.
+		awaitable<std::optional<std::uint64_t>> cart_mutate(std::uint64_t uid, std::function<bool(odb::database&)> mutate);
+		awaitable<std::uint64_t> cart_version(std::uint64_t uid);
+		// 订单状态变化时推给买家和/或卖家, 见 order_event.
+		awaitable<void> notify_order_event(order_event event, const cmall_order& order);
+		// 同一条已经序列化好的消息推给一批连接, 各连接的发送队列共享这一块缓冲.
+		void broadcast_message(const std::vector<client_connection_ptr>& connections, httpd::shared_message msg);
 
 		// round robing for acceptor.
 		auto& get_executor(){ return m_io_context_pool.get_io_context(); }
 
 		awaitable<bool> order_check_payment(cmall_order& order, const cmall_merchant& seller);
 		awaitable<bool> order_mark_payed(cmall_order& order, const cmall_merchant& seller);
+		// 在事务里锁住订单标记为已支付, 已经付过的不动, 关闭了的重新打开.
+		// 返回这次是否由未支付变成已支付 (此时推送 order_paid), order 换成库里的最新值.
+		awaitable<bool> order_record_payment(cmall_order& order, boost::posix_time::ptime payed_at);
 
 		awaitable<bool> in_temp_api_token(std::string api_token);
 		awaitable<std::string> gen_temp_api_token(std::string merchant_id);
 		awaitable<void> drop_temp_api_token(std::string api_token);
 
+		// 把上传的内容写进 upload_dir_, 返回 upload_id. 上传归属于 session: 登录用户最多留几份,
+		// 匿名的只留一份, 超出时丢掉最早的. 目录总量超限或者写失败返回空.
+		awaitable<std::string> put_upload(const services::client_session& session, std::string data);
+		// 取走并删除, 不存在, 已过期或者不归这个 session 返回空.
+		awaitable<std::optional<std::string>> take_upload(const services::client_session& session, std::string_view upload_id);
+		// 定期删掉过期的上传, 并重新统计目录总量.
+		awaitable<void> upload_sweep_loop();
+
 	private:
 		io_context_pool& m_io_context_pool;
 		boost::asio::io_context& m_io_context;
@@ -332,18 +391,37 @@ namespace cmall {
 
 		// ws 服务端相关.
 		utility::shared_mutex::container_with_mutex<active_session_map> active_users;
+		utility::shared_mutex::container_with_mutex<catalog_subscription_map> catalog_subscribers;
 
 		// api-token 相关.
 		utility::shared_mutex::set<std::string> temp_api_token;
 
+		// upload_dir_ 里的总字节数, put/take 时增减, upload_sweep_loop 按目录实际情况校正.
+		std::atomic<std::uint64_t> upload_bytes_{ 0 };
+
 		std::once_flag check_admin_flag;
 
+		// 必须比 sslctx_ 活得久, sslctx_ 的回调里会用到它.
+		httpd::tls_session_manager tls_session_manager_;
 		boost::asio::ssl::context sslctx_;
+		// 所有 acceptor 共用, 必须比 acceptor 活得久.
+		httpd::admission_control admission_control_;
+		// 所有 websocket 连接的发送队列共用.
+		httpd::send_queue_counters ws_send_counters_;
+		// 各个 RPC 方法的调用次数和延迟.
+		rpc_stats_table rpc_stats_;
+		// 没有启用 --notify_channel 时为空.
+		std::unique_ptr<services::notify_bus> notify_bus_;
 		std::vector<httpd::acceptor<client_connection_ptr, cmall_service>> m_ws_acceptors;
 		std::vector<httpd::ssl_acceptor<client_connection_ptr, cmall_service>> m_wss_acceptors;
 		std::vector<httpd::unix_acceptor<client_connection_ptr, cmall_service>> m_ws_unix_acceptors;
 		std::vector<promise<void(std::exception_ptr)>> m_background_threads;
 
+		// systemd 或者旧进程交过来, 还没有被 acceptor 认领的监听 fd.
+		std::vector<int> m_inherited_listen_fds;
+		// 交出监听 fd 的旧进程, 等我们准备好了通知它退出.
+		boost::asio::local::stream_protocol::socket m_handoff_predecessor;
+
 		friend class httpd::acceptor<client_connection_ptr, cmall_service>;
 		friend class httpd::ssl_acceptor<client_connection_ptr, cmall_service>;
 		friend class httpd::unix_acceptor<client_connection_ptr, cmall_service>;
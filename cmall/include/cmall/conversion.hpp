@@ -33,11 +33,12 @@ inline namespace conversion
 	void tag_invoke(const value_from_tag&, value& jv, const cmall_apply_for_mechant& g);
 	void tag_invoke(const value_from_tag&, value& jv, const cmall_kuaidi_info& k);
 
+	// 指向解析出来的请求, 不拷贝, 只在请求的 json 活着的时候有效.
 	struct jsonrpc_request_t
 	{
-		std::string method;
-		boost::json::value id;
-		boost::json::object params; // only {}
+		std::string_view method;
+		const boost::json::value* id; // 没有 id 时为 nullptr
+		const boost::json::object* params; // only {}, 没有时指向空 object
 	};
 	using maybe_jsonrpc_request_t = std::optional<jsonrpc_request_t>;
 
@@ -33,6 +33,7 @@
 #include "odb/traits.hxx"
 #include "utils/logging.hpp"
 #include "utils/coroyield.hpp"
+#include "utils/pending_ops.hpp"
 
 using boost::asio::awaitable;
 using boost::asio::use_awaitable;
@@ -79,13 +80,16 @@ namespace cmall
 	public:
 		void shutdown();
 
+		// 线程池上排队和执行中的数据库操作数.
+		std::size_t pending_ops() const { return pending_ops_.load(std::memory_order_relaxed); }
+
 
 		using odb_transaction_ptr = std::shared_ptr<odb::transaction>;
 
 		template <typename Op>
 		awaitable<bool> async_transacton(Op&& op)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				auto tx = std::make_shared<odb::transaction>(m_db->begin());
@@ -366,7 +370,7 @@ namespace cmall
 		template <typename T>
 		awaitable<bool> async_load(std::uint64_t id, T& value)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]()mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]()mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return get<T>(id, value);
@@ -376,7 +380,7 @@ namespace cmall
 		template <typename T>
 		awaitable<bool> async_load(const odb::query<T>& query, std::vector<T>& ret)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return get<T>(query, ret);
@@ -386,7 +390,7 @@ namespace cmall
 		template <typename T>
 		awaitable<bool> async_load(const odb::query<T>& query, T& ret)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return get<T>(query, ret);
@@ -396,7 +400,7 @@ namespace cmall
 		template <typename T>
 		awaitable<bool> async_add(T& value)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]()mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]()mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return add<T>(value);
@@ -406,7 +410,7 @@ namespace cmall
 		template<typename T>
 		awaitable<bool> async_upset(T& value)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return upset<T>(value);
@@ -416,7 +420,7 @@ namespace cmall
 		template<typename T>
 		awaitable<bool> async_erase_and_insert(odb::query<T> deletequery, const std::vector<T> & values)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return erase_and_insert<T>(deletequery, values);
@@ -426,7 +430,7 @@ namespace cmall
 		template<typename T>
 		awaitable<bool> async_reload(T& value)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return reload<T>(value);
@@ -436,7 +440,7 @@ namespace cmall
 		template<typename T>
 		awaitable<bool> async_update(T& value)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return update<T>(value);
@@ -446,7 +450,7 @@ namespace cmall
 		template<typename T, typename UPDATER>
 		awaitable<bool> async_update(const typename odb::object_traits<T>::id_type id, UPDATER && updater)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return update<T>(id, std::forward<UPDATER>(updater));
@@ -456,7 +460,7 @@ namespace cmall
 		template<typename T, typename UPDATER>
 		awaitable<bool> async_update(const odb::query<T>& query, UPDATER && updater)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return update<T>(query, std::forward<UPDATER>(updater));
@@ -466,7 +470,7 @@ namespace cmall
 		template<typename T>
 		awaitable<bool> async_hard_remove(std::uint64_t id)
 		{
-			return boost::asio::co_spawn(thread_pool, [id, this]()mutable -> awaitable<bool>
+			return boost::asio::co_spawn(thread_pool, [id, this, pending = utility::pending_op_guard(pending_ops_)]()mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return hard_remove<T>(id);
@@ -476,7 +480,7 @@ namespace cmall
 		template <typename T>
 		awaitable<bool> async_erase(const odb::query<T>& query)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return erase_query<T>(query);
@@ -486,7 +490,7 @@ namespace cmall
 		template<SupportSoftDeletion T>
 		awaitable<bool> async_soft_remove(std::uint64_t id)
 		{
-			return boost::asio::co_spawn(thread_pool, [id, this]()mutable -> awaitable<bool>
+			return boost::asio::co_spawn(thread_pool, [id, this, pending = utility::pending_op_guard(pending_ops_)]()mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return soft_remove<T>(id);
@@ -496,7 +500,7 @@ namespace cmall
 		template<SupportSoftDeletion T>
 		awaitable<bool> async_soft_remove(T& value)
 		{
-			co_return co_await boost::asio::co_spawn(thread_pool, [&, this]()mutable -> awaitable<bool>
+			co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]()mutable -> awaitable<bool>
 			{
 				co_await this_coro::coro_yield();
 				co_return soft_remove<T>(value);
@@ -540,6 +544,7 @@ namespace cmall
 		};
 		db_config m_config;
 		boost::asio::thread_pool thread_pool;
+		std::atomic_size_t pending_ops_{ 0 };
 		boost::shared_ptr<odb::core::database> m_db;
 	};
 }
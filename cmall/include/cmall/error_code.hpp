@@ -49,6 +49,9 @@ namespace cmall
 			nofity_message_decode_failed,
 			good_option_needed,
 			good_option_invalid,
+			too_many_subscriptions,
+			order_already_payed,
+			upload_not_found,
 		};
 
 		class cmall_category : public boost::system::error_category
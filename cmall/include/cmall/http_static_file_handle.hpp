@@ -1,4 +1,5 @@
 ﻿
+#include <memory_resource>
 #include <boost/asio/awaitable.hpp>
 #include <boost/beast.hpp>
 
@@ -7,5 +8,5 @@
 using boost::asio::awaitable;
 
 namespace cmall{
-	awaitable<int> http_handle_static_file(size_t connection_id, boost::beast::http::request<boost::beast::http::string_body>&, httpd::http_any_stream& client);
+	awaitable<int> http_handle_static_file(size_t connection_id, boost::beast::http::request<boost::beast::http::string_body>&, httpd::http_any_stream& client, std::pmr::memory_resource* arena);
 }
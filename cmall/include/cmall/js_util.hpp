@@ -52,10 +52,10 @@ namespace jsutil
 		{
 			if (obj_.contains(key))
 			{
-				auto value = obj_.at(key);
+				const auto& value = obj_.at(key);
 				if (value.is_string())
 				{
-					auto ref = value.as_string();
+					const auto& ref = value.as_string();
 					return std::string(ref.begin(), ref.end());
 				}
 			}
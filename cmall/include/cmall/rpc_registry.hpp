@@ -0,0 +1,236 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include <boost/json.hpp>
+
+#include "magic_enum.hpp"
+
+namespace cmall
+{
+	enum class req_method {
+		recover_session,
+
+		ping,
+
+		user_fastlogin,
+		user_prelogin,
+		user_login,
+		user_logout,
+		user_islogin,
+		user_info,
+		user_apply_merchant,
+		user_apply_info, // 审核状态.
+
+		user_add_face,
+		user_search_by_face, // demo
+
+		user_list_recipient_address,
+		user_add_recipient_address,
+		user_modify_receipt_address,
+		user_erase_receipt_address,
+		user_get_wx_openid,
+		user_3rd_kv_put,
+		user_3rd_kv_get,
+		user_3rd_kv_put_pubkey,
+		user_3rd_kv_get_pubkey,
+
+		cart_add,
+		cart_mod,
+		cart_del,
+		cart_list,
+
+		fav_add,
+		fav_del,
+		fav_list,
+
+		order_create_cart,
+		order_create_direct,
+		order_detail,
+		order_list,
+		order_close,
+
+		order_get_paymethods, // 获取支持的支付方式.
+		order_get_pay_url,
+		order_check_payment,
+		order_get_wxpay_prepay_id, // 获取微信预支付 id
+		order_get_wxpay_object, // 获取一个用于调用 wx.requestPayment(OBJECT) 的 OBJECT
+
+
+		search_goods,
+		goods_list,
+		goods_detail,
+		goods_markdown,
+		goods_merchant_index,
+		subscribe_merchant, // 商户的商品有变化时推送 catalog_changed.
+		unsubscribe_merchant,
+
+		merchant_info,
+		merchant_get_sold_order_detail,
+		merchant_sold_orders_check_payment,
+		merchant_sold_orders_mark_payed,
+		merchant_alter_order_price,
+		merchant_goods_list,
+		merchant_keywords_list,
+		merchant_list_sold_orders,
+		merchant_sold_orders_add_kuaidi,
+		merchant_delete_sold_orders,
+		merchant_get_gitea_password,
+		merchant_reset_gitea_password,
+		merchant_create_apptoken,
+		merchant_list_apptoken,
+		merchant_delete_apptoken,
+		merchant_alter_name,
+		merchant_user_kv_get,
+
+		admin_user_detail,
+		admin_user_list,
+		admin_user_ban,
+		admin_list_applicants,
+		admin_approve_merchant,
+		admin_deny_applicant,
+		admin_list_merchants,
+		admin_disable_merchants,
+		admin_reenable_merchants,
+		admin_set_merchant_wxpay_submchid,
+		admin_set_wxpay_detail,
+		admin_sudo,
+		admin_sudo_cancel,
+		admin_list_index_goods,
+		admin_set_index_goods,
+		admin_add_index_goods,
+		admin_remove_index_goods,
+
+		admin_set_profit_sharing,
+
+		admin_server_stats,
+
+		wx_direct_pay,
+	};
+
+	inline constexpr std::size_t rpc_method_count = magic_enum::enum_count<req_method>();
+
+	// 调用前要满足的身份. 除了 recover_session, 所有方法都要先有 session.
+	enum class rpc_auth
+	{
+		none,
+		login,
+		merchant,
+		admin,
+		sudo, // 处于 sudo 模式, 且有原来的用户.
+	};
+
+	// 交给哪个 handle_jsonrpc_*_api 处理.
+	enum class rpc_group
+	{
+		session,
+		user,
+		cart,
+		fav,
+		order,
+		goods,
+		merchant,
+		admin,
+		misc,
+		unimplemented,
+	};
+
+	// 开销等级, 值就是默认占用的并发额度.
+	enum class rpc_cost_class : std::uint8_t
+	{
+		light = 1,
+		medium = 2,
+		heavy = 4,
+		expensive = 8,
+	};
+
+	enum class rpc_param_type
+	{
+		integer,
+		string,
+		boolean,
+		array,
+		object,
+	};
+
+	struct rpc_param
+	{
+		std::string_view name;
+		rpc_param_type type;
+		bool required = false;
+	};
+
+	struct rpc_method_desc
+	{
+		std::string_view name;
+		req_method method;
+		rpc_group group;
+		rpc_auth auth;
+		rpc_cost_class cost;
+		// 只检查列出的参数, 没列出的由 handler 自己处理.
+		std::span<const rpc_param> params;
+	};
+
+	// 按方法名查描述, 查不到返回 nullptr. 方法名到描述用的是编译期构造的完美哈希, 运行时不用初始化.
+	const rpc_method_desc* find_rpc_method(std::string_view name) noexcept;
+	const rpc_method_desc& rpc_method(req_method method) noexcept;
+	std::span<const rpc_method_desc> rpc_methods() noexcept;
+
+	// 按描述里的 schema 检查参数.
+	bool check_rpc_params(const rpc_method_desc& desc, const boost::json::object& params) noexcept;
+
+	// 单个方法的调用计数和延迟直方图.
+	class rpc_method_stats
+	{
+	public:
+		// 各个桶的上界 (微秒), 最后还有一个不封顶的桶.
+		static constexpr std::array<std::uint64_t, 14> latency_bounds_us = {
+			100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000,
+		};
+
+		struct snapshot
+		{
+			std::uint64_t calls = 0;
+			std::uint64_t errors = 0;
+			std::uint64_t total_us = 0;
+			std::uint64_t max_us = 0;
+			std::array<std::uint64_t, latency_bounds_us.size() + 1> buckets{};
+		};
+
+		void record(std::chrono::steady_clock::duration elapsed, bool error) noexcept;
+		snapshot load() const noexcept;
+
+	private:
+		std::atomic<std::uint64_t> calls_{ 0 };
+		std::atomic<std::uint64_t> errors_{ 0 };
+		std::atomic<std::uint64_t> total_us_{ 0 };
+		std::atomic<std::uint64_t> max_us_{ 0 };
+		std::array<std::atomic<std::uint64_t>, latency_bounds_us.size() + 1> buckets_{};
+	};
+
+	// 每个方法一份 rpc_method_stats, 用 req_method 下标.
+	class rpc_stats_table
+	{
+	public:
+		rpc_method_stats& operator[](req_method method) noexcept
+		{
+			return stats_[static_cast<std::size_t>(method)];
+		}
+
+		const rpc_method_stats& operator[](req_method method) const noexcept
+		{
+			return stats_[static_cast<std::size_t>(method)];
+		}
+
+		boost::json::array to_json() const;
+
+	private:
+		std::array<rpc_method_stats, rpc_method_count> stats_;
+	};
+}
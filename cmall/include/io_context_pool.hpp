@@ -7,9 +7,23 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <boost/asio.hpp>
 
+/// Load of one io_context, for monitoring.
+struct io_context_load
+{
+	/// Live connections bound to this io_context.
+	std::size_t connections = 0;
+
+	/// Fraction of recent wall time its thread spent on CPU, 0 ~ 1.
+	double busy = 0;
+};
+
 /// A pool of io_context objects.
 class io_context_pool
 {
@@ -27,7 +41,21 @@ public:
 	/// Stop all io_context objects in the pool.
 	void stop();
 
-	/// Get an io_context to use for a client.
+	/// Counts a connection on an io_context while alive.
+	class connection_token
+	{
+	public:
+		connection_token() = default;
+		explicit connection_token(std::atomic<std::size_t>* counter);
+		connection_token(connection_token&& o) noexcept;
+		connection_token& operator=(connection_token&& o) noexcept;
+		~connection_token();
+
+	private:
+		std::atomic<std::size_t>* counter_ = nullptr;
+	};
+
+	/// Get an io_context to use for a client, the less loaded of two random picks.
 	boost::asio::io_context& get_io_context();
 
 	boost::asio::io_context& get_io_context(std::size_t index);
@@ -38,8 +66,24 @@ public:
 	/// Get pool size.
 	std::size_t pool_size() const;
 
+	/// Index of the io_context an executor belongs to, pool_size() if not in the pool.
+	std::size_t index_of(const boost::asio::any_io_executor& executor) const;
+
+	/// Count a connection on io_context index until the token is destroyed.
+	connection_token track_connection(std::size_t index);
+
+	/// Current load of each io_context.
+	std::vector<io_context_load> load();
+
 	void notify_fork(boost::asio::execution_context::fork_event event);
 
+	/// Pin io thread i to CPU thread_cpus()[i], CPUs are ordered NUMA node by node.
+	/// Can be called before or after run(), returns false if not supported.
+	bool pin_threads();
+
+	/// CPU of each pinned io thread, empty if not pinned.
+	const std::vector<int>& thread_cpus() const;
+
 
 private:
 	using io_context_ptr = std::shared_ptr<boost::asio::io_context>;
@@ -55,4 +99,24 @@ private:
 	std::vector<work_ptr> work_;
 
 	std::size_t next_io_context_;
+
+	std::vector<int> thread_cpus_;
+
+	struct load_state
+	{
+		std::atomic<std::size_t> connections{ 0 };
+		std::atomic<std::uint32_t> busy_permille{ 0 };
+
+		// io 线程的 CPU 时间时钟, 线程启动后设置. Linux 上 clockid 本身是负数, 另用一个标志表示有没有.
+		int cpu_clock = 0;
+		std::atomic<bool> has_cpu_clock{ false };
+		std::int64_t last_cpu_ns = 0;
+	};
+
+	std::unique_ptr<load_state[]> loads_;
+	std::mutex sample_mutex_;
+	std::atomic<std::int64_t> last_sample_ns_{ 0 };
+
+	std::size_t load_score(std::size_t index) const;
+	void sample_busy();
 };
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <filesystem>
 
 #include <boost/asio/any_io_executor.hpp>
@@ -8,6 +9,7 @@
 #include <boost/asio/executor.hpp>
 #include <boost/asio/thread_pool.hpp>
 #include <boost/system/detail/error_code.hpp>
+#include <map>
 #include <memory>
 #include <string>
 #include <boost/asio.hpp>
@@ -94,6 +96,9 @@ namespace services
 
 		std::uint64_t get_merchant_uid() const;
 
+		// 商品 id 到商品文件 (.md 和 .option) 的 blob id, 比较两次的结果就知道哪些商品改过.
+		awaitable<std::map<std::string, std::string>> goods_versions();
+
 		awaitable<bool> check_repo_changed(std::string oldhead) const;
 		awaitable<std::string> git_head() const;
 
@@ -101,8 +106,12 @@ namespace services
 
 		static std::filesystem::path repo_path(std::filesystem::path repo_root_dir, std::uint64_t merchant_id);
 
+		// 所有仓库在线程池上排队和执行中的 git 操作数.
+		static std::size_t pending_ops();
+
 	private:
 		boost::asio::thread_pool& thread_pool;
+		static std::atomic_size_t pending_ops_;
 
 		const merchant_git_repo_impl& impl() const;
 		merchant_git_repo_impl& impl();
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <boost/asio.hpp>
+
+using boost::asio::awaitable;
+
+namespace services
+{
+	struct notify_bus_config
+	{
+		// 留空的字段按 libpq 的默认值 (PGHOST 等环境变量) 处理.
+		std::string host;
+		unsigned int port = 5432;
+		std::string dbname;
+		std::string user;
+		std::string password;
+
+		std::string channel = "cmall_notify";
+		std::chrono::seconds reconnect_delay{ 3 };
+		// 断线重连期间最多攒多少条待发的通知, 超过后丢弃最早的.
+		std::size_t max_pending = 4096;
+	};
+
+	struct notify_bus_stats
+	{
+		bool connected = false;
+		std::uint64_t published = 0;
+		std::uint64_t received = 0;
+		std::uint64_t dropped = 0;
+		std::uint64_t reconnects = 0;
+	};
+
+	// 基于 PostgreSQL LISTEN/NOTIFY 的跨实例通知总线.
+	// 独占一条异步连接, LISTEN 一个频道, 发出的通知走同一条连接的 pg_notify.
+	// 其他实例发来的通知交给 handler, 自己发出的不会回来, 本地投递由调用方自己做.
+	struct notify_bus_impl;
+	class notify_bus
+	{
+	public:
+		using handler_type = std::function<void(std::string_view payload)>;
+
+		notify_bus(boost::asio::any_io_executor executor, notify_bus_config config, handler_type handler);
+		~notify_bus();
+
+		// 连接, LISTEN, 然后处理通知直到 stop(). 断线后等 reconnect_delay 重连.
+		awaitable<void> run();
+		void stop();
+
+		// 线程安全. payload 超过 PostgreSQL 的上限 (8000 字节) 时直接丢弃.
+		void publish(std::string payload);
+
+		notify_bus_stats stats() const;
+
+	private:
+		std::shared_ptr<notify_bus_impl> impl_;
+	};
+}
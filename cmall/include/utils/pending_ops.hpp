@@ -0,0 +1,37 @@
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace utility {
+
+	// 统计线程池上排队和执行中的任务数. 放进任务的 lambda 捕获里, 随 lambda 移动,
+	// 任务结束 lambda 析构时减一.
+	class pending_op_guard
+	{
+	public:
+		explicit pending_op_guard(std::atomic_size_t& counter)
+			: counter_(&counter)
+		{
+			counter_->fetch_add(1, std::memory_order_relaxed);
+		}
+
+		pending_op_guard(pending_op_guard&& o) noexcept
+			: counter_(std::exchange(o.counter_, nullptr))
+		{
+		}
+
+		pending_op_guard(const pending_op_guard&) = delete;
+		pending_op_guard& operator=(const pending_op_guard&) = delete;
+
+		~pending_op_guard()
+		{
+			if (counter_)
+				counter_->fetch_sub(1, std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic_size_t* counter_;
+	};
+}
@@ -22,8 +22,19 @@
 #include "httpd/http_misc_helper.hpp"
 #include "httpd/header_helper.hpp"
 #include "httpd/httpd.hpp"
+#include "httpd/http2/connection.hpp"
 #include "httpd/wait_all.hpp"
+#include "httpd/listen_fds.hpp"
 #include "dirmon/dirmon.hpp"
+#include "utils/uawaitable.hpp"
+#include "utils/scoped_exit.hpp"
+
+#include <charconv>
+#include <fstream>
+
+#ifdef BOOST_POSIX_API
+#include <unistd.h>
+#endif
 
 template <typename Iterator>
 auto make_iterator_range(std::pair<Iterator, Iterator> pair)
@@ -48,14 +59,48 @@ namespace cmall
 		, payment_service(m_io_context)
 		, script_runner(m_io_context)
 		, gitea_service(config.gitea_api, config.gitea_admin_token)
+		, tls_session_manager_(m_config.tls_session_)
 		, sslctx_(boost::asio::ssl::context::tls_server)
+		, admission_control_(m_config.admission_)
+		, m_handoff_predecessor(m_io_context)
 	{
+		admission_control_.set_pending_work_probe([this]()
+		{
+			return m_database.pending_ops() + services::merchant_git_repo::pending_ops();
+		});
+
+		if (!m_config.notify_channel_.empty())
+		{
+			services::notify_bus_config bus_config;
+			bus_config.host = m_config.dbcfg_.host_;
+			bus_config.port = m_config.dbcfg_.port_;
+			bus_config.dbname = m_config.dbcfg_.dbname_;
+			bus_config.user = m_config.dbcfg_.user_;
+			bus_config.password = m_config.dbcfg_.password_;
+			bus_config.channel = m_config.notify_channel_;
+
+			// payload 是 "uid 消息", 见 send_notify_message.
+			notify_bus_ = std::make_unique<services::notify_bus>(m_io_context.get_executor(), bus_config, [this](std::string_view payload)
+			{
+				std::uint64_t uid = 0;
+				auto [ptr, ec] = std::from_chars(payload.data(), payload.data() + payload.size(), uid);
+				if (ec != std::errc{} || ptr == payload.data() + payload.size() || *ptr != ' ')
+				{
+					LOG_WARN << "notify bus: malformed payload";
+					return;
+				}
+				std::string_view msg(ptr + 1, payload.data() + payload.size());
+				deliver_notify_message(uid, std::make_shared<const std::string>(msg));
+			});
+		}
 	}
 
 	cmall_service::~cmall_service() { LOG_DBG << "~cmall_service()"; }
 
 	awaitable<void> cmall_service::stop()
 	{
+		if (notify_bus_)
+			notify_bus_->stop();
 		m_background_threads.clear();
 
 		LOG_DBG << "close all ws...";
@@ -67,6 +112,132 @@ namespace cmall
 		LOG_DBG << "cmall_service.stop()";
 	}
 
+	void cmall_service::inherit_listen_fds(std::vector<int> fds)
+	{
+		m_inherited_listen_fds.insert(m_inherited_listen_fds.end(), fds.begin(), fds.end());
+	}
+
+	// 连上 handoff_socket_, 从正在运行的旧进程那里接过监听 fd. 没有旧进程返回 false.
+	bool cmall_service::take_over_listeners()
+	{
+		if (m_config.handoff_socket_.empty())
+			return false;
+
+		boost::system::error_code ec;
+		m_handoff_predecessor.connect(boost::asio::local::stream_protocol::endpoint(m_config.handoff_socket_), ec);
+		if (ec)
+		{
+			LOG_DBG << "no predecessor on " << m_config.handoff_socket_ << ": " << ec.message();
+			return false;
+		}
+
+		auto fds = httpd::receive_listen_fds(m_handoff_predecessor.native_handle(), ec);
+		if (ec)
+		{
+			LOG_ERR << "receive listen fds from predecessor failed: " << ec.message();
+			m_handoff_predecessor.close(ec);
+			return false;
+		}
+
+		LOG_INFO << "took over " << fds.size() << " listen fd(s) from predecessor";
+		inherit_listen_fds(std::move(fds));
+		return true;
+	}
+
+	// acceptor 都初始化好了, 马上要开始 accept. 关掉没人认领的 fd, 通知旧进程可以退出了.
+	void cmall_service::listeners_ready()
+	{
+#ifdef BOOST_POSIX_API
+		for (int fd : m_inherited_listen_fds)
+		{
+			LOG_WARN << "inherited listen fd " << fd << " matches no --ws/--wss/--ws_unix address, closing";
+			::close(fd);
+		}
+#endif
+		m_inherited_listen_fds.clear();
+
+		if (m_handoff_predecessor.is_open())
+		{
+			boost::system::error_code ec;
+			char ready = 1;
+			boost::asio::write(m_handoff_predecessor, boost::asio::buffer(&ready, 1), ec);
+			m_handoff_predecessor.close(ec);
+		}
+	}
+
+	// 在 handoff_socket_ 上等下一个进程. 把所有监听 fd 交给它, 等它准备好以后返回,
+	// 之后由调用方停止 accept 并关闭现有连接. 没有配置 handoff_socket_ 时永远不返回.
+	awaitable<void> cmall_service::serve_listener_handoff()
+	{
+		using local = boost::asio::local::stream_protocol;
+		boost::system::error_code ec;
+
+		if (m_config.handoff_socket_.empty())
+		{
+			boost::asio::steady_timer forever(m_io_context, boost::asio::steady_timer::time_point::max());
+			co_await forever.async_wait(asio_util::use_awaitable[ec]);
+			co_return;
+		}
+
+		std::filesystem::remove(m_config.handoff_socket_, ec);
+		local::acceptor acceptor(m_io_context);
+		acceptor.open(local(), ec);
+		if (!ec)
+			acceptor.bind(local::endpoint(m_config.handoff_socket_), ec);
+		if (!ec)
+			acceptor.listen(1, ec);
+		if (ec)
+		{
+			LOG_ERR << "listen handoff socket " << m_config.handoff_socket_ << " failed: " << ec.message();
+			boost::asio::steady_timer forever(m_io_context, boost::asio::steady_timer::time_point::max());
+			co_await forever.async_wait(asio_util::use_awaitable[ec]);
+			co_return;
+		}
+
+		// 拿到这个 socket 就能拿到我们的监听 fd, 只给同一个用户用.
+		std::filesystem::permissions(m_config.handoff_socket_, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write, ec);
+
+		for (;;)
+		{
+			local::socket successor(m_io_context);
+			co_await acceptor.async_accept(successor, asio_util::use_awaitable[ec]);
+			if (ec == boost::asio::error::operation_aborted)
+				co_return;
+			if (ec)
+				continue;
+
+			std::vector<int> fds;
+			for (auto&& a : m_ws_acceptors)
+				fds.push_back(a.native_handle());
+			for (auto&& a : m_wss_acceptors)
+				fds.push_back(a.native_handle());
+			for (auto&& a : m_ws_unix_acceptors)
+				fds.push_back(a.native_handle());
+
+			httpd::send_listen_fds(successor.native_handle(), fds, ec);
+			if (ec)
+			{
+				LOG_ERR << "send listen fds to successor failed: " << ec.message();
+				continue;
+			}
+
+			LOG_INFO << "handed " << fds.size() << " listen fd(s) to successor, waiting for it to be ready";
+
+			char ready = 0;
+			co_await boost::asio::async_read(successor, boost::asio::buffer(&ready, 1), asio_util::use_awaitable[ec]);
+			if (ec == boost::asio::error::operation_aborted)
+				co_return;
+			if (!ec)
+			{
+				LOG_INFO << "successor is ready, stop accepting and let open connections finish";
+				co_return;
+			}
+
+			// 新进程没起来, 我们接着干.
+			LOG_WARN << "successor exited before ready: " << ec.message();
+		}
+	}
+
 	// false if no git repo for merchant
 	awaitable<bool> cmall_service::load_merchant_git(const cmall_merchant& merchant)
 	{
@@ -151,12 +322,14 @@ namespace cmall
 	awaitable<void> cmall_service::repo_push_check(std::weak_ptr<services::merchant_git_repo> repo_)
 	{
 		std::string repo_dir;
+		std::map<std::string, std::string> goods_versions;
 
 		{
 			auto repo = repo_.lock();
 			if (!repo)
 				co_return;
 			repo_dir = repo->repo_path().string();
+			goods_versions = co_await repo->goods_versions();
 		}
 
 		// dirmon::dirmon git_monitor(co_await boost::asio::this_coro::executor, repo_dir);
@@ -204,6 +377,25 @@ namespace cmall
 				{
 					LOG_DBG << std::format("repo {} git HEAD changed!", repo->repo_path().string());
 					co_await search_service.reload_merchant(repo);
+
+					// 只告诉订阅者哪些商品变了, 客户端不必重新拉整个商品列表.
+					auto new_versions = co_await repo->goods_versions();
+					std::vector<std::string> changed, removed;
+					for (const auto& [goods_id, version] : new_versions)
+					{
+						auto it = goods_versions.find(goods_id);
+						if (it == goods_versions.end() || it->second != version)
+							changed.push_back(goods_id);
+					}
+					for (const auto& [goods_id, version] : goods_versions)
+					{
+						if (!new_versions.contains(goods_id))
+							removed.push_back(goods_id);
+					}
+					goods_versions = std::move(new_versions);
+
+					if (!changed.empty() || !removed.empty())
+						notify_catalog_changed(repo->get_merchant_uid(), changed, removed);
 				}
 			}
 		}
@@ -330,18 +522,29 @@ namespace cmall
 
 		std::vector<promise<void(std::exception_ptr)>> co_threads;
 
+		if (notify_bus_)
+			m_background_threads.push_back(boost::asio::co_spawn(m_io_context, notify_bus_->run(), use_promise));
+
+		m_background_threads.push_back(boost::asio::co_spawn(m_io_context, upload_sweep_loop(), use_promise));
+
 		for (auto&& a: m_ws_acceptors)
         {
+			if (admission_control_.enabled())
+				a.set_admission_control(admission_control_);
 			co_threads.push_back(boost::asio::co_spawn(a.get_executor(), a.run_accept_loop(concurrent_accepter), use_promise));
         }
 
 		for (auto&& a: m_wss_acceptors)
         {
+			if (admission_control_.enabled())
+				a.set_admission_control(admission_control_);
 			co_threads.push_back(boost::asio::co_spawn(a.get_executor(), a.run_accept_loop(concurrent_accepter), use_promise));
         }
 
 		for (auto&& a: m_ws_unix_acceptors)
         {
+			if (admission_control_.enabled())
+				a.set_admission_control(admission_control_);
 			co_threads.push_back(boost::asio::co_spawn(a.get_executor(), a.run_accept_loop(concurrent_accepter), use_promise));
         }
 
@@ -350,6 +553,76 @@ namespace cmall
             co_await co(use_awaitable);
 	}
 
+	// 把继承来的, 监听在 address 上的 fd 交给新建的 acceptor. 没有这样的 fd 返回 false, 由调用方自己 listen.
+	template <typename Acceptors, typename Emplace>
+	bool cmall_service::adopt_listen_fds(Acceptors& acceptors, const std::string& address, bool unix_socket, Emplace&& emplace)
+	{
+#ifdef BOOST_POSIX_API
+		std::vector<int> fds;
+		std::erase_if(m_inherited_listen_fds, [&](int fd)
+		{
+			bool match = unix_socket ? httpd::is_unix_listener_on(fd, address) : httpd::is_tcp_listener_on(fd, address);
+			if (match)
+				fds.push_back(fd);
+			return match;
+		});
+
+		if (fds.empty())
+			return false;
+
+		// SO_REUSEPORT 模式下每个 io_context 都要有 acceptor, 继承来的 fd 不够就 dup,
+		// dup 出来的 fd 共用同一个监听队列.
+		std::size_t count = fds.size();
+		if (!unix_socket && httpd::has_so_reuseport())
+			count = std::max(count, m_io_context_pool.pool_size());
+
+		auto group_begin = acceptors.size();
+		for (std::size_t i = 0; i < count; i++)
+		{
+			int fd = i < fds.size() ? fds[i] : fcntl(fds[i % fds.size()], F_DUPFD_CLOEXEC, 0);
+			if (fd < 0)
+				break;
+
+			auto& io = (!unix_socket && httpd::has_so_reuseport()) ? m_io_context_pool.get_io_context(i % m_io_context_pool.pool_size()) : m_io_context;
+
+			boost::system::error_code ec;
+			emplace(io).assign(fd, ec);
+			if (ec)
+			{
+				acceptors.pop_back();
+				::close(fd);
+			}
+		}
+
+		LOG_INFO << "listen " << address << " on " << fds.size() << " inherited fd(s)";
+
+		// 上一个进程交过来的是整个 SO_REUSEPORT 组, 顺序就是组里的顺序, 第 i 个 fd 归 io_context i,
+		// 按本进程的 thread_cpus() 重新挂 cBPF. systemd 给的通常只有一个 socket, dup 出来的 fd
+		// 还是同一个 socket, 没法按 CPU 分, 只记一条日志.
+		if constexpr (httpd::has_reuseport_cbpf()
+			&& requires (typename Acceptors::value_type& a, boost::system::error_code& ec) { a.steer_incoming_cpu(std::vector<int>{}, ec); })
+		{
+			if (!unix_socket && m_config.cpu_affinity_)
+			{
+				if (fds.size() == m_io_context_pool.pool_size() && acceptors.size() - group_begin == fds.size())
+				{
+					boost::system::error_code ec;
+					acceptors[group_begin].steer_incoming_cpu(m_io_context_pool.thread_cpus(), ec);
+				}
+				else
+				{
+					LOG_WARN << "cpu steering inactive on " << address << ": inherited " << fds.size()
+						<< " socket(s) for " << m_io_context_pool.pool_size() << " io threads";
+				}
+			}
+		}
+
+		return true;
+#else
+		return false;
+#endif
+	}
+
 	awaitable<bool> cmall_service::init_ws_acceptors()
 	{
 		boost::system::error_code ec;
@@ -358,8 +631,12 @@ namespace cmall
 
 		for (const auto& wsd : m_config.ws_listens_)
 		{
+			if (adopt_listen_fds(m_ws_acceptors, wsd, false, [this](auto& io) -> auto& { return m_ws_acceptors.emplace_back(io, *this); }))
+				continue;
+
 			if constexpr (httpd::has_so_reuseport())
 			{
+				auto group_begin = m_ws_acceptors.size();
 				for (std::size_t io_index = 0; io_index < m_io_context_pool.pool_size(); io_index++)
 				{
 					m_ws_acceptors.emplace_back(m_io_context_pool.get_io_context(io_index), *this);
@@ -369,6 +646,13 @@ namespace cmall
 						co_return false;
 					}
 				}
+
+				// 组内 socket 按 io_index 顺序 listen, 下标和 thread_cpus() 一一对应.
+				if constexpr (httpd::has_reuseport_cbpf())
+				{
+					if (m_config.cpu_affinity_)
+						m_ws_acceptors[group_begin].steer_incoming_cpu(m_io_context_pool.thread_cpus(), ec);
+				}
 			}
 			else
 			{
@@ -395,6 +679,15 @@ namespace cmall
 
 //		sslctx_.use_tmp_dh(boost::asio::buffer(dh.data(), dh.size()));
 
+		if (m_config.enable_http2_)
+			httpd::http2::enable_alpn(sslctx_);
+
+		tls_session_manager_.apply(sslctx_);
+		if (m_config.tls_session_.session_tickets)
+		{
+			m_background_threads.push_back(
+				boost::asio::co_spawn(m_io_context, tls_session_manager_.ticket_key_rotate_loop(), use_promise));
+		}
 
 		boost::system::error_code ec;
 
@@ -402,8 +695,12 @@ namespace cmall
 
 		for (const auto& wsd : m_config.wss_listens_)
 		{
+			if (adopt_listen_fds(m_wss_acceptors, wsd, false, [this](auto& io) -> auto& { return m_wss_acceptors.emplace_back(io, sslctx_, *this); }))
+				continue;
+
 			if constexpr (httpd::has_so_reuseport())
 			{
+				auto group_begin = m_wss_acceptors.size();
 				for (std::size_t io_index = 0; io_index < m_io_context_pool.pool_size(); io_index++)
 				{
 					m_wss_acceptors.emplace_back(m_io_context_pool.get_io_context(io_index), sslctx_, *this);
@@ -413,6 +710,13 @@ namespace cmall
 						co_return false;
 					}
 				}
+
+				// 组内 socket 按 io_index 顺序 listen, 下标和 thread_cpus() 一一对应.
+				if constexpr (httpd::has_reuseport_cbpf())
+				{
+					if (m_config.cpu_affinity_)
+						m_wss_acceptors[group_begin].steer_incoming_cpu(m_io_context_pool.thread_cpus(), ec);
+				}
 			}
 			else
 			{
@@ -436,6 +740,9 @@ namespace cmall
 
 		for (const auto& wsd : m_config.ws_unix_listens_)
 		{
+			if (adopt_listen_fds(m_ws_unix_acceptors, wsd, true, [this](auto& io) -> auto& { return m_ws_unix_acceptors.emplace_back(io, *this); }))
+				continue;
+
 			m_ws_unix_acceptors.emplace_back(m_io_context, *this);
 			m_ws_unix_acceptors.back().listen(wsd, ec);
 			if (ec)
@@ -449,8 +756,8 @@ namespace cmall
 
 	// 从 git 仓库获取文件，没找到返回 0
 	awaitable<int> cmall_service::render_git_repo_files(size_t connection_id, std::string merchant,
-		std::string path_in_repo, httpd::http_any_stream& client,
-		boost::beast::http::request<boost::beast::http::string_body> req)
+		std::string path_in_repo, httpd::http_any_stream& client, std::pmr::memory_resource* arena,
+		const boost::beast::http::request<boost::beast::http::string_body>& req)
 	{
 		auto merchant_id = strtoll(merchant.c_str(), nullptr, 10);
 
@@ -472,21 +779,22 @@ namespace cmall
 
 		auto req_range = httpd::parse_range(req[boost::beast::http::field::range]);
 
-		std::map<boost::beast::http::field, std::string> headers;
+		httpd::response_fields headers{ arena };
 
-		headers.insert({boost::beast::http::field::accept_ranges, "bytes"});
-		headers.insert({boost::beast::http::field::expires, httpd::make_http_last_modified(std::time(0) + 60)});
-		headers.insert({boost::beast::http::field::content_type, httpd::get_mime_type_from_extension(std::filesystem::path(path_in_repo).extension().string())});
+		headers.set(boost::beast::http::field::accept_ranges, "bytes");
+		headers.set(boost::beast::http::field::expires, httpd::cached_http_date(std::time(0) + 60));
+		headers.set(boost::beast::http::field::content_type, httpd::get_mime_type_from_path(path_in_repo));
 
 
 		if (req_range && ((res_body.length() != req_range->end) && (req_range->begin != 0)))
 		{
-			headers.insert({boost::beast::http::field::content_range, httpd::make_cpntent_range(req_range.value(), res_body.length())});
+			headers.set(boost::beast::http::field::content_range, httpd::make_cpntent_range(req_range.value(), res_body.length()));
 
+			std::string_view body_view = res_body;
 
 			// 执行 206 响应.
 			ec = co_await httpd::send_string_response_body(client,
-				req_range->end == 0 ? res_body.substr(req_range->begin): res_body.substr(req_range->begin, req_range->end - req_range->begin),
+				req_range->end == 0 ? body_view.substr(req_range->begin): body_view.substr(req_range->begin, req_range->end - req_range->begin),
 				std::move(headers),
 				req.version(),
 				req.keep_alive(),
@@ -498,7 +806,7 @@ namespace cmall
 		else
 		{
 			ec = co_await httpd::send_string_response_body(client,
-				std::move(res_body),
+				res_body,
 				std::move(headers),
 				req.version(),
 				req.keep_alive());
@@ -509,7 +817,7 @@ namespace cmall
 	}
 
 	// 成功给用户返回内容, 返回 200. 如果没找到商品, 不要向 client 写任何数据, 直接放回 404, 由调用方统一返回错误页面.
-	awaitable<int> cmall_service::render_goods_detail_content(std::string merchant, std::string goods_id, httpd::http_any_stream& client, const boost::beast::http::request<boost::beast::http::string_body>& req)
+	awaitable<int> cmall_service::render_goods_detail_content(std::string merchant, std::string goods_id, httpd::http_any_stream& client, std::pmr::memory_resource* arena, const boost::beast::http::request<boost::beast::http::string_body>& req)
 	{
 
 		auto merchant_id = strtoll(merchant.c_str(), nullptr, 10);
@@ -539,20 +847,20 @@ namespace cmall
 // 			return_md_type = true; //|= std::string::npos != accept.value().find("text/markdown");
 // 		}
 
-		std::map<boost::beast::http::field, std::string> headers;
-		headers.insert({boost::beast::http::field::expires, httpd::make_http_last_modified(std::time(0) + 60)});
+		httpd::response_fields headers{ arena };
+		headers.set(boost::beast::http::field::expires, httpd::cached_http_date(std::time(0) + 60));
 
 		std::string return_body;
 
 		if (return_md_type)
 		{
 			return_body = co_await merchant_repo_ptr->get_product_detail(goods_id, baseurl);
-			headers.insert({boost::beast::http::field::content_type, "text/markdown; charset=utf-8"});
+			headers.set(boost::beast::http::field::content_type, "text/markdown; charset=utf-8");
 		}
 		else
 		{
 			std::string html_body = co_await merchant_repo_ptr->get_product_html(goods_id, baseurl);
-			headers.insert({boost::beast::http::field::content_type, "text/html; charset=utf-8"});
+			headers.set(boost::beast::http::field::content_type, "text/html; charset=utf-8");
 
 			return_body = std::format(R"xhtml(<!DOCTYPE html>
 <html lang="en">
@@ -572,7 +880,7 @@ namespace cmall
 
 		ec = co_await httpd::send_string_response_body(client,
 			return_body,
-			headers,
+			std::move(headers),
 			req.version(),
 			req.keep_alive());
 		if (ec)
@@ -626,46 +934,109 @@ namespace cmall
 	}
 
 
+	std::size_t cmall_service::rpc_cost(std::string_view method) const
+	{
+		if (auto it = m_config.rpc_costs_.find(method); it != m_config.rpc_costs_.end())
+			return it->second;
+		if (auto desc = find_rpc_method(method))
+			return static_cast<std::size_t>(desc->cost);
+		return 1;
+	}
+
 	awaitable<boost::json::object> cmall_service::handle_jsonrpc_call(
-		client_connection_ptr connection_ptr, const std::string& methodstr, boost::json::object params)
+		client_connection_ptr connection_ptr, std::string_view methodstr, const boost::json::object& params)
 	{
 		client_connection& this_client = *connection_ptr;
-		boost::json::object reply_message;
 
-		auto method = magic_enum::enum_cast<req_method>(methodstr);
-		if (!method.has_value())
+		auto desc = find_rpc_method(methodstr);
+		if (!desc)
 		{
 			throw boost::system::system_error(cmall::error::unknown_method);
 		}
 
-		auto ensure_login
-			= [&](bool check_admin = false, bool check_merchant = false) mutable -> awaitable<void>
+		auto start = std::chrono::steady_clock::now();
+		bool failed = true;
+		scoped_exit record([&, method = desc->method]() noexcept
 		{
-			if (!this_client.session_info->user_info)
-				throw boost::system::system_error(error::login_required);
+			rpc_stats_[method].record(std::chrono::steady_clock::now() - start, failed);
+		});
 
-			if (check_admin)
-			{
-				if (!this_client.session_info->isAdmin)
-					throw boost::system::system_error(error::admin_user_required);
-			}
+		if (desc->method != req_method::recover_session)
+		{
+			if (!this_client.session_info)
+				throw boost::system::system_error(cmall::error::session_needed);
+		}
 
-			if (check_merchant)
-			{
-				if (!this_client.session_info->isMerchant)
+		const auto& session_info = this_client.session_info;
+		switch (desc->auth)
+		{
+			case rpc_auth::none:
+				break;
+			case rpc_auth::login:
+			case rpc_auth::merchant:
+			case rpc_auth::admin:
+				if (!session_info->user_info)
+					throw boost::system::system_error(error::login_required);
+				if (desc->auth == rpc_auth::admin && !session_info->isAdmin)
+					throw boost::system::system_error(error::admin_user_required);
+				if (desc->auth == rpc_auth::merchant && !session_info->isMerchant)
 					throw boost::system::system_error(error::merchant_user_required);
-			}
+				break;
+			case rpc_auth::sudo:
+				// check original user
+				if (!session_info->sudo_mode || !session_info->original_user)
+					throw boost::system::system_error(error::not_in_sudo_mode);
+				break;
+		}
 
-			co_return;
-		};
+		if (!check_rpc_params(*desc, params))
+			throw boost::system::system_error(cmall::error::invalid_params);
 
-		if ((method.value() != req_method::recover_session))
+		boost::json::object reply_message;
+		switch (desc->group)
 		{
-			if (!this_client.session_info)
-				throw boost::system::system_error(cmall::error::session_needed);
+			case rpc_group::session:
+				reply_message = co_await handle_jsonrpc_session_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::user:
+				reply_message = co_await handle_jsonrpc_user_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::cart:
+				reply_message = co_await handle_jsonrpc_cart_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::fav:
+				reply_message = co_await handle_jsonrpc_fav_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::order:
+				reply_message = co_await handle_jsonrpc_order_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::goods:
+				reply_message = co_await handle_jsonrpc_goods_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::merchant:
+				reply_message = co_await handle_jsonrpc_merchant_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::admin:
+				reply_message = co_await handle_jsonrpc_admin_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::misc:
+				reply_message = co_await handle_jsonrpc_misc_api(connection_ptr, desc->method, params);
+				break;
+			case rpc_group::unimplemented:
+				throw boost::system::system_error(error::not_implemented);
 		}
 
-		switch (method.value())
+		failed = false;
+		co_return reply_message;
+	}
+
+	awaitable<boost::json::object> cmall_service::handle_jsonrpc_session_api(
+		client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
+	{
+		client_connection& this_client = *connection_ptr;
+		boost::json::object reply_message;
+
+		switch (method)
 		{
 			case req_method::recover_session:
 			{
@@ -726,15 +1097,18 @@ namespace cmall
 
 					if (co_await in_temp_api_token(api_token))
 					{
-						boost::smatch token_matched;
-
-						if (!boost::regex_match(api_token, token_matched, boost::regex("([0-9]+)-(.+)")))
+						// 临时 token 的格式是 "uid-随机串", 见 gen_temp_api_token.
+						auto dash = api_token.find('-');
+						if (dash == std::string::npos || dash == 0 || dash + 1 == api_token.size())
 						{
 							throw boost::system::system_error(error::internal_server_error);
 						}
 
-						std::string token_uid_part = token_matched[1].str();
-						appid_info.uid_ = std::stoull(token_uid_part);
+						auto [ptr, ec] = std::from_chars(api_token.data(), api_token.data() + dash, appid_info.uid_);
+						if (ec != std::errc{} || ptr != api_token.data() + dash)
+						{
+							throw boost::system::system_error(error::internal_server_error);
+						}
 
 					}
 					else if (co_await m_database.async_load<cmall_apptoken>(odb::query<cmall_apptoken>::apptoken == api_token, appid_info))
@@ -787,120 +1161,6 @@ namespace cmall
 			{
 				reply_message["result"] = "pong";
 			}break;
-			case req_method::user_fastlogin:
-			case req_method::user_prelogin:
-			case req_method::user_login:
-			case req_method::user_islogin:
-			case req_method::user_logout:
-				co_return co_await handle_jsonrpc_user_api(connection_ptr, method.value(), params);
-				break;
-			case req_method::user_info:
-			case req_method::user_apply_merchant:
-			case req_method::user_apply_info:
-			case req_method::user_list_recipient_address:
-			case req_method::user_add_recipient_address:
-			case req_method::user_modify_receipt_address:
-			case req_method::user_erase_receipt_address:
-			case req_method::user_get_wx_openid:
-			case req_method::user_3rd_kv_put:
-			case req_method::user_3rd_kv_get:
-			case req_method::user_3rd_kv_put_pubkey:
-			case req_method::user_3rd_kv_get_pubkey:
-			case req_method::user_add_face:
-				co_await ensure_login();
-			case req_method::user_search_by_face:
-				co_return co_await handle_jsonrpc_user_api(connection_ptr, method.value(), params);
-				break;
-
-			case req_method::cart_add:
-			case req_method::cart_mod:
-			case req_method::cart_del:
-			case req_method::cart_list:
-				co_await ensure_login();
-				co_return co_await handle_jsonrpc_cart_api(connection_ptr, method.value(), params);
-				break;
-			case req_method::fav_add:
-			case req_method::fav_del:
-			case req_method::fav_list:
-				co_await ensure_login();
-				co_return co_await handle_jsonrpc_fav_api(connection_ptr, method.value(), params);
-				break;
-
-			case req_method::order_create_cart:
-			case req_method::order_create_direct:
-			case req_method::order_detail:
-			case req_method::order_close:
-			case req_method::order_list:
-			case req_method::order_get_paymethods:
-			case req_method::order_get_pay_url:
-			case req_method::order_get_wxpay_prepay_id:
-			case req_method::order_get_wxpay_object:
-			case req_method::order_check_payment:
-				co_await ensure_login();
-				co_return co_await handle_jsonrpc_order_api(connection_ptr, method.value(), params);
-				break;
-			case req_method::search_goods:
-			case req_method::goods_list:
-			case req_method::goods_detail:
-			case req_method::goods_markdown:
-			case req_method::goods_merchant_index:
-				co_return co_await handle_jsonrpc_goods_api(connection_ptr, method.value(), params);
-				break;
-			case req_method::merchant_info:
-			case req_method::merchant_get_sold_order_detail:
-			case req_method::merchant_sold_orders_check_payment:
-			case req_method::merchant_sold_orders_mark_payed:
-			case req_method::merchant_alter_order_price:
-			case req_method::merchant_goods_list:
-			case req_method::merchant_keywords_list:
-			case req_method::merchant_list_sold_orders:
-			case req_method::merchant_sold_orders_add_kuaidi:
-			case req_method::merchant_delete_sold_orders:
-			case req_method::merchant_get_gitea_password:
-			case req_method::merchant_reset_gitea_password:
-			case req_method::merchant_create_apptoken:
-			case req_method::merchant_list_apptoken:
-			case req_method::merchant_delete_apptoken:
-			case req_method::merchant_alter_name:
-			case req_method::merchant_user_kv_get:
-				co_await ensure_login(false, true);
-				co_return co_await handle_jsonrpc_merchant_api(connection_ptr, method.value(), params);
-				break;
-			case req_method::admin_user_detail:
-			case req_method::admin_user_list:
-			case req_method::admin_user_ban:
-			case req_method::admin_list_applicants:
-			case req_method::admin_approve_merchant:
-			case req_method::admin_deny_applicant:
-			case req_method::admin_list_merchants:
-			case req_method::admin_disable_merchants:
-			case req_method::admin_reenable_merchants:
-			case req_method::admin_set_merchant_wxpay_submchid:
-			case req_method::admin_set_wxpay_detail:
-			case req_method::admin_sudo:
-				co_await ensure_login(true);
-				co_return co_await handle_jsonrpc_admin_api(connection_ptr, method.value(), params);
-			case req_method::admin_sudo_cancel:
-				// check original user
-				if (this_client.session_info->sudo_mode && this_client.session_info->original_user)
-				{
-					co_return co_await handle_jsonrpc_admin_api(connection_ptr, method.value(), params);
-				}
-				else
-				{
-					throw boost::system::system_error(error::not_in_sudo_mode);
-				}
-				break;
-			case req_method::admin_list_index_goods:
-			case req_method::admin_set_index_goods:
-			case req_method::admin_add_index_goods:
-			case req_method::admin_remove_index_goods:
-				co_await ensure_login(true);
-				co_return co_await handle_jsonrpc_admin_api(connection_ptr, method.value(), params);
-				break;
-			case req_method::wx_direct_pay:
-				co_return co_await handle_jsonrpc_misc_api(connection_ptr, method.value(), params);
-				break;
 			default:
 				throw boost::system::system_error(error::not_implemented);
 		}
@@ -930,8 +1190,223 @@ namespace cmall
 		co_return;
 	}
 
+	// 上传后要在这段时间内用掉.
+	static constexpr std::chrono::minutes upload_ttl{ 5 };
+	// 每个登录用户同时留着的上传. 匿名的 session 只能留一份.
+	static constexpr std::size_t max_uploads_per_user = 4;
+	static constexpr std::size_t max_uploads_per_session = 1;
+
+	// upload_id 和 session_id 都是 uuid, 拼进路径之前检查一下.
+	static bool is_upload_name(std::string_view name)
+	{
+		return !name.empty() && name.size() <= 64
+			&& std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '-'; });
+	}
+
+	// 每个 session 一个子目录, 登录用户是 u<uid>, 匿名的是 s<session_id>. 不能用的 session_id 返回空.
+	static std::filesystem::path upload_owner_dir(const std::string& upload_dir, const services::client_session& session)
+	{
+		if (session.user_info)
+			return std::filesystem::path(upload_dir) / ("u" + std::to_string(session.user_info->uid_));
+		if (!is_upload_name(session.session_id))
+			return {};
+		return std::filesystem::path(upload_dir) / ("s" + session.session_id);
+	}
+
+	static bool upload_expired(const std::filesystem::directory_entry& e)
+	{
+		std::error_code ec;
+		auto mtime = e.last_write_time(ec);
+		return ec || std::filesystem::file_time_type::clock::now() - mtime > upload_ttl;
+	}
+
+	// 写入 dir/upload_id, 这个目录里的文件超过 max_uploads 份时先删掉最早的, 删掉的大小记到 freed.
+	// 先写临时文件再改名, 共享目录的其他实例不会读到一半的内容.
+	static bool store_upload(const std::filesystem::path& dir, const std::string& upload_id,
+		const std::string& data, std::size_t max_uploads, std::uint64_t& freed)
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(dir, ec);
+
+		std::vector<std::filesystem::directory_entry> existing;
+		for (auto& e : std::filesystem::directory_iterator(dir, ec))
+		{
+			if (e.path().extension().empty())
+				existing.push_back(e);
+		}
+		if (existing.size() >= max_uploads)
+		{
+			std::sort(existing.begin(), existing.end(), [](auto& a, auto& b)
+			{
+				std::error_code ec;
+				return a.last_write_time(ec) < b.last_write_time(ec);
+			});
+			for (std::size_t i = 0; i + max_uploads <= existing.size(); i++)
+			{
+				auto size = existing[i].file_size(ec);
+				if (std::filesystem::remove(existing[i].path(), ec))
+					freed += size;
+			}
+		}
+
+		auto tmp = dir / (upload_id + ".tmp");
+		std::ofstream f(tmp, std::ios::binary);
+		if (!f.is_open())
+		{
+			// 空目录可能刚好被 sweep_uploads 删掉了.
+			std::filesystem::create_directories(dir, ec);
+			f.open(tmp, std::ios::binary);
+		}
+		f.write(data.data(), data.size());
+		f.close();
+		if (!f)
+		{
+			std::filesystem::remove(tmp, ec);
+			return false;
+		}
+		std::filesystem::rename(tmp, dir / upload_id, ec);
+		if (ec)
+		{
+			std::filesystem::remove(tmp, ec);
+			return false;
+		}
+		return true;
+	}
+
+	// 先改名占住再读, 同一个 upload_id 只有一个请求 (包括其他实例上的) 能拿到. 文件的大小记到 size.
+	static std::optional<std::string> fetch_upload(const std::filesystem::path& dir, std::string_view upload_id, std::uint64_t& size)
+	{
+		std::error_code ec;
+		auto taken = dir / (std::string(upload_id) + ".taken");
+		std::filesystem::rename(dir / upload_id, taken, ec);
+		if (ec)
+			return std::nullopt;
+
+		std::optional<std::string> ret;
+		std::filesystem::directory_entry e(taken, ec);
+		size = e.file_size(ec);
+		if (!ec && !upload_expired(e))
+		{
+			std::string data(size, '\0');
+			std::ifstream f(taken, std::ios::binary);
+			if (f.read(data.data(), data.size()))
+				ret = std::move(data);
+		}
+		std::filesystem::remove(taken, ec);
+		return ret;
+	}
+
+	// 删掉过期的文件 (包括写了一半和取了一半留下的) 和空的子目录, 返回剩下的总大小.
+	static std::uint64_t sweep_uploads(const std::filesystem::path& upload_dir)
+	{
+		std::error_code ec;
+		std::uint64_t total = 0;
+		for (auto& owner : std::filesystem::directory_iterator(upload_dir, ec))
+		{
+			if (!owner.is_directory(ec))
+				continue;
+			bool empty = true;
+			for (auto& e : std::filesystem::directory_iterator(owner.path(), ec))
+			{
+				if (upload_expired(e) && std::filesystem::remove(e.path(), ec))
+					continue;
+				empty = false;
+				auto size = e.file_size(ec);
+				if (!ec)
+					total += size;
+			}
+			if (empty)
+				std::filesystem::remove(owner.path(), ec);
+		}
+		return total;
+	}
+
+	awaitable<std::string> cmall_service::put_upload(const services::client_session& session, std::string data)
+	{
+		auto dir = upload_owner_dir(m_config.upload_dir_, session);
+		if (dir.empty())
+			co_return "";
+
+		// 先占上额度, 写不进去再退回.
+		std::uint64_t size = data.size();
+		if (upload_bytes_.fetch_add(size) + size > m_config.upload_total_size_)
+		{
+			upload_bytes_ -= size;
+			co_return "";
+		}
+
+		std::string upload_id = gen_uuid();
+		std::size_t max_uploads = session.user_info ? max_uploads_per_user : max_uploads_per_session;
+		std::uint64_t freed = 0;
+		bool ok = false;
+
+		// 文件读写放到后台线程池, 不占 io 线程.
+		co_await boost::asio::co_spawn(background_task_thread_pool, [&]() mutable -> awaitable<void>
+		{
+			co_await this_coro::coro_yield();
+			ok = store_upload(dir, upload_id, data, max_uploads, freed);
+		}, use_awaitable);
+
+		upload_bytes_ -= ok ? freed : freed + size;
+		if (!ok)
+			co_return "";
+		co_return upload_id;
+	}
+
+	awaitable<std::optional<std::string>> cmall_service::take_upload(const services::client_session& session, std::string_view upload_id)
+	{
+		auto dir = upload_owner_dir(m_config.upload_dir_, session);
+		if (dir.empty() || !is_upload_name(upload_id))
+			co_return std::nullopt;
+
+		std::uint64_t size = 0;
+		std::optional<std::string> ret;
+		co_await boost::asio::co_spawn(background_task_thread_pool, [&]() mutable -> awaitable<void>
+		{
+			co_await this_coro::coro_yield();
+			ret = fetch_upload(dir, upload_id, size);
+		}, use_awaitable);
+
+		upload_bytes_ -= std::min<std::uint64_t>(size, upload_bytes_);
+		co_return ret;
+	}
+
+	awaitable<void> cmall_service::upload_sweep_loop()
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(m_config.upload_dir_, ec);
+		if (ec)
+			LOG_WARN << "upload_dir " << m_config.upload_dir_ << ": " << ec.message();
+
+		for (;;)
+		{
+			std::uint64_t total = 0;
+			co_await boost::asio::co_spawn(background_task_thread_pool, [&]() mutable -> awaitable<void>
+			{
+				co_await this_coro::coro_yield();
+				total = sweep_uploads(m_config.upload_dir_);
+			}, use_awaitable);
+			// 共享目录时其他实例写的也算在内.
+			upload_bytes_ = total;
+
+			awaitable_timer timer(co_await boost::asio::this_coro::executor);
+			timer.expires_from_now(1min);
+			co_await timer.async_wait();
+		}
+	}
+
 	awaitable<void> cmall_service::send_notify_message(
 		std::uint64_t uid_, const std::string& msg, std::int64_t exclude_connection_id)
+	{
+		deliver_notify_message(uid_, std::make_shared<const std::string>(msg));
+
+		// 同一个用户可能连在别的实例上.
+		if (notify_bus_)
+			notify_bus_->publish(std::format("{} {}", uid_, msg));
+		co_return;
+	}
+
+	void cmall_service::deliver_notify_message(std::uint64_t uid_, httpd::shared_message msg)
 	{
 		std::vector<client_connection_ptr> active_user_connections;
 		{
@@ -941,9 +1416,211 @@ namespace cmall
 				active_user_connections.push_back(c);
 			}
 		}
-		std::vector<promise<void(std::exception_ptr)>> writers;
-		for (auto c : active_user_connections)
-			 writers.push_back(websocket_write(c, msg));
-		co_await httpd::wait_all(writers);
+		if (!active_user_connections.empty())
+			broadcast_message(active_user_connections, std::move(msg));
+	}
+
+	awaitable<void> cmall_service::notify_cart_changed(const client_connection& c, std::string_view op, boost::json::object item, std::uint64_t version)
+	{
+		auto uid = c.session_info->user_info->uid_;
+		boost::json::object msg = {
+			{ "topic", "cart_changed" },
+			{ "session_id", c.session_info->session_id },
+			{ "op", op },
+			{ "item", std::move(item) },
+			{ "prev_version", version - 1 },
+			{ "version", version },
+		};
+		co_await send_notify_message(uid, boost::json::serialize(msg), c.connection_id_);
+	}
+
+	static std::uint64_t parse_cart_version(const cmall_3rd_kv_store& kv)
+	{
+		std::uint64_t version = 0;
+		std::from_chars(kv.value_.data(), kv.value_.data() + kv.value_.size(), version);
+		return version;
+	}
+
+	awaitable<std::optional<std::uint64_t>> cmall_service::cart_mutate(std::uint64_t uid, std::function<bool(odb::database&)> mutate)
+	{
+		std::uint64_t version = 0;
+		bool ok = co_await m_database.async_transacton([&](const cmall_database::odb_transaction_ptr& tx) mutable -> awaitable<bool>
+		{
+			auto& db = tx->database();
+
+			using user_query = odb::query<cmall_user>;
+			if (!db.query_one<cmall_user>((user_query::uid == uid) + " FOR UPDATE"))
+				co_return false;
+
+			if (!mutate(db))
+				co_return false;
+
+			cmall_3rd_kv_store kv;
+			kv.key_.uid_ = uid;
+			kv.key_.key_value_ = cart_version_kv_key;
+			bool exist = db.find<cmall_3rd_kv_store>(kv.key_, kv);
+			version = (exist ? parse_cart_version(kv) : 0) + 1;
+			kv.value_ = std::to_string(version);
+			if (exist)
+				db.update(kv);
+			else
+				db.persist(kv);
+			co_return true;
+		});
+
+		if (!ok)
+			co_return std::nullopt;
+		co_return version;
+	}
+
+	awaitable<std::uint64_t> cmall_service::cart_version(std::uint64_t uid)
+	{
+		cmall_3rd_kv_store kv;
+		kv.key_.uid_ = uid;
+		kv.key_.key_value_ = cart_version_kv_key;
+		if (!co_await m_database.async_reload<cmall_3rd_kv_store>(kv))
+			co_return 0;
+		co_return parse_cart_version(kv);
+	}
+
+	awaitable<void> cmall_service::notify_order_event(order_event event, const cmall_order& order)
+	{
+		std::string_view topic;
+		bool to_buyer = true, to_seller = true;
+		switch (event)
+		{
+			case order_event::created:
+				topic = "new_order_for_merchant";
+				to_buyer = false;
+				break;
+			case order_event::paid:
+				topic = "order_paid";
+				break;
+			case order_event::shipped:
+				topic = "order_shipped";
+				to_seller = false;
+				break;
+			case order_event::closed:
+				topic = "order_closed";
+				break;
+		}
+
+		// 只带列表页要用的字段, 要详情的客户端自己调 order_detail.
+		// 消息要过 notify bus, 不能带 bought_goods 这种不限长度的字段.
+		boost::json::object msg = {
+			{ "topic", topic },
+			{ "orderid", order.oid_ },
+			{ "buyer", order.buyer_ },
+			{ "seller", order.seller_ },
+			{ "price", ::to_string(order.price_) },
+			{ "kuaidifei", ::to_string(order.kuaidifei) },
+			{ "payed_at", order.payed_at_.null() ? "" : ::to_string(order.payed_at_.get()) },
+			{ "close_at", order.close_at_.null() ? "" : ::to_string(order.close_at_.get()) },
+		};
+		if (event == order_event::shipped)
+			msg["kuaidiinfo"] = boost::json::value_from(order.kuaidi);
+
+		auto serialized = boost::json::serialize(msg);
+		if (to_buyer)
+			co_await send_notify_message(order.buyer_, serialized, 0);
+		if (to_seller && order.seller_ != order.buyer_)
+			co_await send_notify_message(order.seller_, serialized, 0);
+	}
+
+	void cmall_service::notify_catalog_changed(std::uint64_t merchant_id, const std::vector<std::string>& changed, const std::vector<std::string>& removed)
+	{
+		std::vector<client_connection_ptr> subscribers;
+		bool has_expired = false;
+		{
+			std::shared_lock<std::shared_mutex> l(catalog_subscribers);
+			auto [first, last] = catalog_subscribers.get<tag::merchant_uid_tag>().equal_range(merchant_id);
+			for (auto it = first; it != last; ++it)
+			{
+				if (auto c = it->connection.lock())
+					subscribers.push_back(std::move(c));
+				else
+					has_expired = true;
+			}
+		}
+		if (has_expired)
+		{
+			// 连接没了但订阅还在, 顺手删掉.
+			std::unique_lock<std::shared_mutex> l(catalog_subscribers);
+			auto& by_merchant = catalog_subscribers.get<tag::merchant_uid_tag>();
+			auto [first, last] = by_merchant.equal_range(merchant_id);
+			for (auto it = first; it != last;)
+			{
+				if (it->connection.expired())
+					it = by_merchant.erase(it);
+				else
+					++it;
+			}
+		}
+		if (subscribers.empty())
+			return;
+
+		boost::json::object msg = {
+			{ "topic", "catalog_changed" },
+			{ "merchant_id", merchant_id },
+			{ "changed", boost::json::array(changed.begin(), changed.end()) },
+			{ "removed", boost::json::array(removed.begin(), removed.end()) },
+		};
+		broadcast_message(subscribers, std::make_shared<const std::string>(boost::json::serialize(msg)));
+	}
+
+	void cmall_service::broadcast_message(const std::vector<client_connection_ptr>& connections, httpd::shared_message msg)
+	{
+		// 按连接所在的 io_context 分组, 每组只 post 一次, 在那个线程上挨个入队.
+		// 入队和写协程在同一个线程, 不用为每个连接单独跨线程唤醒.
+		std::vector<std::pair<boost::asio::any_io_executor, std::vector<client_connection_ptr>>> groups;
+		for (auto& c : connections)
+		{
+			if (!c->ws_client)
+				continue;
+
+			auto executor = c->get_executor();
+			auto it = std::find_if(groups.begin(), groups.end(), [&](auto& g) { return g.first == executor; });
+			if (it == groups.end())
+				it = groups.emplace(groups.end(), executor, std::vector<client_connection_ptr>{});
+			it->second.push_back(c);
+		}
+
+		// 协商了二进制子协议的连接, 每种编码也只转一次.
+		std::array<httpd::shared_message, 2> binary_msg;
+		auto encoded = [&](const client_connection_ptr& c) -> httpd::shared_message
+		{
+			auto format = c->ws_client->binary_format;
+			if (!format)
+				return msg;
+
+			auto& m = binary_msg[static_cast<std::size_t>(*format)];
+			if (!m)
+			{
+				boost::system::error_code ec;
+				auto jv = boost::json::parse(*msg, ec);
+				if (ec)
+				{
+					LOG_ERR << "broadcast_message: not json: " << *msg;
+					return msg;
+				}
+				std::string out;
+				httpd::binary_json::encode(*format, jv, out);
+				m = std::make_shared<const std::string>(std::move(out));
+			}
+			return m;
+		};
+
+		for (auto& [executor, group] : groups)
+		{
+			std::vector<std::pair<client_connection_ptr, httpd::shared_message>> targets;
+			for (auto& c : group)
+				targets.emplace_back(c, encoded(c));
+
+			boost::asio::post(executor, [targets = std::move(targets)]()
+			{
+				for (auto& [c, m] : targets)
+					c->ws_client->send_queue.push(m);
+			});
+		}
 	}
 }
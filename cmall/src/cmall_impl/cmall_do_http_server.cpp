@@ -8,7 +8,12 @@
 
 #include "httpd/http_misc_helper.hpp"
 #include "httpd/header_helper.hpp"
+#include "httpd/coalescing_stream.hpp"
+#include "httpd/binary_json.hpp"
+#include "httpd/ws_loop.hpp"
 #include "httpd/httpd.hpp"
+#include "httpd/http2/connection.hpp"
+#include "utils/scoped_exit.hpp"
 
 template <typename Iterator>
 auto make_iterator_range(std::pair<Iterator, Iterator> pair)
@@ -52,8 +57,73 @@ auto is_microapp(auto user_agent, auto sec_websocket_protocol)
 //	 user_agent.length() && (user_agent.find("Mozilla")!= std::string::npos) && sec_websocket_protocol== "request_cookie"
 }
 
+// Sec-WebSocket-Protocol 里列出了二进制编码的 JSON-RPC 子协议时选中第一个, 否则还是 JSON 文本.
+static std::optional<std::pair<std::string_view, httpd::binary_json::format>> select_binary_subprotocol(std::string_view protocols)
+{
+	while (!protocols.empty())
+	{
+		auto comma = protocols.find(',');
+		auto token = protocols.substr(0, comma);
+		protocols = comma == std::string_view::npos ? std::string_view() : protocols.substr(comma + 1);
+
+		while (!token.empty() && (token.front() == ' ' || token.front() == '\t'))
+			token.remove_prefix(1);
+		while (!token.empty() && (token.back() == ' ' || token.back() == '\t'))
+			token.remove_suffix(1);
+
+		if (token == "jsonrpc.msgpack")
+			return std::make_pair(token, httpd::binary_json::format::msgpack);
+		if (token == "jsonrpc.cbor")
+			return std::make_pair(token, httpd::binary_json::format::cbor);
+	}
+	return {};
+}
+
+static awaitable<void> http_simple_error_page(httpd::http_any_stream& stream, auto body, auto status_code, unsigned version)
+{
+	using string_body = boost::beast::http::string_body;
+
+	boost::beast::http::response<string_body> res{ static_cast<boost::beast::http::status>(status_code), version };
+	res.set(boost::beast::http::field::server, HTTPD_VERSION_STRING);
+	res.set(boost::beast::http::field::content_type, "text/html");
+	res.keep_alive(false);
+	res.body() = body;
+	res.prepare_payload();
+
+	boost::beast::http::serializer<false, string_body, boost::beast::http::fields> sr{ res };
+	co_await boost::beast::http::async_write(stream, sr, use_awaitable);
+	stream.close();
+}
+
 namespace cmall
 {
+	// 路由用的正则只编译一次, 不要在每个请求里构造.
+	static const boost::regex repos_assets_regex("/repos/([0-9]+)/((images|css)/.+)");
+	static const boost::regex repos_callback_regex("/repos/([0-9]+)/callback\\.js([?/](.+))?");
+	static const boost::regex repos_scripts_regex("/repos/([0-9]+)/scripts/([^\\.]+\\.js)([?/](.+))?");
+	static const boost::regex cgi_scripts_regex("/api/cgi-scripts/([0-9]+)/([^\\.]+\\.js)([?/](.+))?");
+	static const boost::regex repos_pages_regex("/repos/([0-9]+)/(pages/.+)");
+	static const boost::regex repos_pages_index_regex("/repos/([0-9]+)/pages/");
+	static const boost::regex goods_detail_regex("/goods/([^/]+)/([^/]+)");
+	static const boost::regex wx_pay_action_regex("/api/wx/pay\\.action");
+	static const boost::regex upload_regex("/api/upload(\\?.*)?");
+
+	awaitable<void> cmall_service::drain_connections()
+	{
+		std::chrono::steady_clock::duration grace = m_config.handoff_drain_timeout_;
+
+		co_await httpd::detail::map(m_ws_acceptors,
+			[grace](auto&& a) mutable -> awaitable<void> { co_return co_await a.graceful_shutdown(grace); });
+
+		co_await httpd::detail::map(m_wss_acceptors,
+			[grace](auto&& a) mutable -> awaitable<void> { co_return co_await a.graceful_shutdown(grace); });
+
+		co_await httpd::detail::map(m_ws_unix_acceptors,
+			[grace](auto&& a) mutable -> awaitable<void> { co_return co_await a.graceful_shutdown(grace); });
+
+		LOG_DBG << "cmall_service::drain_connections() success!";
+	}
+
 	awaitable<void> cmall_service::close_all_ws()
 	{
 		co_await httpd::detail::map(m_ws_acceptors,
@@ -80,6 +150,14 @@ namespace cmall
 
 	client_connection_ptr cmall_service::make_shared_ssl_connection(const boost::asio::any_io_executor& io, std::int64_t connection_id)
 	{
+		if (m_config.enable_ktls_)
+		{
+			if constexpr (httpd::has_so_reuseport())
+				return std::make_shared<client_connection>(io, sslctx_, connection_id, 0);
+			else
+				return std::make_shared<client_connection>(m_io_context_pool.get_io_context(), sslctx_, connection_id, 0);
+		}
+
 		if constexpr (httpd::has_so_reuseport())
 			return std::make_shared<client_connection>(io, sslctx_, connection_id);
 		else
@@ -92,110 +170,129 @@ namespace cmall
 	}
 
 	awaitable<void> cmall_service::client_connected(client_connection_ptr client_ptr)
+	{
+		const size_t connection_id = client_ptr->connection_id_;
+
+		LOG_FMT("coro created: handle_accepted_client({})", connection_id);
+
+		// 连接在哪个 io_context 上, 一直计数到这个协程结束, 供 get_io_context() 挑负载低的.
+		auto io_load = m_io_context_pool.track_connection(m_io_context_pool.index_of(client_ptr->get_executor()));
+
+		// 读缓冲在 keep-alive 的多个请求间复用.
+		// buffer 不能每次重建, 否则 pipeline 过来的下一个请求的数据会被丢掉.
+		boost::beast::flat_buffer buffer;
+
+		// 读请求头, 读 body 和 keep-alive 空闲的超时, 挂在本 io_context 的时间轮上.
+		// 超时直接关闭 socket, 挂起的 async_read 会以错误返回.
+		httpd::deadline read_deadline(client_ptr->get_executor());
+		read_deadline.on_expire([&tcp_stream = client_ptr->tcp_stream]() { tcp_stream.close(); });
+
+		read_deadline.expires_after(m_config.http_header_timeout_);
+		if (m_config.enable_http2_ && co_await httpd::http2::is_http2_connection(client_ptr->tcp_stream, buffer))
+		{
+			read_deadline.cancel();
+			co_await serve_http2(client_ptr, buffer);
+			LOG_DBG << "handle_accepted_client: HTTP/2 connection closed : " << connection_id;
+			co_return;
+		}
+
+		co_await httpd::visit_connection_stream(client_ptr->tcp_stream, [&](auto& stream)
+		{
+			return serve_http1(client_ptr, stream, buffer, read_deadline);
+		});
+	}
+
+	template <typename Stream>
+	awaitable<void> cmall_service::serve_http1(client_connection_ptr client_ptr, Stream& stream, boost::beast::flat_buffer& buffer, httpd::deadline& read_deadline)
 	{
 		using string_body = boost::beast::http::string_body;
-		using fields	  = boost::beast::http::fields;
 		using request	  = boost::beast::http::request<string_body>;
-		using response	  = boost::beast::http::response<string_body>;
 		using header_field = boost::beast::http::field;
 
 		const size_t connection_id = client_ptr->connection_id_;
 
 		bool keep_alive = false;
 
-		auto http_simple_error_page
-			= [&client_ptr](auto body, auto status_code, unsigned version) mutable -> awaitable<void>
-		{
-			response res{ static_cast<boost::beast::http::status>(status_code), version };
-			res.set(header_field::server, HTTPD_VERSION_STRING);
-			res.set(header_field::content_type, "text/html");
-			res.keep_alive(false);
-			res.body() = body;
-			res.prepare_payload();
-
-			boost::beast::http::serializer<false, string_body, fields> sr{ res };
-			co_await boost::beast::http::async_write(client_ptr->tcp_stream, sr, use_awaitable);
-			client_ptr->tcp_stream.close();
-		};
+		// parser 和响应头用的 arena 在 keep-alive 的多个请求间复用.
+		// arena 自带 4K 的 buffer, 第一个普通 HTTP 请求时才分配, 升级成 websocket 的连接用不到它.
+		std::optional<boost::beast::http::request_parser<boost::beast::http::string_body>> parser_;
+		std::unique_ptr<httpd::request_arena> arena;
 
-		LOG_FMT("coro created: handle_accepted_client({})", connection_id);
+		bool first_request = true;
 
 		do
 		{
-			boost::beast::flat_buffer buffer;
-			boost::beast::http::request_parser<boost::beast::http::string_body> parser_;
-
-			parser_.body_limit(2000);
-
-			co_await boost::beast::http::async_read(client_ptr->tcp_stream, buffer, parser_, use_awaitable);
-			request req = parser_.release();
-			keep_alive = req.keep_alive();
-
-			// 这里是为了能提取到客户端的 IP 地址，即便服务本身运行在 nginx 的后面。
-			auto x_real_ip = req["x-real-ip"];
-			auto x_forwarded_for = req["x-forwarded-for"];
-			if (x_real_ip.empty())
+			if (arena)
+				arena->reset();
+			parser_.emplace();
+			// Content-Length 超限在解析头的时候就报错, 读头时先按上传接口的上限放开, 读完头再收回.
+			parser_->body_limit(std::max<std::size_t>(m_config.upload_max_size_, 2000));
+
+			// 第一个请求的头沿用上面的超时, 之后的请求等待时间算 keep-alive 空闲.
+			// keep-alive 空闲时 drain() 可以直接关掉连接.
+			if (!first_request)
+				read_deadline.expires_after(m_config.http_keepalive_timeout_);
+			client_ptr->http_idle_ = !first_request;
+			first_request = false;
+
+			co_await boost::beast::http::async_read_header(stream, buffer, *parser_, use_awaitable);
+			client_ptr->http_idle_ = false;
+
+			// 只有带着 session 的上传请求 body 可以大, body 直接读进请求的 string 里, 不经过 json.
+			std::string_view header_target = parser_->get().target();
+			std::size_t body_limit = 2000;
+			if (boost::regex_match(header_target.begin(), header_target.end(), upload_regex))
 			{
-				client_ptr->x_real_ip = client_ptr->remote_host_;
+				// 读 body 前先从 cookie 认出 session, 没有 session 的上传和普通请求一样限制大小.
+				co_await update_client_info(client_ptr, parser_->get());
+				if (client_ptr->session_info)
+					body_limit = std::max<std::size_t>(body_limit, client_ptr->session_info->user_info
+						? m_config.upload_max_size_ : m_config.anonymous_upload_max_size_);
 			}
-			else
+
+			auto content_length = parser_->content_length();
+			if (content_length && *content_length > body_limit)
+				throw boost::system::system_error(boost::beast::http::error::body_limit);
+			parser_->body_limit(body_limit);
+
+			if (body_limit > 2000 && !parser_->is_done()
+				&& boost::beast::http::token_list{ parser_->get()[header_field::expect] }.exists("100-continue"))
 			{
-				client_ptr->x_real_ip = x_real_ip;
+				boost::beast::http::response<boost::beast::http::empty_body> res{ boost::beast::http::status::continue_, parser_->get().version() };
+				co_await boost::beast::http::async_write(stream, res, use_awaitable);
 			}
 
-			if (!x_forwarded_for.empty())
+			if (!parser_->is_done())
 			{
-				std::vector<std::string> x_forwarded_clients;
-				boost::split(x_forwarded_clients, x_forwarded_for, boost::is_any_of(", "));
-				client_ptr->x_real_ip = x_forwarded_clients[0];
+				read_deadline.expires_after(m_config.http_body_timeout_);
+				co_await boost::beast::http::async_read(stream, buffer, *parser_, use_awaitable);
 			}
+			read_deadline.cancel();
+
+			request req = parser_->release();
+			keep_alive = req.keep_alive();
 
 			std::string_view target = req.target();
 
 			LOG_FMT("coro: handle_accepted_client: [{}], got request on {}", connection_id, target);
 
-			if (target.empty() || target[0] != '/' || target.find("..") != boost::beast::string_view::npos)
-			{
-				co_await http_simple_error_page(
-					"Illegal request-target", boost::beast::http::status::bad_request, req.version());
-			}
-
-			if (!client_ptr->session_info)
-			{
-				// 处理 cookie.
-				for (auto& cookie : make_iterator_range(req.equal_range(header_field::cookie)))
-				{
-					auto sessionid = httpd::parse_cookie(cookie.value())["Session"];
-
-					if ((!sessionid.empty()) && (co_await session_cache_map.exist(sessionid)) )
-					{
-						// 从 cookie 里直接 recover_session
-						client_ptr->session_info
-							= std::make_shared<services::client_session>(co_await session_cache_map.load(sessionid));
-
-						if (client_ptr->session_info->user_info)
-						{
-							co_await load_user_info(client_ptr);
-						}
-						co_await session_cache_map.update_lifetime(sessionid, client_ptr->x_real_ip);
-						break;
-					}
-				}
-			}
+			co_await update_client_info(client_ptr, req);
 
 			// 处理 HTTP 请求.
 			if (boost::beast::websocket::is_upgrade(req))
 			{
 				LOG_FMT("ws client incoming: [{}], remote: {}, real_remote: {}", connection_id, client_ptr->remote_host_, client_ptr->x_real_ip);
 
-				if (!target.starts_with("/api"))
+				if (!target.starts_with("/api") || target.find("..") != std::string_view::npos)
 				{
-					co_await http_simple_error_page(
+					co_await http_simple_error_page(client_ptr->tcp_stream,
 						"not allowed", boost::beast::http::status::forbidden, req.version());
 					break;
 				}
 
-				client_ptr->ws_client.emplace(client_ptr->tcp_stream);
+				client_ptr->ws_client.emplace(stream.get_executor(), m_config.ws_send_queue_, ws_send_counters_, m_config.ws_inflight_limit_);
+				// 中间夹一层合并写, do_ws_write 一次把一批消息写出去.
+				boost::beast::websocket::stream<httpd::write_coalescing_stream<Stream&>> ws(stream);
 
 				std::string cookie_line;
 				std::string_view user_agent = req[header_field::user_agent];
@@ -209,7 +306,7 @@ namespace cmall
 
 						cookie_line = std::format("Session={}; Path=/api; Expires={}",
 							client_ptr->session_info->session_id,
-							httpd::make_http_last_modified(std::time(NULL) + 31536000)
+							httpd::cached_http_date(std::time(NULL) + 31536000)
 						);
 					}
 				}
@@ -221,7 +318,7 @@ namespace cmall
 
 						cookie_line = std::format("Session={}; Path=/api; Expires={}",
 							client_ptr->session_info->session_id,
-							httpd::make_http_last_modified(std::time(NULL) + 31536000)
+							httpd::cached_http_date(std::time(NULL) + 31536000)
 						);
 					}
 				}
@@ -230,310 +327,506 @@ namespace cmall
 					LOG_WARN << "Non broswer accessed cmall with UA:" << user_agent;
 				}
 
-				boost::beast::websocket::permessage_deflate permessage_deflate_opt;
-				permessage_deflate_opt.client_enable = true; // for clients
-				permessage_deflate_opt.server_enable = true; // for servers
-				client_ptr->ws_client->ws_stream_.set_option(permessage_deflate_opt);
+				ws.set_option(m_config.ws_deflate_);
 
 				auto timeout_opt = boost::beast::websocket::stream_base::timeout::suggested(boost::beast::role_type::server);
 				timeout_opt.idle_timeout = std::chrono::seconds(45);
-				client_ptr->ws_client->ws_stream_.set_option(timeout_opt);
+				ws.set_option(timeout_opt);
 
-				client_ptr->ws_client->ws_stream_.set_option(
-					boost::beast::websocket::stream_base::decorator([&sec_websocket_protocol, &cookie_line](auto& res)
+				// 子协议只能回一个, 选中了二进制编码就回它, 否则照旧原样返回.
+				auto binary_subprotocol = select_binary_subprotocol(sec_websocket_protocol);
+
+				ws.set_option(
+					boost::beast::websocket::stream_base::decorator([&sec_websocket_protocol, &binary_subprotocol, &cookie_line](auto& res)
 					{
 						res.set(header_field::server, HTTPD_VERSION_STRING);
-						if (!sec_websocket_protocol.empty())
+						if (binary_subprotocol)
+							res.set(header_field::sec_websocket_protocol, binary_subprotocol->first);
+						else if (!sec_websocket_protocol.empty())
 							res.set(header_field::sec_websocket_protocol, sec_websocket_protocol);
 						if (!cookie_line.empty())
 							res.set(boost::beast::http::field::set_cookie, cookie_line);
 					}));
 
-				co_await client_ptr->ws_client->ws_stream_.async_accept(req, use_awaitable);
-
-				// 获取executor.
-				auto executor = client_ptr->tcp_stream.get_executor();
+				co_await ws.async_accept(req, use_awaitable);
 
 				client_ptr->ws_client->m_disable_ping = (req["x-tencent-ua"] == "Qcloud");
+				if (binary_subprotocol)
+				{
+					client_ptr->ws_client->binary_format = binary_subprotocol->second;
+					ws.binary(true);
+				}
+
+				httpd::release_upgrade_request(req, parser_, buffer);
 
 				// 接收到pong, 重置超时定时器.
-				client_ptr->ws_client->ws_stream_.control_callback(
-					[&tcp_stream = client_ptr->tcp_stream](
-						boost::beast::websocket::frame_type ft, boost::beast::string_view)
+				ws.control_callback(
+					[&stream](boost::beast::websocket::frame_type ft, boost::beast::string_view)
 					{
-						if (ft == boost::beast::websocket::frame_type::pong)
-							tcp_stream.expires_after(std::chrono::seconds(60));
+						if (ft != boost::beast::websocket::frame_type::pong)
+							return;
+						if constexpr (requires { stream.expires_after(std::chrono::seconds(60)); })
+							stream.expires_after(std::chrono::seconds(60));
+						else
+							boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(60));
 					});
 
 				using namespace boost::asio::experimental::awaitable_operators;
 
 				co_await (
 					// 启动读写协程.
-					do_ws_read(connection_id, client_ptr) || do_ws_write(connection_id, client_ptr));
+					do_ws_read(connection_id, client_ptr, ws) || do_ws_write(connection_id, client_ptr, ws));
 				LOG_FMT("ws connection [{}] exit", connection_id);
 				co_return;
 			}
 			else
 			{
-				boost::match_results<std::string_view::const_iterator> w;
-				if (boost::regex_match(target.begin(), target.end(), w, boost::regex("/repos/([0-9]+)/((images|css)/.+)")))
+				if (!arena)
+					arena = std::make_unique<httpd::request_arena>();
+				keep_alive = co_await handle_http_request(client_ptr, client_ptr->tcp_stream, req, arena->resource());
+				// 进程在交接, 这个请求做完就断开.
+				if (client_ptr->draining_)
+					keep_alive = false;
+			}
+		} while (keep_alive);
+
+		if (!keep_alive)
+		{
+			co_await client_ptr->tcp_stream.async_teardown(boost::beast::role_type::server, use_awaitable);
+		}
+
+		LOG_DBG << "handle_accepted_client: HTTP connection closed : " << connection_id;
+	}
+
+	awaitable<void> cmall_service::serve_http2(client_connection_ptr client_ptr, boost::beast::flat_buffer& buffer)
+	{
+		httpd::http2::settings settings;
+		// 和 HTTP/1.1 的 parser 一样的 body 限制. 上传接口放开到上传的上限,
+		// 这时还不知道 session, 按 session 区分的限制由 handle_upload 检查.
+		settings.body_limit = 2000;
+		settings.stream_body_limit = [this](const httpd::http2::request& req) -> std::size_t
+		{
+			std::string_view target = req.target();
+			if (boost::regex_match(target.begin(), target.end(), upload_regex))
+				return std::max({ m_config.upload_max_size_, m_config.anonymous_upload_max_size_, std::size_t(2000) });
+			return 2000;
+		};
+		// 没有进行中的 stream 时和 HTTP/1.1 的 keep-alive 一样计空闲.
+		settings.idle_timeout = m_config.http_keepalive_timeout_;
+
+		auto connection = std::make_shared<httpd::http2::server_connection>(client_ptr->tcp_stream, buffer, settings);
+		client_ptr->http2_ = connection;
+
+		// 多个 stream 并发处理, 而 update_client_info 改的是连接上共享的 session_info, 中间还有 co_await.
+		// 用一个容量为 1 的 channel 当锁, 同一时间只让一个 stream 更新.
+		auto session_lock = std::make_shared<boost::asio::experimental::channel<void(boost::system::error_code)>>(client_ptr->get_executor(), 1);
+
+		co_await connection->run(
+			[this, client_ptr, session_lock](httpd::http2::request& req, httpd::http_any_stream& stream) -> awaitable<void>
+			{
+				// 每个 stream 一个 arena, 多个 stream 是并发处理的.
+				httpd::request_arena arena;
+
+				LOG_FMT("coro: handle_accepted_client: [{}], got h2 request on {}", client_ptr->connection_id_, std::string_view(req.target()));
+
+				boost::system::error_code no_error;
+				co_await session_lock->async_send(no_error, use_awaitable);
 				{
-					std::string merchant = w[1].str();
-					std::string remains = httpd::decodeURIComponent(w[2].str());
+					scoped_exit unlock([&session_lock] { session_lock->try_receive([](boost::system::error_code) {}); });
+					co_await update_client_info(client_ptr, req);
+				}
+				co_await handle_http_request(client_ptr, stream, req, arena.resource());
+			});
+	}
+
+	awaitable<void> cmall_service::update_client_info(client_connection_ptr client_ptr, const boost::beast::http::request<boost::beast::http::string_body>& req)
+	{
+		using header_field = boost::beast::http::field;
+
+		// 这里是为了能提取到客户端的 IP 地址，即便服务本身运行在 nginx 的后面。
+		auto x_real_ip = req["x-real-ip"];
+		auto x_forwarded_for = req["x-forwarded-for"];
+		if (x_real_ip.empty())
+		{
+			client_ptr->x_real_ip = client_ptr->remote_host_;
+		}
+		else
+		{
+			client_ptr->x_real_ip = x_real_ip;
+		}
 
-					int status_code = co_await render_git_repo_files(
-						connection_id, merchant, remains, client_ptr->tcp_stream, req);
+		if (!x_forwarded_for.empty())
+		{
+			std::vector<std::string> x_forwarded_clients;
+			boost::split(x_forwarded_clients, x_forwarded_for, boost::is_any_of(", "));
+			client_ptr->x_real_ip = x_forwarded_clients[0];
+		}
 
-					if ((status_code != 200) && (status_code != 206))
+		if (!client_ptr->session_info)
+		{
+			// 处理 cookie.
+			for (auto& cookie : make_iterator_range(req.equal_range(header_field::cookie)))
+			{
+				auto sessionid = httpd::parse_cookie(cookie.value())["Session"];
+
+				if ((!sessionid.empty()) && (co_await session_cache_map.exist(sessionid)) )
+				{
+					// 从 cookie 里直接 recover_session
+					client_ptr->session_info
+						= std::make_shared<services::client_session>(co_await session_cache_map.load(sessionid));
+
+					if (client_ptr->session_info->user_info)
 					{
-						co_await http_simple_error_page("ERRORED", status_code, req.version());
+						co_await load_user_info(client_ptr);
 					}
+					co_await session_cache_map.update_lifetime(sessionid, client_ptr->x_real_ip);
+					break;
 				}
-				else if (boost::regex_match(target.begin(), target.end(), w, boost::regex("/repos/([0-9]+)/callback\\.js([?/](.+))?")))
-				{
-					std::string merchant = w[1].str();
-					std::string remains;
-					if (w.size() == 5)
-						remains = httpd::decodeURIComponent(w[4].str());
+			}
+		}
+	}
 
-					auto merchant_id = strtoll(merchant.c_str(), nullptr, 10);
-					boost::system::error_code ec;
-					auto merchant_repo_ptr = get_merchant_git_repo(merchant_id, ec);
+	awaitable<bool> cmall_service::handle_http_request(client_connection_ptr client_ptr, httpd::http_any_stream& stream,
+		boost::beast::http::request<boost::beast::http::string_body>& req, std::pmr::memory_resource* arena)
+	{
+		const size_t connection_id = client_ptr->connection_id_;
 
-					if (ec)
-					{
-						co_await http_simple_error_page("ERRORED", 404, req.version());
-						continue;
-					}
+		bool keep_alive = req.keep_alive();
 
-					std::string callback_js = co_await merchant_repo_ptr->get_file_content("scripts/callback.js", ec);
-					if (ec)
-					{
-						co_await http_simple_error_page("ERRORED", 404, req.version());
-						continue;
-					}
+		std::string_view target = req.target();
 
-					std::map<std::string, std::string> script_env;
+		if (target.empty() || target[0] != '/' || target.find("..") != boost::beast::string_view::npos)
+		{
+			co_await http_simple_error_page(stream,
+				"Illegal request-target", boost::beast::http::status::bad_request, req.version());
+			co_return false;
+		}
 
-					for (auto& kv : req)
-					{
-						script_env.insert({std::string(kv.name_string()), std::string(kv.value())});
-					}
+		boost::match_results<std::string_view::const_iterator> w;
+		if (boost::regex_match(target.begin(), target.end(), w, repos_assets_regex))
+		{
+			std::string merchant = w[1].str();
+			std::string remains = httpd::decodeURIComponent(w[2].str());
 
-					std::string template_api_token = co_await gen_temp_api_token(merchant);
-					script_env.insert({"_METHOD", std::string(req.method_string())});
-					script_env.insert({"_PATH", remains});
-					script_env.insert({"_API_TOKEN", template_api_token});
-					if (client_ptr->session_info && client_ptr->session_info->user_info)
-					{
-						std::string visitor_uid = fmt::format("{}", client_ptr->session_info->user_info->uid_);
-						script_env.insert({"_VISITOR", visitor_uid});
-					}
+			int status_code = co_await render_git_repo_files(
+				connection_id, merchant, remains, stream, arena, req);
 
-					// 然后运行 callback.js
-					std::string response_body = co_await script_runner.run_script(callback_js,
-						req.body(), script_env, {});
+			if ((status_code != 200) && (status_code != 206))
+			{
+				co_await http_simple_error_page(stream, "ERRORED", status_code, req.version());
+			}
+			co_return keep_alive;
+		}
+		else if (boost::regex_match(target.begin(), target.end(), w, repos_callback_regex))
+		{
+			std::string merchant = w[1].str();
+			std::string remains;
+			if (w.size() == 5)
+				remains = httpd::decodeURIComponent(w[4].str());
 
-					co_await drop_temp_api_token(template_api_token);
+			auto merchant_id = strtoll(merchant.c_str(), nullptr, 10);
+			boost::system::error_code ec;
+			auto merchant_repo_ptr = get_merchant_git_repo(merchant_id, ec);
 
-					std::map<boost::beast::http::field, std::string> headers;
+			if (ec)
+			{
+				co_await http_simple_error_page(stream, "ERRORED", 404, req.version());
+				co_return keep_alive;
+			}
 
-					headers.insert({boost::beast::http::field::expires, httpd::make_http_last_modified(std::time(0) + 60)});
-					headers.insert({boost::beast::http::field::content_type, "text/plain"});
+			std::string callback_js = co_await merchant_repo_ptr->get_file_content("scripts/callback.js", ec);
+			if (ec)
+			{
+				co_await http_simple_error_page(stream, "ERRORED", 404, req.version());
+				co_return keep_alive;
+			}
 
-					ec = co_await httpd::send_string_response_body(client_ptr->tcp_stream,
-						response_body,
-						std::move(headers),
-						req.version(),
-						keep_alive);
-					if (ec)
-						throw boost::system::system_error(ec);
+			std::map<std::string, std::string> script_env;
 
-				}
-				else if (
-					boost::regex_match(target.begin(), target.end(), w, boost::regex("/repos/([0-9]+)/scripts/([^\\.]+\\.js)([?/](.+))?"))
-					||
-					boost::regex_match(target.begin(), target.end(), w, boost::regex("/api/cgi-scripts/([0-9]+)/([^\\.]+\\.js)([?/](.+))?"))
-				)
-				{
-					std::string merchant = w[1].str();
-					std::string script_name = w[2].str();
-					std::string remains;
-					if (w.size() == 5)
-						remains = httpd::decodeURIComponent(w[4].str());
+			for (auto& kv : req)
+			{
+				script_env.insert({std::string(kv.name_string()), std::string(kv.value())});
+			}
 
-					auto merchant_id = strtoll(merchant.c_str(), nullptr, 10);
-					boost::system::error_code ec;
-					auto merchant_repo_ptr = get_merchant_git_repo(merchant_id, ec);
+			std::string template_api_token = co_await gen_temp_api_token(merchant);
+			script_env.insert({"_METHOD", std::string(req.method_string())});
+			script_env.insert({"_PATH", remains});
+			script_env.insert({"_API_TOKEN", template_api_token});
+			if (client_ptr->session_info && client_ptr->session_info->user_info)
+			{
+				std::string visitor_uid = fmt::format("{}", client_ptr->session_info->user_info->uid_);
+				script_env.insert({"_VISITOR", visitor_uid});
+			}
 
-					if (ec)
-					{
-						co_await http_simple_error_page("ERRORED", 404, req.version());
-						continue;
-					}
+			// 然后运行 callback.js
+			std::string response_body = co_await script_runner.run_script(callback_js,
+				req.body(), script_env, {});
 
-					std::string callback_js = co_await merchant_repo_ptr->get_file_content("scripts/" + script_name, ec);
-					if (ec)
-					{
-						co_await http_simple_error_page("ERRORED", 404, req.version());
-						continue;
-					}
+			co_await drop_temp_api_token(template_api_token);
 
-					std::map<std::string, std::string> script_env;
+			httpd::response_fields headers{ arena };
 
-					for (auto& kv : req)
-					{
-						script_env.insert({std::string(kv.name_string()), std::string(kv.value())});
-					}
+			headers.set(boost::beast::http::field::expires, httpd::cached_http_date(std::time(0) + 60));
+			headers.set(boost::beast::http::field::content_type, "text/plain");
 
-					std::string template_api_token = co_await gen_temp_api_token(merchant);
+			ec = co_await httpd::send_string_response_body(stream,
+				response_body,
+				std::move(headers),
+				req.version(),
+				keep_alive);
+			if (ec)
+				throw boost::system::system_error(ec);
+			co_return keep_alive;
+		}
+		else if (
+			boost::regex_match(target.begin(), target.end(), w, repos_scripts_regex)
+			||
+			boost::regex_match(target.begin(), target.end(), w, cgi_scripts_regex)
+		)
+		{
+			std::string merchant = w[1].str();
+			std::string script_name = w[2].str();
+			std::string remains;
+			if (w.size() == 5)
+				remains = httpd::decodeURIComponent(w[4].str());
 
-					script_env.insert({"_METHOD", std::string(req.method_string())});
-					script_env.insert({"_PATH", remains});
-					script_env.insert({"_API_TOKEN", template_api_token});
-					if (client_ptr->session_info && client_ptr->session_info->user_info)
-					{
-						std::string visitor_uid = fmt::format("{}", client_ptr->session_info->user_info->uid_);
-						script_env.insert({"_VISITOR", visitor_uid});
-					}
+			auto merchant_id = strtoll(merchant.c_str(), nullptr, 10);
+			boost::system::error_code ec;
+			auto merchant_repo_ptr = get_merchant_git_repo(merchant_id, ec);
 
-					LOG_DBG << "runing script: " << script_name;
+			if (ec)
+			{
+				co_await http_simple_error_page(stream, "ERRORED", 404, req.version());
+				co_return keep_alive;
+			}
 
-					// 然后运行 script_name
-					std::string response_body = co_await script_runner.run_script(callback_js,
-						req.body(), script_env, {});
+			std::string callback_js = co_await merchant_repo_ptr->get_file_content("scripts/" + script_name, ec);
+			if (ec)
+			{
+				co_await http_simple_error_page(stream, "ERRORED", 404, req.version());
+				co_return keep_alive;
+			}
 
-					co_await drop_temp_api_token(template_api_token);
+			std::map<std::string, std::string> script_env;
 
-					std::map<boost::beast::http::field, std::string> headers;
+			for (auto& kv : req)
+			{
+				script_env.insert({std::string(kv.name_string()), std::string(kv.value())});
+			}
 
-					headers.insert({boost::beast::http::field::expires, httpd::make_http_last_modified(std::time(0) + 60)});
-					headers.insert({boost::beast::http::field::content_type, "text/plain"});
+			std::string template_api_token = co_await gen_temp_api_token(merchant);
 
-					ec = co_await httpd::send_string_response_body(client_ptr->tcp_stream,
-						response_body,
-						std::move(headers),
-						req.version(),
-						keep_alive);
-					if (ec)
-						throw boost::system::system_error(ec);
+			script_env.insert({"_METHOD", std::string(req.method_string())});
+			script_env.insert({"_PATH", remains});
+			script_env.insert({"_API_TOKEN", template_api_token});
+			if (client_ptr->session_info && client_ptr->session_info->user_info)
+			{
+				std::string visitor_uid = fmt::format("{}", client_ptr->session_info->user_info->uid_);
+				script_env.insert({"_VISITOR", visitor_uid});
+			}
 
-				}
-				else if (boost::regex_match(target.begin(), target.end(), w, boost::regex("/repos/([0-9]+)/(pages/.+)")))
-				{
-					std::string merchant = w[1].str();
-					std::string remains = httpd::decodeURIComponent(w[2].str());
+			LOG_DBG << "runing script: " << script_name;
 
-					if (remains.find_first_of('?') != std::string::npos)
-					{
-						remains = remains.substr(0, remains.find_first_of('?'));
-					}
+			// 然后运行 script_name
+			std::string response_body = co_await script_runner.run_script(callback_js,
+				req.body(), script_env, {});
 
-					int status_code = co_await render_git_repo_files(
-						connection_id, merchant, remains, client_ptr->tcp_stream, req);
+			co_await drop_temp_api_token(template_api_token);
 
-					if (status_code == 404)
-					{
-						status_code = co_await render_git_repo_files(connection_id, merchant, "pages/index.html", client_ptr->tcp_stream, req);
-					}
+			httpd::response_fields headers{ arena };
 
-					if ((status_code != 200) && (status_code != 206))
-					{
-						co_await http_simple_error_page("ERRORED", status_code, req.version());
-					}
-				}
-				else if (boost::regex_match(target.begin(), target.end(), w, boost::regex("/repos/([0-9]+)/pages/")))
-				{
-					std::string merchant = w[1].str();
+			headers.set(boost::beast::http::field::expires, httpd::cached_http_date(std::time(0) + 60));
+			headers.set(boost::beast::http::field::content_type, "text/plain");
 
-					int status_code = co_await render_git_repo_files(
-						connection_id, merchant, "pages/index.html", client_ptr->tcp_stream, req);
+			ec = co_await httpd::send_string_response_body(stream,
+				response_body,
+				std::move(headers),
+				req.version(),
+				keep_alive);
+			if (ec)
+				throw boost::system::system_error(ec);
+			co_return keep_alive;
+		}
+		else if (boost::regex_match(target.begin(), target.end(), w, repos_pages_regex))
+		{
+			std::string merchant = w[1].str();
+			std::string remains = httpd::decodeURIComponent(w[2].str());
 
-					if ((status_code != 200) && (status_code != 206))
-					{
-						co_await http_simple_error_page("ERRORED", status_code, req.version());
-					}
-				}
-				// 这个 /goods/${merchant}/${goods_id} 获取 富文本的商品描述.
-				else if (target.starts_with("/goods"))
-				{
-					boost::match_results<std::string_view::const_iterator> w;
-					if (boost::regex_match(target.begin(), target.end(), w, boost::regex("/goods/([^/]+)/([^/]+)")))
-					{
-						std::string merchant = w[1].str();
-						std::string goods_id = httpd::decodeURIComponent(w[2].str());
+			if (remains.find_first_of('?') != std::string::npos)
+			{
+				remains = remains.substr(0, remains.find_first_of('?'));
+			}
 
-						int status_code = co_await render_goods_detail_content(merchant, goods_id, client_ptr->tcp_stream, req);
+			int status_code = co_await render_git_repo_files(
+				connection_id, merchant, remains, stream, arena, req);
 
-						if (status_code != 200)
-						{
-							co_await http_simple_error_page("ERRORED", status_code, req.version());
-							continue;
-						}
-					}
-					else
-					{
-						co_await http_simple_error_page("access denied", 401, req.version());
-					}
-					continue;
-				}
-				else if (boost::regex_match(target.begin(), target.end(), w, boost::regex("/api/wx/pay\\.action")))
-				{
-					bool callback_handled = false;
-					for (auto wxpay_service : wxpay_services)
-					{
-						services::weixin::notify_message nofity_msg;
-						try
-						{
-							nofity_msg = co_await wxpay_service.second->decode_notify_message(req.body(), req["Wechatpay-Timestamp"], req["Wechatpay-Nonce"], req["Wechatpay-Signature"]);
-						}catch(std::exception& e)
-						{
-							// if e == nofity_message_decode_failed
-							continue;
-						}
-
-						// TODO, 根据 notify_msg 的内容处理支付结果.
-						bool success = co_await handle_order_wx_callback(nofity_msg);
-						if (success)
-						{
-							co_await http_simple_error_page(R"json(SUCCESS)json", 200, req.version());
-							callback_handled = true;
-							break;
-						}
-					}
-					if (!callback_handled)
-						co_await http_simple_error_page(R"json({"code": "FAIL", "message": "失败"})json", 500, req.version());
-					continue;
-				}
+			if (status_code == 404)
+			{
+				status_code = co_await render_git_repo_files(connection_id, merchant, "pages/index.html", stream, arena, req);
+			}
 
+			if ((status_code != 200) && (status_code != 206))
+			{
+				co_await http_simple_error_page(stream, "ERRORED", status_code, req.version());
+			}
+			co_return keep_alive;
+		}
+		else if (boost::regex_match(target.begin(), target.end(), w, repos_pages_index_regex))
+		{
+			std::string merchant = w[1].str();
 
-				// 这里使用 zip 里打包的 angular 页面. 对不存在的地址其实直接替代性的返回 index.html 因此此
-				// api 绝对不返回 400. 如果解压内部 zip 发生错误, 会放回 500 错误代码.
-				int status_code = co_await http_handle_static_file(connection_id, req, client_ptr->tcp_stream);
+			int status_code = co_await render_git_repo_files(
+				connection_id, merchant, "pages/index.html", stream, arena, req);
+
+			if ((status_code != 200) && (status_code != 206))
+			{
+				co_await http_simple_error_page(stream, "ERRORED", status_code, req.version());
+			}
+			co_return keep_alive;
+		}
+		// 这个 /goods/${merchant}/${goods_id} 获取 富文本的商品描述.
+		else if (target.starts_with("/goods"))
+		{
+			boost::match_results<std::string_view::const_iterator> w;
+			if (boost::regex_match(target.begin(), target.end(), w, goods_detail_regex))
+			{
+				std::string merchant = w[1].str();
+				std::string goods_id = httpd::decodeURIComponent(w[2].str());
+
+				int status_code = co_await render_goods_detail_content(merchant, goods_id, stream, arena, req);
 
 				if (status_code != 200)
 				{
-					co_await http_simple_error_page("ERRORED", 404, req.version());
-					keep_alive &= !req.need_eof();
+					co_await http_simple_error_page(stream, "ERRORED", status_code, req.version());
+					co_return keep_alive;
+				}
+			}
+			else
+			{
+				co_await http_simple_error_page(stream, "access denied", 401, req.version());
+			}
+			co_return keep_alive;
+		}
+		else if (boost::regex_match(target.begin(), target.end(), w, upload_regex))
+		{
+			co_return co_await handle_upload(client_ptr, stream, req, arena);
+		}
+		else if (boost::regex_match(target.begin(), target.end(), w, wx_pay_action_regex))
+		{
+			bool callback_handled = false;
+			for (auto wxpay_service : wxpay_services)
+			{
+				services::weixin::notify_message nofity_msg;
+				try
+				{
+					nofity_msg = co_await wxpay_service.second->decode_notify_message(req.body(), req["Wechatpay-Timestamp"], req["Wechatpay-Nonce"], req["Wechatpay-Signature"]);
+				}catch(std::exception& e)
+				{
+					// if e == nofity_message_decode_failed
 					continue;
 				}
 
-				keep_alive &= !req.need_eof();
+				// TODO, 根据 notify_msg 的内容处理支付结果.
+				bool success = co_await handle_order_wx_callback(nofity_msg);
+				if (success)
+				{
+					co_await http_simple_error_page(stream, R"json(SUCCESS)json", 200, req.version());
+					callback_handled = true;
+					break;
+				}
 			}
-		} while (keep_alive);
+			if (!callback_handled)
+				co_await http_simple_error_page(stream, R"json({"code": "FAIL", "message": "失败"})json", 500, req.version());
+			co_return keep_alive;
+		}
 
-		if (!keep_alive)
+
+		// 这里使用 zip 里打包的 angular 页面. 对不存在的地址其实直接替代性的返回 index.html 因此此
+		// api 绝对不返回 400. 如果解压内部 zip 发生错误, 会放回 500 错误代码.
+		int status_code = co_await http_handle_static_file(connection_id, req, stream, arena);
+
+		if (status_code != 200)
 		{
-			co_await client_ptr->tcp_stream.async_teardown(boost::beast::role_type::server, use_awaitable);
+			co_await http_simple_error_page(stream, "ERRORED", 404, req.version());
+			keep_alive &= !req.need_eof();
+			co_return keep_alive;
 		}
 
-		LOG_DBG << "handle_accepted_client: HTTP connection closed : " << connection_id;
+		keep_alive &= !req.need_eof();
+		co_return keep_alive;
+	}
+
+	awaitable<bool> cmall_service::handle_upload(client_connection_ptr client_ptr, httpd::http_any_stream& stream,
+		boost::beast::http::request<boost::beast::http::string_body>& req, std::pmr::memory_resource* arena)
+	{
+		bool keep_alive = req.keep_alive();
+
+		if (req.method() != boost::beast::http::verb::post && req.method() != boost::beast::http::verb::put)
+		{
+			co_await http_simple_error_page(stream, "method not allowed", boost::beast::http::status::method_not_allowed, req.version());
+			co_return keep_alive;
+		}
+
+		// 用 Session cookie 认人. 没登录的也行, 上传归属于这个 session.
+		if (!client_ptr->session_info)
+		{
+			co_await http_simple_error_page(stream, "session required", boost::beast::http::status::unauthorized, req.version());
+			co_return keep_alive;
+		}
+
+		if (req.body().empty())
+		{
+			co_await http_simple_error_page(stream, "empty body", boost::beast::http::status::bad_request, req.version());
+			co_return keep_alive;
+		}
+
+		// http/1.1 读 body 前已经按这个限制过了, h2 的请求在这里检查.
+		std::size_t max_size = client_ptr->session_info->user_info ? m_config.upload_max_size_ : m_config.anonymous_upload_max_size_;
+		if (req.body().size() > max_size)
+		{
+			co_await http_simple_error_page(stream, "body too large", boost::beast::http::status::payload_too_large, req.version());
+			co_return keep_alive;
+		}
+
+		// body 整个移交过去, 不复制.
+		std::size_t size = req.body().size();
+		std::string upload_id = co_await put_upload(*client_ptr->session_info, std::move(req.body()));
+		if (upload_id.empty())
+		{
+			co_await http_simple_error_page(stream, "upload storage full", boost::beast::http::status::service_unavailable, req.version());
+			co_return keep_alive;
+		}
+
+		boost::json::object reply = {
+			{ "upload_id", upload_id },
+			{ "size", size },
+		};
+
+		httpd::response_fields headers{ arena };
+		headers.set(boost::beast::http::field::content_type, "application/json");
+		headers.set(boost::beast::http::field::cache_control, "no-store");
+
+		auto ec = co_await httpd::send_string_response_body(stream,
+			boost::json::serialize(reply),
+			std::move(headers),
+			req.version(),
+			keep_alive);
+		if (ec)
+			throw boost::system::system_error(ec);
+		co_return keep_alive;
 	}
 
 	awaitable<void> cmall_service::client_disconnected(client_connection_ptr c)
 	{
-		std::unique_lock<std::shared_mutex> l(active_users);
-		active_users.get<1>().erase(c->connection_id_);
+		{
+			std::unique_lock<std::shared_mutex> l(active_users);
+			active_users.get<1>().erase(c->connection_id_);
+		}
+		{
+			std::unique_lock<std::shared_mutex> l(catalog_subscribers);
+			c->disconnected_ = true;
+			catalog_subscribers.get<tag::connection_id_tag>().erase(c->connection_id_);
+		}
 		co_return;
 	}
 }
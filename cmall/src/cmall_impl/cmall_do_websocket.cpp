@@ -5,131 +5,304 @@
 
 #include "cmall/conversion.hpp"
 #include "httpd/http_misc_helper.hpp"
+#include "httpd/coalescing_stream.hpp"
+#include "httpd/binary_json.hpp"
+#include "httpd/ws_loop.hpp"
 #include "services/search_service.hpp"
 
-awaitable<void> cmall::cmall_service::do_ws_read(size_t connection_id, client_connection_ptr connection_ptr)
+// 按连接协商的编码序列化发给客户端的消息.
+static std::string encode_ws_message(const cmall::client_connection& client, const boost::json::object& message)
 {
+	if (client.ws_client->binary_format)
+	{
+		std::string out;
+		httpd::binary_json::encode(*client.ws_client->binary_format, message, out);
+		return out;
+	}
+	return jsutil::json_to_string(message);
+}
+
+// 批量请求的应答是数组.
+static std::string encode_ws_message(const cmall::client_connection& client, const boost::json::array& message)
+{
+	if (client.ws_client->binary_format)
+	{
+		std::string out;
+		httpd::binary_json::encode(*client.ws_client->binary_format, message, out);
+		return out;
+	}
+	return boost::json::serialize(message) + "\n";
+}
+
+// 格式不对的请求的应答.
+static boost::json::object invalid_request_reply(const boost::json::value& request)
+{
+	boost::json::object reply_message;
+	if (request.is_object())
+	{
+		if (auto id = request.get_object().if_contains("id"))
+			reply_message["id"] = *id;
+	}
+	reply_message["error"] = { { "code", -32600 }, { "message", "Invalid Request" } };
+	return reply_message;
+}
+
+// 格式正确但没有 id 的请求是通知, 不回应答. 格式不对的照样回错误.
+static bool is_notification(const boost::json::value& request)
+{
+	auto maybe_req = boost::json::value_to<maybe_jsonrpc_request_t>(request);
+	return maybe_req && maybe_req->id == nullptr;
+}
+
+// 批的应答里去掉留给通知的 null.
+static void drop_notification_slots(boost::json::array& replies)
+{
+	replies.erase(std::remove_if(replies.begin(), replies.end(), [](const boost::json::value& v) { return v.is_null(); }), replies.end());
+}
+
+// 在连接的 executor 上启动一个请求处理协程. 连接关闭时能取消它, 结束后归还占用的额度.
+template <typename Task>
+static void spawn_rpc_task(cmall::client_connection_ptr connection_ptr, std::size_t cost, Task task)
+{
+	auto cancel_signal = std::make_shared<boost::asio::cancellation_signal>();
+	auto last_processed_req_id = connection_ptr->last_processed_req_id ++;
+
+	connection_ptr->cancel_signals_.emplace(last_processed_req_id, cancel_signal);
+
+	boost::asio::post(connection_ptr->get_executor(), [cancel_signal, last_processed_req_id, connection_ptr, cost, task = std::move(task)]() mutable
+	{
+		boost::asio::co_spawn(
+			connection_ptr->get_executor(),
+			std::move(task),
+			boost::asio::bind_cancellation_slot(cancel_signal->slot(), [last_processed_req_id, connection_ptr, cost](std::exception_ptr)
+			{
+				connection_ptr->cancel_signals_.erase(last_processed_req_id);
+				connection_ptr->ws_client->inflight.release(cost);
+			})
+		);
+	});
+}
+
+template <typename WsStream>
+awaitable<void> cmall::cmall_service::do_ws_read(size_t connection_id, client_connection_ptr connection_ptr, WsStream& ws)
+{
+	// 读缓冲在整个连接上复用.
+	// 上限由 --ws_max_message_size 设置, 大的图片走 /api/upload.
+	boost::beast::flat_buffer buffer{ m_config.ws_max_message_size_ };
+
+	auto binary_format = connection_ptr->ws_client->binary_format;
+
 	for (;;)
 	{
-		boost::beast::multi_buffer buffer{ 6 * 1024 * 1024 }; // max multi_buffer size 6M.
-		co_await connection_ptr->ws_client->ws_stream_.async_read(buffer, use_awaitable);
+		co_await ws.async_read(buffer, use_awaitable);
 
-		auto body = boost::beast::buffers_to_string(buffer.data());
+		// 每条消息的 json 放在它自己的 monotonic arena 里, 按消息大小预留第一块.
+		// arena 是引用计数的, 跟着 json 一起交给处理请求的协程, 请求处理完整块释放.
+		auto arena = boost::json::make_shared_resource<boost::json::monotonic_resource>(buffer.size() * 2 + 256);
 
+		boost::json::value jv;
 		boost::system::error_code ec;
-		auto jv = boost::json::parse(body, ec, {}, { 64, false, false, true });
+		std::string_view data(static_cast<const char*>(buffer.data().data()), buffer.size());
+		if (binary_format)
+		{
+			// 二进制子协议直接解码成 json, 后面的处理和文本一样.
+			jv = httpd::binary_json::decode(*binary_format, data, ec, arena);
+		}
+		else
+		{
+			jv = httpd::parse_json_message(data, ec, arena);
+		}
+
+		httpd::recycle_read_buffer(buffer);
 
-		if (ec || !jv.is_object())
+		if (ec)
 		{
 			// 这里直接　co_return, 连接会关闭. 因为用户发来的数据连 json 都不是.
 			// 对这种垃圾客户端，直接暴力断开不搭理.
 			co_return;
 		}
 
+		// 批量请求: 各项各自占额度并发处理, 应答收齐后放在一个数组里一次发回去.
+		if (jv.is_array())
+		{
+			co_await handle_jsonrpc_batch(connection_ptr, std::move(jv));
+			continue;
+		}
+
+		if (!jv.is_object())
+			co_return;
+
 		maybe_jsonrpc_request_t maybe_req = boost::json::value_to<maybe_jsonrpc_request_t>(jv);
 		if (!maybe_req.has_value())
 		{
 			// 格式不对.
-			boost::json::object reply_message;
-			if (jv.as_object().contains("id"))
-				reply_message["id"] = jv.at("id");
-			reply_message["error"] = { { "code", -32600 }, { "message", "Invalid Request" } };
-			co_await websocket_write(connection_ptr, jsutil::json_to_string(reply_message))(use_awaitable);
+			co_await websocket_write(connection_ptr, encode_ws_message(*connection_ptr, invalid_request_reply(jv)))(use_awaitable);
 			continue;
 		}
 
-		auto req	= maybe_req.value();
-		auto method = req.method;
-		auto params = req.params;
-
 		client_connection& this_client = *connection_ptr;
 
 		if (!this_client.session_info)
 		{
-			if (method != "recover_session")
+			if (maybe_req->method != "recover_session")
 			{
 				throw boost::system::system_error(cmall::error::session_needed);
 			}
-			boost::json::object replay_message;
 			// 未有 session 前， 先不并发处理 request，避免 客户端恶意并发 recover_session 把程序挂掉
-			try
-			{
-				replay_message = co_await handle_jsonrpc_call(connection_ptr, method, params);
-			}
-			catch (boost::system::system_error& e)
-			{
-				replay_message["error"] = { { "code", e.code().value() }, { "message", e.code().message() } };
-			}
-			catch (std::exception& e)
-			{
-				LOG_ERR << e.what();
-				replay_message["error"] = { { "code", 502 }, { "message", "internal server error" } };
-			}
-			if (jv.as_object().contains("id"))
-				replay_message.insert_or_assign("id", jv.at("id"));
-			co_await websocket_write(connection_ptr, jsutil::json_to_string(replay_message))(use_awaitable);
+			auto replay_message = co_await handle_jsonrpc_request(connection_ptr, jv);
+			co_await websocket_write(connection_ptr, encode_ws_message(*connection_ptr, replay_message))(use_awaitable);
 			continue;
 		}
 
-		auto cancel_signal = std::make_shared<boost::asio::cancellation_signal>();
-		auto last_processed_req_id = connection_ptr->last_processed_req_id ++;
-
-		connection_ptr->cancel_signals_.emplace(last_processed_req_id, cancel_signal);
+		// 额度用完时在这里等, 不再读新消息.
+		auto& inflight = this_client.ws_client->inflight;
+		auto cost = inflight.clamp(rpc_cost(maybe_req->method));
+		co_await inflight.async_acquire(cost);
 
-		// 每个请求都单开线程处理
-		boost::asio::post(connection_ptr->get_executor(), [this, cancel_signal, last_processed_req_id, connection_ptr, method, params, jv]() mutable
+		// 每个请求都单开线程处理. json 整个移交过去, method 和 params 都直接引用它, 不再拷贝.
+		spawn_rpc_task(connection_ptr, cost, [this, connection_ptr, jv = std::move(jv)]() -> awaitable<void>
 		{
-			boost::asio::co_spawn(
-				connection_ptr->get_executor(),
-				[this, connection_ptr, method, params, jv]() -> awaitable<void>
-				{
-					boost::json::object replay_message;
-					try
-					{
-						replay_message = co_await handle_jsonrpc_call(connection_ptr, method, params);
-					}
-					catch (boost::system::system_error& e)
-					{
-						replay_message["error"] = { { "code", e.code().value() }, { "message", e.code().message() } };
-					}
-					catch (std::exception& e)
-					{
-						LOG_ERR << e.what();
-						replay_message["error"] = { { "code", 502 }, { "message", "internal server error" } };
-					}
-					// 每个请求都单开线程处理, 因此客户端收到的应答是乱序的,
-					// 这就是 jsonrpc 里 id 字段的重要意义.
-					// 将 id 字段原原本本的还回去, 客户端就可以根据 返回的 id 找到原来发的请求
-					if (jv.as_object().contains("id"))
-						replay_message.insert_or_assign("id", jv.at("id"));
-					co_await websocket_write(connection_ptr, jsutil::json_to_string(replay_message));
-				},
-				boost::asio::bind_cancellation_slot(cancel_signal->slot(), [last_processed_req_id, connection_ptr](std::exception_ptr)
-				{
-					connection_ptr->cancel_signals_.erase(last_processed_req_id);
-				})
-			);
+			// 每个请求都单开线程处理, 因此客户端收到的应答是乱序的,
+			// 这就是 jsonrpc 里 id 字段的重要意义.
+			// 将 id 字段原原本本的还回去, 客户端就可以根据 返回的 id 找到原来发的请求
+			auto replay_message = co_await handle_jsonrpc_request(connection_ptr, jv);
+			co_await websocket_write(connection_ptr, encode_ws_message(*connection_ptr, replay_message));
 		});
 	}
 }
 
-awaitable<void> cmall::cmall_service::do_ws_write(size_t connection_id, client_connection_ptr connection_ptr)
+awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_request(client_connection_ptr connection_ptr, const boost::json::value& request)
 {
-	auto& message_deque = connection_ptr->ws_client->message_channel;
-	auto& ws			= connection_ptr->ws_client->ws_stream_;
+	maybe_jsonrpc_request_t maybe_req = boost::json::value_to<maybe_jsonrpc_request_t>(request);
+	if (!maybe_req.has_value())
+		co_return invalid_request_reply(request);
 
-	using namespace boost::asio::experimental::awaitable_operators;
+	auto& req = *maybe_req;
+	boost::json::object replay_message;
+	try
+	{
+		replay_message = co_await handle_jsonrpc_call(connection_ptr, req.method, *req.params);
+	}
+	catch (boost::system::system_error& e)
+	{
+		replay_message["error"] = { { "code", e.code().value() }, { "message", e.code().message() } };
+	}
+	catch (std::exception& e)
+	{
+		LOG_ERR << e.what();
+		replay_message["error"] = { { "code", 502 }, { "message", "internal server error" } };
+	}
+	if (req.id)
+		replay_message.insert_or_assign("id", *req.id);
+	co_return replay_message;
+}
 
-	for (;;)
+awaitable<void> cmall::cmall_service::handle_jsonrpc_batch(client_connection_ptr connection_ptr, boost::json::value batch)
+{
+	// 一批最多这么多项, 超过的整批拒绝.
+	constexpr std::size_t max_batch_size = 64;
+
+	auto count = batch.get_array().size();
+	if (count == 0 || count > max_batch_size)
 	{
-		std::string message = co_await message_deque.async_receive(use_awaitable);
+		co_await websocket_write(connection_ptr, encode_ws_message(*connection_ptr, invalid_request_reply(batch)))(use_awaitable);
+		co_return;
+	}
 
-		if (message.empty())
-			co_return;
-		co_await ws.async_write(boost::asio::buffer(message), use_awaitable);
+	// 应答按请求的顺序放, 全部处理完后一起发. 通知 (没有 id 的请求) 不回应答, 位置上留 null,
+	// 发之前去掉; 整批都是通知的话什么都不发.
+	struct batch_state
+	{
+		boost::json::value batch;
+		boost::json::array replies;
+		std::size_t pending;
+	};
+	auto state = std::make_shared<batch_state>(std::move(batch), boost::json::array(count), count);
+	const auto& items = state->batch.get_array();
+
+	if (!connection_ptr->session_info)
+	{
+		// 未有 session 前不并发, 按顺序处理. 批里第一项 recover_session 之后, 后面的请求就能用了.
+		for (std::size_t i = 0; i < count; i++)
+		{
+			auto reply = co_await handle_jsonrpc_request(connection_ptr, items[i]);
+			if (!is_notification(items[i]))
+				state->replies[i] = std::move(reply);
+		}
+		drop_notification_slots(state->replies);
+		if (!state->replies.empty())
+			co_await websocket_write(connection_ptr, encode_ws_message(*connection_ptr, state->replies))(use_awaitable);
+		co_return;
+	}
+
+	auto finish_one = [connection_ptr](batch_state& s)
+	{
+		if (--s.pending != 0)
+			return;
+		drop_notification_slots(s.replies);
+		if (!s.replies.empty())
+			connection_ptr->ws_client->send_queue.push(encode_ws_message(*connection_ptr, s.replies));
+	};
+
+	auto& inflight = connection_ptr->ws_client->inflight;
+	for (std::size_t i = 0; i < count; i++)
+	{
+		maybe_jsonrpc_request_t maybe_req = boost::json::value_to<maybe_jsonrpc_request_t>(items[i]);
+		if (!maybe_req.has_value())
+		{
+			state->replies[i] = invalid_request_reply(items[i]);
+			finish_one(*state);
+			continue;
+		}
+
+		// 和单个请求一样占额度, 额度不够时等前面的 (包括同一批里的) 请求处理完.
+		auto cost = inflight.clamp(rpc_cost(maybe_req->method));
+		co_await inflight.async_acquire(cost);
+
+		bool notification = maybe_req->id == nullptr;
+		spawn_rpc_task(connection_ptr, cost, [this, connection_ptr, state, i, notification, finish_one]() -> awaitable<void>
+		{
+			auto reply = co_await handle_jsonrpc_request(connection_ptr, state->batch.get_array()[i]);
+			if (!notification)
+				state->replies[i] = std::move(reply);
+			finish_one(*state);
+		});
 	}
 }
 
+template <typename WsStream>
+awaitable<void> cmall::cmall_service::do_ws_write(size_t connection_id, client_connection_ptr connection_ptr, WsStream& ws)
+{
+	auto& queue = connection_ptr->ws_client->send_queue;
+	co_await httpd::ws_write_loop(ws, queue);
+
+	if (queue.overflowed())
+	{
+		// 客户端收得太慢, 积压超过了水位线. 告诉它稍后重连, 不等它回应.
+		LOG_WARN << "ws client [" << connection_id << "] send queue overflow, disconnecting";
+		boost::system::error_code ec;
+		co_await ws.async_close(boost::beast::websocket::close_code::try_again_later, boost::asio::redirect_error(use_awaitable, ec));
+	}
+	else if (auto close_code = queue.close_code())
+	{
+		// 进程在交接, 排队的消息已经发完. 告诉客户端是服务重启, 重连会连到新进程.
+		boost::system::error_code ec;
+		co_await ws.async_close(close_code, boost::asio::redirect_error(use_awaitable, ec));
+	}
+}
+
+// serve_http1 按每种连接 stream 实例化 websocket 的读写协程.
+#define CMALL_INSTANTIATE_WS_LOOPS(Stream) \
+	template awaitable<void> cmall::cmall_service::do_ws_read(size_t, client_connection_ptr, boost::beast::websocket::stream<httpd::write_coalescing_stream<Stream&>>&); \
+	template awaitable<void> cmall::cmall_service::do_ws_write(size_t, client_connection_ptr, boost::beast::websocket::stream<httpd::write_coalescing_stream<Stream&>>&);
+
+CMALL_INSTANTIATE_WS_LOOPS(boost::beast::tcp_stream)
+CMALL_INSTANTIATE_WS_LOOPS(boost::beast::ssl_stream<boost::beast::tcp_stream>)
+CMALL_INSTANTIATE_WS_LOOPS(httpd::unix_stream)
+CMALL_INSTANTIATE_WS_LOOPS(httpd::ktls_stream)
+
+#undef CMALL_INSTANTIATE_WS_LOOPS
+
 promise<void(std::exception_ptr)> cmall::cmall_service::websocket_write(client_connection_ptr clientptr, std::string message)
 {
 	// 本来 co_await co_spawn 就好，但是 gcc 上有 bug, 会崩
@@ -143,7 +316,8 @@ promise<void(std::exception_ptr)> cmall::cmall_service::websocket_write(client_c
 			clientptr->get_executor(),
 			[clientptr, message = std::move(message)]() mutable -> awaitable<void>
 			{
-				clientptr->ws_client->message_channel.try_send(boost::system::error_code(), message);
+				// 积压超过水位线时按配置丢弃旧消息或者断开连接, 不会阻塞发送方.
+				clientptr->ws_client->send_queue.push(std::move(message));
 				co_return;
 			},
 			use_promise);
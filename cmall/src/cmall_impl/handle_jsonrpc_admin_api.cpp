@@ -9,7 +9,7 @@
 #include "cmall/conversion.hpp"
 #include "utils/coroyield.hpp"
 
-awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_admin_api(client_connection_ptr connection_ptr, const req_method method, boost::json::object params)
+awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_admin_api(client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
 {
     client_connection& this_client = *connection_ptr;
     boost::json::object reply_message;
@@ -406,6 +406,59 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_admin_api(cl
             // TODO 配置分账功能.
         }
         break;
+        case req_method::admin_server_stats:
+        {
+            auto tls = tls_session_manager_.stats();
+            auto admission = admission_control_.stats();
+            auto ws_send = ws_send_counters_.stats();
+
+            boost::json::value notify_bus;
+            if (notify_bus_)
+            {
+                auto bus = notify_bus_->stats();
+                notify_bus = {
+                    { "connected", bus.connected },
+                    { "published", bus.published },
+                    { "received", bus.received },
+                    { "dropped", bus.dropped },
+                    { "reconnects", bus.reconnects },
+                };
+            }
+
+            boost::json::array io_contexts;
+            for (auto& l : m_io_context_pool.load())
+                io_contexts.push_back({ { "connections", l.connections }, { "busy", l.busy } });
+
+            reply_message["result"] = {
+                { "tls", {
+                    { "full_handshakes", tls.full_handshakes },
+                    { "resumed_handshakes", tls.resumed_handshakes },
+                    { "ticket_key_rotations", tls.ticket_key_rotations },
+                } },
+                { "admission", {
+                    { "live_connections", admission.live_connections },
+                    { "admitted", admission.admitted },
+                    { "rejected_global", admission.rejected_global },
+                    { "rejected_per_ip", admission.rejected_per_ip },
+                    { "rejected_overload", admission.rejected_overload },
+                    { "accept_pauses", admission.accept_pauses },
+                    { "pending_work", m_database.pending_ops() + services::merchant_git_repo::pending_ops() },
+                } },
+                { "ws_send", {
+                    { "queued_messages", ws_send.queued_messages },
+                    { "sent_messages", ws_send.sent_messages },
+                    { "coalesced_writes", ws_send.coalesced_writes },
+                    { "dropped_messages", ws_send.dropped_messages },
+                    { "dropped_bytes", ws_send.dropped_bytes },
+                    { "overflow_disconnects", ws_send.overflow_disconnects },
+                } },
+                { "rpc", rpc_stats_.to_json() },
+                { "notify_bus", notify_bus },
+                { "io_backend", httpd::socket_io_backend() },
+                { "io_contexts", io_contexts },
+            };
+        }
+        break;
         default:
             throw "this should never be executed";
     }
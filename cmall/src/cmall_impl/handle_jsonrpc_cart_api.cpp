@@ -7,7 +7,7 @@
 #include "services/merchant_git_repo.hpp"
 #include "cmall/conversion.hpp"
 
-awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_cart_api(client_connection_ptr connection_ptr, const req_method method, boost::json::object params)
+awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_cart_api(client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
 {
     client_connection& this_client = *connection_ptr;
     boost::json::object reply_message;
@@ -26,7 +26,7 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_cart_api(cli
                 throw boost::system::system_error(cmall::error::invalid_params);
 
             if (params.contains("selection"))
-                selections = params["selection"].as_array();
+                selections = params.at("selection").as_array();
 
             std::string selection_string;
             for (auto s : selections)
@@ -36,27 +36,39 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_cart_api(cli
             using query_t = odb::query<cmall_cart>;
             auto query(query_t::uid == this_user.uid_ && query_t::merchant_id == merchant_id
                 && query_t::goods_id == goods_id && query_t::selection == selection_string);
-            if (co_await m_database.async_load<cmall_cart>(query, item))
+            auto version = co_await cart_mutate(this_user.uid_, [&](odb::database& db)
             {
-                item.count_ += 1;
-                co_await m_database.async_update(item);
-            }
-            else
-            {
-                item.uid_		  = this_user.uid_;
-                item.merchant_id_ = merchant_id;
-                item.goods_id_	  = goods_id;
-                item.count_		  = 1;
-                item.selection    = selection_string;
-
-                co_await m_database.async_add(item);
-            }
+                auto r = db.query<cmall_cart>(query);
+                if (!r.empty())
+                {
+                    item = *r.begin();
+                    item.count_ += 1;
+                    item.updated_at_ = boost::posix_time::second_clock::local_time();
+                    db.update(item);
+                }
+                else
+                {
+                    item = cmall_cart{};
+                    item.uid_		  = this_user.uid_;
+                    item.merchant_id_ = merchant_id;
+                    item.goods_id_	  = goods_id;
+                    item.count_		  = 1;
+                    item.selection    = selection_string;
+
+                    db.persist(item);
+                }
+                return true;
+            });
+            if (!version)
+                throw boost::system::system_error(cmall::error::internal_server_error);
             reply_message["result"] = true;
 
-            co_await send_notify_message(this_user.uid_,
-                std::format(R"---({{"topic":"cart_changed", "session_id": "{}"}})---",
-                    this_client.session_info->session_id),
-                this_client.connection_id_);
+            // 推送的条目和 cart_list 里的格式一样, 客户端按 item_id 整条替换.
+            cmall_merchant merchant;
+            if (co_await m_database.async_load<cmall_merchant>(item.merchant_id_, merchant))
+                item.merchant_name_ = merchant.name_;
+            auto delta = boost::json::value_from(item).as_object();
+            co_await notify_cart_changed(this_client, std::string_view("add"), std::move(delta), *version);
         }
         break;
         case req_method::cart_mod: // 修改数量.
@@ -67,27 +79,30 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_cart_api(cli
                 throw boost::system::system_error(cmall::error::invalid_params);
 
             cmall_cart item;
-            bool ok = co_await m_database.async_load(item_id, item);
-            if (!ok)
+            bool found = false, owned = false;
+            auto version = co_await cart_mutate(this_user.uid_, [&](odb::database& db)
             {
+                found = db.find<cmall_cart>(item_id, item);
+                owned = found && item.uid_ == this_user.uid_;
+                if (!owned)
+                    return false;
+                item.count_ = count;
+                item.updated_at_ = boost::posix_time::second_clock::local_time();
+                db.update(item);
+                return true;
+            });
+            if (!found)
                 throw boost::system::system_error(cmall::error::cart_goods_not_found);
-            }
-            if (item.uid_ != this_user.uid_)
-            {
+            if (!owned)
                 throw boost::system::system_error(cmall::error::invalid_params);
-            }
-
-            co_await m_database.async_update<cmall_cart>(item_id,
-                [count](cmall_cart&& old) mutable
-                {
-                    old.count_ = count;
-                    return old;
-                });
+            if (!version)
+                throw boost::system::system_error(cmall::error::internal_server_error);
             reply_message["result"] = true;
-            co_await send_notify_message(this_user.uid_,
-                std::format(R"---({{"topic":"cart_changed", "session_id": "{}"}})---",
-                    this_client.session_info->session_id),
-                this_client.connection_id_);
+            cmall_merchant merchant;
+            if (co_await m_database.async_load<cmall_merchant>(item.merchant_id_, merchant))
+                item.merchant_name_ = merchant.name_;
+            auto delta = boost::json::value_from(item).as_object();
+            co_await notify_cart_changed(this_client, std::string_view("mod"), std::move(delta), *version);
         }
         break;
         case req_method::cart_del: // 从购物车删除.
@@ -97,28 +112,35 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_cart_api(cli
                 throw boost::system::system_error(cmall::error::invalid_params);
 
             cmall_cart item;
-            bool ok = co_await m_database.async_load(item_id, item);
-            if (!ok)
+            bool found = false, owned = false;
+            auto version = co_await cart_mutate(this_user.uid_, [&](odb::database& db)
             {
+                found = db.find<cmall_cart>(item_id, item);
+                owned = found && item.uid_ == this_user.uid_;
+                if (!owned)
+                    return false;
+                db.erase<cmall_cart>(item_id);
+                return true;
+            });
+            if (!found)
                 throw boost::system::system_error(cmall::error::cart_goods_not_found);
-            }
-            if (item.uid_ != this_user.uid_)
-            {
+            if (!owned)
                 throw boost::system::system_error(cmall::error::invalid_params);
-            }
-
-            co_await m_database.async_hard_remove<cmall_cart>(item_id);
+            if (!version)
+                throw boost::system::system_error(cmall::error::internal_server_error);
             reply_message["result"] = true;
-            co_await send_notify_message(this_user.uid_,
-                std::format(R"---({{"topic":"cart_changed", "session_id": "{}"}})---",
-                    this_client.session_info->session_id),
-                this_client.connection_id_);
+            boost::json::object delta = { { "item_id", item.id_ } };
+            co_await notify_cart_changed(this_client, std::string_view("del"), std::move(delta), *version);
         }
         break;
         case req_method::cart_list: // 查看购物车列表.
         {
             auto page	   = jsutil::json_accessor(params).get("page", 0).as_int64();
             auto page_size = jsutil::json_accessor(params).get("page_size", 20).as_int64();
+            auto with_version = jsutil::json_accessor(params).get("with_version", false).as_bool();
+
+            // 先取版本号再查表, 查表期间的改动客户端会再收到一次推送, 按 item_id 替换是幂等的.
+            auto version = co_await cart_version(this_user.uid_);
 
             std::map<std::uint64_t, cmall_merchant> cache;
 
@@ -148,11 +170,36 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_cart_api(cli
 
             if (!vanished_merchant_ids.empty())
             {
+                std::erase_if(items, [&](const cmall_cart& cc) { return vanished_merchant_ids.contains(cc.merchant_id_); });
+
+                // 商户没了, 删掉它在本用户购物车里的条目. 和 cart_del 一样一条一条走 cart_mutate,
+                // 每条版本号加一并推送 del (本连接也会收到), 按增量维护购物车的客户端不会漏.
                 for (auto merchant_id : vanished_merchant_ids)
-                    co_await m_database.async_erase<cmall_cart>(query_t::merchant_id == merchant_id);
+                {
+                    std::vector<cmall_cart> gone;
+                    auto gone_query = query_t::uid == this_user.uid_ && query_t::merchant_id == merchant_id;
+                    co_await m_database.async_load<cmall_cart>(gone_query, gone);
+
+                    for (auto& g : gone)
+                    {
+                        auto gone_id = g.id_;
+                        auto erase_version = co_await cart_mutate(this_user.uid_, [&](odb::database& db)
+                        {
+                            // 可能已经被并发的 cart_del 删了.
+                            return db.erase_query<cmall_cart>(query_t::id == gone_id && query_t::uid == this_user.uid_) > 0;
+                        });
+                        if (!erase_version)
+                            continue;
+                        boost::json::object delta = { { "item_id", gone_id } };
+                        co_await notify_cart_changed(this_client, std::string_view("del"), std::move(delta), *erase_version);
+                    }
+                }
             }
 
-            reply_message["result"] = boost::json::value_from(items);
+            if (with_version)
+                reply_message["result"] = { { "items", boost::json::value_from(items) }, { "version", version } };
+            else
+                reply_message["result"] = boost::json::value_from(items);
         }
         break;
         default:
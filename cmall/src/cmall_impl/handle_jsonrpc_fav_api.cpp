@@ -7,7 +7,7 @@
 #include "services/merchant_git_repo.hpp"
 #include "cmall/conversion.hpp"
 
-awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_fav_api(client_connection_ptr connection_ptr, const req_method method, boost::json::object params)
+awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_fav_api(client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
 {
     client_connection& this_client = *connection_ptr;
     boost::json::object reply_message;
@@ -10,7 +10,7 @@
 #include "services/search_service.hpp"
 
 awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_goods_api(
-	client_connection_ptr connection_ptr, const req_method method, boost::json::object params)
+	client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
 {
 	client_connection& this_client = *connection_ptr;
 	boost::json::object reply_message;
@@ -140,6 +140,44 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_goods_api(
 			reply_message["result"] = index_md;
 		}
 		break;
+		case req_method::subscribe_merchant:
+		{
+			auto merchant_id = jsutil::json_accessor(params).get("merchant_id", -1).as_int64();
+			boost::system::error_code ec;
+			if (!get_merchant_git_repo(merchant_id, ec))
+				throw boost::system::system_error(cmall::error::merchant_vanished);
+
+			std::unique_lock<std::shared_mutex> l(catalog_subscribers);
+			auto& by_connection = catalog_subscribers.get<tag::connection_id_tag>();
+			auto [first, last] = by_connection.equal_range(this_client.connection_id_);
+			// 连接已经断开 (client_disconnected 已经清理过) 的话不再插入, 否则这条订阅就没人删了.
+			if (!this_client.disconnected_ && std::none_of(first, last, [&](const catalog_subscription& s) { return s.merchant_id == static_cast<std::uint64_t>(merchant_id); }))
+			{
+				// 一个连接能订阅的商户数有上限, 免得一个连接占满订阅表.
+				if (std::distance(first, last) >= 64)
+					throw boost::system::system_error(cmall::error::too_many_subscriptions);
+				catalog_subscribers.insert({ static_cast<std::uint64_t>(merchant_id), this_client.connection_id_, connection_ptr });
+			}
+			reply_message["result"] = true;
+		}
+		break;
+		case req_method::unsubscribe_merchant:
+		{
+			auto merchant_id = jsutil::json_accessor(params).get("merchant_id", -1).as_int64();
+
+			std::unique_lock<std::shared_mutex> l(catalog_subscribers);
+			auto& by_connection = catalog_subscribers.get<tag::connection_id_tag>();
+			auto [first, last] = by_connection.equal_range(this_client.connection_id_);
+			for (auto it = first; it != last;)
+			{
+				if (it->merchant_id == static_cast<std::uint64_t>(merchant_id))
+					it = by_connection.erase(it);
+				else
+					++it;
+			}
+			reply_message["result"] = true;
+		}
+		break;
 		default:
 			throw "this should never be executed";
 	}
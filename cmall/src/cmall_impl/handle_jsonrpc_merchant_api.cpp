@@ -9,7 +9,7 @@
 #include "services/merchant_git_repo.hpp"
 #include "cmall/conversion.hpp"
 
-awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_merchant_api(client_connection_ptr connection_ptr, const req_method method, boost::json::object params)
+awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_merchant_api(client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
 {
     boost::json::object reply_message;
     client_connection& this_client         = *connection_ptr;
@@ -182,6 +182,8 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_merchant_api
                 orders[0].kuaidi.push_back(kuaidi_info);
 
                 bool success = co_await m_database.async_update<cmall_order>(orders[0]);
+                if (success)
+                    co_await notify_order_event(order_event::shipped, orders[0]);
 
                 reply_message["result"] = success;
             }
@@ -264,8 +266,8 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_merchant_api
         }break;
         case req_method::merchant_user_kv_get:
         {
-			auto key_value = params["key_value"].as_string();
-			auto user_id = params["user_id"].as_int64();
+			auto key_value = params.at("key_value").as_string();
+			auto user_id = params.at("user_id").as_int64();
 			cmall_3rd_public_kv_store kv;
 			kv.key_.uid_ = user_id;
 			kv.key_.key_value_ = key_value;
@@ -311,11 +313,8 @@ awaitable<bool> cmall::cmall_service::order_check_payment(cmall_order& order, co
 
 awaitable<bool> cmall::cmall_service::order_mark_payed(cmall_order& order, const cmall_merchant& seller)
 {
-    order.payed_at_ = boost::posix_time::second_clock::local_time();
-
-    bool success = co_await m_database.async_update<cmall_order>(order);
-
-    if (success)
+    // 已经是已支付的不再推送, 也不再跑 orderstatus.js.
+    if (co_await order_record_payment(order, boost::posix_time::second_clock::local_time()))
     {
         boost::system::error_code ec;
         auto merchant_repo_ptr = get_merchant_git_repo(seller, ec);
@@ -328,10 +327,6 @@ awaitable<bool> cmall::cmall_service::order_mark_payed(cmall_order& order, const
                     script_runner.run_script(pay_script_content, {"--order-id", order.oid_}), boost::asio::detached);
             }
         }
-        co_return true;
-    }
-    else
-    {
-        throw boost::system::system_error(cmall::error::internal_server_error);
     }
+    co_return true;
 }
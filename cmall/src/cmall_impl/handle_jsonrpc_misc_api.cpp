@@ -6,7 +6,7 @@
 
 #include "cmall/conversion.hpp"
 
-awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_misc_api(client_connection_ptr connection_ptr, const req_method method, boost::json::object params)
+awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_misc_api(client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
 {
 	client_connection& this_client = *connection_ptr;
 	boost::json::object reply_message;
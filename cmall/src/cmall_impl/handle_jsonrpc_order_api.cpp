@@ -20,7 +20,7 @@ inline bool is_sigle_merchant_order(const cmall_order& order_to_pay)
 }
 
 awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_order_api(
-    client_connection_ptr connection_ptr, const req_method method, boost::json::object params)
+    client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
 {
     client_connection& this_client = *connection_ptr;
     boost::json::object reply_message;
@@ -141,7 +141,8 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_order_api(
             new_order.price_ = total_price;
             new_order.kuaidifei = total_kuaidifei;
 
-            co_await m_database.async_add(new_order);
+            if (co_await m_database.async_add(new_order))
+                co_await notify_order_event(order_event::created, new_order);
 
             reply_message["result"] = {
                 { "orderid", new_order.oid_ },
@@ -165,7 +166,40 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_order_api(
         }
         break;
         case req_method::order_close:
-            break;
+        {
+            auto orderid	   = jsutil::json_accessor(params).get_string("orderid");
+
+            // 锁住订单再检查和修改, 免得和支付回调交错, 把刚付的钱又写回未支付.
+            using query_t = odb::query<cmall_order>;
+            auto query	  = (query_t::oid == orderid && query_t::buyer == this_user.uid_ && query_t::deleted_at.is_null()) + " FOR UPDATE";
+
+            bool found = false, payed = false, closed = false;
+            cmall_order order;
+            auto now = boost::posix_time::second_clock::local_time();
+            bool ok = co_await m_database.async_update<cmall_order>(query, [&](cmall_order&& value) mutable
+            {
+                found = true;
+                payed = !value.payed_at_.null();
+                closed = !payed && value.close_at_.null();
+                if (closed)
+                    value.close_at_ = now;
+                order = value;
+                return value;
+            });
+
+            if (!ok)
+                throw boost::system::system_error(cmall::error::internal_server_error);
+            if (!found)
+                throw boost::system::system_error(cmall::error::order_not_found);
+            if (payed)
+                throw boost::system::system_error(cmall::error::order_already_payed);
+
+            // 只有这次真正关闭的才推送, 重复关闭不再推.
+            if (closed)
+                co_await notify_order_event(order_event::closed, order);
+            reply_message["result"] = true;
+        }
+        break;
         case req_method::order_list:
         {
             auto page	   = jsutil::json_accessor(params).get("page", 0).as_int64();
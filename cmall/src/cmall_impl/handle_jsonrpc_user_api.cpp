@@ -16,12 +16,28 @@ namespace
 }
 
 awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
-	client_connection_ptr connection_ptr, const req_method method, boost::json::object params)
+	client_connection_ptr connection_ptr, const req_method method, const boost::json::object& params)
 {
 	client_connection& this_client = *connection_ptr;
 	boost::json::object reply_message;
 	services::client_session& session_info = *this_client.session_info;
 
+	// 人脸接口的图片: image 是 base64 或者 URL, 大图片可以先 POST 到 /api/upload, 这里给 upload_id.
+	auto get_face_image = [&]() -> awaitable<std::string>
+	{
+		jsutil::json_accessor accessor(params);
+		std::string upload_id = accessor.get_string("upload_id");
+		if (upload_id.empty())
+			co_return accessor.get_string("image");
+
+		// 上传归属于 session, 匿名的 session 也能用自己传的.
+		auto data = co_await take_upload(session_info, upload_id);
+		if (!data)
+			throw boost::system::system_error(cmall::error::upload_not_found);
+		// 腾讯的接口只收 base64.
+		co_return base64_encode(*data);
+	};
+
 	auto handle_user_login = [&](std::string telephone) -> awaitable<void>
 	{
 		// SUCCESS.
@@ -243,7 +259,7 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
 			auto pname = std::to_string(uid);
 			auto pid = std::to_string(uid);
 
-			std::string image = jsutil::json_accessor(params).get_string("image");
+			std::string image = co_await get_face_image();
 
 			tencentsdk sdk(m_config.tencent_secret_id, m_config.tencent_secret_key);
 			// check if user in group
@@ -263,7 +279,7 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
 		break;
 		case req_method::user_search_by_face:
 		{
-			std::string image = jsutil::json_accessor(params).get_string("image");
+			std::string image = co_await get_face_image();
 
 			tencentsdk sdk(m_config.tencent_secret_id, m_config.tencent_secret_key);
 			std::string pid = co_await sdk.person_search_by_face(face_group_id, image);
@@ -300,9 +316,9 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
 			Recipient new_address;
 
 			// 这次这里获取不到就 throw 出去， 给客户端一点颜色 see see.
-			new_address.telephone = params["telephone"].as_string();
-			new_address.address	  = params["address"].as_string();
-			new_address.name	  = params["name"].as_string();
+			new_address.telephone = params.at("telephone").as_string();
+			new_address.address	  = params.at("address").as_string();
+			new_address.name	  = params.at("name").as_string();
 
 			cmall_user& user_info = *(session_info.user_info);
 			// 重新载入 user_info, 以便获取正确的收件人地址信息.
@@ -320,7 +336,7 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
 			break;
 		case req_method::user_erase_receipt_address:
 		{
-			auto recipient_id_to_remove = params["recipient_id"].as_int64();
+			auto recipient_id_to_remove = params.at("recipient_id").as_int64();
 			cmall_user& user_info		= *(session_info.user_info);
 
 			bool is_db_op_ok		= co_await m_database.async_update<cmall_user>(user_info.uid_,
@@ -356,8 +372,12 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
 		break;
 		case req_method::user_3rd_kv_put:
 		{
-			auto key_value = params["key_value"].as_string();
-			auto value = params["value"].as_string();
+			auto key_value = params.at("key_value").as_string();
+			auto value = params.at("value").as_string();
+
+			// cmall. 开头的键是 cmall 自己用的, 比如购物车版本号.
+			if (std::string_view(key_value).starts_with(reserved_kv_prefix))
+				throw boost::system::system_error(cmall::error::invalid_params);
 
 			cmall_3rd_kv_store kv;
 			kv.key_.uid_ = session_info.user_info->uid_;
@@ -369,7 +389,7 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
 		break;
 		case req_method::user_3rd_kv_get:
 		{
-			auto key_value = params["key_value"].as_string();
+			auto key_value = params.at("key_value").as_string();
 			cmall_3rd_kv_store kv;
 			kv.key_.uid_ = session_info.user_info->uid_;
 			kv.key_.key_value_ = key_value;
@@ -384,8 +404,8 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
 		break;
 		case req_method::user_3rd_kv_put_pubkey:
 		{
-			auto key_value = params["key_value"].as_string();
-			auto value = params["value"].as_string();
+			auto key_value = params.at("key_value").as_string();
+			auto value = params.at("value").as_string();
 
 			cmall_3rd_public_kv_store kv;
 			kv.key_.uid_ = session_info.user_info->uid_;
@@ -397,7 +417,7 @@ awaitable<boost::json::object> cmall::cmall_service::handle_jsonrpc_user_api(
 		break;
 		case req_method::user_3rd_kv_get_pubkey:
 		{
-			auto key_value = params["key_value"].as_string();
+			auto key_value = params.at("key_value").as_string();
 			cmall_3rd_public_kv_store kv;
 			kv.key_.uid_ = session_info.user_info->uid_;
 			kv.key_.key_value_ = key_value;
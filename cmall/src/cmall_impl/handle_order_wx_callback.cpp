@@ -27,10 +27,53 @@ awaitable<bool> cmall::cmall_service::handle_order_wx_callback(services::weixin:
     {
         if (msg.trade_state == services::weixin::pay_status::SUCCESS)
         {
-            payed_order.payed_at_ = msg.success_time;
-            co_return co_await m_database.async_update<cmall_order>(payed_order);
+            // 微信会重复回调, order_record_payment 只在第一次推送.
+            bool success = true;
+            try
+            {
+                co_await order_record_payment(payed_order, msg.success_time);
+            }
+            catch (boost::system::system_error&)
+            {
+                success = false;
+            }
+            co_return success;
         }
     }
 
     co_return false;
 }
+
+awaitable<bool> cmall::cmall_service::order_record_payment(cmall_order& order, boost::posix_time::ptime payed_at)
+{
+    // 锁住订单再检查和修改, 和 order_close 互斥.
+    using query_t = odb::query<cmall_order>;
+    auto query = (query_t::oid == order.oid_) + " FOR UPDATE";
+
+    bool found = false, changed = false, reopened = false;
+    cmall_order latest;
+    bool ok = co_await m_database.async_update<cmall_order>(query, [&](cmall_order&& value) mutable
+    {
+        found = true;
+        changed = value.payed_at_.null();
+        reopened = changed && !value.close_at_.null();
+        if (changed)
+        {
+            value.payed_at_ = payed_at;
+            // 钱已经收了, 关闭的订单重新打开, 由卖家发货或者退款.
+            value.close_at_.reset();
+        }
+        latest = value;
+        return value;
+    });
+
+    if (!ok || !found)
+        throw boost::system::system_error(cmall::error::internal_server_error);
+
+    order = latest;
+    if (reopened)
+        LOG_WARN << "order " << order.oid_ << " was paid after being closed, reopened";
+    if (changed)
+        co_await notify_order_event(order_event::paid, order);
+    co_return changed;
+}
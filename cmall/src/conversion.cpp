@@ -219,25 +219,23 @@ inline namespace conversion
 
 	maybe_jsonrpc_request_t tag_invoke(const value_to_tag<maybe_jsonrpc_request_t>&, const value& jv)
 	{
+		static const object empty_params;
+
 		if (!jv.is_object())
 			return {};
 
 		const auto& obj = jv.get_object();
 
-		if (!obj.contains("method") || !obj.at("method").is_string())
+		auto method = obj.if_contains("method");
+		if (!method || !method->is_string())
 			return {};
 
-		auto method = value_to<std::string>(obj.at("method"));
-
-		jsonrpc_request_t req{ .method = method, .id = {}, .params = {} };
-		if (obj.contains("id"))
-		{
-			req.id = obj.at("id");
-		}
+		jsonrpc_request_t req{ .method = method->get_string(), .id = obj.if_contains("id"), .params = &empty_params };
 
-		if (obj.contains("params") && obj.at("params").is_object())
+		auto params = obj.if_contains("params");
+		if (params && params->is_object())
 		{
-			req.params = obj.at("params").as_object();
+			req.params = &params->get_object();
 		}
 
 		return req;
@@ -82,6 +82,12 @@ std::string cmall::error::cmall_category::message(int ev) const
 			return (const char*) u8"需要选择商品子选项";
 		case good_option_invalid:
 			return (const char*) u8"商品子选项不正确";
+		case too_many_subscriptions:
+			return (const char*) u8"订阅的商户太多";
+		case order_already_payed:
+			return (const char*) u8"订单已支付";
+		case upload_not_found:
+			return (const char*) u8"上传的文件不存在或已过期";
 	}
 	return "error message";
 }
@@ -5,6 +5,7 @@
 #include "cmall/internal.hpp"
 
 #include "httpd/header_helper.hpp"
+#include "httpd/arena.hpp"
 #include "httpd/http_stream.hpp"
 #include "httpd/http_misc_helper.hpp"
 
@@ -17,7 +18,7 @@
 using boost::asio::awaitable;
 using boost::asio::use_awaitable;
 
-awaitable<int> cmall::http_handle_static_file(size_t connection_id, boost::beast::http::request<boost::beast::http::string_body>& req, httpd::http_any_stream& client)
+awaitable<int> cmall::http_handle_static_file(size_t connection_id, boost::beast::http::request<boost::beast::http::string_body>& req, httpd::http_any_stream& client, std::pmr::memory_resource* arena)
 {
 #ifdef EMBED_SITE
 	unzFile zip_file = ::unzOpen2_64("internel_bundled_exe", &exe_bundled_file_ops);
@@ -59,15 +60,18 @@ awaitable<int> cmall::http_handle_static_file(size_t connection_id, boost::beast
 
 	std::time_t target_file_modifined_time = httpd::dos2unixtime(target_file_info.dosDate);
 
-	using fields = boost::beast::http::fields;
+	using fields = httpd::response_fields;
 
-	using response = boost::beast::http::response<boost::beast::http::buffer_body>;
+	using response = boost::beast::http::response<boost::beast::http::buffer_body, fields>;
 
-	response res{ boost::beast::http::status::ok, req.version() };
+	char last_modified[httpd::http_date_length];
+	httpd::format_http_date(target_file_modifined_time, last_modified);
+
+	response res{ boost::beast::http::status::ok, req.version(), boost::beast::http::buffer_body::value_type{}, fields{ arena } };
 	res.set(boost::beast::http::field::server, HTTPD_VERSION_STRING);
-	res.set(boost::beast::http::field::expires, httpd::make_http_last_modified(std::time(0) + 60));
-	res.set(boost::beast::http::field::last_modified, httpd::make_http_last_modified(target_file_modifined_time));
-	res.set(boost::beast::http::field::content_type, httpd::get_mime_type_from_extension(std::filesystem::path(path).extension().string()));
+	res.set(boost::beast::http::field::expires, httpd::cached_http_date(std::time(0) + 60));
+	res.set(boost::beast::http::field::last_modified, std::string_view(last_modified, httpd::http_date_length));
+	res.set(boost::beast::http::field::content_type, httpd::get_mime_type_from_path(path));
 	res.keep_alive(req.keep_alive());
 
 	if (have_if_modified_since && (target_file_modifined_time <= if_modified_since))
@@ -75,7 +79,6 @@ awaitable<int> cmall::http_handle_static_file(size_t connection_id, boost::beast
 		// 返回 304
 		res.result(boost::beast::http::status::not_modified);
 
-		res.set(boost::beast::http::field::expires, httpd::make_http_last_modified(std::time(0) + 60));
 		boost::beast::http::response_serializer<boost::beast::http::buffer_body, fields> sr{ res };
 		res.body().data = nullptr;
 		res.body().more = false;
@@ -98,12 +101,32 @@ awaitable<int> cmall::http_handle_static_file(size_t connection_id, boost::beast
 		res.content_length(target_file_info.uncompressed_size);
 	}
 
-	res.body().data = nullptr;
-	res.body().more = true;
-
 	boost::system::error_code ec;
 	boost::beast::http::response_serializer<boost::beast::http::buffer_body, fields> sr{ res };
 
+	// 不需要解压的时候, 文件内容在内存里的 zip 中是连续的一整块, 直接整块发出去, 不经过中转 buffer.
+	// 对 kTLS 连接就是把这块内存直接交给内核加密发送.
+	if (method == 0 || (method == Z_DEFLATED && accept_deflate))
+	{
+		Res site = SITE();
+		ZPOS64_T offset = unzGetCurrentFileZStreamPos64(zip_file);
+		ZPOS64_T size = (method == 0) ? target_file_info.uncompressed_size : target_file_info.compressed_size;
+
+		if (offset + size <= site.size)
+		{
+			res.body().data = const_cast<char*>(site.data + offset);
+			res.body().size = size;
+			res.body().more = false;
+
+			co_await boost::beast::http::async_write(client, sr, use_awaitable);
+			unzCloseCurrentFile(zip_file);
+			co_return 200;
+		}
+	}
+
+	res.body().data = nullptr;
+	res.body().more = true;
+
 	co_await boost::beast::http::async_write_header(client, sr, use_awaitable);
 
 	char buffer[2048];
@@ -10,8 +10,14 @@
 #include "cmall/internal.hpp"
 #include "io_context_pool.hpp"
 
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
 io_context_pool::io_context_pool(std::size_t pool_size)
 	: next_io_context_(0)
+	, loads_(new load_state[pool_size])
 {
 	if (pool_size == 0)
 		throw std::runtime_error("io_context_pool size is 0");
@@ -37,7 +43,18 @@ void io_context_pool::run()
 	for (std::size_t i = 0; i < io_contexts_.size(); ++i)
 	{
         std::shared_ptr<std::thread> thread(new std::thread(
-			[this, i]() mutable { io_contexts_[i]->run();  }));
+			[this, i]() mutable
+			{
+#ifdef __linux__
+				clockid_t cid;
+				if (pthread_getcpuclockid(pthread_self(), &cid) == 0)
+				{
+					loads_[i].cpu_clock = static_cast<int>(cid);
+					loads_[i].has_cpu_clock.store(true, std::memory_order_release);
+				}
+#endif
+				io_contexts_[i]->run();
+			}));
 			set_thread_name(thread.get(), "round-robin io runner");
 		threads.push_back(thread);
 	}
@@ -60,10 +77,19 @@ void io_context_pool::stop()
 
 boost::asio::io_context& io_context_pool::get_io_context()
 {
-	// Use a round-robin scheme to choose the next io_context to use.
-	boost::asio::io_context& io_context = *io_contexts_[next_io_context_];
-	next_io_context_ = (next_io_context_ + 1) % io_contexts_.size();
-	return io_context;
+	if (io_contexts_.size() == 1)
+		return *io_contexts_[0];
+
+	sample_busy();
+
+	// power of two choices: 随机挑两个, 用负载低的那个.
+	thread_local std::minstd_rand rng(std::random_device{}());
+	std::size_t a = rng() % io_contexts_.size();
+	std::size_t b = rng() % (io_contexts_.size() - 1);
+	if (b >= a)
+		b++;
+
+	return *io_contexts_[load_score(b) < load_score(a) ? b : a];
 }
 
 boost::asio::io_context& io_context_pool::get_io_context(std::size_t index)
@@ -88,3 +114,219 @@ void io_context_pool::notify_fork(boost::asio::execution_context::fork_event eve
 	for (auto& io: io_contexts_)
 		io->notify_fork(event);
 }
+
+#ifdef __linux__
+
+// 解析 /sys 下 "0-3,8-11" 这样的 cpulist.
+static std::vector<int> parse_cpulist(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::vector<std::string> ranges;
+	boost::split(ranges, boost::trim_copy(list), boost::is_any_of(","), boost::token_compress_on);
+	for (auto& r : ranges)
+	{
+		if (r.empty())
+			continue;
+		int first = 0, last = 0;
+		auto n = std::sscanf(r.c_str(), "%d-%d", &first, &last);
+		if (n < 1)
+			continue;
+		if (n == 1)
+			last = first;
+		for (int c = first; c <= last; c++)
+			cpus.push_back(c);
+	}
+	return cpus;
+}
+
+// 可用的 CPU, 按 NUMA 节点排列, 这样线程数少于 CPU 数的时候先占满一个节点.
+static std::vector<int> numa_ordered_cpus()
+{
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return {};
+
+	std::vector<int> cpus;
+	std::vector<int> seen(CPU_SETSIZE, 0);
+
+	boost::system::error_code ec;
+	std::vector<std::filesystem::path> nodes;
+	for (auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+	{
+		auto name = entry.path().filename().string();
+		if (name.starts_with("node") && name.size() > 4 && std::isdigit(name[4]))
+			nodes.push_back(entry.path());
+	}
+	std::sort(nodes.begin(), nodes.end(), [](auto& a, auto& b)
+	{
+		return std::stoi(a.filename().string().substr(4)) < std::stoi(b.filename().string().substr(4));
+	});
+
+	for (auto& node : nodes)
+	{
+		std::ifstream f(node / "cpulist");
+		std::string list;
+		std::getline(f, list);
+		for (int c : parse_cpulist(list))
+		{
+			if (c < CPU_SETSIZE && CPU_ISSET(c, &allowed) && !seen[c])
+			{
+				seen[c] = 1;
+				cpus.push_back(c);
+			}
+		}
+	}
+
+	// 没有 NUMA 信息的机器.
+	for (int c = 0; c < CPU_SETSIZE; c++)
+	{
+		if (CPU_ISSET(c, &allowed) && !seen[c])
+			cpus.push_back(c);
+	}
+
+	return cpus;
+}
+
+bool io_context_pool::pin_threads()
+{
+	auto cpus = numa_ordered_cpus();
+	if (cpus.empty())
+		return false;
+
+	thread_cpus_.clear();
+	for (std::size_t i = 0; i < io_contexts_.size(); ++i)
+	{
+		int cpu = cpus[i % cpus.size()];
+		thread_cpus_.push_back(cpu);
+
+		// 在 io 线程自己身上设置, run() 之前调用的话线程启动后马上执行.
+		boost::asio::post(*io_contexts_[i], [cpu]()
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+				LOG_WARN << "pin io thread to cpu " << cpu << " failed";
+		});
+	}
+
+	return true;
+}
+
+#else
+
+bool io_context_pool::pin_threads()
+{
+	return false;
+}
+
+#endif
+
+const std::vector<int>& io_context_pool::thread_cpus() const
+{
+	return thread_cpus_;
+}
+
+io_context_pool::connection_token::connection_token(std::atomic<std::size_t>* counter)
+	: counter_(counter)
+{
+	if (counter_)
+		counter_->fetch_add(1, std::memory_order_relaxed);
+}
+
+io_context_pool::connection_token::connection_token(connection_token&& o) noexcept
+	: counter_(std::exchange(o.counter_, nullptr))
+{
+}
+
+io_context_pool::connection_token& io_context_pool::connection_token::operator=(connection_token&& o) noexcept
+{
+	if (this != &o)
+	{
+		if (counter_)
+			counter_->fetch_sub(1, std::memory_order_relaxed);
+		counter_ = std::exchange(o.counter_, nullptr);
+	}
+	return *this;
+}
+
+io_context_pool::connection_token::~connection_token()
+{
+	if (counter_)
+		counter_->fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::size_t io_context_pool::index_of(const boost::asio::any_io_executor& executor) const
+{
+	auto& ctx = boost::asio::query(executor, boost::asio::execution::context);
+	for (std::size_t i = 0; i < io_contexts_.size(); ++i)
+	{
+		if (io_contexts_[i].get() == &ctx)
+			return i;
+	}
+	return io_contexts_.size();
+}
+
+io_context_pool::connection_token io_context_pool::track_connection(std::size_t index)
+{
+	if (index >= io_contexts_.size())
+		return connection_token();
+	return connection_token(&loads_[index].connections);
+}
+
+std::vector<io_context_load> io_context_pool::load()
+{
+	sample_busy();
+
+	std::vector<io_context_load> ret;
+	for (std::size_t i = 0; i < io_contexts_.size(); ++i)
+	{
+		ret.push_back({
+			loads_[i].connections.load(std::memory_order_relaxed),
+			loads_[i].busy_permille.load(std::memory_order_relaxed) / 1000.0
+		});
+	}
+	return ret;
+}
+
+// 连接数和忙碌程度一起算, 一个跑满 CPU 的线程相当于连接数翻倍.
+std::size_t io_context_pool::load_score(std::size_t index) const
+{
+	auto connections = loads_[index].connections.load(std::memory_order_relaxed);
+	auto busy = loads_[index].busy_permille.load(std::memory_order_relaxed);
+	return (connections + 1) * (1000 + busy);
+}
+
+// 最多每 100ms 采样一次各 io 线程的 CPU 时间, 和上次的值做指数平滑.
+void io_context_pool::sample_busy()
+{
+#ifdef __linux__
+	std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	if (now - last_sample_ns_.load(std::memory_order_relaxed) < 100'000'000)
+		return;
+
+	std::unique_lock<std::mutex> lock(sample_mutex_, std::try_to_lock);
+	if (!lock.owns_lock())
+		return;
+
+	std::int64_t wall_ns = now - last_sample_ns_.load(std::memory_order_relaxed);
+	if (wall_ns < 100'000'000)
+		return;
+	last_sample_ns_.store(now, std::memory_order_relaxed);
+
+	for (std::size_t i = 0; i < io_contexts_.size(); ++i)
+	{
+		auto& l = loads_[i];
+		timespec ts;
+		if (!l.has_cpu_clock.load(std::memory_order_acquire) || clock_gettime(static_cast<clockid_t>(l.cpu_clock), &ts) != 0)
+			continue;
+
+		std::int64_t cpu_ns = ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+		std::int64_t permille = l.last_cpu_ns ? std::min<std::int64_t>(1000, (cpu_ns - l.last_cpu_ns) * 1000 / wall_ns) : 0;
+		l.last_cpu_ns = cpu_ns;
+		l.busy_permille = static_cast<std::uint32_t>((l.busy_permille.load() + permille) / 2);
+	}
+#endif
+}
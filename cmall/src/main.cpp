@@ -1,6 +1,8 @@
 
 #include "stdafx.hpp"
 
+#include <charconv>
+
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
 
@@ -9,6 +11,7 @@ namespace po = boost::program_options;
 #include "cmall/version.hpp"
 #include "cmall/internal.hpp"
 #include "cmall/cmall.hpp"
+#include "httpd/listen_fds.hpp"
 #include "utils/uawaitable.hpp"
 
 static int platform_init()
@@ -141,6 +144,28 @@ static std::string version_info()
 awaitable<int> co_main(int argc, char** argv, io_context_pool& ios)
 {
 	std::vector<std::string> ws_listens, wss_listens, ws_unix_listens;
+	bool enable_http2;
+	bool enable_ktls;
+	bool cpu_affinity;
+	httpd::admission_config admission;
+	long retry_after;
+	long http_header_timeout, http_body_timeout, http_keepalive_timeout;
+	std::string handoff_socket;
+	long handoff_drain_timeout;
+	httpd::send_queue_config ws_send_queue;
+	std::string ws_send_overflow;
+	std::size_t ws_inflight_limit;
+	std::size_t ws_max_message_size, upload_max_size, anonymous_upload_max_size;
+	std::uint64_t upload_total_size;
+	std::string upload_dir;
+	bool ws_deflate;
+	bool ws_deflate_no_context_takeover;
+	int ws_deflate_window_bits, ws_deflate_mem_level, ws_deflate_level;
+	std::size_t ws_deflate_min_size;
+	std::vector<std::string> rpc_costs;
+	std::string notify_channel;
+	httpd::tls_session_config tls_session;
+	long tls_session_timeout, tls_ticket_rotate;
 
 	std::string db_name;
 	std::string db_host;
@@ -167,11 +192,46 @@ awaitable<int> co_main(int argc, char** argv, io_context_pool& ios)
 		("ws", po::value<std::vector<std::string>>(&ws_listens)->multitoken()->value_name("ip:port [ip:port ...]"), "For websocket server listen.")
 		("wss", po::value<std::vector<std::string>>(&wss_listens)->multitoken()->value_name("ip:port [ip:port ...]"), "For SSL websocket server listen.")
 		("ws_unix", po::value<std::vector<std::string>>(&ws_unix_listens)->multitoken()->value_name("path [path ...]"), "For (unix socket) websocket server listen.")
+		("http2", po::value<bool>(&enable_http2)->default_value(true)->value_name("bool"), "Enable HTTP/2 (ALPN h2 on wss, prior-knowledge h2c on ws/ws_unix).")
+		("ktls", po::value<bool>(&enable_ktls)->default_value(false)->value_name("bool"), "Offload TLS of wss connections to the kernel (kTLS) when supported.")
+		("tls_session_cache", po::value<long>(&tls_session.session_cache_size)->default_value(20480)->value_name("entries"), "TLS server session cache size, 0 to only use session tickets.")
+		("tls_session_timeout", po::value<long>(&tls_session_timeout)->default_value(7200)->value_name("seconds"), "TLS session and ticket lifetime.")
+		("tls_session_tickets", po::value<bool>(&tls_session.session_tickets)->default_value(true)->value_name("bool"), "Enable stateless TLS session tickets.")
+		("tls_ticket_rotate", po::value<long>(&tls_ticket_rotate)->default_value(3600)->value_name("seconds"), "TLS session ticket key rotation interval.")
+		("tls_groups", po::value<std::string>(&tls_session.groups)->default_value("X25519:P-256:P-384")->value_name("groups"), "ECDHE groups in preference order.")
+		("cpu_affinity", po::value<bool>(&cpu_affinity)->default_value(false)->value_name("bool"), "Pin io threads to CPUs (NUMA aware) and steer new connections to the acceptor on the receiving CPU.")
+		("max_connections", po::value<std::size_t>(&admission.max_connections)->default_value(0)->value_name("n"), "Max concurrent connections, 0 for unlimited. Excess connections get 503.")
+		("max_connections_per_ip", po::value<std::size_t>(&admission.max_connections_per_ip)->default_value(0)->value_name("n"), "Max concurrent connections per client IP, 0 for unlimited. Loopback and unix socket peers are not counted: behind a local reverse proxy every client has the proxy's address.")
+		("retry_after", po::value<long>(&retry_after)->default_value(5)->value_name("seconds"), "Retry-After of the 503 sent to rejected connections.")
+		("pending_work_high", po::value<std::size_t>(&admission.pending_work_high)->default_value(0)->value_name("n"), "Pause accepting when queued database and git operations reach this, 0 to disable.")
+		("pending_work_low", po::value<std::size_t>(&admission.pending_work_low)->default_value(0)->value_name("n"), "Resume accepting below this, 0 for half of pending_work_high.")
+		("http_header_timeout", po::value<long>(&http_header_timeout)->default_value(15)->value_name("seconds"), "Close connections that do not send a complete request header in time.")
+		("http_body_timeout", po::value<long>(&http_body_timeout)->default_value(30)->value_name("seconds"), "Close connections that do not send the request body in time.")
+		("http_keepalive_timeout", po::value<long>(&http_keepalive_timeout)->default_value(60)->value_name("seconds"), "Close idle keep-alive HTTP connections after this.")
+		("ws_send_high_water", po::value<std::size_t>(&ws_send_queue.high_water_bytes)->default_value(4 * 1024 * 1024)->value_name("bytes"), "Max unsent bytes queued per websocket connection.")
+		("ws_send_batch", po::value<std::size_t>(&ws_send_queue.max_batch_bytes)->default_value(64 * 1024)->value_name("bytes"), "Coalesce queued websocket messages into writes of up to this size.")
+		("ws_send_overflow", po::value<std::string>(&ws_send_overflow)->default_value("disconnect")->value_name("disconnect|drop_oldest"), "What to do when a websocket send queue exceeds ws_send_high_water.")
+		("ws_deflate", po::value<bool>(&ws_deflate)->default_value(true)->value_name("bool"), "Offer permessage-deflate on websocket connections.")
+		("ws_deflate_window_bits", po::value<int>(&ws_deflate_window_bits)->default_value(15)->value_name("9-15"), "Max deflate window bits for both directions. Each step down halves the window memory.")
+		("ws_deflate_mem_level", po::value<int>(&ws_deflate_mem_level)->default_value(4)->value_name("1-9"), "Deflate memLevel of the server side compressor.")
+		("ws_deflate_level", po::value<int>(&ws_deflate_level)->default_value(8)->value_name("0-9"), "Deflate compression level.")
+		("ws_deflate_no_context_takeover", po::value<bool>(&ws_deflate_no_context_takeover)->default_value(false)->value_name("bool"), "Reset the compression context after every message in both directions.")
+		("ws_deflate_min_size", po::value<std::size_t>(&ws_deflate_min_size)->default_value(256)->value_name("bytes"), "Send websocket messages smaller than this uncompressed.")
+		("ws_inflight_limit", po::value<std::size_t>(&ws_inflight_limit)->default_value(32)->value_name("n"), "Max total cost of JSON-RPC calls in flight per websocket connection, 0 for unlimited. Reading pauses while saturated.")
+		("ws_max_message_size", po::value<std::size_t>(&ws_max_message_size)->default_value(6 * 1024 * 1024)->value_name("bytes"), "Max size of a websocket message. Upload images through /api/upload instead of raising this.")
+		("upload_max_size", po::value<std::size_t>(&upload_max_size)->default_value(6 * 1024 * 1024)->value_name("bytes"), "Max body size of POST/PUT /api/upload.")
+		("anonymous_upload_max_size", po::value<std::size_t>(&anonymous_upload_max_size)->default_value(2 * 1024 * 1024)->value_name("bytes"), "Max body size of /api/upload for clients that have a session but are not logged in.")
+		("upload_dir", po::value<std::string>(&upload_dir)->default_value((std::filesystem::temp_directory_path() / "cmall-upload").string())->value_name("dir"), "Where uploads wait for the RPC that uses them. Point all instances at the same directory when running several.")
+		("upload_total_size", po::value<std::uint64_t>(&upload_total_size)->default_value(512 * 1024 * 1024)->value_name("bytes"), "Max total size of pending uploads in upload_dir. New uploads get 503 beyond this.")
+		("rpc_cost", po::value<std::vector<std::string>>(&rpc_costs)->multitoken()->value_name("method=n [method=n ...]"), "Override the cost weight of JSON-RPC methods (default comes from the method table: 1, 2, 4 or 8).")
+		("handoff_socket", po::value<std::string>(&handoff_socket)->value_name("path"), "Unix socket for restart handoff: take over listen sockets from the running instance, then hand them to the next one.")
+		("handoff_drain_timeout", po::value<long>(&handoff_drain_timeout)->default_value(30)->value_name("seconds"), "After handing listen sockets to the next instance, wait this long for open HTTP requests to finish and websocket clients to take the close frame (1012) before exiting.")
 		("db_name", po::value<std::string>(&db_name)->default_value("cmall")->value_name("db"), "Database name.")
 		("db_host", po::value<std::string>(&db_host)->default_value("")->value_name("host"), "Database host.")
 		("db_port", po::value<unsigned short>(&db_port)->default_value(5432)->value_name("port"), "Database port.")
 		("db_user", po::value<std::string>(&db_user)->default_value("postgres")->value_name("user"), "Database user.")
 		("db_passwd", po::value<std::string>(&db_passwd)->default_value("postgres")->value_name("passwd"), "Database password.")
+		("notify_channel", po::value<std::string>(&notify_channel)->value_name("channel"), "Relay push notifications between cmall instances over PostgreSQL LISTEN/NOTIFY on this channel.")
 		("repo_root", po::value<std::string>(&repo_root)->default_value("/repos")->value_name("dir"), "gitea repo base dir")
 		("gitea_token", po::value<std::string>(&gitea_token)->value_name("token"), "gitea api token")
 		("gitea_api_path", po::value<std::string>(&gitea_api_path)->value_name("url"), "default http://localhost:3000 cmall will use this url to manage gitea")
@@ -202,6 +262,7 @@ awaitable<int> co_main(int argc, char** argv, io_context_pool& ios)
 
 		// 输出版本信息.
 		LOG_INFO << version_info();
+		LOG_INFO << "socket I/O backend: " << httpd::socket_io_backend();
 
 		// 帮助输出.
 		if (vm.count("help") || argc == 1)
@@ -248,9 +309,72 @@ awaitable<int> co_main(int argc, char** argv, io_context_pool& ios)
 	dbcfg.port_ = db_port;
 
 	cfg.dbcfg_ = dbcfg;
+	cfg.notify_channel_ = notify_channel;
 	cfg.ws_listens_ = ws_listens;
 	cfg.wss_listens_ = wss_listens;
 	cfg.ws_unix_listens_ = ws_unix_listens;
+	cfg.enable_http2_ = enable_http2;
+	cfg.enable_ktls_ = enable_ktls;
+	tls_session.session_timeout = std::chrono::seconds(tls_session_timeout);
+	tls_session.ticket_key_rotation = std::chrono::seconds(tls_ticket_rotate);
+	cfg.tls_session_ = tls_session;
+	if (cpu_affinity && !ios.pin_threads())
+		LOG_WARN << "cpu_affinity not supported on this platform";
+	cfg.cpu_affinity_ = cpu_affinity && !ios.thread_cpus().empty();
+	admission.retry_after = std::chrono::seconds(retry_after);
+	if (admission.pending_work_high && admission.pending_work_low >= admission.pending_work_high)
+	{
+		LOG_ERR << "pending_work_low must be below pending_work_high";
+		co_return EXIT_FAILURE;
+	}
+	cfg.admission_ = admission;
+	cfg.http_header_timeout_ = std::chrono::seconds(http_header_timeout);
+	cfg.http_body_timeout_ = std::chrono::seconds(http_body_timeout);
+	cfg.http_keepalive_timeout_ = std::chrono::seconds(http_keepalive_timeout);
+	cfg.handoff_socket_ = handoff_socket;
+	cfg.handoff_drain_timeout_ = std::chrono::seconds(handoff_drain_timeout);
+	if (ws_send_overflow == "drop_oldest")
+		ws_send_queue.policy = httpd::overflow_policy::drop_oldest;
+	else if (ws_send_overflow != "disconnect")
+	{
+		LOG_ERR << "ws_send_overflow must be disconnect or drop_oldest";
+		co_return EXIT_FAILURE;
+	}
+	cfg.ws_send_queue_ = ws_send_queue;
+	if (ws_deflate_window_bits < 9 || ws_deflate_window_bits > 15 || ws_deflate_mem_level < 1 || ws_deflate_mem_level > 9
+		|| ws_deflate_level < 0 || ws_deflate_level > 9)
+	{
+		LOG_ERR << "ws_deflate_window_bits must be 9-15, ws_deflate_mem_level 1-9, ws_deflate_level 0-9";
+		co_return EXIT_FAILURE;
+	}
+	cfg.ws_deflate_.server_enable = ws_deflate;
+	cfg.ws_deflate_.client_enable = ws_deflate;
+	cfg.ws_deflate_.server_max_window_bits = ws_deflate_window_bits;
+	cfg.ws_deflate_.client_max_window_bits = ws_deflate_window_bits;
+	cfg.ws_deflate_.server_no_context_takeover = ws_deflate_no_context_takeover;
+	cfg.ws_deflate_.client_no_context_takeover = ws_deflate_no_context_takeover;
+	cfg.ws_deflate_.memLevel = ws_deflate_mem_level;
+	cfg.ws_deflate_.compLevel = ws_deflate_level;
+	cfg.ws_deflate_.msg_size_threshold = ws_deflate_min_size;
+	cfg.ws_inflight_limit_ = ws_inflight_limit;
+	cfg.ws_max_message_size_ = ws_max_message_size;
+	cfg.upload_max_size_ = upload_max_size;
+	cfg.anonymous_upload_max_size_ = anonymous_upload_max_size;
+	cfg.upload_dir_ = upload_dir;
+	cfg.upload_total_size_ = upload_total_size;
+	for (const auto& c : rpc_costs)
+	{
+		auto pos = c.find('=');
+		std::size_t cost = 0;
+		if (pos != std::string::npos)
+			std::from_chars(c.data() + pos + 1, c.data() + c.size(), cost);
+		if (cost == 0 || !cmall::find_rpc_method(std::string_view(c).substr(0, pos)))
+		{
+			LOG_ERR << "bad rpc_cost: " << c;
+			co_return EXIT_FAILURE;
+		}
+		cfg.rpc_costs_.insert_or_assign(c.substr(0, pos), cost);
+	}
 	cfg.repo_root = repo_root;
 	cfg.gitea_api = gitea_api_path;
 	cfg.gitea_template_user = gitea_template_user;
@@ -267,13 +391,14 @@ awaitable<int> co_main(int argc, char** argv, io_context_pool& ios)
 
 	using namespace boost::asio::experimental::awaitable_operators;
 
-	if (!co_await xsrv.load_configs())
-		co_return EXIT_FAILURE;
+	// systemd socket activation 或者旧进程交过来的监听 fd, 在 init_*_acceptors 里按地址认领.
+	xsrv.inherit_listen_fds(httpd::take_systemd_listen_fds());
+	xsrv.take_over_listeners();
 
-	if (!co_await xsrv.load_repos())
+	if (!co_await xsrv.load_configs())
 		co_return EXIT_FAILURE;
 
-	// 初始化ws acceptors.
+	// 先 listen 再加载仓库, 加载期间新连接在内核队列里排队而不是被拒绝.
 	co_await xsrv.init_ws_acceptors();
 
 	#if defined(BOOST_WINDOWS_API) || defined (BOOST_ASIO_HAS_IO_URING)
@@ -303,13 +428,29 @@ awaitable<int> co_main(int argc, char** argv, io_context_pool& ios)
 
 	co_await xsrv.init_ws_unix_acceptors();
 
-	// 处理中止信号.
-	co_await(
+	if (!co_await xsrv.load_repos())
+		co_return EXIT_FAILURE;
+
+	// 旧进程收到通知后停止 accept, 从这里开始由我们接手.
+	xsrv.listeners_ready();
+
+	// 处理中止信号, 或者监听 fd 已经交给了下一个进程.
+	auto exit_reason = co_await(
 		xsrv.run_httpd()
 			||
 		terminator_signal.async_wait(use_awaitable)
+			||
+		xsrv.serve_listener_handoff()
 	);
 
+	// 交接出去了: 新连接已经由新进程接收, 现有的连接收尾后再退出.
+	// 中止信号的话直接关闭所有连接.
+	if (exit_reason.index() == 2)
+	{
+		LOG_INFO << "listeners handed off, waiting up to " << cfg.handoff_drain_timeout_.count() << "s for open connections";
+		co_await xsrv.drain_connections();
+	}
+
 	terminator_signal.clear();
 
 	LOG_DBG << "terminator is called!";
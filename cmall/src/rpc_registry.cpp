@@ -0,0 +1,361 @@
+#include "stdafx.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+#include "cmall/rpc_registry.hpp"
+
+namespace cmall
+{
+	namespace
+	{
+		using enum rpc_param_type;
+
+		constexpr rpc_param recover_session_params[] = {
+			{ "sessionid", string },
+			{ "api-token", string },
+			{ "baseurl", string },
+		};
+		constexpr rpc_param face_image_params[] = {
+			{ "image", string },
+			{ "upload_id", string },
+		};
+		constexpr rpc_param search_goods_params[] = {
+			{ "q", string, true },
+		};
+		constexpr rpc_param goods_list_params[] = {
+			{ "merchant", string },
+		};
+		constexpr rpc_param goods_detail_params[] = {
+			{ "merchant_id", integer, true },
+			{ "goods_id", string, true },
+		};
+		constexpr rpc_param merchant_id_params[] = {
+			{ "merchant_id", integer, true },
+		};
+		constexpr rpc_param cart_add_params[] = {
+			{ "merchant_id", integer, true },
+			{ "goods_id", string, true },
+			{ "selection", array },
+		};
+		constexpr rpc_param cart_mod_params[] = {
+			{ "item_id", integer, true },
+			{ "count", integer, true },
+		};
+		constexpr rpc_param cart_del_params[] = {
+			{ "item_id", integer, true },
+		};
+		constexpr rpc_param orderid_params[] = {
+			{ "orderid", string, true },
+		};
+		constexpr rpc_param page_params[] = {
+			{ "page", integer },
+			{ "page_size", integer },
+		};
+		constexpr rpc_param cart_list_params[] = {
+			{ "page", integer },
+			{ "page_size", integer },
+			{ "with_version", boolean },
+		};
+		constexpr rpc_param fav_params[] = {
+			{ "merchant_id", integer, true },
+		};
+
+		constexpr rpc_method_desc method(req_method m, rpc_group group, rpc_auth auth,
+			rpc_cost_class cost = rpc_cost_class::light, std::span<const rpc_param> params = {})
+		{
+			return { magic_enum::enum_name(m), m, group, auth, cost, params };
+		}
+
+		using enum req_method;
+		using enum rpc_group;
+		using enum rpc_cost_class;
+		constexpr auto none = rpc_auth::none;
+		constexpr auto login = rpc_auth::login;
+		constexpr auto merchant_user = rpc_auth::merchant;
+		constexpr auto admin_user = rpc_auth::admin;
+
+		// 按 req_method 的顺序排列, 下标就是枚举值.
+		constexpr rpc_method_desc method_table[] = {
+			method(recover_session, session, none, light, recover_session_params),
+			method(ping, session, none),
+
+			method(user_fastlogin, user, none),
+			method(user_prelogin, user, none),
+			method(user_login, user, none),
+			method(user_logout, user, none),
+			method(user_islogin, user, none),
+			method(user_info, user, login),
+			method(user_apply_merchant, user, login),
+			method(user_apply_info, user, login),
+			method(user_add_face, user, login, expensive, face_image_params),
+			method(user_search_by_face, user, none, expensive, face_image_params),
+			method(user_list_recipient_address, user, login),
+			method(user_add_recipient_address, user, login),
+			method(user_modify_receipt_address, user, login),
+			method(user_erase_receipt_address, user, login),
+			method(user_get_wx_openid, user, login),
+			method(user_3rd_kv_put, user, login),
+			method(user_3rd_kv_get, user, login),
+			method(user_3rd_kv_put_pubkey, user, login),
+			method(user_3rd_kv_get_pubkey, user, login),
+
+			method(cart_add, cart, login, light, cart_add_params),
+			method(cart_mod, cart, login, light, cart_mod_params),
+			method(cart_del, cart, login, light, cart_del_params),
+			method(cart_list, cart, login, light, cart_list_params),
+
+			method(fav_add, fav, login, light, fav_params),
+			method(fav_del, fav, login, light, fav_params),
+			method(fav_list, fav, login, light, page_params),
+
+			method(order_create_cart, order, login, heavy),
+			method(order_create_direct, order, login, heavy),
+			method(order_detail, order, login),
+			method(order_list, order, login),
+			method(order_close, order, login, light, orderid_params),
+			method(order_get_paymethods, order, login),
+			method(order_get_pay_url, order, login),
+			method(order_check_payment, order, login),
+			method(order_get_wxpay_prepay_id, order, login),
+			method(order_get_wxpay_object, order, login),
+
+			method(search_goods, goods, none, heavy, search_goods_params),
+			method(goods_list, goods, none, medium, goods_list_params),
+			method(goods_detail, goods, none, medium, goods_detail_params),
+			method(goods_markdown, goods, none, medium, goods_detail_params),
+			method(goods_merchant_index, goods, none, medium, merchant_id_params),
+			method(subscribe_merchant, goods, none, light, merchant_id_params),
+			method(unsubscribe_merchant, goods, none, light, merchant_id_params),
+
+			method(merchant_info, merchant, merchant_user),
+			method(merchant_get_sold_order_detail, merchant, merchant_user),
+			method(merchant_sold_orders_check_payment, merchant, merchant_user),
+			method(merchant_sold_orders_mark_payed, merchant, merchant_user),
+			method(merchant_alter_order_price, merchant, merchant_user),
+			method(merchant_goods_list, merchant, merchant_user),
+			method(merchant_keywords_list, merchant, merchant_user),
+			method(merchant_list_sold_orders, merchant, merchant_user, medium),
+			method(merchant_sold_orders_add_kuaidi, merchant, merchant_user),
+			method(merchant_delete_sold_orders, merchant, merchant_user),
+			method(merchant_get_gitea_password, merchant, merchant_user),
+			method(merchant_reset_gitea_password, merchant, merchant_user),
+			method(merchant_create_apptoken, merchant, merchant_user),
+			method(merchant_list_apptoken, merchant, merchant_user),
+			method(merchant_delete_apptoken, merchant, merchant_user),
+			method(merchant_alter_name, merchant, merchant_user),
+			method(merchant_user_kv_get, merchant, merchant_user),
+
+			method(admin_user_detail, admin, admin_user),
+			method(admin_user_list, admin, admin_user, medium),
+			method(admin_user_ban, admin, admin_user),
+			method(admin_list_applicants, admin, admin_user),
+			method(admin_approve_merchant, admin, admin_user),
+			method(admin_deny_applicant, admin, admin_user),
+			method(admin_list_merchants, admin, admin_user),
+			method(admin_disable_merchants, admin, admin_user),
+			method(admin_reenable_merchants, admin, admin_user),
+			method(admin_set_merchant_wxpay_submchid, admin, admin_user),
+			method(admin_set_wxpay_detail, admin, admin_user),
+			method(admin_sudo, admin, admin_user),
+			// sudo 之后当前用户已经换成了目标用户, 只看原来的用户.
+			method(admin_sudo_cancel, admin, rpc_auth::sudo),
+			method(admin_list_index_goods, admin, admin_user),
+			method(admin_set_index_goods, admin, admin_user),
+			method(admin_add_index_goods, admin, admin_user),
+			method(admin_remove_index_goods, admin, admin_user),
+			method(admin_set_profit_sharing, unimplemented, admin_user),
+			method(admin_server_stats, admin, admin_user),
+
+			method(wx_direct_pay, misc, none),
+		};
+
+		static_assert(std::size(method_table) == rpc_method_count);
+
+		constexpr bool table_in_enum_order()
+		{
+			for (std::size_t i = 0; i < std::size(method_table); i++)
+				if (static_cast<std::size_t>(method_table[i].method) != i)
+					return false;
+			return true;
+		}
+		static_assert(table_in_enum_order(), "method_table must follow req_method order");
+
+		constexpr std::uint32_t fnv1a(std::string_view s) noexcept
+		{
+			std::uint32_t h = 2166136261u;
+			for (unsigned char c : s)
+			{
+				h ^= c;
+				h *= 16777619u;
+			}
+			return h;
+		}
+
+		// murmur3 的 fmix32, 让不同 seed 得到的槽位互不相关.
+		constexpr std::uint32_t mix(std::uint32_t h) noexcept
+		{
+			h ^= h >> 16;
+			h *= 0x85ebca6bu;
+			h ^= h >> 13;
+			h *= 0xc2b2ae35u;
+			h ^= h >> 16;
+			return h;
+		}
+
+		// 槽位数取 2 的幂, 至少是方法数的 4 倍. 编译期换 seed 直到没有冲突,
+		// 之后查一次只要算一次哈希, 比一次字符串.
+		class method_index
+		{
+		public:
+			constexpr method_index()
+			{
+				std::array<std::uint32_t, rpc_method_count> hashes{};
+				for (std::size_t i = 0; i < rpc_method_count; i++)
+					hashes[i] = fnv1a(method_table[i].name);
+
+				for (seed_ = 0;; seed_++)
+				{
+					slots_.fill(0);
+					bool collision = false;
+					for (std::size_t i = 0; i < rpc_method_count && !collision; i++)
+					{
+						auto& slot = slots_[mix(hashes[i] ^ seed_) & mask];
+						collision = slot != 0;
+						slot = static_cast<std::uint8_t>(i + 1);
+					}
+					if (!collision)
+						break;
+				}
+			}
+
+			const rpc_method_desc* find(std::string_view name) const noexcept
+			{
+				auto slot = slots_[mix(fnv1a(name) ^ seed_) & mask];
+				if (slot == 0)
+					return nullptr;
+				auto& desc = method_table[slot - 1];
+				return desc.name == name ? &desc : nullptr;
+			}
+
+		private:
+			static constexpr std::size_t slot_count = std::bit_ceil(rpc_method_count * 4);
+			static constexpr std::size_t mask = slot_count - 1;
+			static_assert(rpc_method_count < 255);
+
+			std::uint32_t seed_ = 0;
+			std::array<std::uint8_t, slot_count> slots_{};
+		};
+
+		constexpr method_index method_lookup;
+
+		bool match_type(const boost::json::value& v, rpc_param_type type) noexcept
+		{
+			switch (type)
+			{
+				case integer:
+					return v.is_int64();
+				case string:
+					return v.is_string();
+				case boolean:
+					return v.is_bool();
+				case array:
+					return v.is_array();
+				case object:
+					return v.is_object();
+			}
+			return false;
+		}
+	}
+
+	const rpc_method_desc* find_rpc_method(std::string_view name) noexcept
+	{
+		return method_lookup.find(name);
+	}
+
+	const rpc_method_desc& rpc_method(req_method method) noexcept
+	{
+		return method_table[static_cast<std::size_t>(method)];
+	}
+
+	std::span<const rpc_method_desc> rpc_methods() noexcept
+	{
+		return method_table;
+	}
+
+	bool check_rpc_params(const rpc_method_desc& desc, const boost::json::object& params) noexcept
+	{
+		for (const auto& p : desc.params)
+		{
+			auto it = params.find(p.name);
+			if (it == params.end())
+			{
+				if (p.required)
+					return false;
+				continue;
+			}
+			if (!match_type(it->value(), p.type))
+				return false;
+		}
+		return true;
+	}
+
+	void rpc_method_stats::record(std::chrono::steady_clock::duration elapsed, bool error) noexcept
+	{
+		auto us = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+		auto bucket = std::lower_bound(latency_bounds_us.begin(), latency_bounds_us.end(), us) - latency_bounds_us.begin();
+
+		calls_.fetch_add(1, std::memory_order_relaxed);
+		if (error)
+			errors_.fetch_add(1, std::memory_order_relaxed);
+		total_us_.fetch_add(us, std::memory_order_relaxed);
+		buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+
+		auto max = max_us_.load(std::memory_order_relaxed);
+		while (us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed))
+			;
+	}
+
+	rpc_method_stats::snapshot rpc_method_stats::load() const noexcept
+	{
+		snapshot s;
+		s.calls = calls_.load(std::memory_order_relaxed);
+		s.errors = errors_.load(std::memory_order_relaxed);
+		s.total_us = total_us_.load(std::memory_order_relaxed);
+		s.max_us = max_us_.load(std::memory_order_relaxed);
+		for (std::size_t i = 0; i < buckets_.size(); i++)
+			s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+		return s;
+	}
+
+	boost::json::array rpc_stats_table::to_json() const
+	{
+		boost::json::array bounds(rpc_method_stats::latency_bounds_us.begin(), rpc_method_stats::latency_bounds_us.end());
+
+		// 只列出调用过的方法, 按总耗时排, 最占时间的在前面.
+		std::vector<std::pair<const rpc_method_desc*, rpc_method_stats::snapshot>> called;
+		for (const auto& desc : method_table)
+		{
+			auto s = (*this)[desc.method].load();
+			if (s.calls)
+				called.emplace_back(&desc, s);
+		}
+		std::sort(called.begin(), called.end(), [](const auto& a, const auto& b) { return a.second.total_us > b.second.total_us; });
+
+		boost::json::array result;
+		for (const auto& [desc, s] : called)
+		{
+			result.push_back({
+				{ "method", desc->name },
+				{ "calls", s.calls },
+				{ "errors", s.errors },
+				{ "total_us", s.total_us },
+				{ "max_us", s.max_us },
+				{ "bounds_us", bounds },
+				{ "buckets", boost::json::array(s.buckets.begin(), s.buckets.end()) },
+			});
+		}
+		return result;
+	}
+}
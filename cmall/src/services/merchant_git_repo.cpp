@@ -27,6 +27,7 @@
 #include "md_render.hpp"
 #include "cmall/error_code.hpp"
 #include "utils/coroyield.hpp"
+#include "utils/pending_ops.hpp"
 
 using boost::asio::use_awaitable;
 using boost::asio::experimental::use_promise;
@@ -361,6 +362,34 @@ namespace services
 			return ret;
 		}
 
+		std::map<std::string, std::string> goods_versions()
+		{
+			std::map<std::string, std::string> ret;
+			gitpp::oid commit_version = git_repo.head().target();
+			gitpp::tree repo_tree = git_repo.get_tree_by_commit(commit_version);
+
+			auto goods = repo_tree.by_path("goods");
+
+			if (!goods.empty())
+				treewalk(git_repo.get_tree_by_treeid(goods.get_oid()), [&](const gitpp::tree_entry & tree_entry, const gitpp::tree& parent_dir_in_git)
+				{
+					std::filesystem::path entry_filename(tree_entry.name());
+					if (entry_filename.has_extension() && entry_filename.extension() == ".md")
+					{
+						auto goods_id = entry_filename.stem().string();
+						// 不用读文件内容, blob id 变了就是改过.
+						auto version = tree_entry.get_oid().as_sha1_string();
+						auto goods_option_file = parent_dir_in_git.by_path(goods_id + ".option");
+						if (!goods_option_file.empty())
+							version += ":" + goods_option_file.get_oid().as_sha1_string();
+						ret.emplace(std::move(goods_id), std::move(version));
+					}
+					return false;
+				});
+
+			return ret;
+		}
+
 		bool check_repo_changed(std::string old_head) const
 		{
 			return git_repo.head().target().as_sha1_string() != old_head;
@@ -414,7 +443,7 @@ namespace services
 	awaitable<std::string> merchant_git_repo::get_file_content(std::filesystem::path path, boost::system::error_code& ec)
 	{
 		std::string ret;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().get_file_content(path, ec);
 		}, use_awaitable);
@@ -426,7 +455,7 @@ namespace services
 	{
 		boost::system::error_code ec;
 		product ret;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().get_product(goods_id, merchant_name, baseurl, ec);
 			co_return;
@@ -440,7 +469,7 @@ namespace services
 	awaitable<product> merchant_git_repo::get_product(std::string goods_id, std::string_view merchant_name, std::string baseurl, boost::system::error_code& ec)
 	{
 		product ret;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().get_product(goods_id, merchant_name, baseurl, ec);
 		}, use_awaitable);
@@ -450,7 +479,7 @@ namespace services
 	awaitable<std::vector<product>> merchant_git_repo::get_products(std::string merchant_name, std::string baseurl)
 	{
 		std::vector<product> ret;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<int> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<int> {
 			co_await this_coro::coro_yield();
 			co_return impl().get_products(ret, merchant_name, baseurl);
 		}, use_awaitable);
@@ -461,7 +490,7 @@ namespace services
 	{
 		std::string ret;
 		boost::system::error_code ec;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().get_transpiled_md(md_file_path, baseurl, ec);
 			co_return;
@@ -474,7 +503,7 @@ namespace services
 	awaitable<std::string> merchant_git_repo::get_transpiled_md(std::string md_file_path, std::string baseurl, boost::system::error_code& ec)
 	{
 		std::string ret;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().get_transpiled_md(md_file_path, baseurl, ec);
 			co_return;
@@ -487,7 +516,7 @@ namespace services
 		std::string ret;
 		boost::system::error_code ec;
 
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().get_product_detail(goods_id, baseurl, ec);
 			co_return;
@@ -500,7 +529,7 @@ namespace services
 	awaitable<std::string> merchant_git_repo::get_product_detail(std::string goods_id, std::string baseurl, boost::system::error_code& ec)
 	{
 		std::string ret;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().get_product_detail(goods_id, baseurl, ec);
 			co_return;
@@ -512,7 +541,7 @@ namespace services
 	{
 		std::string ret;
 		boost::system::error_code ec;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().get_product_html(goods_id, baseurl, ec);
 			co_return;
@@ -526,7 +555,7 @@ namespace services
 	awaitable<std::vector<std::string>> merchant_git_repo::get_supported_payment()
 	{
 		std::vector<std::string> supported_payment;
-		co_await boost::asio::co_spawn(thread_pool, [&supported_payment, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&supported_payment, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			supported_payment = impl().get_supported_payment();
 			co_return;
@@ -541,16 +570,26 @@ namespace services
 
 	awaitable<bool> merchant_git_repo::check_repo_changed(std::string old_head) const
 	{
-		co_return co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<bool> {
+		co_return co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<bool> {
 			co_await this_coro::coro_yield();
 			co_return impl().check_repo_changed(old_head);
 		}, use_awaitable);
 	}
 
+	awaitable<std::map<std::string, std::string>> merchant_git_repo::goods_versions()
+	{
+		std::map<std::string, std::string> ret;
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
+			co_await this_coro::coro_yield();
+			ret = impl().goods_versions();
+		}, use_awaitable);
+		co_return ret;
+	}
+
 	awaitable<std::string> merchant_git_repo::git_head() const
 	{
 		std::string ret;
-		co_await boost::asio::co_spawn(thread_pool, [&, this]() mutable -> awaitable<void> {
+		co_await boost::asio::co_spawn(thread_pool, [&, this, pending = utility::pending_op_guard(pending_ops_)]() mutable -> awaitable<void> {
 			co_await this_coro::coro_yield();
 			ret = impl().git_head();
 		}, use_awaitable);
@@ -584,6 +623,13 @@ namespace services
 		return *reinterpret_cast<merchant_git_repo_impl*>(obj_stor.data());
 	}
 
+	std::atomic_size_t merchant_git_repo::pending_ops_{ 0 };
+
+	std::size_t merchant_git_repo::pending_ops()
+	{
+		return pending_ops_.load(std::memory_order_relaxed);
+	}
+
 	bool merchant_git_repo::init_bare_repo(std::filesystem::path repo_path)
 	{
 		return gitpp::init_bare_repo(repo_path);
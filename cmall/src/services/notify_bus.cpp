@@ -0,0 +1,343 @@
+#include "stdafx.hpp"
+
+#include <atomic>
+#include <deque>
+
+#include <libpq-fe.h>
+
+#include "utils/logging.hpp"
+
+#include "services/notify_bus.hpp"
+
+namespace services
+{
+	// PostgreSQL 的 NOTIFY payload 必须小于 8000 字节.
+	static constexpr std::size_t max_payload_size = 7999;
+	// 一次 SELECT 最多带多少个 pg_notify, 攒着的通知一个来回发完.
+	static constexpr std::size_t max_batch = 32;
+
+	struct notify_bus_impl : std::enable_shared_from_this<notify_bus_impl>
+	{
+#ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+		using socket_type = boost::asio::posix::stream_descriptor;
+#else
+		using socket_type = boost::asio::ip::tcp::socket;
+#endif
+
+		notify_bus_impl(boost::asio::any_io_executor executor, notify_bus_config config, notify_bus::handler_type handler)
+			: executor_(executor)
+			, config_(std::move(config))
+			, handler_(std::move(handler))
+			, socket_(executor)
+			, timer_(executor)
+		{
+		}
+
+		~notify_bus_impl()
+		{
+			close();
+		}
+
+		awaitable<void> run()
+		{
+			while (!stopped_)
+			{
+				auto err = co_await session();
+				close();
+				if (stopped_)
+					break;
+
+				LOG_WARN << "notify bus: " << err << ", reconnect in " << config_.reconnect_delay.count() << "s";
+				reconnects_.fetch_add(1, std::memory_order_relaxed);
+
+				boost::system::error_code ec;
+				timer_.expires_after(config_.reconnect_delay);
+				co_await timer_.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+			}
+		}
+
+		void stop()
+		{
+			boost::asio::post(executor_, [self = shared_from_this()]()
+			{
+				self->stopped_ = true;
+				self->timer_.cancel();
+				boost::system::error_code ec;
+				self->socket_.cancel(ec);
+			});
+		}
+
+		void publish(std::string payload)
+		{
+			if (payload.size() > max_payload_size)
+			{
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			boost::asio::post(executor_, [self = shared_from_this(), payload = std::move(payload)]() mutable
+			{
+				if (self->stopped_)
+					return;
+				if (self->pending_.size() >= self->config_.max_pending)
+				{
+					self->pending_.pop_front();
+					self->dropped_.fetch_add(1, std::memory_order_relaxed);
+				}
+				self->pending_.push_back(std::move(payload));
+				self->send_pending();
+			});
+		}
+
+		notify_bus_stats stats() const
+		{
+			return {
+				connected_.load(std::memory_order_relaxed),
+				published_.load(std::memory_order_relaxed),
+				received_.load(std::memory_order_relaxed),
+				dropped_.load(std::memory_order_relaxed),
+				reconnects_.load(std::memory_order_relaxed),
+			};
+		}
+
+	private:
+		// 连上并 LISTEN, 然后一直处理, 直到连接出错或者 stop(). 返回出错原因.
+		awaitable<std::string> session()
+		{
+			std::vector<const char*> keywords;
+			std::vector<const char*> values;
+			auto add_param = [&](const char* keyword, const std::string& value)
+			{
+				if (value.empty())
+					return;
+				keywords.push_back(keyword);
+				values.push_back(value.c_str());
+			};
+			std::string port = config_.port ? std::to_string(config_.port) : std::string();
+			add_param("host", config_.host);
+			add_param("port", port);
+			add_param("dbname", config_.dbname);
+			add_param("user", config_.user);
+			add_param("password", config_.password);
+			keywords.push_back(nullptr);
+			values.push_back(nullptr);
+
+			conn_ = PQconnectStartParams(keywords.data(), values.data(), 0);
+			if (!conn_)
+				co_return "out of memory";
+
+			boost::system::error_code ec;
+			for (auto status = PGRES_POLLING_WRITING; status != PGRES_POLLING_OK; status = PQconnectPoll(conn_))
+			{
+				if (status == PGRES_POLLING_FAILED || PQstatus(conn_) == CONNECTION_BAD)
+					co_return error_message();
+
+				// 连接过程中 libpq 可能换 socket (比如尝试下一个地址).
+				attach(PQsocket(conn_));
+				co_await socket_.async_wait(status == PGRES_POLLING_READING ? socket_type::wait_read : socket_type::wait_write,
+					boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+				if (stopped_)
+					co_return std::string();
+			}
+			attach(PQsocket(conn_));
+
+			auto channel = PQescapeIdentifier(conn_, config_.channel.data(), config_.channel.size());
+			if (!channel)
+				co_return error_message();
+			std::string listen = std::string("LISTEN ") + channel;
+			PQfreemem(channel);
+
+			if (!PQsendQuery(conn_, listen.c_str()))
+				co_return error_message();
+			busy_ = true;
+
+			for (;;)
+			{
+				co_await socket_.async_wait(socket_type::wait_read, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+				if (stopped_)
+					co_return std::string();
+				if (broken_)
+					co_return error_message();
+				if (ec)
+					co_return ec.message();
+				if (!PQconsumeInput(conn_))
+					co_return error_message();
+
+				if (auto err = drain_results(); !err.empty())
+					co_return err;
+
+				auto self_pid = PQbackendPID(conn_);
+				while (auto notify = PQnotifies(conn_))
+				{
+					// 自己发的也会收到一份, 本地投递已经做过了.
+					if (notify->be_pid != self_pid)
+					{
+						received_.fetch_add(1, std::memory_order_relaxed);
+						handler_(notify->extra);
+					}
+					PQfreemem(notify);
+				}
+			}
+		}
+
+		std::string drain_results()
+		{
+			while (busy_ && !PQisBusy(conn_))
+			{
+				PGresult* res = PQgetResult(conn_);
+				if (!res)
+				{
+					busy_ = false;
+					send_pending();
+					continue;
+				}
+
+				auto status = PQresultStatus(res);
+				bool ok = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+				if (!listening_)
+				{
+					// 第一个结果是 LISTEN 的.
+					if (!ok)
+					{
+						std::string err = PQresultErrorMessage(res);
+						PQclear(res);
+						return err;
+					}
+					listening_ = true;
+					connected_.store(true, std::memory_order_relaxed);
+				}
+				else if (!ok)
+				{
+					LOG_WARN << "notify bus: pg_notify failed: " << PQresultErrorMessage(res);
+				}
+				PQclear(res);
+			}
+			return {};
+		}
+
+		// 把攒着的通知合成一条 SELECT pg_notify(...), pg_notify(...) 发出去.
+		// 同一时间只有一条查询在路上, 结果回来后再发下一批.
+		void send_pending()
+		{
+			if (busy_ || !listening_ || broken_ || pending_.empty())
+				return;
+
+			auto n = std::min(pending_.size(), max_batch);
+			std::string sql = "SELECT ";
+			std::vector<const char*> params{ config_.channel.c_str() };
+			for (std::size_t i = 0; i < n; i++)
+			{
+				sql += std::format("{}pg_notify($1, ${})", i ? ", " : "", i + 2);
+				params.push_back(pending_[i].c_str());
+			}
+
+			if (!PQsendQueryParams(conn_, sql.c_str(), static_cast<int>(params.size()), nullptr, params.data(), nullptr, nullptr, 0))
+			{
+				// 交给读循环去断开重连, 待发的留着.
+				broken_ = true;
+				boost::system::error_code ec;
+				socket_.cancel(ec);
+				return;
+			}
+
+			pending_.erase(pending_.begin(), pending_.begin() + n);
+			published_.fetch_add(n, std::memory_order_relaxed);
+			busy_ = true;
+		}
+
+		void attach(int fd)
+		{
+			if (fd == attached_fd_)
+				return;
+			detach();
+			if (fd < 0)
+				return;
+#ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+			socket_.assign(fd);
+#else
+			socket_.assign(boost::asio::ip::tcp::v4(), fd);
+#endif
+			attached_fd_ = fd;
+		}
+
+		// fd 归 libpq 管, 只从 asio 里摘下来, 不关闭.
+		void detach()
+		{
+			if (socket_.is_open())
+				socket_.release();
+			attached_fd_ = -1;
+		}
+
+		void close()
+		{
+			detach();
+			if (conn_)
+				PQfinish(conn_);
+			conn_ = nullptr;
+			busy_ = false;
+			listening_ = false;
+			broken_ = false;
+			connected_.store(false, std::memory_order_relaxed);
+		}
+
+		std::string error_message() const
+		{
+			std::string err = conn_ ? PQerrorMessage(conn_) : "connection failed";
+			while (!err.empty() && (err.back() == '\n' || err.back() == ' '))
+				err.pop_back();
+			return err;
+		}
+
+		boost::asio::any_io_executor executor_;
+		notify_bus_config config_;
+		notify_bus::handler_type handler_;
+
+		socket_type socket_;
+		boost::asio::steady_timer timer_;
+		PGconn* conn_ = nullptr;
+		int attached_fd_ = -1;
+
+		bool stopped_ = false;
+		bool busy_ = false;
+		bool listening_ = false;
+		bool broken_ = false;
+		std::deque<std::string> pending_;
+
+		std::atomic<bool> connected_{ false };
+		std::atomic<std::uint64_t> published_{ 0 };
+		std::atomic<std::uint64_t> received_{ 0 };
+		std::atomic<std::uint64_t> dropped_{ 0 };
+		std::atomic<std::uint64_t> reconnects_{ 0 };
+	};
+
+	notify_bus::notify_bus(boost::asio::any_io_executor executor, notify_bus_config config, handler_type handler)
+		: impl_(std::make_shared<notify_bus_impl>(executor, std::move(config), std::move(handler)))
+	{
+	}
+
+	notify_bus::~notify_bus()
+	{
+		impl_->stop();
+	}
+
+	awaitable<void> notify_bus::run()
+	{
+		auto impl = impl_;
+		co_await impl->run();
+	}
+
+	void notify_bus::stop()
+	{
+		impl_->stop();
+	}
+
+	void notify_bus::publish(std::string payload)
+	{
+		impl_->publish(std::move(payload));
+	}
+
+	notify_bus_stats notify_bus::stats() const
+	{
+		return impl_->stats();
+	}
+}
@@ -21,6 +21,7 @@
 #include "detail/time_clock.hpp"
 
 #include "detail/wait_all.hpp"
+#include "admission.hpp"
 #include "detail/config.hpp"
 
 // 每线程一个 accept 的 多 socket accept 模式 适配器.
@@ -38,6 +39,7 @@ namespace httpd
 		boost::asio::ip::tcp::acceptor accept_socket_;
 		std::unordered_map<std::size_t, AcceptedClientClass> all_client;
 		bool accepting = false;
+		admission_control* admission_ = nullptr;
 
 	public:
 		acceptor(const acceptor&) = delete;
@@ -45,6 +47,7 @@ namespace httpd
 			: executor_(o.executor_)
 			, accept_socket_(std::move(o.accept_socket_))
 			, accepting(o.accepting)
+			, admission_(o.admission_)
 		{
 			BOOST_ASSERT_MSG(!o.accepting, "cannot move a socket that has pending IO");
 		};
@@ -66,6 +69,9 @@ namespace httpd
 
 		auto get_executor() { return accept_socket_.get_executor(); }
 
+		// 开始 accept 之前调用. 多个 acceptor 可以共用一个 admission_control.
+		void set_admission_control(admission_control& ac) { admission_ = &ac; }
+
 		void listen(std::string listen_address)
 		{
 			boost::system::error_code ec;
@@ -161,6 +167,37 @@ namespace httpd
 			}
 		}
 
+		// 本 acceptor 是 SO_REUSEPORT 组里第一个 listen 的, 给整个组挂上按 CPU 分发的规则.
+		void steer_incoming_cpu(const std::vector<int>& cpu_of_index, boost::system::error_code& ec)
+		{
+			attach_reuseport_cpu_steering(accept_socket_.native_handle(), cpu_of_index, ec);
+#ifdef HTTPD_ENABLE_LOGGING
+			if (ec)
+				LOG_ERR << "WS server attach reuseport cbpf failed: " << ec.message();
+#endif
+		}
+
+		// 接管一个已经在 listen 的 fd (systemd 或者上一个进程交过来的), 不再 bind/listen.
+		void assign(int fd, boost::system::error_code& ec)
+		{
+			sockaddr_storage addr{};
+			socklen_t len = sizeof(addr);
+			if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+			{
+				ec = boost::system::error_code(errno, boost::system::system_category());
+				return;
+			}
+
+			auto protocol = addr.ss_family == AF_INET6 ? boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4();
+			accept_socket_.assign(protocol, fd, ec);
+#ifdef HTTPD_ENABLE_LOGGING
+			if (ec)
+				LOG_ERR << "WS server assign listen fd failed: " << ec.message();
+#endif
+		}
+
+		int native_handle() { return accept_socket_.native_handle(); }
+
 		boost::asio::awaitable<void> run_accept_loop(int number_of_concurrent_acceptor)
 		{
 			boost::asio::cancellation_state cs = co_await boost::asio::this_coro::cancellation_state;
@@ -194,6 +231,31 @@ namespace httpd
 #endif
 		}
 
+		// 平滑退出: 关掉监听 socket 不再 accept, 在每个连接自己的 executor 上调用 drain() 让它收尾,
+		// 最多等 grace, 还没结束的再由 clean_shutdown 强制关闭. 要在本 acceptor 的 executor 上调用.
+		boost::asio::awaitable<void> graceful_shutdown(std::chrono::steady_clock::duration grace)
+		{
+			boost::system::error_code ignore_ec;
+			accept_socket_.close(ignore_ec);
+
+			for (auto& ws : all_client)
+			{
+				auto conn_ptr = ws.second;
+				boost::asio::post(conn_ptr->get_executor(), [conn_ptr]() { conn_ptr->drain(); });
+			}
+
+			auto deadline = std::chrono::steady_clock::now() + grace;
+			while (all_client.size() && std::chrono::steady_clock::now() < deadline)
+			{
+				using timer = boost::asio::basic_waitable_timer<time_clock::steady_clock>;
+				timer t(get_executor());
+				t.expires_from_now(std::chrono::milliseconds(20));
+				co_await t.async_wait(boost::asio::use_awaitable);
+			}
+
+			co_await clean_shutdown();
+		}
+
 		boost::asio::awaitable<void> clean_shutdown()
 		{
 			for (auto& ws : all_client)
@@ -229,6 +291,9 @@ namespace httpd
 
 				boost::system::error_code error;
 
+				if (admission_)
+					co_await admission_->wait_for_capacity();
+
 				auto client_ptr = executor_.make_shared_connection(get_executor(), connection_id);
 
 				co_await accept_socket_.async_accept(
@@ -249,11 +314,25 @@ namespace httpd
 				flags |= FD_CLOEXEC;
 				fcntl(fd, F_SETFD, flags);
 #endif
+				boost::system::error_code endp_error;
+				auto endp = client_ptr->socket().remote_endpoint(endp_error);
+
+				// 超出连接数上限的直接回 503, 不进入 client_connected.
+				admission_control::ticket admission_ticket;
+				if (admission_)
+				{
+					admission_ticket = admission_->admit(endp.address());
+					if (!admission_ticket)
+					{
+						admission_->reject(client_ptr->socket());
+						continue;
+					}
+				}
+
 				client_ptr->socket().set_option(boost::asio::socket_base::keep_alive(true), error);
 
 				std::string remote_host;
-				auto endp = client_ptr->socket().remote_endpoint(error);
-				if (!error)
+				if (!endp_error)
 				{
 					if (endp.address().is_v6())
 					{
@@ -271,8 +350,9 @@ namespace httpd
 
 				boost::asio::co_spawn(client_ptr->get_executor(),
 					executor_.client_connected(client_ptr),
-					[this, connection_id, client_ptr](std::exception_ptr)
+					[this, connection_id, client_ptr, admission_ticket = std::move(admission_ticket)](std::exception_ptr) mutable
 					{
+						admission_ticket = {};
 						all_client.erase(connection_id);
 						boost::asio::co_spawn(
 							get_executor(), executor_.client_disconnected(client_ptr), boost::asio::detached);
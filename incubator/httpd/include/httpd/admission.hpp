@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include <boost/asio.hpp>
+
+namespace httpd {
+
+	struct admission_config
+	{
+		// 同时在线的连接数上限, 0 表示不限制.
+		std::size_t max_connections = 0;
+
+		// 单个 IP 的连接数上限, 0 表示不限制. unix socket 和 loopback 上的连接不按 IP 计,
+		// 那通常是本机的反向代理, 所有客户端都是这一个地址.
+		std::size_t max_connections_per_ip = 0;
+
+		// 拒绝时 503 响应里的 Retry-After.
+		std::chrono::seconds retry_after = std::chrono::seconds(5);
+
+		// 后端待处理的任务数 (pending_work_probe 的返回值) 达到 high 时暂停 accept,
+		// 降到 low 以下恢复. high 为 0 表示不检查, low 为 0 表示取 high 的一半 (至少为 1).
+		// 给了 low 就必须小于 high, 否则构造时抛 std::invalid_argument.
+		std::size_t pending_work_high = 0;
+		std::size_t pending_work_low = 0;
+	};
+
+	struct admission_stats
+	{
+		std::uint64_t live_connections;
+		std::uint64_t admitted;
+		std::uint64_t rejected_global;
+		std::uint64_t rejected_per_ip;
+		// accept 回来时积压已经达到 pending_work_high 而拒绝的.
+		std::uint64_t rejected_overload;
+		std::uint64_t accept_pauses;
+	};
+
+	// 多个 acceptor (多个 io 线程) 共用的准入控制.
+	class admission_control
+	{
+		admission_control(const admission_control&) = delete;
+		admission_control& operator=(const admission_control&) = delete;
+
+	public:
+		// 准入成功的凭证, 析构时归还名额. 连接结束前要一直持有.
+		class ticket
+		{
+		public:
+			ticket() = default;
+			ticket(ticket&& o) noexcept;
+			ticket& operator=(ticket&& o) noexcept;
+			~ticket();
+
+			explicit operator bool() const { return owner_ != nullptr; }
+
+		private:
+			friend class admission_control;
+			ticket(admission_control* owner, const boost::asio::ip::address& addr, bool per_ip);
+			void release();
+
+			admission_control* owner_ = nullptr;
+			boost::asio::ip::address addr_;
+			bool per_ip_ = false;
+		};
+
+		explicit admission_control(const admission_config& config = {});
+
+		// 是否配置了任何限制, 没有的话 acceptor 不需要挂上它.
+		bool enabled() const;
+
+		// 返回后端待处理任务数, 在 accept 线程上调用, 必须线程安全.
+		void set_pending_work_probe(std::function<std::size_t()> probe);
+
+		// 超出上限, 或者后端积压达到 pending_work_high 时返回空的 ticket.
+		// 暂停之前已经挂在 async_accept 上的那些 accept 回来时靠这里拒绝.
+		ticket admit(const boost::asio::ip::address& addr);
+
+		// 没有 IP 的连接 (unix socket), 只检查全局上限和积压.
+		ticket admit();
+
+		// 待处理任务超过水位线时等待, 直到降下来.
+		boost::asio::awaitable<void> wait_for_capacity();
+
+		// 拒绝一个明文连接: 尽力写一个 503 + Retry-After, 然后关闭. 不等待对方.
+		template <typename Socket>
+		void reject(Socket& socket)
+		{
+			boost::system::error_code ec;
+			auto response = overload_response();
+			socket.non_blocking(true, ec);
+			if (!ec)
+				socket.write_some(boost::asio::buffer(response), ec);
+			socket.shutdown(Socket::shutdown_both, ec);
+			socket.close(ec);
+		}
+
+		admission_stats stats() const;
+
+		const admission_config& config() const { return config_; }
+
+	private:
+		std::string_view overload_response() const;
+		bool overloaded();
+
+		admission_config config_;
+		std::function<std::size_t()> pending_work_probe_;
+
+		std::atomic<std::uint64_t> live_connections_{ 0 };
+		std::atomic<std::uint64_t> admitted_{ 0 };
+		std::atomic<std::uint64_t> rejected_global_{ 0 };
+		std::atomic<std::uint64_t> rejected_per_ip_{ 0 };
+		std::atomic<std::uint64_t> rejected_overload_{ 0 };
+		std::atomic<std::uint64_t> accept_pauses_{ 0 };
+
+		std::mutex per_ip_mutex_;
+		std::unordered_map<boost::asio::ip::address, std::size_t> per_ip_;
+
+		std::string overload_response_;
+	};
+}
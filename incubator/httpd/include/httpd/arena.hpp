@@ -0,0 +1,34 @@
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+
+#include <boost/beast/http/fields.hpp>
+
+namespace httpd {
+
+	// 每个连接一个的小内存池. 一次 HTTP 请求/响应 里产生的临时对象 (主要是响应头)
+	// 都从这里分配, 请求处理完毕调用 reset() 一次性归还.
+	// 内置的 buffer 用完了才会向上游(默认堆)要内存, 正常的静态资源响应头是用不完的.
+	class request_arena
+	{
+	public:
+		request_arena() = default;
+		request_arena(const request_arena&) = delete;
+		request_arena& operator=(const request_arena&) = delete;
+
+		std::pmr::memory_resource* resource() noexcept { return &mr_; }
+
+		// 释放本次请求用掉的内存, 指针重新回到内置 buffer 的开头.
+		void reset() noexcept { mr_.release(); }
+
+	private:
+		alignas(std::max_align_t) std::array<std::byte, 4096> initial_buffer_;
+		std::pmr::monotonic_buffer_resource mr_{ initial_buffer_.data(), initial_buffer_.size() };
+	};
+
+	// 分配器指向 request_arena 的 http 头.
+	using response_fields = boost::beast::http::basic_fields<std::pmr::polymorphic_allocator<char>>;
+}
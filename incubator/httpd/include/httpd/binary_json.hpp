@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <boost/json.hpp>
+#include <boost/system/error_code.hpp>
+
+// JSON 数据模型的两种二进制编码 (MessagePack, CBOR), 和 boost::json::value 之间直接转换,
+// 不经过 JSON 文本.
+//
+// 解码时 bin/bytes 当作字符串, CBOR 的 tag 忽略, undefined 当作 null. map 的 key 必须是字符串.
+// 整数能放进 int64 的解码成 int64, 和 JSON parser 的行为一致.
+// MessagePack 的 ext 类型和其他 JSON 表达不了的东西都报 error::syntax.
+namespace httpd::binary_json {
+
+	enum class format
+	{
+		msgpack,
+		cbor,
+	};
+
+	// 追加到 out 后面.
+	void encode(format f, const boost::json::value& jv, std::string& out);
+	void encode(format f, const boost::json::object& obj, std::string& out);
+	void encode(format f, const boost::json::array& arr, std::string& out);
+
+	// data 必须正好是一个完整的值. 嵌套超过 max_depth 层报 error::too_deep.
+	boost::json::value decode(format f, std::string_view data, boost::system::error_code& ec,
+		boost::json::storage_ptr sp = {}, std::size_t max_depth = 64);
+}
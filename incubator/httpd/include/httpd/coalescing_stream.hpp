@@ -0,0 +1,158 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/any_completion_handler.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket/teardown.hpp>
+
+namespace httpd {
+
+	// 放在 websocket::stream 和连接之间的一层, 平时读写直接透传.
+	// begin_batch() 之后写出的数据只追加到缓冲里, async_flush 一次写出去,
+	// 这样一批 websocket 帧只需要一次 write (TLS 下也只封一次 record).
+	template <typename NextLayer>
+	class write_coalescing_stream
+	{
+	public:
+		using next_layer_type = std::remove_reference_t<NextLayer>;
+		using executor_type = typename next_layer_type::executor_type;
+
+		template <typename... Args>
+		explicit write_coalescing_stream(Args&&... args)
+			: next_layer_(std::forward<Args>(args)...)
+		{}
+
+		executor_type get_executor() noexcept
+		{
+			return next_layer_.get_executor();
+		}
+
+		next_layer_type& next_layer() noexcept
+		{
+			return next_layer_;
+		}
+
+		const next_layer_type& next_layer() const noexcept
+		{
+			return next_layer_;
+		}
+
+		void begin_batch()
+		{
+			batching_ = true;
+		}
+
+		std::size_t buffered_bytes() const
+		{
+			return buffer_.size();
+		}
+
+		template <typename MutableBufferSequence, typename ReadHandler>
+		auto async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+		{
+			return next_layer_.async_read_some(buffers, std::forward<ReadHandler>(handler));
+		}
+
+		template <typename ConstBufferSequence, typename WriteHandler>
+		auto async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+		{
+			return boost::asio::async_initiate<WriteHandler, void(boost::system::error_code, std::size_t)>(
+				[this](auto handler, const ConstBufferSequence& buffers)
+				{
+					if (flushing_)
+					{
+						// 合并写不在 websocket 的写锁里, 这时 websocket 自己发的 ping/pong/close
+						// 不能直接写下去, 排到正在写的那批后面, 真正写完才回调.
+						auto n = boost::asio::buffer_copy(pending_.prepare(boost::asio::buffer_size(buffers)), buffers);
+						pending_.commit(n);
+						waiting_.emplace_back(std::move(handler), n);
+						return;
+					}
+
+					if (!batching_)
+					{
+						next_layer_.async_write_some(buffers, std::move(handler));
+						return;
+					}
+
+					auto n = boost::asio::buffer_copy(buffer_.prepare(boost::asio::buffer_size(buffers)), buffers);
+					buffer_.commit(n);
+					boost::asio::post(next_layer_.get_executor(),
+						boost::beast::bind_front_handler(std::move(handler), boost::system::error_code(), n));
+				}, handler, buffers);
+		}
+
+		// 结束合并, 把缓冲里的数据一次写出去. 写的过程中排进来的数据接着写, 全部写完才完成.
+		template <typename FlushHandler>
+		auto async_flush(FlushHandler&& handler)
+		{
+			batching_ = false;
+			flushing_ = true;
+			return boost::asio::async_compose<FlushHandler, void(boost::system::error_code)>(
+				[this, started = false](auto& self, boost::system::error_code ec = {}, std::size_t = 0) mutable
+				{
+					if (!started)
+					{
+						started = true;
+						boost::asio::async_write(next_layer_, buffer_.data(), std::move(self));
+						return;
+					}
+
+					buffer_.consume(buffer_.size());
+					complete_writing(ec);
+
+					if (!ec && pending_.size())
+					{
+						std::swap(buffer_, pending_);
+						std::swap(writing_, waiting_);
+						boost::asio::async_write(next_layer_, buffer_.data(), std::move(self));
+						return;
+					}
+
+					flushing_ = false;
+					// 出错了, 排着的也写不出去了.
+					pending_.consume(pending_.size());
+					std::swap(writing_, waiting_);
+					complete_writing(ec);
+
+					// 合并写不常发生, 写完就把缓冲还回去, 免得空闲连接一直占着一批的大小.
+					buffer_.shrink_to_fit();
+					pending_.shrink_to_fit();
+					self.complete(ec);
+				}, handler, next_layer_);
+		}
+
+	private:
+		using write_handler = boost::asio::any_completion_handler<void(boost::system::error_code, std::size_t)>;
+
+		void complete_writing(boost::system::error_code ec)
+		{
+			for (auto& [handler, n] : writing_)
+				boost::asio::post(next_layer_.get_executor(),
+					boost::beast::bind_front_handler(std::move(handler), ec, ec ? 0 : n));
+			writing_.clear();
+		}
+
+		NextLayer next_layer_;
+		boost::beast::flat_buffer buffer_;
+		bool batching_ = false;
+		bool flushing_ = false;
+
+		// 合并写期间透传过来的数据, 和它们的回调.
+		boost::beast::flat_buffer pending_;
+		std::vector<std::pair<write_handler, std::size_t>> waiting_;
+		// 数据已经在 buffer_ 里写着的回调.
+		std::vector<std::pair<write_handler, std::size_t>> writing_;
+	};
+
+	// websocket::stream 关闭时通过 ADL 找到它, 再按下一层的类型找对应的 teardown.
+	template <typename NextLayer, typename TeardownHandler>
+	void async_teardown(boost::beast::role_type role, write_coalescing_stream<NextLayer>& stream, TeardownHandler&& handler)
+	{
+		async_teardown(role, stream.next_layer(), std::forward<TeardownHandler>(handler));
+	}
+}
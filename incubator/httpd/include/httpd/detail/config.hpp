@@ -1,9 +1,16 @@
 
 #pragma once
 
+#include <vector>
+
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#include <sys/socket.h>
+#endif
+
 namespace httpd
 {
 
@@ -16,10 +23,108 @@ namespace httpd
 #endif
 	}
 
+	constexpr bool has_reuseport_cbpf()
+	{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// asio 在编译期选定 socket 的 I/O 后端, 见 ENABLE_IOURING_SOCKETS.
+	constexpr const char* socket_io_backend()
+	{
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+		return "io_uring";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+		return "iocp";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+		return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+		return "kqueue";
+#elif defined(BOOST_ASIO_HAS_DEV_POLL)
+		return "/dev/poll";
+#else
+		return "select";
+#endif
+	}
+
 	namespace socket_options
 	{
 #ifdef SO_REUSEPORT
 		typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+	}
+
+	// 给 SO_REUSEPORT 组挂一段 cBPF, 按收包的 CPU 选 socket.
+	// cpu_of_index[i] 是组里第 i 个 listen 的 socket 所在线程绑定的 CPU, 不在表里的 CPU 取模分配.
+	// 线程比可用的 CPU 多时一个 CPU 会出现多次, 这些 socket 之间随机分.
+	// 挂在组里任何一个 socket 上对整个组生效.
+	inline void attach_reuseport_cpu_steering(int fd, const std::vector<int>& cpu_of_index, boost::system::error_code& ec)
+	{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+		if (cpu_of_index.empty())
+		{
+			ec = boost::asio::error::invalid_argument;
+			return;
+		}
+
+		// 按 CPU 归组, 保持第一次出现的顺序.
+		std::vector<std::pair<int, std::vector<std::size_t>>> groups;
+		for (std::size_t i = 0; i < cpu_of_index.size(); i++)
+		{
+			auto it = std::find_if(groups.begin(), groups.end(), [&](auto& g) { return g.first == cpu_of_index[i]; });
+			if (it == groups.end())
+				it = groups.insert(groups.end(), { cpu_of_index[i], {} });
+			it->second.push_back(i);
+		}
+
+		std::vector<sock_filter> code;
+		code.reserve(cpu_of_index.size() * 3 + groups.size() * 2 + 3);
+
+		// A = 收包的 CPU.
+		code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU)));
+		for (auto& [cpu, indexes] : groups)
+		{
+			std::size_t k = indexes.size();
+			// 不匹配时跳过本组的指令, 跳转距离只有 8 位.
+			std::size_t block = k == 1 ? 1 : 2 * k + 1;
+			if (block > 255)
+			{
+				ec = boost::asio::error::invalid_argument;
+				return;
+			}
+
+			code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<__u32>(cpu), 0, static_cast<__u8>(block)));
+			if (k == 1)
+			{
+				code.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<__u32>(indexes[0])));
+				continue;
+			}
+
+			// A = random % k, 再按 A 选组里的一个.
+			code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<__u32>(SKF_AD_OFF + SKF_AD_RANDOM)));
+			code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<__u32>(k)));
+			for (std::size_t j = 0; j + 1 < k; j++)
+			{
+				code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<__u32>(j), 0, 1));
+				code.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<__u32>(indexes[j])));
+			}
+			code.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<__u32>(indexes[k - 1])));
+		}
+		code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<__u32>(cpu_of_index.size())));
+		code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+
+		sock_fprog prog{ static_cast<unsigned short>(code.size()), code.data() };
+		if (::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+		else
+			ec = {};
+#else
+		(void)fd;
+		(void)cpu_of_index;
+		ec = boost::asio::error::operation_not_supported;
 #endif
 	}
 }
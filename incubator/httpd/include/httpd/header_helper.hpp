@@ -19,6 +19,14 @@ namespace httpd {
 
     std::optional<BytesRange> parse_range(std::string_view range);
     std::string make_http_last_modified(std::time_t t);
+
+    // 按 RFC 7231 IMF-fixdate 格式化, 固定输出 29 个字符, 不依赖 locale, 不分配内存.
+    constexpr std::size_t http_date_length = 29;
+    void format_http_date(std::time_t t, char* out);
+
+    // 每线程按秒缓存的 HTTP 日期字符串, 用于 Date/Expires 这类每个响应都要带的头.
+    // 返回的 string_view 在本线程下一次调用前有效, 调用方应立即拷贝 (比如 res.set).
+    std::string_view cached_http_date(std::time_t t);
     std::string make_cpntent_range(BytesRange, std::uint64_t content_length);
 
     std::map<std::string, std::string> parse_cookie(std::string_view cookie_line);
@@ -0,0 +1,122 @@
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast.hpp>
+
+#include "httpd/http_stream.hpp"
+#include "httpd/timer_wheel.hpp"
+#include "httpd/http2/frame.hpp"
+#include "httpd/http2/hpack.hpp"
+#include "httpd/http2/server_stream.hpp"
+
+namespace httpd::http2 {
+
+	typedef boost::beast::http::request<boost::beast::http::string_body> request;
+
+	struct settings
+	{
+		std::uint32_t max_concurrent_streams = 100;
+		std::uint32_t max_header_list_size = 16384;
+		// 单个请求 body 的上限, 超过了 RST_STREAM.
+		std::size_t body_limit = 1024 * 1024;
+		// 收齐请求头后按请求决定这个 stream 的 body 上限, 不设置时都用 body_limit.
+		std::function<std::size_t(const request&)> stream_body_limit;
+		// 没有进行中的 stream 超过这么久就关闭连接, 0 表示不限制. PING 之类的帧不会延长它.
+		std::chrono::steady_clock::duration idle_timeout{};
+	};
+
+	// 服务端的 HTTP/2 连接. 每个 stream 收齐请求后, 用一个 server_stream 作为 http_any_stream
+	// 调用 handler, 多个 stream 的 handler 并发执行, 响应按帧交错发送.
+	class server_connection : public std::enable_shared_from_this<server_connection>
+	{
+		friend class server_stream;
+
+	public:
+		typedef std::function<boost::asio::awaitable<void>(request&, http_any_stream&)> handler_type;
+
+		// stream 和 buffer 的生命期由调用方保证. buffer 里可能已经有探测 h2c 时读到的数据.
+		server_connection(http_any_stream& stream, boost::beast::flat_buffer& buffer, settings s = {});
+
+		// 跑到连接关闭为止.
+		boost::asio::awaitable<void> run(handler_type handler);
+
+		// 平滑关闭: 发 GOAWAY, 不再接受新的 stream, 已有的处理完后关闭连接. 在连接的 executor 上调用.
+		void shutdown();
+
+	private:
+		boost::asio::awaitable<void> read_loop();
+		boost::asio::awaitable<void> write_loop();
+		boost::asio::awaitable<bool> fill(std::size_t size, boost::system::error_code& ec);
+
+		error_code process_frame(const frame_header& h, std::string_view payload);
+		error_code on_headers(const frame_header& h, std::string_view payload);
+		error_code on_header_block_complete();
+		error_code on_data(const frame_header& h, std::string_view payload);
+		error_code on_settings(const frame_header& h, std::string_view payload);
+		error_code on_window_update(const frame_header& h, std::string_view payload);
+		error_code on_rst_stream(const frame_header& h, std::string_view payload);
+
+		void start_handler(std::shared_ptr<stream_state> st);
+		// streams_ 空了开始计空闲超时, 有 stream 时取消.
+		void update_idle_deadline();
+		void reset_stream(std::uint32_t stream_id, error_code code);
+
+		void queue_frame(std::string frame);
+		void queue_headers(std::uint32_t stream_id, std::string_view block, bool end_stream);
+		void queue_data(std::uint32_t stream_id, std::string_view payload, bool end_stream);
+		void queue_window_update(std::uint32_t stream_id, std::uint32_t increment);
+
+		// 给 server_stream 用的.
+		boost::asio::awaitable<boost::system::error_code> write_response(std::shared_ptr<stream_state> st, std::string data);
+		void close_stream(const std::shared_ptr<stream_state>& st);
+
+		http_any_stream& stream_;
+		boost::beast::flat_buffer& buffer_;
+		settings settings_;
+		handler_type handler_;
+		boost::asio::any_io_executor executor_;
+		deadline idle_deadline_;
+
+		hpack_decoder decoder_;
+		hpack_encoder encoder_;
+
+		// 还没结束的 stream, handler 执行完才会移除, 所以 RST_STREAM 不会让并发数超出限制.
+		std::map<std::uint32_t, std::shared_ptr<stream_state>> streams_;
+		std::uint32_t last_stream_id_ = 0;
+
+		// 正在接收的 header block (HEADERS + CONTINUATION).
+		std::uint32_t header_stream_id_ = 0;
+		std::uint8_t header_flags_ = 0;
+		bool expect_continuation_ = false;
+		std::string header_block_;
+
+		// 对端的设置和发送窗口.
+		std::uint32_t peer_initial_window_ = default_window_size;
+		std::uint32_t peer_max_frame_size_ = default_max_frame_size;
+		std::int64_t send_window_ = default_window_size;
+
+		std::deque<std::string> write_queue_;
+		// 这两个 timer 永不到期, 只用来 cancel 唤醒等待者.
+		boost::asio::steady_timer write_notify_;
+		boost::asio::steady_timer window_notify_;
+		bool closing_ = false;
+		bool goaway_sent_ = false;
+	};
+
+	// TLS 连接看 ALPN 是否协商出了 h2, 明文连接看开头是不是 h2c 的连接序言.
+	// 明文时读到的数据留在 buffer 里, 不是 h2c 的话接着交给 HTTP/1.1 的 parser.
+	boost::asio::awaitable<bool> is_http2_connection(http_any_stream& stream, boost::beast::flat_buffer& buffer);
+
+	// 给 ssl context 设置 ALPN 回调, 客户端支持 h2 时优先选 h2, 否则 http/1.1.
+	void enable_alpn(boost::asio::ssl::context& ctx);
+}
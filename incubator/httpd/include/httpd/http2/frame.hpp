@@ -0,0 +1,115 @@
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// RFC 9113 帧格式和常量.
+
+namespace httpd::http2 {
+
+	// 客户端连接序言. h2c 靠它识别 prior-knowledge 的连接.
+	inline constexpr std::string_view client_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+	inline constexpr std::size_t frame_header_length = 9;
+
+	enum class frame_type : std::uint8_t
+	{
+		data = 0x0,
+		headers = 0x1,
+		priority = 0x2,
+		rst_stream = 0x3,
+		settings = 0x4,
+		push_promise = 0x5,
+		ping = 0x6,
+		goaway = 0x7,
+		window_update = 0x8,
+		continuation = 0x9,
+	};
+
+	namespace flags {
+		inline constexpr std::uint8_t end_stream = 0x1;
+		inline constexpr std::uint8_t ack = 0x1;
+		inline constexpr std::uint8_t end_headers = 0x4;
+		inline constexpr std::uint8_t padded = 0x8;
+		inline constexpr std::uint8_t priority = 0x20;
+	}
+
+	enum class error_code : std::uint32_t
+	{
+		no_error = 0x0,
+		protocol_error = 0x1,
+		internal_error = 0x2,
+		flow_control_error = 0x3,
+		settings_timeout = 0x4,
+		stream_closed = 0x5,
+		frame_size_error = 0x6,
+		refused_stream = 0x7,
+		cancel = 0x8,
+		compression_error = 0x9,
+		connect_error = 0xa,
+		enhance_your_calm = 0xb,
+		inadequate_security = 0xc,
+		http_1_1_required = 0xd,
+	};
+
+	enum class settings_id : std::uint16_t
+	{
+		header_table_size = 0x1,
+		enable_push = 0x2,
+		max_concurrent_streams = 0x3,
+		initial_window_size = 0x4,
+		max_frame_size = 0x5,
+		max_header_list_size = 0x6,
+	};
+
+	inline constexpr std::uint32_t default_window_size = 65535;
+	inline constexpr std::uint32_t max_window_size = 0x7fffffff;
+	inline constexpr std::uint32_t default_max_frame_size = 16384;
+	inline constexpr std::uint32_t max_max_frame_size = 0xffffff;
+
+	struct frame_header
+	{
+		std::uint32_t length;
+		frame_type type;
+		std::uint8_t flags;
+		std::uint32_t stream_id;
+	};
+
+	inline std::uint32_t read_uint32(const char* p)
+	{
+		auto u = reinterpret_cast<const unsigned char*>(p);
+		return (std::uint32_t(u[0]) << 24) | (std::uint32_t(u[1]) << 16) | (std::uint32_t(u[2]) << 8) | u[3];
+	}
+
+	inline void append_uint32(std::string& out, std::uint32_t v)
+	{
+		out.push_back(static_cast<char>(v >> 24));
+		out.push_back(static_cast<char>(v >> 16));
+		out.push_back(static_cast<char>(v >> 8));
+		out.push_back(static_cast<char>(v));
+	}
+
+	// p 至少要有 frame_header_length 字节.
+	inline frame_header parse_frame_header(const char* p)
+	{
+		auto u = reinterpret_cast<const unsigned char*>(p);
+		return frame_header{
+			(std::uint32_t(u[0]) << 16) | (std::uint32_t(u[1]) << 8) | u[2],
+			static_cast<frame_type>(u[3]),
+			u[4],
+			read_uint32(p + 5) & 0x7fffffff,
+		};
+	}
+
+	inline void append_frame_header(std::string& out, std::uint32_t length, frame_type type, std::uint8_t flags, std::uint32_t stream_id)
+	{
+		out.push_back(static_cast<char>(length >> 16));
+		out.push_back(static_cast<char>(length >> 8));
+		out.push_back(static_cast<char>(length));
+		out.push_back(static_cast<char>(type));
+		out.push_back(static_cast<char>(flags));
+		append_uint32(out, stream_id & 0x7fffffff);
+	}
+}
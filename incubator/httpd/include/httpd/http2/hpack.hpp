@@ -0,0 +1,60 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// RFC 7541 HPACK 头部压缩.
+
+namespace httpd::http2 {
+
+	struct header_field
+	{
+		std::string name;
+		std::string value;
+	};
+
+	// huffman 编解码. 解码遇到非法的填充或者 EOS 返回 false.
+	bool huffman_decode(std::string_view in, std::string& out);
+	void huffman_encode(std::string_view in, std::string& out);
+	std::size_t huffman_encoded_length(std::string_view in);
+
+	// 带 prefix_bits 位前缀的整数编码. first_byte 里高位是调用方给的标志位.
+	void encode_integer(std::string& out, std::uint8_t first_byte, int prefix_bits, std::uint64_t value);
+
+	class hpack_decoder
+	{
+	public:
+		explicit hpack_decoder(std::size_t max_table_size = 4096);
+
+		// 解码一个完整的 header block (HEADERS + 所有 CONTINUATION 拼起来).
+		// 解码后的头总大小超过 max_list_size 或者编码有误返回 false, 对应 COMPRESSION_ERROR.
+		bool decode(std::string_view block, std::vector<header_field>& out, std::size_t max_list_size);
+
+		std::size_t table_size() const { return size_; }
+
+	private:
+		bool lookup(std::uint64_t index, header_field& out) const;
+		void insert(header_field field);
+		void evict(std::size_t max_size);
+
+		// 动态表, 新的在前面.
+		std::deque<header_field> entries_;
+		std::size_t size_ = 0;
+		std::size_t max_size_;
+		// SETTINGS_HEADER_TABLE_SIZE, 对端的 size update 不能超过它.
+		std::size_t settings_max_size_;
+	};
+
+	// 编码器不使用动态表, 只用静态表索引和不索引的字面量, 因此不需要关心对端的 SETTINGS_HEADER_TABLE_SIZE.
+	// name 必须是小写的.
+	class hpack_encoder
+	{
+	public:
+		void encode(std::string& out, std::string_view name, std::string_view value);
+	};
+}
@@ -0,0 +1,82 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/asio/any_completion_handler.hpp>
+#include <boost/beast/core/role.hpp>
+
+namespace httpd::http2 {
+
+	class server_connection;
+	struct stream_state;
+
+	// HTTP/2 连接上的一个 stream, 作为 http_any_stream 的一种, 让现有的 HTTP/1.1 处理代码不用改.
+	// 写进来的是序列化好的 HTTP/1.1 响应, server_connection 把它翻译成 HEADERS 和 DATA 帧,
+	// 写操作在流控窗口允许发送之前不会完成. 请求 body 已经在 request 里了, 读总是返回 eof.
+	class server_stream
+	{
+	public:
+		typedef boost::asio::any_io_executor executor_type;
+		typedef boost::asio::any_completion_handler<void(boost::system::error_code, std::size_t)> write_handler;
+
+		// 每次 async_write_some 最多接收的字节数, 剩下的由调用方 (beast 的 async_write) 再写.
+		static constexpr std::size_t max_write_size = 64 * 1024;
+
+		server_stream(std::shared_ptr<server_connection> connection, std::shared_ptr<stream_state> state, executor_type executor);
+
+		executor_type get_executor() { return executor_; }
+
+		template<typename MutableBufferSequence, typename H>
+		auto async_read_some(const MutableBufferSequence&, H&& handler)
+		{
+			return boost::asio::async_initiate<H, void(boost::system::error_code, std::size_t)>(
+				[this](auto handler) mutable
+				{
+					boost::system::error_code ec = boost::asio::error::eof;
+					boost::asio::post(executor_, boost::asio::append(std::move(handler), ec, std::size_t(0)));
+				}, handler);
+		}
+
+		template<typename ConstBufferSequence, typename H>
+		auto async_write_some(const ConstBufferSequence& b, H&& handler)
+		{
+			return boost::asio::async_initiate<H, void(boost::system::error_code, std::size_t)>(
+				[this](auto handler, const ConstBufferSequence& b) mutable
+				{
+					std::string data(std::min(boost::asio::buffer_size(b), max_write_size), '\0');
+					boost::asio::buffer_copy(boost::asio::buffer(data), b);
+					start_write(std::move(data), write_handler(std::move(handler)));
+				}, handler, b);
+		}
+
+		// 响应已经完整发出时什么都不做, 否则 RST_STREAM.
+		void close();
+
+		// 超时由所在的连接负责.
+		template<typename Duration>
+		void expires_after(Duration) {}
+
+		template<class TeardownHandler>
+		auto async_teardown(boost::beast::role_type, TeardownHandler&& handler)
+		{
+			return boost::asio::async_initiate<TeardownHandler, void(const boost::system::error_code&)>(
+				[this](auto handler) mutable
+				{
+					close();
+					boost::asio::post(executor_, boost::asio::append(std::move(handler), boost::system::error_code{}));
+				}, handler);
+		}
+
+	private:
+		void start_write(std::string data, write_handler handler);
+
+		std::shared_ptr<server_connection> connection_;
+		std::shared_ptr<stream_state> state_;
+		executor_type executor_;
+	};
+}
@@ -10,7 +10,9 @@
 #include <string_view>
 
 namespace httpd {
-	std::string get_mime_type_from_extension(std::string_view extension);
+	std::string_view get_mime_type_from_extension(std::string_view extension);
+	// 取 path 的扩展名 (不构造 std::filesystem::path) 再查 mime 表.
+	std::string_view get_mime_type_from_path(std::string_view path);
 
 	time_t dos2unixtime(unsigned long dostime);
 	std::string decodeURIComponent(std::string_view str);
@@ -7,13 +7,16 @@
 #include <boost/beast.hpp>
 #include <boost/beast/ssl.hpp>
 
+#include "httpd/ktls_stream.hpp"
+#include "httpd/http2/server_stream.hpp"
+
 namespace httpd {
 
 using namespace boost::variant2;
 
 typedef boost::beast::basic_stream<boost::asio::local::stream_protocol> unix_stream;
 
-// 把 ssl 和 非 ssl 封成一个 variant.
+// 把 ssl 和 非 ssl 封成一个 variant. HTTP/2 的 stream 也是其中一种, 这样处理 http 请求的代码可以共用.
 template <typename... StreamTypes>
 class http_stream : public variant<StreamTypes...>
 {
@@ -28,20 +31,27 @@ public:
         }, *this);
     }
 
+    // 用 async_initiate 包一层, 这样 use_awaitable 之类的 completion token 也能直接用.
     template<typename MutableBufferSequence, typename H>
     auto async_read_some(const MutableBufferSequence& b, H&& handler)
     {
-        return visit([&b, handler = std::forward<H>(handler)](auto && realtype) mutable -> void {
-            return realtype.async_read_some(b, std::forward<H>(handler));
-        }, *this);
+        return boost::asio::async_initiate<H, void(boost::system::error_code, std::size_t)>(
+            [this](auto handler, const MutableBufferSequence& b) mutable {
+                visit([&b, &handler](auto && realtype) mutable -> void {
+                    realtype.async_read_some(b, std::move(handler));
+                }, *this);
+            }, handler, b);
     }
 
     template<typename ConstBufferSequence, typename H>
     auto async_write_some(const ConstBufferSequence& b, H&& handler)
     {
-        visit([&b, handler = std::forward<H>(handler)](auto && realtype) mutable -> void {
-            return realtype.async_write_some(b, std::forward<H>(handler));
-        }, *this);
+        return boost::asio::async_initiate<H, void(boost::system::error_code, std::size_t)>(
+            [this](auto handler, const ConstBufferSequence& b) mutable {
+                visit([&b, &handler](auto && realtype) mutable -> void {
+                    realtype.async_write_some(b, std::move(handler));
+                }, *this);
+            }, handler, b);
     }
 
     auto close()
@@ -54,7 +64,10 @@ public:
     auto expires_after(auto expiry_time)
     {
         return visit([expiry_time](auto && realtype) mutable {
-            return boost::beast::get_lowest_layer(realtype).expires_after(expiry_time);
+            if constexpr (requires { realtype.expires_after(expiry_time); })
+                return realtype.expires_after(expiry_time);
+            else
+                return boost::beast::get_lowest_layer(realtype).expires_after(expiry_time);
         }, *this);
     }
 
@@ -63,6 +76,8 @@ public:
         return visit([](auto && realtype) mutable -> boost::asio::ip::tcp::socket& {
             if constexpr (std::is_same_v<std::decay_t<decltype(realtype)>, httpd::unix_stream>)
                 throw std::runtime_error("not a tcp socket");
+            else if constexpr (std::is_same_v<std::decay_t<decltype(realtype)>, httpd::http2::server_stream>)
+                throw std::runtime_error("not a tcp socket");
             else
                 return boost::beast::get_lowest_layer(realtype).socket();
         }, *this);
@@ -84,13 +99,30 @@ public:
         return boost::asio::async_initiate<TeardownHandler, void(const boost::system::error_code&)>(
             [role, this](auto&& handler) mutable {
                 return visit([role, handler = std::move(handler)](auto&& realtype) mutable {
-                    boost::beast::async_teardown(role, realtype, std::move(handler));
+                    if constexpr (requires { realtype.async_teardown(role, std::move(handler)); })
+                        realtype.async_teardown(role, std::move(handler));
+                    else
+                        boost::beast::async_teardown(role, realtype, std::move(handler));
                 }, *this);
             }, handler);
     }
 };
 
-typedef http_stream<boost::beast::tcp_stream, boost::beast::ssl_stream<boost::beast::tcp_stream>, unix_stream> http_any_stream;
+typedef http_stream<boost::beast::tcp_stream, boost::beast::ssl_stream<boost::beast::tcp_stream>, unix_stream, http2::server_stream, ktls_stream> http_any_stream;
+
+// 按连接实际的 stream 类型调用 f, 只在连接开始时 visit 一次.
+// f 里面的读写直接作用在具体类型上, beast 的组合操作不再每次 read_some/write_some 都经过 variant.
+// HTTP/2 的 server_stream 不是一条连接, 不会传给 f.
+template <typename F>
+decltype(auto) visit_connection_stream(http_any_stream& s, F&& f)
+{
+    return visit([&f](auto && realtype) mutable -> decltype(f(std::declval<boost::beast::tcp_stream&>())) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(realtype)>, http2::server_stream>)
+            throw std::runtime_error("not a connection stream");
+        else
+            return f(realtype);
+    }, s);
+}
 
 }
 
@@ -1,21 +1,23 @@
 
 #pragma once
 
-#include <map>
 #include <string>
+#include <string_view>
 
 #include <boost/beast.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/awaitable.hpp>
 
+#include "httpd/arena.hpp"
 #include "httpd/http_stream.hpp"
 
 using boost::asio::awaitable;
 
 
 namespace httpd {
+    // headers 的分配器一般指向连接上的 request_arena, res_body 直接发送, 不会拷贝.
     awaitable<boost::system::error_code> send_string_response_body(http_any_stream& client,
-        std::string res_body,
-        std::map<boost::beast::http::field, std::string> headers, int http_version, bool keepalive, boost::beast::http::status status = boost::beast::http::status::ok);
+        std::string_view res_body,
+        response_fields headers, int http_version, bool keepalive, boost::beast::http::status status = boost::beast::http::status::ok);
 
 }
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+#include <boost/asio.hpp>
+#include <boost/asio/experimental/channel.hpp>
+
+namespace httpd {
+
+	// 一个连接上正在处理的请求的总开销上限, 每个请求按自己的开销占用额度.
+	// 读协程在 async_acquire 上等着的时候不再读新消息, 背压经过 TCP 传回客户端.
+	// 不加锁, 只能在连接所在 io_context 的线程上使用, 同时只能有一个协程在 async_acquire 上等.
+	class inflight_limit
+	{
+		inflight_limit(const inflight_limit&) = delete;
+		inflight_limit& operator=(const inflight_limit&) = delete;
+
+	public:
+		// capacity 为 0 表示不限制.
+		inflight_limit(boost::asio::any_io_executor executor, std::size_t capacity);
+
+		// 把开销折算成实际占用的额度. 超过 capacity 的按 capacity 算, 等其他请求都结束后独占.
+		std::size_t clamp(std::size_t cost) const;
+
+		// 等到剩余额度放得下 cost 后占用. cost 要先经过 clamp.
+		boost::asio::awaitable<void> async_acquire(std::size_t cost);
+
+		void release(std::size_t cost);
+
+		std::size_t in_use() const
+		{
+			return in_use_;
+		}
+
+		// 因为额度用完而等待的次数.
+		std::size_t waits() const
+		{
+			return waits_;
+		}
+
+	private:
+		std::size_t capacity_;
+		std::size_t in_use_ = 0;
+		std::size_t waits_ = 0;
+
+		boost::asio::experimental::channel<void(boost::system::error_code)> doorbell_;
+	};
+}
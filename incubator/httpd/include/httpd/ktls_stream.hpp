@@ -0,0 +1,215 @@
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket/teardown.hpp>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace httpd {
+
+	// OpenSSL 直接读写 socket (socket BIO), 而不是像 asio::ssl::stream 那样经过内存 BIO.
+	// 这样握手完成后 OpenSSL 可以把记录层交给内核 (kTLS), 之后的 SSL_read/SSL_write 在内核里加解密.
+	// 内核, cipher 或者 OpenSSL 本身 (OPENSSL_NO_KTLS) 不支持时, OpenSSL 自动留在用户态加解密.
+	class ktls_stream
+	{
+	public:
+		typedef boost::asio::any_io_executor executor_type;
+		typedef boost::beast::tcp_stream next_layer_type;
+
+		template <typename Executor>
+		ktls_stream(Executor&& ex, boost::asio::ssl::context& ctx)
+			: next_layer_(std::forward<Executor>(ex))
+			, ssl_(SSL_new(ctx.native_handle()))
+			, timer_(std::make_shared<boost::asio::steady_timer>(next_layer_.get_executor()))
+		{
+			if (!ssl_)
+				throw boost::system::system_error(
+					boost::system::error_code(static_cast<int>(ERR_get_error()), boost::asio::error::get_ssl_category()), "SSL_new");
+
+			SSL_set_mode(ssl_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_ENABLE_KTLS
+			SSL_set_options(ssl_, SSL_OP_ENABLE_KTLS);
+#endif
+		}
+
+		ktls_stream(const ktls_stream&) = delete;
+		ktls_stream& operator=(const ktls_stream&) = delete;
+
+		~ktls_stream()
+		{
+			SSL_free(ssl_);
+		}
+
+		executor_type get_executor() { return next_layer_.get_executor(); }
+
+		next_layer_type& next_layer() { return next_layer_; }
+
+		SSL* native_handle() { return ssl_; }
+
+		// 握手完成后才有意义.
+		bool ktls_send() const
+		{
+#ifndef OPENSSL_NO_KTLS
+			return BIO_get_ktls_send(SSL_get_wbio(ssl_));
+#else
+			return false;
+#endif
+		}
+
+		bool ktls_recv() const
+		{
+#ifndef OPENSSL_NO_KTLS
+			return BIO_get_ktls_recv(SSL_get_rbio(ssl_));
+#else
+			return false;
+#endif
+		}
+
+		// tcp_stream 的超时只对它自己的读写操作生效, 而这里等的是 socket 可读/可写.
+		// 所以自己挂一个定时器, 到期就关掉 socket, 正在等待的操作随之出错返回.
+		void expires_after(boost::asio::steady_timer::duration expiry_time)
+		{
+			timer_->expires_after(expiry_time);
+			timer_->async_wait([this, weak_timer = std::weak_ptr<boost::asio::steady_timer>(timer_)](boost::system::error_code ec)
+			{
+				auto timer = weak_timer.lock();
+				if (ec || !timer || timer->expiry() > boost::asio::steady_timer::clock_type::now())
+					return;
+				next_layer_.socket().close(ec);
+			});
+		}
+
+		// 服务端握手.
+		template <typename H>
+		auto async_handshake(H&& handler)
+		{
+			auto& socket = next_layer_.socket();
+			boost::system::error_code ec;
+			socket.non_blocking(true, ec);
+			SSL_set_fd(ssl_, static_cast<int>(socket.native_handle()));
+			SSL_set_accept_state(ssl_);
+
+			return async_ssl_op<void(boost::system::error_code)>(
+				[this](std::size_t&) { return SSL_do_handshake(ssl_); }, std::forward<H>(handler));
+		}
+
+		template <typename MutableBufferSequence, typename H>
+		auto async_read_some(const MutableBufferSequence& b, H&& handler)
+		{
+			auto buf = boost::beast::buffers_front(b);
+			return async_ssl_op<void(boost::system::error_code, std::size_t)>(
+				[this, buf](std::size_t& n) { return buf.size() ? SSL_read_ex(ssl_, buf.data(), buf.size(), &n) : 1; },
+				std::forward<H>(handler));
+		}
+
+		template <typename ConstBufferSequence, typename H>
+		auto async_write_some(const ConstBufferSequence& b, H&& handler)
+		{
+			auto buf = boost::beast::buffers_front(b);
+			return async_ssl_op<void(boost::system::error_code, std::size_t)>(
+				[this, buf](std::size_t& n) { return buf.size() ? SSL_write_ex(ssl_, buf.data(), buf.size(), &n) : 1; },
+				std::forward<H>(handler));
+		}
+
+		// 尽力发一个 close_notify, 不等对方回应, 然后关闭 tcp.
+		template <typename TeardownHandler>
+		void async_teardown(boost::beast::role_type role, TeardownHandler&& handler)
+		{
+			ERR_clear_error();
+			SSL_shutdown(ssl_);
+			boost::beast::websocket::async_teardown(role, next_layer_.socket(), std::forward<TeardownHandler>(handler));
+		}
+
+	private:
+		// 反复调用 op 直到它不再需要等待 socket 可读/可写.
+		// op 返回 SSL_xxx 的返回值, 成功时通过参数给出传输的字节数.
+		template <typename Signature, typename Op, typename H>
+		auto async_ssl_op(Op op, H&& handler)
+		{
+			auto finish = [](auto& self, boost::system::error_code ec, std::size_t n)
+			{
+				if constexpr (std::is_same_v<Signature, void(boost::system::error_code)>)
+					self.complete(ec);
+				else
+					self.complete(ec, n);
+			};
+
+			return boost::asio::async_compose<H, Signature>(
+				[this, op, finish, waited = false, result_ec = boost::system::error_code{}, result_size = std::size_t(0), completed = false]
+				(auto& self, boost::system::error_code ec = {}) mutable
+				{
+					if (completed)
+						return finish(self, result_ec, result_size);
+
+					if (ec)
+						return finish(self, ec, 0);
+
+					ERR_clear_error();
+					errno = 0;
+					std::size_t n = 0;
+					int ret = op(n);
+
+					if (ret <= 0)
+					{
+						switch (SSL_get_error(ssl_, ret))
+						{
+							case SSL_ERROR_WANT_READ:
+								waited = true;
+								return next_layer_.socket().async_wait(boost::asio::socket_base::wait_read, std::move(self));
+							case SSL_ERROR_WANT_WRITE:
+								waited = true;
+								return next_layer_.socket().async_wait(boost::asio::socket_base::wait_write, std::move(self));
+							case SSL_ERROR_ZERO_RETURN:
+								ec = boost::asio::error::eof;
+								break;
+							case SSL_ERROR_SYSCALL:
+								if (ERR_peek_error() == 0)
+								{
+									ec = errno ? boost::system::error_code(errno, boost::system::system_category())
+										: boost::system::error_code(boost::asio::ssl::error::stream_truncated);
+									break;
+								}
+								[[fallthrough]];
+							default:
+								ec = boost::system::error_code(static_cast<int>(ERR_get_error()), boost::asio::error::get_ssl_category());
+								break;
+						}
+					}
+
+					// 一次都没等待就完成了, 不能在发起函数里直接调用 handler.
+					if (!waited)
+					{
+						completed = true;
+						result_ec = ec;
+						result_size = n;
+						return boost::asio::post(next_layer_.get_executor(), std::move(self));
+					}
+
+					finish(self, ec, n);
+				},
+				handler, next_layer_.socket());
+		}
+
+		next_layer_type next_layer_;
+		SSL* ssl_;
+		// 超时回调用 weak_ptr 判断 stream 是否还活着.
+		std::shared_ptr<boost::asio::steady_timer> timer_;
+	};
+
+	// websocket::stream<ktls_stream&> 关闭时通过 ADL 找到它.
+	template <typename TeardownHandler>
+	void async_teardown(boost::beast::role_type role, ktls_stream& stream, TeardownHandler&& handler)
+	{
+		stream.async_teardown(role, std::forward<TeardownHandler>(handler));
+	}
+}
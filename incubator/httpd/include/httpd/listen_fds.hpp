@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+// 继承监听 socket, 让重启期间一直有进程在 accept:
+// systemd socket activation (LISTEN_FDS), 或者旧进程通过 unix socket 把监听 fd 交给新进程.
+// 都是 POSIX 才有的, 其他平台上返回空或者 operation_not_supported.
+
+namespace httpd {
+
+	// systemd socket activation. 只在 LISTEN_PID 是本进程时生效, 取完清掉环境变量,
+	// 免得子进程再继承. 返回的 fd 已经设置了 FD_CLOEXEC.
+	std::vector<int> take_systemd_listen_fds();
+
+	// fd 是否是监听在 listen_address (--ws/--wss 里的 "ip:port" 格式) 上的 TCP socket.
+	bool is_tcp_listener_on(int fd, const std::string& listen_address);
+
+	// fd 是否是监听在 path 上的 unix socket.
+	bool is_unix_listener_on(int fd, const std::string& path);
+
+	// 通过已连接的 unix socket 一次发送一组 fd (SCM_RIGHTS), 阻塞调用.
+	void send_listen_fds(int unix_socket, const std::vector<int>& fds, boost::system::error_code& ec);
+
+	// 接收 send_listen_fds 发过来的 fd, 阻塞调用. 返回的 fd 已经设置了 FD_CLOEXEC.
+	std::vector<int> receive_listen_fds(int unix_socket, boost::system::error_code& ec);
+}
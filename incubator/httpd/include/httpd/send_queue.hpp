@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/experimental/concurrent_channel.hpp>
+
+namespace httpd {
+
+	// 队列积压超过水位线时怎么办.
+	enum class overflow_policy
+	{
+		// 断开连接, 客户端重连后重新同步.
+		disconnect,
+		// 丢掉最早的消息, 直到放得下新消息.
+		drop_oldest,
+	};
+
+	struct send_queue_config
+	{
+		// 队列里还没写出去的字节数上限. 队列为空时单条消息不受限制.
+		std::size_t high_water_bytes = 4 * 1024 * 1024;
+
+		// 一次合并写出的字节数上限.
+		std::size_t max_batch_bytes = 64 * 1024;
+
+		overflow_policy policy = overflow_policy::disconnect;
+	};
+
+	struct send_queue_stats
+	{
+		std::uint64_t queued_messages;
+		std::uint64_t sent_messages;
+		// 多条消息合成一次写的次数.
+		std::uint64_t coalesced_writes;
+		std::uint64_t dropped_messages;
+		std::uint64_t dropped_bytes;
+		std::uint64_t overflow_disconnects;
+	};
+
+	// 多个 send_queue 共用的计数.
+	class send_queue_counters
+	{
+	public:
+		send_queue_stats stats() const;
+
+	private:
+		friend class send_queue;
+
+		std::atomic<std::uint64_t> queued_messages_{ 0 };
+		std::atomic<std::uint64_t> sent_messages_{ 0 };
+		std::atomic<std::uint64_t> coalesced_writes_{ 0 };
+		std::atomic<std::uint64_t> dropped_messages_{ 0 };
+		std::atomic<std::uint64_t> dropped_bytes_{ 0 };
+		std::atomic<std::uint64_t> overflow_disconnects_{ 0 };
+	};
+
+	// 排队的消息. 广播时多个连接的队列共享同一块只读缓冲, 不再各拷一份.
+	using shared_message = std::shared_ptr<const std::string>;
+
+	// 一个连接的发送队列, 按字节数设水位线. push 可以在任意线程调用,
+	// async_pop 只能有一个写协程在等.
+	class send_queue
+	{
+		send_queue(const send_queue&) = delete;
+		send_queue& operator=(const send_queue&) = delete;
+
+	public:
+		send_queue(boost::asio::any_io_executor executor, const send_queue_config& config, send_queue_counters* counters = nullptr);
+
+		// 队列已关闭, 或者因为积压被关闭 (disconnect 策略) 时返回 false.
+		bool push(shared_message message);
+
+		bool push(std::string message)
+		{
+			return push(std::make_shared<const std::string>(std::move(message)));
+		}
+
+		// 等到有消息, 取出一批: 至少一条, 总字节数不超过 max_batch_bytes.
+		// 队列关闭后返回 false.
+		boost::asio::awaitable<bool> async_pop(std::vector<shared_message>& batch);
+
+		void close();
+
+		// 不再接受新消息, 已经排队的照常取完, 然后 async_pop 返回 false.
+		// 写协程随后用 close_code() 给客户端发 close 帧.
+		void shutdown(std::uint16_t close_code);
+
+		// shutdown 时给的 close code, 没有 shutdown 过是 0.
+		std::uint16_t close_code() const;
+
+		// 是否因为积压被关闭.
+		bool overflowed() const;
+
+		std::size_t pending_bytes() const;
+
+	private:
+		send_queue_config config_;
+		send_queue_counters* counters_;
+
+		mutable std::mutex mutex_;
+		std::deque<shared_message> queue_;
+		std::size_t bytes_ = 0;
+		bool closed_ = false;
+		bool overflowed_ = false;
+		std::uint16_t close_code_ = 0;
+
+		// 只用来唤醒写协程, 满了说明已经唤醒过了.
+		boost::asio::experimental::concurrent_channel<void(boost::system::error_code)> doorbell_;
+	};
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace httpd {
+
+	class timer_wheel;
+
+	namespace detail {
+
+		// 侵入式双向循环链表的节点. 时间轮的每个槽有一个自指向的头节点.
+		struct wheel_link
+		{
+			wheel_link* prev = nullptr;
+			wheel_link* next = nullptr;
+
+			void self_link() { prev = next = this; }
+			bool linked() const { return prev != nullptr; }
+
+			void link_before(wheel_link* pos)
+			{
+				prev = pos->prev;
+				next = pos;
+				pos->prev->next = this;
+				pos->prev = this;
+			}
+
+			void unlink()
+			{
+				prev->next = next;
+				next->prev = prev;
+				prev = next = nullptr;
+			}
+		};
+	}
+
+	// 挂在 timer_wheel 上的一个超时. 一般作为连接的成员或者连接协程里的局部变量.
+	// 只能在所属 io_context 的线程上使用, 没有加锁.
+	class deadline : private detail::wheel_link
+	{
+		deadline(const deadline&) = delete;
+		deadline& operator=(const deadline&) = delete;
+
+	public:
+		explicit deadline(const boost::asio::any_io_executor& executor);
+		explicit deadline(timer_wheel& wheel);
+		~deadline();
+
+		// 到期时在 io_context 线程上调用, 一般是关闭连接, 让挂起的读写以错误返回.
+		void on_expire(std::function<void()> handler);
+
+		// 重新设置超时, O(1). 不会提前触发, 最多晚两个 tick.
+		void expires_after(std::chrono::steady_clock::duration d);
+
+		void cancel();
+
+		bool pending() const { return linked(); }
+
+	private:
+		friend class timer_wheel;
+
+		timer_wheel& wheel_;
+		std::function<void()> handler_;
+		std::size_t rounds_ = 0;
+	};
+
+	// 每个 io_context 一个的哈希时间轮 (asio service), 管理大量连接的读超时和空闲超时.
+	// 不管挂了多少 deadline 都只用一个 steady_timer, 而且没有 deadline 的时候不跑,
+	// 不会让 io_context::run() 无法退出.
+	class timer_wheel : public boost::asio::execution_context::service
+	{
+	public:
+		using key_type = timer_wheel;
+		static inline boost::asio::execution_context::id id;
+
+		// 默认 250ms 一个 tick, 256 个槽转一圈 64 秒, 更长的超时多转几圈.
+		// 要改的话在第一次使用之前 boost::asio::make_service<timer_wheel>(ctx, tick, slot_count).
+		explicit timer_wheel(boost::asio::execution_context& ctx,
+			std::chrono::steady_clock::duration tick = std::chrono::milliseconds(250), std::size_t slot_count = 256);
+
+		// 取 executor 所在 io_context 的时间轮.
+		static timer_wheel& of(const boost::asio::any_io_executor& executor);
+
+		std::size_t size() const { return size_; }
+
+	private:
+		friend class deadline;
+
+		void shutdown() override;
+
+		void schedule(deadline& d, std::chrono::steady_clock::duration after);
+		void cancel(deadline& d);
+
+		void wait_tick();
+		void on_tick();
+
+		std::chrono::steady_clock::duration tick_;
+		boost::asio::steady_timer timer_;
+		// 构造后不再改变大小, 头节点的地址是稳定的.
+		std::vector<detail::wheel_link> slots_;
+		std::size_t current_ = 0;
+		std::size_t size_ = 0;
+		bool ticking_ = false;
+	};
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <openssl/ssl.h>
+
+namespace httpd {
+
+	struct tls_session_config
+	{
+		// 服务端有状态 session cache 的条目数, 0 表示不用 session cache, 只靠 ticket.
+		long session_cache_size = 20480;
+
+		// session 和 ticket 的有效期.
+		std::chrono::seconds session_timeout = std::chrono::hours(2);
+
+		// 无状态的 session ticket.
+		bool session_tickets = true;
+
+		// ticket 密钥轮换周期. 轮换后旧密钥还保留一个周期用来解密, 用旧密钥恢复的连接会拿到新 ticket.
+		std::chrono::seconds ticket_key_rotation = std::chrono::hours(1);
+
+		// ECDHE 的曲线, 按优先级排列. 空字符串表示用 OpenSSL 的默认值.
+		std::string groups = "X25519:P-256:P-384";
+	};
+
+	struct tls_session_stats
+	{
+		std::uint64_t full_handshakes;
+		std::uint64_t resumed_handshakes;
+		std::uint64_t ticket_key_rotations;
+	};
+
+	// 给服务端 ssl context 配置 session 恢复, 并且在进程内管理和轮换 ticket 密钥.
+	// apply 之后, 这个对象的生命期必须比 ssl context 长.
+	class tls_session_manager
+	{
+		tls_session_manager(const tls_session_manager&) = delete;
+		tls_session_manager& operator=(const tls_session_manager&) = delete;
+
+	public:
+		explicit tls_session_manager(const tls_session_config& config = {});
+
+		// 失败抛 boost::system::system_error.
+		void apply(boost::asio::ssl::context& ctx);
+
+		void rotate_ticket_key();
+
+		// 按 ticket_key_rotation 周期轮换密钥, 直到被取消.
+		boost::asio::awaitable<void> ticket_key_rotate_loop();
+
+		tls_session_stats stats() const;
+
+		const tls_session_config& config() const { return config_; }
+
+	private:
+		struct ticket_key
+		{
+			std::array<unsigned char, 16> name;
+			std::array<unsigned char, 32> aes_key;
+			std::array<unsigned char, 32> hmac_key;
+		};
+
+		static ticket_key generate_ticket_key();
+
+		static int ticket_key_callback(SSL* ssl, unsigned char key_name[16], unsigned char* iv,
+			EVP_CIPHER_CTX* cipher_ctx, EVP_MAC_CTX* mac_ctx, int enc);
+		static void info_callback(const SSL* ssl, int where, int ret);
+
+		static tls_session_manager* from_ssl(const SSL* ssl);
+
+		tls_session_config config_;
+
+		// 回调在所有 io 线程上并发执行, 轮换在另一个线程上, 所以密钥要加锁.
+		mutable std::mutex key_mutex_;
+		ticket_key current_key_;
+		ticket_key previous_key_;
+
+		std::atomic<std::uint64_t> full_handshakes_{ 0 };
+		std::atomic<std::uint64_t> resumed_handshakes_{ 0 };
+		std::atomic<std::uint64_t> ticket_key_rotations_{ 0 };
+	};
+}
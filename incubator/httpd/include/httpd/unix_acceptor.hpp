@@ -23,6 +23,7 @@
 #include "detail/time_clock.hpp"
 
 #include "detail/wait_all.hpp"
+#include "admission.hpp"
 
 // 每线程一个 accept 的 多 socket accept 模式 适配器.
 
@@ -44,6 +45,7 @@ namespace httpd
 		boost::asio::local::stream_protocol::acceptor accept_socket_;
 		std::unordered_map<std::size_t, AcceptedClientClass> all_client;
 		bool accepting = false;
+		admission_control* admission_ = nullptr;
 
 	public:
 		unix_acceptor(const unix_acceptor&) = delete;
@@ -51,6 +53,7 @@ namespace httpd
 			: executor_(o.executor_)
 			, accept_socket_(std::move(o.accept_socket_))
 			, accepting(o.accepting)
+			, admission_(o.admission_)
 		{
 			BOOST_ASSERT_MSG(!o.accepting, "cannot move a socket that has pending IO");
 		};
@@ -72,6 +75,9 @@ namespace httpd
 
 		auto get_executor() { return accept_socket_.get_executor(); }
 
+		// 开始 accept 之前调用. 多个 acceptor 可以共用一个 admission_control.
+		void set_admission_control(admission_control& ac) { admission_ = &ac; }
+
 		void listen(std::string listen_address)
 		{
 			boost::system::error_code ec;
@@ -136,6 +142,18 @@ namespace httpd
 			std::filesystem::permissions(listen_address, std::filesystem::perms::all);
 		}
 
+		// 接管一个已经在 listen 的 fd (systemd 或者上一个进程交过来的), 不再 bind/listen.
+		void assign(int fd, boost::system::error_code& ec)
+		{
+			accept_socket_.assign(boost::asio::local::stream_protocol(), fd, ec);
+#ifdef HTTPD_ENABLE_LOGGING
+			if (ec)
+				LOG_ERR << "WS server assign listen fd failed: " << ec.message();
+#endif
+		}
+
+		int native_handle() { return accept_socket_.native_handle(); }
+
 		awaitable<void> run_accept_loop(int number_of_concurrent_acceptor)
 		{
 			boost::asio::cancellation_state cs = co_await boost::asio::this_coro::cancellation_state;
@@ -168,6 +186,31 @@ namespace httpd
 #endif
 		}
 
+		// 平滑退出: 关掉监听 socket 不再 accept, 在每个连接自己的 executor 上调用 drain() 让它收尾,
+		// 最多等 grace, 还没结束的再由 clean_shutdown 强制关闭. 要在本 acceptor 的 executor 上调用.
+		awaitable<void> graceful_shutdown(std::chrono::steady_clock::duration grace)
+		{
+			boost::system::error_code ignore_ec;
+			accept_socket_.close(ignore_ec);
+
+			for (auto& ws : all_client)
+			{
+				auto conn_ptr = ws.second;
+				boost::asio::post(conn_ptr->get_executor(), [conn_ptr]() { conn_ptr->drain(); });
+			}
+
+			auto deadline = std::chrono::steady_clock::now() + grace;
+			while (all_client.size() && std::chrono::steady_clock::now() < deadline)
+			{
+				using timer = boost::asio::basic_waitable_timer<time_clock::steady_clock>;
+				timer t(get_executor());
+				t.expires_from_now(std::chrono::milliseconds(20));
+				co_await t.async_wait(use_awaitable);
+			}
+
+			co_await clean_shutdown();
+		}
+
 		awaitable<void> clean_shutdown()
 		{
 			for (auto& ws : all_client)
@@ -203,6 +246,9 @@ namespace httpd
 
 				boost::system::error_code error;
 
+				if (admission_)
+					co_await admission_->wait_for_capacity();
+
 				auto client_ptr = executor_.make_shared_unixsocket_connection(get_executor(), connection_id);
 
 				co_await accept_socket_.async_accept(
@@ -223,6 +269,18 @@ namespace httpd
 				flags |= FD_CLOEXEC;
 				fcntl(fd, F_SETFD, flags);
 #endif
+				// unix socket 上没有客户端 IP, 只检查全局上限.
+				admission_control::ticket admission_ticket;
+				if (admission_)
+				{
+					admission_ticket = admission_->admit();
+					if (!admission_ticket)
+					{
+						admission_->reject(client_ptr->unix_socket());
+						continue;
+					}
+				}
+
 				std::string remote_host;
 				auto endp = client_ptr->unix_socket().remote_endpoint(error);
 				if (!error)
@@ -236,8 +294,9 @@ namespace httpd
 
 				boost::asio::co_spawn(client_ptr->get_executor(),
 					executor_.client_connected(client_ptr),
-					[this, connection_id, client_ptr](std::exception_ptr)
+					[this, connection_id, client_ptr, admission_ticket = std::move(admission_ticket)](std::exception_ptr) mutable
 					{
+						admission_ticket = {};
 						all_client.erase(connection_id);
 						boost::asio::co_spawn(
 							get_executor(), executor_.client_disconnected(client_ptr), boost::asio::detached);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/json.hpp>
+#include <boost/system/error_code.hpp>
+
+#include "httpd/send_queue.hpp"
+
+// websocket 连接读写协程里不依赖业务的部分. cmall 和 bench_ws_idle 用的是同一份,
+// 空闲连接的内存开销就是在这些地方省下来的.
+namespace httpd {
+
+	// 用本线程的 stream_parser 解析一条文本消息, json 的内存来自 sp.
+	// 解析是同步完成的, 中间没有 co_await, 所以每个线程一个 parser 就够了,
+	// 不必在每个连接常驻的读协程帧里各放一个 (连同 4K 的临时 buffer).
+	boost::json::value parse_json_message(std::string_view data, boost::system::error_code& ec, boost::json::storage_ptr sp = {});
+
+	// 一条消息处理完后调用. 空闲的连接不要让缓冲一直占着内存, 常见的小请求留着的缓冲不超过 4K.
+	inline void recycle_read_buffer(boost::beast::flat_buffer& buffer)
+	{
+		buffer.consume(buffer.size());
+		if (buffer.capacity() > 4 * 1024)
+			buffer.shrink_to_fit();
+	}
+
+	// 握手以后协程帧要一直挂到连接断开, 用完的升级请求, HTTP parser 和读缓冲现在就还回去.
+	// 之后 websocket 直接从 stream 读, 不再经过 buffer.
+	template <typename Request, typename Parser>
+	void release_upgrade_request(Request& req, std::optional<Parser>& parser, boost::beast::flat_buffer& buffer)
+	{
+		req = {};
+		parser.reset();
+		buffer.shrink_to_fit();
+	}
+
+	// 把 queue 里的消息写到 ws 上, 直到 queue 关闭. ws 的下一层要是 write_coalescing_stream.
+	template <typename WsStream>
+	boost::asio::awaitable<void> ws_write_loop(WsStream& ws, send_queue& queue)
+	{
+		std::vector<shared_message> batch;
+
+		for (;;)
+		{
+			batch.clear();
+			// 一次推送积压出来的大批次, 不要在空闲时还留着.
+			if (batch.capacity() > 16)
+				batch.shrink_to_fit();
+			if (!co_await queue.async_pop(batch))
+				break;
+
+			if (batch.size() == 1)
+			{
+				co_await ws.async_write(boost::asio::buffer(*batch.front()), boost::asio::use_awaitable);
+				continue;
+			}
+
+			// 多条消息各自成帧, 攒在 write_coalescing_stream 里一次写出去.
+			ws.next_layer().begin_batch();
+			for (auto& message : batch)
+				co_await ws.async_write(boost::asio::buffer(*message), boost::asio::use_awaitable);
+			co_await ws.next_layer().async_flush(boost::asio::use_awaitable);
+		}
+	}
+}
@@ -0,0 +1,180 @@
+
+#include "httpd/admission.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace httpd {
+
+	admission_control::ticket::ticket(admission_control* owner, const boost::asio::ip::address& addr, bool per_ip)
+		: owner_(owner)
+		, addr_(addr)
+		, per_ip_(per_ip)
+	{
+	}
+
+	admission_control::ticket::ticket(ticket&& o) noexcept
+		: owner_(std::exchange(o.owner_, nullptr))
+		, addr_(o.addr_)
+		, per_ip_(o.per_ip_)
+	{
+	}
+
+	admission_control::ticket& admission_control::ticket::operator=(ticket&& o) noexcept
+	{
+		if (this != &o)
+		{
+			release();
+			owner_ = std::exchange(o.owner_, nullptr);
+			addr_ = o.addr_;
+			per_ip_ = o.per_ip_;
+		}
+		return *this;
+	}
+
+	admission_control::ticket::~ticket()
+	{
+		release();
+	}
+
+	void admission_control::ticket::release()
+	{
+		if (!owner_)
+			return;
+
+		owner_->live_connections_.fetch_sub(1, std::memory_order_relaxed);
+		if (per_ip_)
+		{
+			std::scoped_lock<std::mutex> l(owner_->per_ip_mutex_);
+			auto it = owner_->per_ip_.find(addr_);
+			if (it != owner_->per_ip_.end() && --it->second == 0)
+				owner_->per_ip_.erase(it);
+		}
+		owner_ = nullptr;
+	}
+
+	admission_control::admission_control(const admission_config& config)
+		: config_(config)
+	{
+		if (config_.pending_work_high && config_.pending_work_low >= config_.pending_work_high)
+			throw std::invalid_argument("pending_work_low must be below pending_work_high");
+		// 至少为 1, 不然 high 为 1 时 low 是 0, 暂停以后永远恢复不了.
+		if (config_.pending_work_low == 0)
+			config_.pending_work_low = std::max<std::size_t>(config_.pending_work_high / 2, 1);
+
+		overload_response_ = "HTTP/1.1 503 Service Unavailable\r\n"
+			"Retry-After: " + std::to_string(config_.retry_after.count()) + "\r\n"
+			"Content-Length: 0\r\n"
+			"Connection: close\r\n"
+			"\r\n";
+	}
+
+	bool admission_control::enabled() const
+	{
+		return config_.max_connections || config_.max_connections_per_ip || config_.pending_work_high;
+	}
+
+	void admission_control::set_pending_work_probe(std::function<std::size_t()> probe)
+	{
+		pending_work_probe_ = std::move(probe);
+	}
+
+	bool admission_control::overloaded()
+	{
+		if (!config_.pending_work_high || !pending_work_probe_ || pending_work_probe_() < config_.pending_work_high)
+			return false;
+		rejected_overload_.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// 反向代理通常在本机, 按 IP 计数会把所有客户端当成一个.
+	static bool is_loopback(const boost::asio::ip::address& addr)
+	{
+		if (addr.is_v6() && addr.to_v6().is_v4_mapped())
+			return boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, addr.to_v6()).is_loopback();
+		return addr.is_loopback();
+	}
+
+	admission_control::ticket admission_control::admit(const boost::asio::ip::address& addr)
+	{
+		if (overloaded())
+			return {};
+
+		auto live = live_connections_.fetch_add(1, std::memory_order_relaxed);
+		if (config_.max_connections && live >= config_.max_connections)
+		{
+			live_connections_.fetch_sub(1, std::memory_order_relaxed);
+			rejected_global_.fetch_add(1, std::memory_order_relaxed);
+			return {};
+		}
+
+		bool per_ip = config_.max_connections_per_ip && !is_loopback(addr);
+		if (per_ip)
+		{
+			std::scoped_lock<std::mutex> l(per_ip_mutex_);
+			auto& count = per_ip_[addr];
+			if (count >= config_.max_connections_per_ip)
+			{
+				live_connections_.fetch_sub(1, std::memory_order_relaxed);
+				rejected_per_ip_.fetch_add(1, std::memory_order_relaxed);
+				return {};
+			}
+			count++;
+		}
+
+		admitted_.fetch_add(1, std::memory_order_relaxed);
+		return ticket(this, addr, per_ip);
+	}
+
+	admission_control::ticket admission_control::admit()
+	{
+		if (overloaded())
+			return {};
+
+		auto live = live_connections_.fetch_add(1, std::memory_order_relaxed);
+		if (config_.max_connections && live >= config_.max_connections)
+		{
+			live_connections_.fetch_sub(1, std::memory_order_relaxed);
+			rejected_global_.fetch_add(1, std::memory_order_relaxed);
+			return {};
+		}
+
+		admitted_.fetch_add(1, std::memory_order_relaxed);
+		return ticket(this, {}, false);
+	}
+
+	boost::asio::awaitable<void> admission_control::wait_for_capacity()
+	{
+		if (!config_.pending_work_high || !pending_work_probe_)
+			co_return;
+
+		if (pending_work_probe_() < config_.pending_work_high)
+			co_return;
+
+		// 暂停期间新连接留在内核的 backlog 里, 满了以后客户端会自己重试.
+		accept_pauses_.fetch_add(1, std::memory_order_relaxed);
+		boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+		while (pending_work_probe_() >= config_.pending_work_low)
+		{
+			timer.expires_after(std::chrono::milliseconds(50));
+			co_await timer.async_wait(boost::asio::use_awaitable);
+		}
+	}
+
+	admission_stats admission_control::stats() const
+	{
+		return admission_stats {
+			live_connections_.load(std::memory_order_relaxed),
+			admitted_.load(std::memory_order_relaxed),
+			rejected_global_.load(std::memory_order_relaxed),
+			rejected_per_ip_.load(std::memory_order_relaxed),
+			rejected_overload_.load(std::memory_order_relaxed),
+			accept_pauses_.load(std::memory_order_relaxed),
+		};
+	}
+
+	std::string_view admission_control::overload_response() const
+	{
+		return overload_response_;
+	}
+}
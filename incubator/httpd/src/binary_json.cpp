@@ -0,0 +1,579 @@
+
+#include "httpd/binary_json.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace httpd::binary_json {
+
+	namespace {
+
+		void put_be(std::string& out, std::uint64_t v, int bytes)
+		{
+			for (int i = bytes - 1; i >= 0; i--)
+				out.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+		}
+
+		// MessagePack.
+
+		void msgpack_uint(std::string& out, std::uint64_t v)
+		{
+			if (v < 0x80)
+				out.push_back(static_cast<char>(v));
+			else if (v <= 0xff)
+				out.push_back('\xcc'), put_be(out, v, 1);
+			else if (v <= 0xffff)
+				out.push_back('\xcd'), put_be(out, v, 2);
+			else if (v <= 0xffffffff)
+				out.push_back('\xce'), put_be(out, v, 4);
+			else
+				out.push_back('\xcf'), put_be(out, v, 8);
+		}
+
+		void msgpack_int(std::string& out, std::int64_t v)
+		{
+			if (v >= 0)
+				msgpack_uint(out, static_cast<std::uint64_t>(v));
+			else if (v >= -32)
+				out.push_back(static_cast<char>(v));
+			else if (v >= std::numeric_limits<std::int8_t>::min())
+				out.push_back('\xd0'), put_be(out, static_cast<std::uint64_t>(v), 1);
+			else if (v >= std::numeric_limits<std::int16_t>::min())
+				out.push_back('\xd1'), put_be(out, static_cast<std::uint64_t>(v), 2);
+			else if (v >= std::numeric_limits<std::int32_t>::min())
+				out.push_back('\xd2'), put_be(out, static_cast<std::uint64_t>(v), 4);
+			else
+				out.push_back('\xd3'), put_be(out, static_cast<std::uint64_t>(v), 8);
+		}
+
+		// fix 形式的类型字节, 和 8/16/32 位长度的三种类型字节 (没有 8 位的传 0).
+		void msgpack_head(std::string& out, std::size_t n, std::size_t fix_max, char fix, char t8, char t16, char t32)
+		{
+			if (n <= fix_max)
+				out.push_back(static_cast<char>(fix | n));
+			else if (t8 && n <= 0xff)
+				out.push_back(t8), put_be(out, n, 1);
+			else if (n <= 0xffff)
+				out.push_back(t16), put_be(out, n, 2);
+			else
+				out.push_back(t32), put_be(out, n, 4);
+		}
+
+		void msgpack_string(std::string& out, boost::json::string_view s)
+		{
+			msgpack_head(out, s.size(), 31, '\xa0', '\xd9', '\xda', '\xdb');
+			out.append(s.data(), s.size());
+		}
+
+		void msgpack_object(std::string& out, const boost::json::object& obj);
+		void msgpack_array(std::string& out, const boost::json::array& arr);
+
+		void msgpack_value(std::string& out, const boost::json::value& jv)
+		{
+			switch (jv.kind())
+			{
+				case boost::json::kind::null:
+					out.push_back('\xc0');
+					break;
+				case boost::json::kind::bool_:
+					out.push_back(jv.get_bool() ? '\xc3' : '\xc2');
+					break;
+				case boost::json::kind::int64:
+					msgpack_int(out, jv.get_int64());
+					break;
+				case boost::json::kind::uint64:
+					msgpack_uint(out, jv.get_uint64());
+					break;
+				case boost::json::kind::double_:
+					out.push_back('\xcb');
+					put_be(out, std::bit_cast<std::uint64_t>(jv.get_double()), 8);
+					break;
+				case boost::json::kind::string:
+					msgpack_string(out, jv.get_string());
+					break;
+				case boost::json::kind::array:
+					msgpack_array(out, jv.get_array());
+					break;
+				case boost::json::kind::object:
+					msgpack_object(out, jv.get_object());
+					break;
+			}
+		}
+
+		void msgpack_object(std::string& out, const boost::json::object& obj)
+		{
+			msgpack_head(out, obj.size(), 15, '\x80', 0, '\xde', '\xdf');
+			for (auto& kv : obj)
+			{
+				msgpack_string(out, kv.key());
+				msgpack_value(out, kv.value());
+			}
+		}
+
+		void msgpack_array(std::string& out, const boost::json::array& arr)
+		{
+			msgpack_head(out, arr.size(), 15, '\x90', 0, '\xdc', '\xdd');
+			for (auto& e : arr)
+				msgpack_value(out, e);
+		}
+
+		// CBOR.
+
+		void cbor_head(std::string& out, unsigned major, std::uint64_t n)
+		{
+			char m = static_cast<char>(major << 5);
+			if (n < 24)
+				out.push_back(static_cast<char>(m | n));
+			else if (n <= 0xff)
+				out.push_back(static_cast<char>(m | 24)), put_be(out, n, 1);
+			else if (n <= 0xffff)
+				out.push_back(static_cast<char>(m | 25)), put_be(out, n, 2);
+			else if (n <= 0xffffffff)
+				out.push_back(static_cast<char>(m | 26)), put_be(out, n, 4);
+			else
+				out.push_back(static_cast<char>(m | 27)), put_be(out, n, 8);
+		}
+
+		void cbor_string(std::string& out, boost::json::string_view s)
+		{
+			cbor_head(out, 3, s.size());
+			out.append(s.data(), s.size());
+		}
+
+		void cbor_object(std::string& out, const boost::json::object& obj);
+		void cbor_array(std::string& out, const boost::json::array& arr);
+
+		void cbor_value(std::string& out, const boost::json::value& jv)
+		{
+			switch (jv.kind())
+			{
+				case boost::json::kind::null:
+					out.push_back('\xf6');
+					break;
+				case boost::json::kind::bool_:
+					out.push_back(jv.get_bool() ? '\xf5' : '\xf4');
+					break;
+				case boost::json::kind::int64:
+					if (jv.get_int64() >= 0)
+						cbor_head(out, 0, static_cast<std::uint64_t>(jv.get_int64()));
+					else
+						cbor_head(out, 1, ~static_cast<std::uint64_t>(jv.get_int64()));
+					break;
+				case boost::json::kind::uint64:
+					cbor_head(out, 0, jv.get_uint64());
+					break;
+				case boost::json::kind::double_:
+					out.push_back('\xfb');
+					put_be(out, std::bit_cast<std::uint64_t>(jv.get_double()), 8);
+					break;
+				case boost::json::kind::string:
+					cbor_string(out, jv.get_string());
+					break;
+				case boost::json::kind::array:
+					cbor_array(out, jv.get_array());
+					break;
+				case boost::json::kind::object:
+					cbor_object(out, jv.get_object());
+					break;
+			}
+		}
+
+		void cbor_object(std::string& out, const boost::json::object& obj)
+		{
+			cbor_head(out, 5, obj.size());
+			for (auto& kv : obj)
+			{
+				cbor_string(out, kv.key());
+				cbor_value(out, kv.value());
+			}
+		}
+
+		void cbor_array(std::string& out, const boost::json::array& arr)
+		{
+			cbor_head(out, 4, arr.size());
+			for (auto& e : arr)
+				cbor_value(out, e);
+		}
+
+		// 解码.
+
+		class decoder
+		{
+		public:
+			decoder(std::string_view data, boost::json::storage_ptr sp, std::size_t max_depth)
+				: p_(reinterpret_cast<const unsigned char*>(data.data()))
+				, end_(p_ + data.size())
+				, sp_(std::move(sp))
+				, max_depth_(max_depth)
+			{}
+
+			boost::json::value decode(format f, boost::system::error_code& ec)
+			{
+				boost::json::value jv = f == format::msgpack ? msgpack(0) : cbor(0);
+				if (!ec_ && p_ != end_)
+					ec_ = boost::json::error::extra_data;
+				ec = ec_;
+				if (ec)
+					return boost::json::value(sp_);
+				return jv;
+			}
+
+		private:
+			boost::json::value fail(boost::json::error e)
+			{
+				if (!ec_)
+					ec_ = e;
+				return boost::json::value(sp_);
+			}
+
+			bool need(std::size_t n)
+			{
+				if (static_cast<std::size_t>(end_ - p_) >= n)
+					return true;
+				if (!ec_)
+					ec_ = boost::json::error::incomplete;
+				return false;
+			}
+
+			std::uint64_t be(int bytes)
+			{
+				std::uint64_t v = 0;
+				for (int i = 0; i < bytes; i++)
+					v = (v << 8) | *p_++;
+				return v;
+			}
+
+			static boost::json::value make_int(std::uint64_t v, boost::json::storage_ptr sp)
+			{
+				if (v <= static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()))
+					return boost::json::value(static_cast<std::int64_t>(v), std::move(sp));
+				return boost::json::value(v, std::move(sp));
+			}
+
+			boost::json::value string(std::size_t n)
+			{
+				if (!need(n))
+					return boost::json::value(sp_);
+				boost::json::value jv(boost::json::string_view(reinterpret_cast<const char*>(p_), n), sp_);
+				p_ += n;
+				return jv;
+			}
+
+			// MessagePack.
+
+			boost::json::value msgpack_array(std::size_t n, std::size_t depth)
+			{
+				if (depth >= max_depth_)
+					return fail(boost::json::error::too_deep);
+				// 每个元素至少一个字节, 先检查一下, 免得被一个假长度骗着预留一大块内存.
+				if (!need(n))
+					return boost::json::value(sp_);
+
+				boost::json::array arr(sp_);
+				arr.reserve(n);
+				for (std::size_t i = 0; i < n && !ec_; i++)
+					arr.push_back(msgpack(depth + 1));
+				return arr;
+			}
+
+			boost::json::value msgpack_map(std::size_t n, std::size_t depth)
+			{
+				if (depth >= max_depth_)
+					return fail(boost::json::error::too_deep);
+				if (!need(n) || !need(n * 2))
+					return boost::json::value(sp_);
+
+				boost::json::object obj(sp_);
+				obj.reserve(n);
+				for (std::size_t i = 0; i < n && !ec_; i++)
+				{
+					auto key = msgpack(depth + 1);
+					if (ec_)
+						break;
+					if (!key.is_string())
+						return fail(boost::json::error::syntax);
+					auto value = msgpack(depth + 1);
+					obj.insert_or_assign(key.get_string(), std::move(value));
+				}
+				return obj;
+			}
+
+			boost::json::value msgpack(std::size_t depth)
+			{
+				if (!need(1))
+					return boost::json::value(sp_);
+
+				unsigned char t = *p_++;
+				if (t <= 0x7f)
+					return boost::json::value(static_cast<std::int64_t>(t), sp_);
+				if (t >= 0xe0)
+					return boost::json::value(static_cast<std::int64_t>(static_cast<std::int8_t>(t)), sp_);
+				if ((t & 0xf0) == 0x80)
+					return msgpack_map(t & 0x0f, depth);
+				if ((t & 0xf0) == 0x90)
+					return msgpack_array(t & 0x0f, depth);
+				if ((t & 0xe0) == 0xa0)
+					return string(t & 0x1f);
+
+				switch (t)
+				{
+					case 0xc0:
+						return boost::json::value(sp_);
+					case 0xc2:
+						return boost::json::value(false, sp_);
+					case 0xc3:
+						return boost::json::value(true, sp_);
+					case 0xc4: case 0xd9:
+						return need(1) ? string(be(1)) : boost::json::value(sp_);
+					case 0xc5: case 0xda:
+						return need(2) ? string(be(2)) : boost::json::value(sp_);
+					case 0xc6: case 0xdb:
+						return need(4) ? string(be(4)) : boost::json::value(sp_);
+					case 0xca:
+						if (!need(4))
+							return boost::json::value(sp_);
+						return boost::json::value(static_cast<double>(std::bit_cast<float>(static_cast<std::uint32_t>(be(4)))), sp_);
+					case 0xcb:
+						if (!need(8))
+							return boost::json::value(sp_);
+						return boost::json::value(std::bit_cast<double>(be(8)), sp_);
+					case 0xcc: case 0xcd: case 0xce: case 0xcf:
+					{
+						int bytes = 1 << (t - 0xcc);
+						if (!need(bytes))
+							return boost::json::value(sp_);
+						return make_int(be(bytes), sp_);
+					}
+					case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+					{
+						int bytes = 1 << (t - 0xd0);
+						if (!need(bytes))
+							return boost::json::value(sp_);
+						// 符号扩展.
+						int shift = 64 - bytes * 8;
+						auto v = static_cast<std::int64_t>(be(bytes) << shift) >> shift;
+						return boost::json::value(v, sp_);
+					}
+					case 0xdc:
+						return need(2) ? msgpack_array(be(2), depth) : boost::json::value(sp_);
+					case 0xdd:
+						return need(4) ? msgpack_array(be(4), depth) : boost::json::value(sp_);
+					case 0xde:
+						return need(2) ? msgpack_map(be(2), depth) : boost::json::value(sp_);
+					case 0xdf:
+						return need(4) ? msgpack_map(be(4), depth) : boost::json::value(sp_);
+					default:
+						// 0xc1 和 ext 类型.
+						return fail(boost::json::error::syntax);
+				}
+			}
+
+			// CBOR.
+
+			// 读出 major type 后面的参数, 不定长时 indefinite 为 true.
+			bool cbor_argument(unsigned char ai, std::uint64_t& n, bool& indefinite)
+			{
+				indefinite = (ai == 31);
+				if (ai < 24 || indefinite)
+				{
+					n = ai;
+					return true;
+				}
+				if (ai > 27)
+				{
+					fail(boost::json::error::syntax);
+					return false;
+				}
+				int bytes = 1 << (ai - 24);
+				if (!need(bytes))
+					return false;
+				n = be(bytes);
+				return true;
+			}
+
+			bool cbor_break()
+			{
+				if (p_ != end_ && *p_ == 0xff)
+				{
+					++p_;
+					return true;
+				}
+				return false;
+			}
+
+			static double half_to_double(std::uint16_t h)
+			{
+				int exp = (h >> 10) & 0x1f;
+				int mant = h & 0x3ff;
+				double v;
+				if (exp == 0)
+					v = std::ldexp(mant, -24);
+				else if (exp != 31)
+					v = std::ldexp(mant + 1024, exp - 25);
+				else
+					v = mant == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+				return (h & 0x8000) ? -v : v;
+			}
+
+			boost::json::value cbor(std::size_t depth)
+			{
+				if (!need(1))
+					return boost::json::value(sp_);
+
+				unsigned char b = *p_++;
+				unsigned major = b >> 5;
+				unsigned char ai = b & 0x1f;
+
+				if (major == 7)
+				{
+					switch (ai)
+					{
+						case 20:
+							return boost::json::value(false, sp_);
+						case 21:
+							return boost::json::value(true, sp_);
+						case 22: case 23:
+							return boost::json::value(sp_);
+						case 25:
+							if (!need(2))
+								return boost::json::value(sp_);
+							return boost::json::value(half_to_double(static_cast<std::uint16_t>(be(2))), sp_);
+						case 26:
+							if (!need(4))
+								return boost::json::value(sp_);
+							return boost::json::value(static_cast<double>(std::bit_cast<float>(static_cast<std::uint32_t>(be(4)))), sp_);
+						case 27:
+							if (!need(8))
+								return boost::json::value(sp_);
+							return boost::json::value(std::bit_cast<double>(be(8)), sp_);
+						default:
+							// 其他 simple value, 以及不该出现在这里的 break.
+							return fail(boost::json::error::syntax);
+					}
+				}
+
+				std::uint64_t n;
+				bool indefinite;
+				if (!cbor_argument(ai, n, indefinite))
+					return boost::json::value(sp_);
+
+				switch (major)
+				{
+					case 0:
+						if (indefinite)
+							return fail(boost::json::error::syntax);
+						return make_int(n, sp_);
+					case 1:
+						if (indefinite || n > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()))
+							return fail(boost::json::error::syntax);
+						return boost::json::value(-1 - static_cast<std::int64_t>(n), sp_);
+					case 2: case 3:
+					{
+						if (!indefinite)
+							return string(n);
+
+						// 不定长字符串由若干个同类型的定长块组成.
+						boost::json::string s(sp_);
+						while (!ec_ && !cbor_break())
+						{
+							if (!need(1))
+								break;
+							if ((*p_ >> 5) != major || (*p_ & 0x1f) == 31)
+								return fail(boost::json::error::syntax);
+							auto chunk = cbor(depth);
+							if (!ec_)
+								s.append(chunk.get_string());
+						}
+						return s;
+					}
+					case 4:
+					{
+						if (depth >= max_depth_)
+							return fail(boost::json::error::too_deep);
+
+						boost::json::array arr(sp_);
+						if (!indefinite)
+						{
+							if (!need(n))
+								return boost::json::value(sp_);
+							arr.reserve(n);
+						}
+						for (std::uint64_t i = 0; !ec_ && (indefinite ? !cbor_break() : i < n); i++)
+							arr.push_back(cbor(depth + 1));
+						return arr;
+					}
+					case 5:
+					{
+						if (depth >= max_depth_)
+							return fail(boost::json::error::too_deep);
+
+						boost::json::object obj(sp_);
+						if (!indefinite)
+						{
+							if (!need(n) || !need(n * 2))
+								return boost::json::value(sp_);
+							obj.reserve(n);
+						}
+						for (std::uint64_t i = 0; !ec_ && (indefinite ? !cbor_break() : i < n); i++)
+						{
+							auto key = cbor(depth + 1);
+							if (ec_)
+								break;
+							if (!key.is_string())
+								return fail(boost::json::error::syntax);
+							auto value = cbor(depth + 1);
+							obj.insert_or_assign(key.get_string(), std::move(value));
+						}
+						return obj;
+					}
+					default:
+						// tag, 忽略它, 取里面的值.
+						if (indefinite)
+							return fail(boost::json::error::syntax);
+						if (depth >= max_depth_)
+							return fail(boost::json::error::too_deep);
+						return cbor(depth + 1);
+				}
+			}
+
+			const unsigned char* p_;
+			const unsigned char* end_;
+			boost::json::storage_ptr sp_;
+			std::size_t max_depth_;
+			boost::system::error_code ec_;
+		};
+	}
+
+	void encode(format f, const boost::json::value& jv, std::string& out)
+	{
+		if (f == format::msgpack)
+			msgpack_value(out, jv);
+		else
+			cbor_value(out, jv);
+	}
+
+	void encode(format f, const boost::json::object& obj, std::string& out)
+	{
+		if (f == format::msgpack)
+			msgpack_object(out, obj);
+		else
+			cbor_object(out, obj);
+	}
+
+	void encode(format f, const boost::json::array& arr, std::string& out)
+	{
+		if (f == format::msgpack)
+			msgpack_array(out, arr);
+		else
+			cbor_array(out, arr);
+	}
+
+	boost::json::value decode(format f, std::string_view data, boost::system::error_code& ec,
+		boost::json::storage_ptr sp, std::size_t max_depth)
+	{
+		return decoder(data, std::move(sp), max_depth).decode(f, ec);
+	}
+}
@@ -522,10 +522,74 @@ std::optional<httpd::BytesRange> httpd::parse_range(std::string_view range)
 
 std::string httpd::make_http_last_modified(std::time_t t)
 {
-    tm* gmt = gmtime((const time_t*)&t);
-    char time_buf[512] = { 0 };
-    strftime(time_buf, 200, "%a, %d %b %Y %H:%M:%S GMT", gmt);
-    return time_buf;
+    char time_buf[http_date_length];
+    format_http_date(t, time_buf);
+    return std::string(time_buf, http_date_length);
+}
+
+void httpd::format_http_date(std::time_t t, char* out)
+{
+    // 1970-01-01 是星期四. gmtime 要查时区数据库还要加锁, 这里直接算.
+    std::int64_t days = t / 86400;
+    std::int64_t secs = t % 86400;
+    if (secs < 0)
+    {
+        secs += 86400;
+        days -= 1;
+    }
+
+    int wday = static_cast<int>(((days % 7) + 10) % 7); // 0 = Mon
+
+    // civil_from_days, 见 http://howardhinnant.github.io/date_algorithms.html
+    std::int64_t z = days + 719468;
+    std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = static_cast<unsigned>(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    std::int64_t year = static_cast<std::int64_t>(yoe) + era * 400;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    unsigned mday = doy - (153 * mp + 2) / 5 + 1;
+    unsigned mon = mp < 10 ? mp + 2 : mp - 10; // 0 = Jan
+    if (mon <= 1)
+        year += 1;
+
+    auto put2 = [](char* p, unsigned v) { p[0] = static_cast<char>('0' + v / 10); p[1] = static_cast<char>('0' + v % 10); };
+
+    std::memcpy(out, gwkday[wday], 3);
+    out[3] = ',';
+    out[4] = ' ';
+    put2(out + 5, mday);
+    out[7] = ' ';
+    std::memcpy(out + 8, gmonth[mon], 3);
+    out[11] = ' ';
+    put2(out + 12, static_cast<unsigned>(year / 100 % 100));
+    put2(out + 14, static_cast<unsigned>(year % 100));
+    out[16] = ' ';
+    put2(out + 17, static_cast<unsigned>(secs / 3600));
+    out[19] = ':';
+    put2(out + 20, static_cast<unsigned>(secs / 60 % 60));
+    out[22] = ':';
+    put2(out + 23, static_cast<unsigned>(secs % 60));
+    std::memcpy(out + 25, " GMT", 4);
+}
+
+std::string_view httpd::cached_http_date(std::time_t t)
+{
+    // 一般同时只会用到 "现在" 和 "现在 + N 秒" 两三个值, 4 个槽位足够.
+    struct cache_slot
+    {
+        std::time_t t = -1;
+        char text[http_date_length];
+    };
+    static thread_local cache_slot slots[4];
+
+    cache_slot& slot = slots[static_cast<std::size_t>(t) % 4];
+    if (slot.t != t)
+    {
+        format_http_date(t, slot.text);
+        slot.t = t;
+    }
+    return std::string_view(slot.text, http_date_length);
 }
 
 std::string httpd::make_cpntent_range(BytesRange r, std::uint64_t content_length)
@@ -0,0 +1,455 @@
+
+#include <array>
+#include <algorithm>
+
+#include "httpd/http2/hpack.hpp"
+
+namespace httpd::http2 {
+
+	namespace {
+
+		struct huffman_code
+		{
+			std::uint32_t code;
+			std::uint8_t bits;
+		};
+
+		// RFC 7541 Appendix B, 最后一个是 EOS.
+		constexpr huffman_code huffman_table[257] = {
+			{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 },
+			{ 0xfffffe6, 28 }, { 0xfffffe7, 28 }, { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+			{ 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 }, { 0xfffffed, 28 }, { 0xfffffee, 28 },
+			{ 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+			{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 },
+			{ 0xffffffa, 28 }, { 0xffffffb, 28 }, { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+			{ 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 },
+			{ 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+			{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 },
+			{ 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+			{ 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 }, { 0x1ffa, 13 }, { 0x21, 6 },
+			{ 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+			{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 },
+			{ 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+			{ 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 },
+			{ 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+			{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 },
+			{ 0x25, 6 }, { 0x26, 6 }, { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+			{ 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 }, { 0x76, 7 },
+			{ 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+			{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 },
+			{ 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+			{ 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 },
+			{ 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+			{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 },
+			{ 0x7fffe2, 23 }, { 0x7fffe3, 23 }, { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+			{ 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 },
+			{ 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+			{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 },
+			{ 0x7fffeb, 23 }, { 0x7fffec, 23 }, { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+			{ 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 },
+			{ 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+			{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 },
+			{ 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+			{ 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 },
+			{ 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+			{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 },
+			{ 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+			{ 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 },
+			{ 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+			{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 },
+			{ 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+			{ 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 }, { 0x3fffffff, 30 },
+		};
+
+		struct static_entry
+		{
+			std::string_view name;
+			std::string_view value;
+		};
+
+		// RFC 7541 Appendix A, 下标从 1 开始.
+		constexpr static_entry static_table[61] = {
+			{ ":authority", "" },
+			{ ":method", "GET" },
+			{ ":method", "POST" },
+			{ ":path", "/" },
+			{ ":path", "/index.html" },
+			{ ":scheme", "http" },
+			{ ":scheme", "https" },
+			{ ":status", "200" },
+			{ ":status", "204" },
+			{ ":status", "206" },
+			{ ":status", "304" },
+			{ ":status", "400" },
+			{ ":status", "404" },
+			{ ":status", "500" },
+			{ "accept-charset", "" },
+			{ "accept-encoding", "gzip, deflate" },
+			{ "accept-language", "" },
+			{ "accept-ranges", "" },
+			{ "accept", "" },
+			{ "access-control-allow-origin", "" },
+			{ "age", "" },
+			{ "allow", "" },
+			{ "authorization", "" },
+			{ "cache-control", "" },
+			{ "content-disposition", "" },
+			{ "content-encoding", "" },
+			{ "content-language", "" },
+			{ "content-length", "" },
+			{ "content-location", "" },
+			{ "content-range", "" },
+			{ "content-type", "" },
+			{ "cookie", "" },
+			{ "date", "" },
+			{ "etag", "" },
+			{ "expect", "" },
+			{ "expires", "" },
+			{ "from", "" },
+			{ "host", "" },
+			{ "if-match", "" },
+			{ "if-modified-since", "" },
+			{ "if-none-match", "" },
+			{ "if-range", "" },
+			{ "if-unmodified-since", "" },
+			{ "last-modified", "" },
+			{ "link", "" },
+			{ "location", "" },
+			{ "max-forwards", "" },
+			{ "proxy-authenticate", "" },
+			{ "proxy-authorization", "" },
+			{ "range", "" },
+			{ "referer", "" },
+			{ "refresh", "" },
+			{ "retry-after", "" },
+			{ "server", "" },
+			{ "set-cookie", "" },
+			{ "strict-transport-security", "" },
+			{ "transfer-encoding", "" },
+			{ "user-agent", "" },
+			{ "vary", "" },
+			{ "via", "" },
+			{ "www-authenticate", "" },
+		};
+
+		// 解码用的二叉树, 叶子节点的 symbol 为 0~256.
+		struct huffman_node
+		{
+			std::int16_t child[2] = { -1, -1 };
+			std::int16_t symbol = -1;
+		};
+
+		struct huffman_tree
+		{
+			std::vector<huffman_node> nodes;
+
+			huffman_tree()
+			{
+				nodes.reserve(513);
+				nodes.emplace_back();
+				for (int sym = 0; sym < 257; sym++)
+				{
+					auto [code, bits] = huffman_table[sym];
+					int node = 0;
+					for (int i = bits - 1; i >= 0; i--)
+					{
+						int bit = (code >> i) & 1;
+						if (nodes[node].child[bit] < 0)
+						{
+							nodes[node].child[bit] = static_cast<std::int16_t>(nodes.size());
+							nodes.emplace_back();
+						}
+						node = nodes[node].child[bit];
+					}
+					nodes[node].symbol = static_cast<std::int16_t>(sym);
+				}
+			}
+		};
+
+		const huffman_tree& get_huffman_tree()
+		{
+			static const huffman_tree tree;
+			return tree;
+		}
+
+		constexpr std::size_t entry_overhead = 32;
+
+		bool decode_integer(const std::uint8_t*& p, const std::uint8_t* end, int prefix_bits, std::uint64_t& value)
+		{
+			if (p == end)
+				return false;
+
+			const std::uint8_t mask = static_cast<std::uint8_t>((1u << prefix_bits) - 1);
+			value = *p++ & mask;
+			if (value < mask)
+				return true;
+
+			for (int shift = 0; p != end; shift += 7)
+			{
+				// 头部里不会出现这么大的整数, 直接当作错误, 同时避免溢出.
+				if (shift > 28)
+					return false;
+				std::uint8_t b = *p++;
+				value += static_cast<std::uint64_t>(b & 0x7f) << shift;
+				if ((b & 0x80) == 0)
+					return true;
+			}
+			return false;
+		}
+
+		bool decode_string(const std::uint8_t*& p, const std::uint8_t* end, std::string& out)
+		{
+			if (p == end)
+				return false;
+
+			bool huffman = (*p & 0x80) != 0;
+			std::uint64_t length;
+			if (!decode_integer(p, end, 7, length))
+				return false;
+			if (length > static_cast<std::uint64_t>(end - p))
+				return false;
+
+			std::string_view raw(reinterpret_cast<const char*>(p), length);
+			p += length;
+
+			out.clear();
+			if (huffman)
+				return huffman_decode(raw, out);
+			out.assign(raw);
+			return true;
+		}
+
+		void encode_string(std::string& out, std::string_view s)
+		{
+			std::size_t huffman_length = huffman_encoded_length(s);
+			if (huffman_length < s.size())
+			{
+				encode_integer(out, 0x80, 7, huffman_length);
+				huffman_encode(s, out);
+			}
+			else
+			{
+				encode_integer(out, 0, 7, s.size());
+				out.append(s);
+			}
+		}
+	}
+
+	bool huffman_decode(std::string_view in, std::string& out)
+	{
+		const auto& nodes = get_huffman_tree().nodes;
+
+		int node = 0;
+		// 自上一个完整字符以来走过的位数, 以及这些位是否全为 1, 用来校验末尾的填充.
+		int depth = 0;
+		bool all_ones = true;
+
+		for (unsigned char c : in)
+		{
+			for (int i = 7; i >= 0; i--)
+			{
+				int bit = (c >> i) & 1;
+				node = nodes[node].child[bit];
+				if (node < 0)
+					return false;
+
+				depth++;
+				all_ones = all_ones && bit;
+
+				if (nodes[node].symbol >= 0)
+				{
+					if (nodes[node].symbol == 256)
+						return false;
+					out.push_back(static_cast<char>(nodes[node].symbol));
+					node = 0;
+					depth = 0;
+					all_ones = true;
+				}
+			}
+		}
+
+		return depth < 8 && all_ones;
+	}
+
+	std::size_t huffman_encoded_length(std::string_view in)
+	{
+		std::size_t bits = 0;
+		for (unsigned char c : in)
+			bits += huffman_table[c].bits;
+		return (bits + 7) / 8;
+	}
+
+	void huffman_encode(std::string_view in, std::string& out)
+	{
+		std::uint64_t acc = 0;
+		int acc_bits = 0;
+
+		for (unsigned char c : in)
+		{
+			auto [code, bits] = huffman_table[c];
+			acc = (acc << bits) | code;
+			acc_bits += bits;
+			while (acc_bits >= 8)
+			{
+				acc_bits -= 8;
+				out.push_back(static_cast<char>(acc >> acc_bits));
+			}
+		}
+
+		// 用 EOS 的高位 (全 1) 填充到字节边界.
+		if (acc_bits > 0)
+			out.push_back(static_cast<char>((acc << (8 - acc_bits)) | (0xff >> acc_bits)));
+	}
+
+	void encode_integer(std::string& out, std::uint8_t first_byte, int prefix_bits, std::uint64_t value)
+	{
+		const std::uint8_t mask = static_cast<std::uint8_t>((1u << prefix_bits) - 1);
+		if (value < mask)
+		{
+			out.push_back(static_cast<char>(first_byte | value));
+			return;
+		}
+
+		out.push_back(static_cast<char>(first_byte | mask));
+		value -= mask;
+		while (value >= 128)
+		{
+			out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	hpack_decoder::hpack_decoder(std::size_t max_table_size)
+		: max_size_(max_table_size)
+		, settings_max_size_(max_table_size)
+	{
+	}
+
+	bool hpack_decoder::lookup(std::uint64_t index, header_field& out) const
+	{
+		if (index == 0)
+			return false;
+		if (index <= std::size(static_table))
+		{
+			out.name = static_table[index - 1].name;
+			out.value = static_table[index - 1].value;
+			return true;
+		}
+		index -= std::size(static_table) + 1;
+		if (index >= entries_.size())
+			return false;
+		out = entries_[index];
+		return true;
+	}
+
+	void hpack_decoder::evict(std::size_t max_size)
+	{
+		while (size_ > max_size && !entries_.empty())
+		{
+			auto& last = entries_.back();
+			size_ -= last.name.size() + last.value.size() + entry_overhead;
+			entries_.pop_back();
+		}
+	}
+
+	void hpack_decoder::insert(header_field field)
+	{
+		std::size_t entry_size = field.name.size() + field.value.size() + entry_overhead;
+		// 比整个表还大的条目会清空表, 但自己并不插入.
+		evict(entry_size > max_size_ ? 0 : max_size_ - entry_size);
+		if (entry_size > max_size_)
+			return;
+		size_ += entry_size;
+		entries_.push_front(std::move(field));
+	}
+
+	bool hpack_decoder::decode(std::string_view block, std::vector<header_field>& out, std::size_t max_list_size)
+	{
+		auto p = reinterpret_cast<const std::uint8_t*>(block.data());
+		auto end = p + block.size();
+
+		std::size_t list_size = 0;
+		bool header_seen = false;
+
+		while (p != end)
+		{
+			std::uint8_t b = *p;
+			header_field field;
+
+			if (b & 0x80)
+			{
+				// Indexed Header Field
+				std::uint64_t index;
+				if (!decode_integer(p, end, 7, index) || !lookup(index, field))
+					return false;
+			}
+			else if ((b & 0xe0) == 0x20)
+			{
+				// Dynamic Table Size Update, 只能出现在 block 的开头.
+				std::uint64_t new_size;
+				if (header_seen || !decode_integer(p, end, 5, new_size) || new_size > settings_max_size_)
+					return false;
+				max_size_ = new_size;
+				evict(max_size_);
+				continue;
+			}
+			else
+			{
+				// 0x40 是 Incremental Indexing, 否则是 Without Indexing / Never Indexed.
+				bool incremental = (b & 0xc0) == 0x40;
+				std::uint64_t name_index;
+				if (!decode_integer(p, end, incremental ? 6 : 4, name_index))
+					return false;
+
+				if (name_index)
+				{
+					if (!lookup(name_index, field))
+						return false;
+				}
+				else if (!decode_string(p, end, field.name))
+				{
+					return false;
+				}
+
+				if (!decode_string(p, end, field.value))
+					return false;
+
+				if (incremental)
+					insert(field);
+			}
+
+			header_seen = true;
+			list_size += field.name.size() + field.value.size() + entry_overhead;
+			if (list_size > max_list_size)
+				return false;
+
+			out.push_back(std::move(field));
+		}
+
+		return true;
+	}
+
+	void hpack_encoder::encode(std::string& out, std::string_view name, std::string_view value)
+	{
+		std::size_t name_index = 0;
+		for (std::size_t i = 0; i < std::size(static_table); i++)
+		{
+			if (static_table[i].name != name)
+				continue;
+			if (static_table[i].value == value)
+			{
+				encode_integer(out, 0x80, 7, i + 1);
+				return;
+			}
+			if (!name_index)
+				name_index = i + 1;
+		}
+
+		// Literal Header Field without Indexing.
+		encode_integer(out, 0, 4, name_index);
+		if (!name_index)
+			encode_string(out, name);
+		encode_string(out, value);
+	}
+}
@@ -0,0 +1,933 @@
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <vector>
+
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <openssl/ssl.h>
+
+#include "httpd/http2/connection.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+
+namespace httpd::http2 {
+
+	namespace {
+
+		// HTTP/2 禁止的逐跳头部. 响应头 (来自 HTTP/1.1 的序列化结果) 里的会被丢掉, 请求里出现的视为错误.
+		bool is_connection_specific_header(std::string_view name)
+		{
+			return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+				|| name == "transfer-encoding" || name == "upgrade";
+		}
+
+		// 把 HTTP/1.1 的响应翻译成 HPACK 编码的头部和 body.
+		class response_translator : public boost::beast::http::basic_parser<false>
+		{
+		public:
+			explicit response_translator(hpack_encoder& encoder)
+				: encoder_(encoder)
+			{
+				eager(true);
+				body_limit(boost::none);
+			}
+
+			std::string header_block;
+			std::string body;
+
+		private:
+			void on_request_impl(boost::beast::http::verb, boost::beast::string_view,
+				boost::beast::string_view, int, boost::system::error_code&) override
+			{
+			}
+
+			void on_response_impl(int code, boost::beast::string_view, int, boost::system::error_code&) override
+			{
+				encoder_.encode(header_block, ":status", std::to_string(code));
+			}
+
+			void on_field_impl(boost::beast::http::field, boost::beast::string_view name,
+				boost::beast::string_view value, boost::system::error_code&) override
+			{
+				lower_name_.assign(name.data(), name.size());
+				std::transform(lower_name_.begin(), lower_name_.end(), lower_name_.begin(),
+					[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+				if (is_connection_specific_header(lower_name_))
+					return;
+				encoder_.encode(header_block, lower_name_, value);
+			}
+
+			void on_header_impl(boost::system::error_code&) override {}
+
+			void on_body_init_impl(boost::optional<std::uint64_t> const&, boost::system::error_code&) override {}
+
+			std::size_t on_body_impl(boost::beast::string_view s, boost::system::error_code&) override
+			{
+				body.append(s.data(), s.size());
+				return s.size();
+			}
+
+			void on_chunk_header_impl(std::uint64_t, boost::beast::string_view, boost::system::error_code&) override {}
+
+			std::size_t on_chunk_body_impl(std::uint64_t, boost::beast::string_view s, boost::system::error_code&) override
+			{
+				body.append(s.data(), s.size());
+				return s.size();
+			}
+
+			void on_finish_impl(boost::system::error_code&) override {}
+
+			hpack_encoder& encoder_;
+			std::string lower_name_;
+		};
+	}
+
+	struct stream_state
+	{
+		stream_state(std::uint32_t id, std::int64_t window, hpack_encoder& encoder)
+			: id(id)
+			, send_window(window)
+			, translator(encoder)
+		{
+		}
+
+		std::uint32_t id;
+		request req;
+		std::size_t body_limit = 0;
+
+		bool request_complete = false;
+		bool handler_started = false;
+		bool reset = false;
+
+		std::int64_t send_window;
+
+		// 还没被 translator 消耗的 HTTP/1.1 响应数据 (通常是不完整的响应头).
+		std::string input;
+		response_translator translator;
+		bool headers_sent = false;
+		bool response_complete = false;
+	};
+
+	server_stream::server_stream(std::shared_ptr<server_connection> connection, std::shared_ptr<stream_state> state, executor_type executor)
+		: connection_(std::move(connection))
+		, state_(std::move(state))
+		, executor_(std::move(executor))
+	{
+	}
+
+	void server_stream::start_write(std::string data, write_handler handler)
+	{
+		auto size = data.size();
+		boost::asio::co_spawn(executor_, connection_->write_response(state_, std::move(data)),
+			[size, handler = std::move(handler)](std::exception_ptr e, boost::system::error_code ec) mutable
+			{
+				if (e && !ec)
+					ec = boost::asio::error::connection_aborted;
+				std::move(handler)(ec, ec ? 0 : size);
+			});
+	}
+
+	void server_stream::close()
+	{
+		connection_->close_stream(state_);
+	}
+
+	server_connection::server_connection(http_any_stream& stream, boost::beast::flat_buffer& buffer, settings s)
+		: stream_(stream)
+		, buffer_(buffer)
+		, settings_(s)
+		, executor_(stream.get_executor())
+		, idle_deadline_(executor_)
+		, write_notify_(executor_, std::chrono::steady_clock::time_point::max())
+		, window_notify_(executor_, std::chrono::steady_clock::time_point::max())
+	{
+		idle_deadline_.on_expire([this] { stream_.close(); });
+	}
+
+	awaitable<void> server_connection::run(handler_type handler)
+	{
+		using namespace boost::asio::experimental::awaitable_operators;
+
+		handler_ = std::move(handler);
+
+		// 服务端的连接序言就是一个 SETTINGS 帧.
+		std::string frame;
+		append_frame_header(frame, 18, frame_type::settings, 0, 0);
+		auto append_setting = [&frame](settings_id id, std::uint32_t value)
+		{
+			frame.push_back(static_cast<char>(static_cast<std::uint16_t>(id) >> 8));
+			frame.push_back(static_cast<char>(static_cast<std::uint16_t>(id)));
+			append_uint32(frame, value);
+		};
+		append_setting(settings_id::max_concurrent_streams, settings_.max_concurrent_streams);
+		append_setting(settings_id::enable_push, 0);
+		append_setting(settings_id::max_header_list_size, settings_.max_header_list_size);
+		queue_frame(std::move(frame));
+		update_idle_deadline();
+
+		co_await (read_loop() && write_loop());
+
+		idle_deadline_.cancel();
+		stream_.close();
+	}
+
+	awaitable<bool> server_connection::fill(std::size_t size, boost::system::error_code& ec)
+	{
+		while (buffer_.size() < size)
+		{
+			auto bytes = co_await stream_.async_read_some(buffer_.prepare(std::max<std::size_t>(size - buffer_.size(), 8192)),
+				boost::asio::redirect_error(use_awaitable, ec));
+			if (ec)
+				co_return false;
+			buffer_.commit(bytes);
+		}
+		co_return true;
+	}
+
+	awaitable<void> server_connection::read_loop()
+	{
+		boost::system::error_code ec;
+		error_code result = error_code::no_error;
+
+		if (co_await fill(client_preface.size(), ec))
+		{
+			std::string_view preface(static_cast<const char*>(buffer_.data().data()), client_preface.size());
+			if (preface != client_preface)
+				result = error_code::protocol_error;
+			buffer_.consume(client_preface.size());
+
+			bool first_frame = true;
+			while (result == error_code::no_error && co_await fill(frame_header_length, ec))
+			{
+				auto h = parse_frame_header(static_cast<const char*>(buffer_.data().data()));
+
+				// 客户端序言里 magic 之后必须是 SETTINGS.
+				if (first_frame && h.type != frame_type::settings)
+				{
+					result = error_code::protocol_error;
+					break;
+				}
+				first_frame = false;
+
+				// 我们没有调大 SETTINGS_MAX_FRAME_SIZE.
+				if (h.length > default_max_frame_size)
+				{
+					result = error_code::frame_size_error;
+					break;
+				}
+
+				if (!co_await fill(frame_header_length + h.length, ec))
+					break;
+
+				std::string_view payload(static_cast<const char*>(buffer_.data().data()) + frame_header_length, h.length);
+				result = process_frame(h, payload);
+				buffer_.consume(frame_header_length + h.length);
+				update_idle_deadline();
+			}
+		}
+
+		if (result != error_code::no_error)
+		{
+			std::string frame;
+			append_frame_header(frame, 8, frame_type::goaway, 0, 0);
+			append_uint32(frame, last_stream_id_);
+			append_uint32(frame, static_cast<std::uint32_t>(result));
+			queue_frame(std::move(frame));
+		}
+
+		// 不再接受新的写, write_loop 发完队列里剩下的就退出.
+		closing_ = true;
+		write_notify_.cancel();
+		window_notify_.cancel();
+	}
+
+	awaitable<void> server_connection::write_loop()
+	{
+		std::vector<std::string> sending;
+		std::vector<boost::asio::const_buffer> buffers;
+
+		for (;;)
+		{
+			if (write_queue_.empty())
+			{
+				if (closing_)
+					break;
+
+				boost::system::error_code ec;
+				co_await write_notify_.async_wait(boost::asio::redirect_error(use_awaitable, ec));
+				continue;
+			}
+
+			// 队列里攒下的帧合并成一次写.
+			sending.clear();
+			buffers.clear();
+			while (!write_queue_.empty())
+			{
+				sending.push_back(std::move(write_queue_.front()));
+				write_queue_.pop_front();
+			}
+			for (auto& f : sending)
+				buffers.push_back(boost::asio::buffer(f));
+
+			boost::system::error_code ec;
+			co_await boost::asio::async_write(stream_, buffers, boost::asio::redirect_error(use_awaitable, ec));
+			if (ec)
+			{
+				closing_ = true;
+				write_queue_.clear();
+				window_notify_.cancel();
+				stream_.close();
+				break;
+			}
+		}
+	}
+
+	error_code server_connection::process_frame(const frame_header& h, std::string_view payload)
+	{
+		// header block 没收完之前只能是同一个 stream 的 CONTINUATION.
+		if (expect_continuation_ && (h.type != frame_type::continuation || h.stream_id != header_stream_id_))
+			return error_code::protocol_error;
+
+		switch (h.type)
+		{
+			case frame_type::data:
+				return on_data(h, payload);
+			case frame_type::headers:
+				return on_headers(h, payload);
+			case frame_type::priority:
+				if (h.stream_id == 0)
+					return error_code::protocol_error;
+				if (payload.size() != 5)
+					reset_stream(h.stream_id, error_code::frame_size_error);
+				return error_code::no_error;
+			case frame_type::rst_stream:
+				return on_rst_stream(h, payload);
+			case frame_type::settings:
+				return on_settings(h, payload);
+			case frame_type::push_promise:
+				return error_code::protocol_error;
+			case frame_type::ping:
+			{
+				if (h.stream_id != 0)
+					return error_code::protocol_error;
+				if (payload.size() != 8)
+					return error_code::frame_size_error;
+				if ((h.flags & flags::ack) == 0)
+				{
+					std::string frame;
+					append_frame_header(frame, 8, frame_type::ping, flags::ack, 0);
+					frame.append(payload);
+					queue_frame(std::move(frame));
+				}
+				return error_code::no_error;
+			}
+			case frame_type::goaway:
+				// 对端不会再开新的 stream, 已有的照常处理, 等它关闭连接.
+				if (h.stream_id != 0)
+					return error_code::protocol_error;
+				return error_code::no_error;
+			case frame_type::window_update:
+				return on_window_update(h, payload);
+			case frame_type::continuation:
+				if (!expect_continuation_)
+					return error_code::protocol_error;
+				header_block_.append(payload);
+				if (header_block_.size() > settings_.max_header_list_size * 2)
+					return error_code::enhance_your_calm;
+				if (h.flags & flags::end_headers)
+					return on_header_block_complete();
+				return error_code::no_error;
+			default:
+				// 未知类型的帧必须忽略.
+				return error_code::no_error;
+		}
+	}
+
+	error_code server_connection::on_headers(const frame_header& h, std::string_view payload)
+	{
+		if (h.stream_id == 0)
+			return error_code::protocol_error;
+
+		if (h.flags & flags::padded)
+		{
+			if (payload.empty())
+				return error_code::frame_size_error;
+			std::size_t pad_length = static_cast<std::uint8_t>(payload[0]);
+			payload.remove_prefix(1);
+			if (pad_length > payload.size())
+				return error_code::protocol_error;
+			payload.remove_suffix(pad_length);
+		}
+
+		if (h.flags & flags::priority)
+		{
+			if (payload.size() < 5)
+				return error_code::frame_size_error;
+			payload.remove_prefix(5);
+		}
+
+		header_stream_id_ = h.stream_id;
+		header_flags_ = h.flags;
+		header_block_.assign(payload);
+
+		if (h.flags & flags::end_headers)
+			return on_header_block_complete();
+
+		expect_continuation_ = true;
+		return error_code::no_error;
+	}
+
+	error_code server_connection::on_header_block_complete()
+	{
+		expect_continuation_ = false;
+
+		// 即便这个 stream 会被拒绝, 也必须解码, 否则 HPACK 动态表就和对端不一致了.
+		std::vector<header_field> fields;
+		bool decoded = decoder_.decode(header_block_, fields, settings_.max_header_list_size);
+		header_block_.clear();
+		if (!decoded)
+			return error_code::compression_error;
+
+		const std::uint32_t id = header_stream_id_;
+		const bool end_stream = (header_flags_ & flags::end_stream) != 0;
+
+		if (auto it = streams_.find(id); it != streams_.end())
+		{
+			// 已有的 stream 上再来 HEADERS 只能是 trailer, trailer 的内容直接丢弃.
+			auto& st = it->second;
+			if (st->request_complete)
+			{
+				reset_stream(id, error_code::stream_closed);
+				return error_code::no_error;
+			}
+			if (!end_stream)
+				return error_code::protocol_error;
+			st->request_complete = true;
+			if (!st->reset)
+				start_handler(st);
+			return error_code::no_error;
+		}
+
+		if ((id % 2) == 0 || id <= last_stream_id_)
+			return error_code::protocol_error;
+		last_stream_id_ = id;
+
+		// GOAWAY 以后开的 stream 不处理, 客户端会换一个连接重试.
+		if (goaway_sent_ || streams_.size() >= settings_.max_concurrent_streams)
+		{
+			reset_stream(id, error_code::refused_stream);
+			return error_code::no_error;
+		}
+
+		auto st = std::make_shared<stream_state>(id, peer_initial_window_, encoder_);
+
+		std::string_view method, path, scheme, authority;
+		bool regular_seen = false;
+		bool malformed = false;
+
+		for (auto& f : fields)
+		{
+			if (std::any_of(f.name.begin(), f.name.end(), [](unsigned char c) { return std::isupper(c); }))
+			{
+				malformed = true;
+				break;
+			}
+
+			if (!f.name.empty() && f.name[0] == ':')
+			{
+				if (regular_seen)
+				{
+					malformed = true;
+					break;
+				}
+
+				if (f.name == ":method")
+					method = f.value;
+				else if (f.name == ":path")
+					path = f.value;
+				else if (f.name == ":scheme")
+					scheme = f.value;
+				else if (f.name == ":authority")
+					authority = f.value;
+				else
+				{
+					malformed = true;
+					break;
+				}
+				continue;
+			}
+
+			regular_seen = true;
+			if (is_connection_specific_header(f.name) || (f.name == "te" && f.value != "trailers"))
+			{
+				malformed = true;
+				break;
+			}
+			st->req.insert(f.name, f.value);
+		}
+
+		// 不支持 CONNECT, 所以三个伪头部都是必须的.
+		if (malformed || method.empty() || path.empty() || scheme.empty())
+		{
+			reset_stream(id, error_code::protocol_error);
+			return error_code::no_error;
+		}
+
+		st->req.method_string(method);
+		st->req.target(path);
+		// 交给 HTTP/1.1 的处理代码, 当作 keep-alive 的 1.1 请求.
+		st->req.version(11);
+		if (!authority.empty())
+			st->req.set(boost::beast::http::field::host, authority);
+
+		st->body_limit = settings_.stream_body_limit ? settings_.stream_body_limit(st->req) : settings_.body_limit;
+		if (auto content_length = st->req[boost::beast::http::field::content_length]; !content_length.empty())
+		{
+			std::size_t length = 0;
+			auto [p, ec] = std::from_chars(content_length.data(), content_length.data() + content_length.size(), length);
+			if (ec != std::errc{} || p != content_length.data() + content_length.size() || length > st->body_limit)
+			{
+				reset_stream(id, error_code::cancel);
+				return error_code::no_error;
+			}
+		}
+
+		st->translator.skip(st->req.method() == boost::beast::http::verb::head);
+		st->request_complete = end_stream;
+
+		streams_.emplace(id, st);
+
+		if (end_stream)
+			start_handler(st);
+
+		return error_code::no_error;
+	}
+
+	error_code server_connection::on_data(const frame_header& h, std::string_view payload)
+	{
+		if (h.stream_id == 0)
+			return error_code::protocol_error;
+
+		if (h.flags & flags::padded)
+		{
+			if (payload.empty())
+				return error_code::frame_size_error;
+			std::size_t pad_length = static_cast<std::uint8_t>(payload[0]);
+			payload.remove_prefix(1);
+			if (pad_length > payload.size())
+				return error_code::protocol_error;
+			payload.remove_suffix(pad_length);
+		}
+
+		// 数据一到就归还连接级的窗口, 请求 body 的大小由每个 stream 的 body_limit 控制.
+		if (h.length)
+			queue_window_update(0, h.length);
+
+		auto it = streams_.find(h.stream_id);
+		if (it == streams_.end())
+		{
+			if (h.stream_id > last_stream_id_)
+				return error_code::protocol_error;
+			reset_stream(h.stream_id, error_code::stream_closed);
+			return error_code::no_error;
+		}
+
+		auto st = it->second;
+		if (st->reset)
+			return error_code::no_error;
+		if (st->request_complete)
+		{
+			reset_stream(h.stream_id, error_code::stream_closed);
+			return error_code::no_error;
+		}
+
+		if (st->req.body().size() + payload.size() > st->body_limit)
+		{
+			reset_stream(h.stream_id, error_code::cancel);
+			return error_code::no_error;
+		}
+		st->req.body().append(payload);
+
+		if (h.flags & flags::end_stream)
+		{
+			st->request_complete = true;
+			start_handler(st);
+		}
+		else if (h.length)
+		{
+			queue_window_update(h.stream_id, h.length);
+		}
+
+		return error_code::no_error;
+	}
+
+	error_code server_connection::on_settings(const frame_header& h, std::string_view payload)
+	{
+		if (h.stream_id != 0)
+			return error_code::protocol_error;
+
+		if (h.flags & flags::ack)
+			return payload.empty() ? error_code::no_error : error_code::frame_size_error;
+
+		if (payload.size() % 6)
+			return error_code::frame_size_error;
+
+		for (std::size_t i = 0; i < payload.size(); i += 6)
+		{
+			auto id = static_cast<settings_id>((static_cast<std::uint8_t>(payload[i]) << 8) | static_cast<std::uint8_t>(payload[i + 1]));
+			std::uint32_t value = read_uint32(payload.data() + i + 2);
+
+			switch (id)
+			{
+				case settings_id::enable_push:
+					if (value > 1)
+						return error_code::protocol_error;
+					break;
+				case settings_id::initial_window_size:
+				{
+					if (value > max_window_size)
+						return error_code::flow_control_error;
+					// 调整所有已打开 stream 的发送窗口, 可能变成负数.
+					std::int64_t delta = static_cast<std::int64_t>(value) - peer_initial_window_;
+					for (auto& [_, st] : streams_)
+					{
+						st->send_window += delta;
+						if (st->send_window > max_window_size)
+							return error_code::flow_control_error;
+					}
+					peer_initial_window_ = value;
+					window_notify_.cancel();
+					break;
+				}
+				case settings_id::max_frame_size:
+					if (value < default_max_frame_size || value > max_max_frame_size)
+						return error_code::protocol_error;
+					peer_max_frame_size_ = value;
+					break;
+				default:
+					// 编码器不用动态表, HEADER_TABLE_SIZE 不影响我们. 其余的也不关心.
+					break;
+			}
+		}
+
+		std::string frame;
+		append_frame_header(frame, 0, frame_type::settings, flags::ack, 0);
+		queue_frame(std::move(frame));
+		return error_code::no_error;
+	}
+
+	error_code server_connection::on_window_update(const frame_header& h, std::string_view payload)
+	{
+		if (payload.size() != 4)
+			return error_code::frame_size_error;
+
+		std::uint32_t increment = read_uint32(payload.data()) & 0x7fffffff;
+
+		if (h.stream_id == 0)
+		{
+			if (increment == 0)
+				return error_code::protocol_error;
+			send_window_ += increment;
+			if (send_window_ > max_window_size)
+				return error_code::flow_control_error;
+		}
+		else
+		{
+			auto it = streams_.find(h.stream_id);
+			if (it == streams_.end())
+			{
+				if (h.stream_id > last_stream_id_)
+					return error_code::protocol_error;
+				// 已经关闭的 stream, 忽略.
+				return error_code::no_error;
+			}
+
+			if (increment == 0)
+			{
+				reset_stream(h.stream_id, error_code::protocol_error);
+				return error_code::no_error;
+			}
+
+			it->second->send_window += increment;
+			if (it->second->send_window > max_window_size)
+			{
+				reset_stream(h.stream_id, error_code::flow_control_error);
+				return error_code::no_error;
+			}
+		}
+
+		window_notify_.cancel();
+		return error_code::no_error;
+	}
+
+	error_code server_connection::on_rst_stream(const frame_header& h, std::string_view payload)
+	{
+		if (h.stream_id == 0 || h.stream_id > last_stream_id_)
+			return error_code::protocol_error;
+		if (payload.size() != 4)
+			return error_code::frame_size_error;
+
+		if (auto it = streams_.find(h.stream_id); it != streams_.end())
+		{
+			auto st = it->second;
+			st->reset = true;
+			if (!st->handler_started)
+				streams_.erase(it);
+			// 唤醒可能在等窗口的写操作, 让它返回错误.
+			window_notify_.cancel();
+		}
+		return error_code::no_error;
+	}
+
+	void server_connection::start_handler(std::shared_ptr<stream_state> st)
+	{
+		st->handler_started = true;
+
+		boost::asio::co_spawn(executor_,
+			[self = shared_from_this(), st]() -> awaitable<void>
+			{
+				http_any_stream stream(boost::variant2::in_place_type<server_stream>, self, st, self->executor_);
+				co_await self->handler_(st->req, stream);
+			},
+			[self = shared_from_this(), st](std::exception_ptr)
+			{
+				// handler 没有写完整个响应就退出了.
+				if (!st->reset && !st->response_complete)
+					self->reset_stream(st->id, error_code::internal_error);
+				self->streams_.erase(st->id);
+				self->update_idle_deadline();
+			});
+	}
+
+	void server_connection::update_idle_deadline()
+	{
+		if (closing_ || !streams_.empty())
+			idle_deadline_.cancel();
+		else if (goaway_sent_)
+		{
+			// GOAWAY 之后没有 stream 了, 留一点时间把 GOAWAY 和最后的响应写出去再关.
+			if (!idle_deadline_.pending())
+				idle_deadline_.expires_after(std::chrono::milliseconds(100));
+		}
+		else if (settings_.idle_timeout == std::chrono::steady_clock::duration::zero())
+			idle_deadline_.cancel();
+		else if (!idle_deadline_.pending())
+			idle_deadline_.expires_after(settings_.idle_timeout);
+	}
+
+	void server_connection::shutdown()
+	{
+		if (closing_ || goaway_sent_)
+			return;
+
+		std::string frame;
+		append_frame_header(frame, 8, frame_type::goaway, 0, 0);
+		append_uint32(frame, last_stream_id_);
+		append_uint32(frame, static_cast<std::uint32_t>(error_code::no_error));
+		queue_frame(std::move(frame));
+
+		goaway_sent_ = true;
+		idle_deadline_.cancel();
+		update_idle_deadline();
+	}
+
+	void server_connection::reset_stream(std::uint32_t stream_id, error_code code)
+	{
+		std::string frame;
+		append_frame_header(frame, 4, frame_type::rst_stream, 0, stream_id);
+		append_uint32(frame, static_cast<std::uint32_t>(code));
+		queue_frame(std::move(frame));
+
+		if (auto it = streams_.find(stream_id); it != streams_.end())
+		{
+			auto st = it->second;
+			st->reset = true;
+			if (!st->handler_started)
+				streams_.erase(it);
+			window_notify_.cancel();
+		}
+	}
+
+	void server_connection::queue_frame(std::string frame)
+	{
+		if (closing_)
+			return;
+		write_queue_.push_back(std::move(frame));
+		write_notify_.cancel();
+	}
+
+	void server_connection::queue_headers(std::uint32_t stream_id, std::string_view block, bool end_stream)
+	{
+		// 超过对端 max frame size 的 header block 拆成 HEADERS + CONTINUATION.
+		frame_type type = frame_type::headers;
+		std::uint8_t frame_flags = end_stream ? flags::end_stream : 0;
+
+		do
+		{
+			std::size_t n = std::min<std::size_t>(block.size(), peer_max_frame_size_);
+			std::uint8_t f = frame_flags | (n == block.size() ? flags::end_headers : 0);
+
+			std::string frame;
+			frame.reserve(frame_header_length + n);
+			append_frame_header(frame, static_cast<std::uint32_t>(n), type, f, stream_id);
+			frame.append(block.substr(0, n));
+			queue_frame(std::move(frame));
+
+			block.remove_prefix(n);
+			type = frame_type::continuation;
+			frame_flags = 0;
+		} while (!block.empty());
+	}
+
+	void server_connection::queue_data(std::uint32_t stream_id, std::string_view payload, bool end_stream)
+	{
+		std::string frame;
+		frame.reserve(frame_header_length + payload.size());
+		append_frame_header(frame, static_cast<std::uint32_t>(payload.size()), frame_type::data,
+			end_stream ? flags::end_stream : 0, stream_id);
+		frame.append(payload);
+		queue_frame(std::move(frame));
+	}
+
+	void server_connection::queue_window_update(std::uint32_t stream_id, std::uint32_t increment)
+	{
+		std::string frame;
+		append_frame_header(frame, 4, frame_type::window_update, 0, stream_id);
+		append_uint32(frame, increment);
+		queue_frame(std::move(frame));
+	}
+
+	awaitable<boost::system::error_code> server_connection::write_response(std::shared_ptr<stream_state> st, std::string data)
+	{
+		if (closing_ || st->reset)
+			co_return boost::asio::error::connection_reset;
+		if (st->response_complete)
+			co_return boost::asio::error::broken_pipe;
+
+		auto& translator = st->translator;
+
+		st->input.append(data);
+		while (!translator.is_done() && !st->input.empty())
+		{
+			boost::system::error_code ec;
+			auto consumed = translator.put(boost::asio::buffer(st->input), ec);
+			st->input.erase(0, consumed);
+			if (ec == boost::beast::http::error::need_more)
+				break;
+			if (ec)
+				co_return ec;
+			if (consumed == 0)
+				break;
+		}
+
+		if (translator.is_header_done() && !st->headers_sent)
+		{
+			bool end_stream = translator.is_done() && translator.body.empty();
+			queue_headers(st->id, translator.header_block, end_stream);
+			translator.header_block.clear();
+			st->headers_sent = true;
+			st->response_complete = end_stream;
+		}
+
+		// body 按流控窗口和对端的 max frame size 切成 DATA 帧, 窗口不够就等 WINDOW_UPDATE.
+		while (!translator.body.empty())
+		{
+			if (closing_ || st->reset)
+				co_return boost::asio::error::connection_reset;
+
+			std::int64_t n = std::min<std::int64_t>({ send_window_, st->send_window,
+				static_cast<std::int64_t>(peer_max_frame_size_), static_cast<std::int64_t>(translator.body.size()) });
+			if (n <= 0)
+			{
+				boost::system::error_code ec;
+				co_await window_notify_.async_wait(boost::asio::redirect_error(use_awaitable, ec));
+				continue;
+			}
+
+			bool end_stream = translator.is_done() && static_cast<std::size_t>(n) == translator.body.size();
+			queue_data(st->id, std::string_view(translator.body).substr(0, n), end_stream);
+			send_window_ -= n;
+			st->send_window -= n;
+			translator.body.erase(0, n);
+			st->response_complete = end_stream;
+		}
+
+		if (st->headers_sent && translator.is_done() && !st->response_complete)
+		{
+			queue_data(st->id, {}, true);
+			st->response_complete = true;
+		}
+
+		co_return boost::system::error_code{};
+	}
+
+	void server_connection::close_stream(const std::shared_ptr<stream_state>& st)
+	{
+		if (st->reset || st->response_complete)
+			return;
+
+		// 没有 content-length 的响应以关闭连接作为结束.
+		auto& translator = st->translator;
+		if (translator.is_header_done() && st->headers_sent && translator.body.empty())
+		{
+			boost::system::error_code ec;
+			translator.put_eof(ec);
+			if (!ec)
+			{
+				queue_data(st->id, {}, true);
+				st->response_complete = true;
+				return;
+			}
+		}
+
+		reset_stream(st->id, error_code::cancel);
+	}
+
+	awaitable<bool> is_http2_connection(http_any_stream& stream, boost::beast::flat_buffer& buffer)
+	{
+		SSL* ssl = nullptr;
+		if (auto s = boost::variant2::get_if<boost::beast::ssl_stream<boost::beast::tcp_stream>>(&stream))
+			ssl = s->native_handle();
+		else if (auto s = boost::variant2::get_if<ktls_stream>(&stream))
+			ssl = s->native_handle();
+
+		if (ssl)
+		{
+			const unsigned char* protocol = nullptr;
+			unsigned int length = 0;
+			SSL_get0_alpn_selected(ssl, &protocol, &length);
+			co_return std::string_view(reinterpret_cast<const char*>(protocol), length) == "h2";
+		}
+
+		for (;;)
+		{
+			std::size_t n = std::min(buffer.size(), client_preface.size());
+			std::string_view received(static_cast<const char*>(buffer.data().data()), n);
+			if (received != client_preface.substr(0, n))
+				co_return false;
+			if (n == client_preface.size())
+				co_return true;
+
+			auto bytes = co_await stream.async_read_some(buffer.prepare(4096), use_awaitable);
+			buffer.commit(bytes);
+		}
+	}
+
+	void enable_alpn(boost::asio::ssl::context& ctx)
+	{
+		SSL_CTX_set_alpn_select_cb(ctx.native_handle(),
+			[](SSL*, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void*) -> int
+			{
+				static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+				unsigned char* selected = nullptr;
+				if (SSL_select_next_proto(&selected, outlen, protocols, sizeof(protocols) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+					return SSL_TLSEXT_ERR_NOACK;
+				*out = selected;
+				return SSL_TLSEXT_ERR_OK;
+			}, nullptr);
+	}
+}
@@ -28,11 +28,20 @@ namespace httpd {
 		{ ".webp", "images/webp" }
 	};
 
-    std::string get_mime_type_from_extension(std::string_view extension)
+    std::string_view get_mime_type_from_extension(std::string_view extension)
     {
-        if (mime_map.contains(extension))
-            return mime_map.at(extension);
-        return std::string{};
+        auto it = mime_map.find(extension);
+        if (it != mime_map.end())
+            return it->second;
+        return std::string_view{};
+    }
+
+    std::string_view get_mime_type_from_path(std::string_view path)
+    {
+        auto pos = path.find_last_of("./");
+        if (pos == std::string_view::npos || path[pos] != '.')
+            return std::string_view{};
+        return get_mime_type_from_extension(path.substr(pos));
     }
 
 	time_t dos2unixtime(unsigned long dostime)
@@ -0,0 +1,39 @@
+
+#include "httpd/inflight_limit.hpp"
+
+namespace httpd {
+
+	inflight_limit::inflight_limit(boost::asio::any_io_executor executor, std::size_t capacity)
+		: capacity_(capacity)
+		, doorbell_(executor, 1)
+	{
+	}
+
+	std::size_t inflight_limit::clamp(std::size_t cost) const
+	{
+		if (capacity_ && cost > capacity_)
+			return capacity_;
+		return cost;
+	}
+
+	boost::asio::awaitable<void> inflight_limit::async_acquire(std::size_t cost)
+	{
+		if (capacity_ && in_use_ + cost > capacity_)
+		{
+			waits_++;
+
+			// 之前的 release 留下的通知可能已经过时, 醒来后重新检查.
+			while (in_use_ + cost > capacity_)
+				co_await doorbell_.async_receive(boost::asio::use_awaitable);
+		}
+
+		in_use_ += cost;
+	}
+
+	void inflight_limit::release(std::size_t cost)
+	{
+		in_use_ -= cost;
+		if (capacity_)
+			doorbell_.try_send(boost::system::error_code());
+	}
+}
@@ -0,0 +1,210 @@
+
+#include "httpd/listen_fds.hpp"
+#include "httpd/detail/parser.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef BOOST_POSIX_API
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace httpd {
+
+#ifdef BOOST_POSIX_API
+
+	// 和 sd-daemon.h 里的 SD_LISTEN_FDS_START 一样, 这里不依赖 libsystemd.
+	static constexpr int listen_fds_start = 3;
+
+	// 一次 sendmsg 最多能带的 fd 数 (内核的 SCM_MAX_FD).
+	static constexpr std::size_t max_fds_per_message = 253;
+
+	static void set_cloexec(int fd)
+	{
+		int flags = fcntl(fd, F_GETFD);
+		if (flags >= 0 && !(flags & FD_CLOEXEC))
+			fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+	}
+
+	static bool is_listening(int fd)
+	{
+		int listening = 0;
+		socklen_t len = sizeof(listening);
+		return getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == 0 && listening;
+	}
+
+	std::vector<int> take_systemd_listen_fds()
+	{
+		std::vector<int> fds;
+
+		const char* pid = std::getenv("LISTEN_PID");
+		const char* count = std::getenv("LISTEN_FDS");
+		if (pid && count && std::atol(pid) == static_cast<long>(getpid()))
+		{
+			int n = std::atoi(count);
+			for (int fd = listen_fds_start; fd < listen_fds_start + n; fd++)
+			{
+				set_cloexec(fd);
+				fds.push_back(fd);
+			}
+		}
+
+		unsetenv("LISTEN_PID");
+		unsetenv("LISTEN_FDS");
+		unsetenv("LISTEN_FDNAMES");
+		return fds;
+	}
+
+	bool is_tcp_listener_on(int fd, const std::string& listen_address)
+	{
+		boost::system::error_code ec;
+		boost::asio::ip::tcp::endpoint want;
+		detail::make_listen_endpoint(listen_address, want, ec);
+		if (ec || !is_listening(fd))
+			return false;
+
+		boost::asio::ip::tcp::endpoint have;
+		socklen_t len = static_cast<socklen_t>(have.capacity());
+		if (getsockname(fd, have.data(), &len) != 0)
+			return false;
+		have.resize(len);
+
+		return have == want;
+	}
+
+	bool is_unix_listener_on(int fd, const std::string& path)
+	{
+		if (!is_listening(fd))
+			return false;
+
+		sockaddr_un addr{};
+		socklen_t len = sizeof(addr);
+		if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0 || addr.sun_family != AF_UNIX)
+			return false;
+
+		return path == addr.sun_path;
+	}
+
+	void send_listen_fds(int unix_socket, const std::vector<int>& fds, boost::system::error_code& ec)
+	{
+		if (fds.empty() || fds.size() > max_fds_per_message)
+		{
+			ec = boost::asio::error::invalid_argument;
+			return;
+		}
+
+		// 至少要带一个字节的数据, 这里放 fd 的个数, 接收方用来校验.
+		unsigned char count = static_cast<unsigned char>(fds.size());
+		iovec iov{ &count, 1 };
+
+		std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+		std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+		ssize_t r;
+		do
+			r = sendmsg(unix_socket, &msg, MSG_NOSIGNAL);
+		while (r < 0 && errno == EINTR);
+
+		if (r < 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+		else
+			ec = {};
+	}
+
+	std::vector<int> receive_listen_fds(int unix_socket, boost::system::error_code& ec)
+	{
+		std::vector<int> fds;
+
+		unsigned char count = 0;
+		iovec iov{ &count, 1 };
+
+		std::vector<char> control(CMSG_SPACE(sizeof(int) * max_fds_per_message));
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+
+		ssize_t r;
+		do
+			r = recvmsg(unix_socket, &msg, MSG_CMSG_CLOEXEC);
+		while (r < 0 && errno == EINTR);
+
+		if (r < 0)
+		{
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			return fds;
+		}
+		if (r == 0)
+		{
+			ec = boost::asio::error::eof;
+			return fds;
+		}
+
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+
+			std::size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			std::size_t offset = fds.size();
+			fds.resize(offset + n);
+			std::memcpy(fds.data() + offset, CMSG_DATA(cmsg), sizeof(int) * n);
+		}
+
+		if ((msg.msg_flags & MSG_CTRUNC) || fds.size() != count)
+		{
+			for (int fd : fds)
+				close(fd);
+			fds.clear();
+			ec = boost::asio::error::message_size;
+			return fds;
+		}
+
+		ec = {};
+		return fds;
+	}
+
+#else
+
+	std::vector<int> take_systemd_listen_fds()
+	{
+		return {};
+	}
+
+	bool is_tcp_listener_on(int, const std::string&)
+	{
+		return false;
+	}
+
+	bool is_unix_listener_on(int, const std::string&)
+	{
+		return false;
+	}
+
+	void send_listen_fds(int, const std::vector<int>&, boost::system::error_code& ec)
+	{
+		ec = boost::asio::error::operation_not_supported;
+	}
+
+	std::vector<int> receive_listen_fds(int, boost::system::error_code& ec)
+	{
+		ec = boost::asio::error::operation_not_supported;
+		return {};
+	}
+
+#endif
+}
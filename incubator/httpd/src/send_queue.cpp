@@ -0,0 +1,146 @@
+
+#include "httpd/send_queue.hpp"
+
+namespace httpd {
+
+	send_queue_stats send_queue_counters::stats() const
+	{
+		return send_queue_stats {
+			queued_messages_.load(std::memory_order_relaxed),
+			sent_messages_.load(std::memory_order_relaxed),
+			coalesced_writes_.load(std::memory_order_relaxed),
+			dropped_messages_.load(std::memory_order_relaxed),
+			dropped_bytes_.load(std::memory_order_relaxed),
+			overflow_disconnects_.load(std::memory_order_relaxed),
+		};
+	}
+
+	send_queue::send_queue(boost::asio::any_io_executor executor, const send_queue_config& config, send_queue_counters* counters)
+		: config_(config)
+		, counters_(counters)
+		, doorbell_(executor, 1)
+	{
+	}
+
+	bool send_queue::push(shared_message message)
+	{
+		{
+			std::unique_lock<std::mutex> l(mutex_);
+			if (closed_ || close_code_)
+				return false;
+
+			if (!queue_.empty() && bytes_ + message->size() > config_.high_water_bytes)
+			{
+				if (config_.policy == overflow_policy::disconnect)
+				{
+					closed_ = true;
+					overflowed_ = true;
+					l.unlock();
+
+					if (counters_)
+						counters_->overflow_disconnects_++;
+					doorbell_.close();
+					return false;
+				}
+
+				while (!queue_.empty() && bytes_ + message->size() > config_.high_water_bytes)
+				{
+					bytes_ -= queue_.front()->size();
+					if (counters_)
+					{
+						counters_->dropped_messages_++;
+						counters_->dropped_bytes_ += queue_.front()->size();
+					}
+					queue_.pop_front();
+				}
+			}
+
+			bytes_ += message->size();
+			queue_.push_back(std::move(message));
+		}
+
+		if (counters_)
+			counters_->queued_messages_++;
+
+		doorbell_.try_send(boost::system::error_code());
+		return true;
+	}
+
+	boost::asio::awaitable<bool> send_queue::async_pop(std::vector<shared_message>& batch)
+	{
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> l(mutex_);
+				if (closed_)
+					co_return false;
+
+				if (!queue_.empty())
+				{
+					std::size_t batch_bytes = 0;
+					do
+					{
+						batch_bytes += queue_.front()->size();
+						bytes_ -= queue_.front()->size();
+						batch.push_back(std::move(queue_.front()));
+						queue_.pop_front();
+					} while (!queue_.empty() && batch_bytes + queue_.front()->size() <= config_.max_batch_bytes);
+
+					l.unlock();
+
+					if (counters_)
+					{
+						counters_->sent_messages_ += batch.size();
+						if (batch.size() > 1)
+							counters_->coalesced_writes_++;
+					}
+					co_return true;
+				}
+
+				if (close_code_)
+					co_return false;
+			}
+
+			boost::system::error_code ec;
+			co_await doorbell_.async_receive(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+			if (ec)
+				co_return false;
+		}
+	}
+
+	void send_queue::close()
+	{
+		{
+			std::lock_guard<std::mutex> l(mutex_);
+			closed_ = true;
+		}
+		doorbell_.close();
+	}
+
+	void send_queue::shutdown(std::uint16_t close_code)
+	{
+		{
+			std::lock_guard<std::mutex> l(mutex_);
+			close_code_ = close_code;
+		}
+		doorbell_.try_send(boost::system::error_code());
+	}
+
+	std::uint16_t send_queue::close_code() const
+	{
+		std::lock_guard<std::mutex> l(mutex_);
+		return close_code_;
+	}
+
+	bool send_queue::overflowed() const
+	{
+		std::lock_guard<std::mutex> l(mutex_);
+		return overflowed_;
+	}
+
+	std::size_t send_queue::pending_bytes() const
+	{
+		std::lock_guard<std::mutex> l(mutex_);
+		return bytes_;
+	}
+}
@@ -0,0 +1,156 @@
+
+#include "httpd/timer_wheel.hpp"
+
+namespace httpd {
+
+	deadline::deadline(const boost::asio::any_io_executor& executor)
+		: wheel_(timer_wheel::of(executor))
+	{
+	}
+
+	deadline::deadline(timer_wheel& wheel)
+		: wheel_(wheel)
+	{
+	}
+
+	deadline::~deadline()
+	{
+		cancel();
+	}
+
+	void deadline::on_expire(std::function<void()> handler)
+	{
+		handler_ = std::move(handler);
+	}
+
+	void deadline::expires_after(std::chrono::steady_clock::duration d)
+	{
+		wheel_.schedule(*this, d);
+	}
+
+	void deadline::cancel()
+	{
+		wheel_.cancel(*this);
+	}
+
+	timer_wheel::timer_wheel(boost::asio::execution_context& ctx, std::chrono::steady_clock::duration tick, std::size_t slot_count)
+		: boost::asio::execution_context::service(ctx)
+		, tick_(tick)
+		, timer_(static_cast<boost::asio::io_context&>(ctx))
+		, slots_(slot_count)
+	{
+		for (auto& s : slots_)
+			s.self_link();
+	}
+
+	timer_wheel& timer_wheel::of(const boost::asio::any_io_executor& executor)
+	{
+		return boost::asio::use_service<timer_wheel>(boost::asio::query(executor, boost::asio::execution::context));
+	}
+
+	void timer_wheel::shutdown()
+	{
+		for (auto& s : slots_)
+		{
+			while (s.next != &s)
+				s.next->unlink();
+		}
+		size_ = 0;
+
+		boost::system::error_code ignore_ec;
+		timer_.cancel(ignore_ec);
+	}
+
+	void timer_wheel::schedule(deadline& d, std::chrono::steady_clock::duration after)
+	{
+		if (d.linked())
+			d.unlink();
+		else
+			size_++;
+
+		// 向上取整到 tick, 至少一个 tick. 轮子已经在转的时候下一个 tick 随时会到,
+		// 再多算一个, 保证不会提前触发.
+		auto ticks = static_cast<std::size_t>((after + tick_ - std::chrono::steady_clock::duration(1)) / tick_);
+		if (ticks == 0)
+			ticks = 1;
+		if (ticking_)
+			ticks++;
+
+		d.rounds_ = (ticks - 1) / slots_.size();
+		d.link_before(&slots_[(current_ + ticks) % slots_.size()]);
+
+		if (!ticking_)
+		{
+			ticking_ = true;
+			timer_.expires_after(tick_);
+			wait_tick();
+		}
+	}
+
+	void timer_wheel::cancel(deadline& d)
+	{
+		if (d.linked())
+		{
+			d.unlink();
+			size_--;
+		}
+	}
+
+	void timer_wheel::on_tick()
+	{
+		current_ = (current_ + 1) % slots_.size();
+		auto& head = slots_[current_];
+
+		// 先把到期的挪到临时链表里. handler 里可能会取消或者析构别的 deadline,
+		// 也可能重新调度自己, 所以每次只从临时链表头上取一个.
+		detail::wheel_link expired;
+		expired.self_link();
+		for (auto* l = head.next; l != &head;)
+		{
+			auto* next = l->next;
+			auto* d = static_cast<deadline*>(l);
+			if (d->rounds_ == 0)
+			{
+				d->unlink();
+				d->link_before(&expired);
+			}
+			else
+			{
+				d->rounds_--;
+			}
+			l = next;
+		}
+
+		while (expired.next != &expired)
+		{
+			auto* d = static_cast<deadline*>(expired.next);
+			d->unlink();
+			size_--;
+			// 复制一份再调用, handler 里可能会析构这个 deadline. 到期是少数情况, 不在乎这次复制.
+			if (auto handler = d->handler_)
+				handler();
+		}
+
+		if (size_ == 0)
+		{
+			ticking_ = false;
+			return;
+		}
+
+		timer_.expires_at(timer_.expiry() + tick_);
+		wait_tick();
+	}
+
+	void timer_wheel::wait_tick()
+	{
+		timer_.async_wait([this](boost::system::error_code ec)
+		{
+			if (ec)
+			{
+				ticking_ = false;
+				return;
+			}
+			on_tick();
+		});
+	}
+}
@@ -0,0 +1,202 @@
+
+#include "httpd/tls_session.hpp"
+
+#include <cstring>
+
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+namespace httpd {
+
+	static int ssl_ctx_ex_index()
+	{
+		static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+		return index;
+	}
+
+	// 标记这个连接已经计过数. TLS 1.3 发 NewSessionTicket 时也会再触发 SSL_CB_HANDSHAKE_DONE.
+	static int ssl_counted_ex_index()
+	{
+		static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+		return index;
+	}
+
+	static void throw_ssl_error(const char* what)
+	{
+		throw boost::system::system_error(
+			boost::system::error_code(static_cast<int>(ERR_get_error()), boost::asio::error::get_ssl_category()), what);
+	}
+
+	tls_session_manager::tls_session_manager(const tls_session_config& config)
+		: config_(config)
+		, current_key_(generate_ticket_key())
+		, previous_key_(current_key_)
+	{
+	}
+
+	tls_session_manager::ticket_key tls_session_manager::generate_ticket_key()
+	{
+		ticket_key key;
+		if (RAND_bytes(key.name.data(), static_cast<int>(key.name.size())) != 1
+			|| RAND_bytes(key.aes_key.data(), static_cast<int>(key.aes_key.size())) != 1
+			|| RAND_bytes(key.hmac_key.data(), static_cast<int>(key.hmac_key.size())) != 1)
+			throw_ssl_error("RAND_bytes");
+		return key;
+	}
+
+	void tls_session_manager::apply(boost::asio::ssl::context& ctx)
+	{
+		SSL_CTX* native = ctx.native_handle();
+
+		SSL_CTX_set_ex_data(native, ssl_ctx_ex_index(), this);
+
+		if (config_.session_cache_size > 0)
+		{
+			SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER);
+			SSL_CTX_sess_set_cache_size(native, config_.session_cache_size);
+		}
+		else
+		{
+			SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_OFF);
+		}
+
+		static const unsigned char session_id_context[] = "httpd";
+		SSL_CTX_set_session_id_context(native, session_id_context, sizeof(session_id_context) - 1);
+		SSL_CTX_set_timeout(native, static_cast<long>(config_.session_timeout.count()));
+
+		if (config_.session_tickets)
+		{
+			SSL_CTX_clear_options(native, SSL_OP_NO_TICKET);
+			if (SSL_CTX_set_tlsext_ticket_key_evp_cb(native, &tls_session_manager::ticket_key_callback) != 1)
+				throw_ssl_error("SSL_CTX_set_tlsext_ticket_key_evp_cb");
+		}
+		else
+		{
+			SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+		}
+
+		if (!config_.groups.empty() && SSL_CTX_set1_groups_list(native, config_.groups.c_str()) != 1)
+			throw_ssl_error("SSL_CTX_set1_groups_list");
+
+		SSL_CTX_set_info_callback(native, &tls_session_manager::info_callback);
+	}
+
+	void tls_session_manager::rotate_ticket_key()
+	{
+		ticket_key new_key = generate_ticket_key();
+
+		std::lock_guard<std::mutex> l(key_mutex_);
+		OPENSSL_cleanse(&previous_key_, sizeof(previous_key_));
+		previous_key_ = current_key_;
+		current_key_ = new_key;
+		OPENSSL_cleanse(&new_key, sizeof(new_key));
+
+		++ticket_key_rotations_;
+	}
+
+	boost::asio::awaitable<void> tls_session_manager::ticket_key_rotate_loop()
+	{
+		boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+
+		for (;;)
+		{
+			timer.expires_after(config_.ticket_key_rotation);
+			co_await timer.async_wait(boost::asio::use_awaitable);
+			rotate_ticket_key();
+		}
+	}
+
+	tls_session_stats tls_session_manager::stats() const
+	{
+		return tls_session_stats{
+			full_handshakes_.load(std::memory_order_relaxed),
+			resumed_handshakes_.load(std::memory_order_relaxed),
+			ticket_key_rotations_.load(std::memory_order_relaxed),
+		};
+	}
+
+	tls_session_manager* tls_session_manager::from_ssl(const SSL* ssl)
+	{
+		return static_cast<tls_session_manager*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ssl_ctx_ex_index()));
+	}
+
+	// enc = 1 时选当前密钥加密新 ticket. enc = 0 时按 key_name 找密钥解密,
+	// 返回 0 表示找不到 (退回完整握手), 1 表示正常, 2 表示正常并且要给客户端发新 ticket.
+	int tls_session_manager::ticket_key_callback(SSL* ssl, unsigned char key_name[16], unsigned char* iv,
+		EVP_CIPHER_CTX* cipher_ctx, EVP_MAC_CTX* mac_ctx, int enc)
+	{
+		tls_session_manager* self = from_ssl(ssl);
+		if (!self)
+			return -1;
+
+		ticket_key key;
+		int ret = 1;
+		{
+			std::lock_guard<std::mutex> l(self->key_mutex_);
+			if (enc)
+			{
+				key = self->current_key_;
+			}
+			else if (std::memcmp(key_name, self->current_key_.name.data(), 16) == 0)
+			{
+				key = self->current_key_;
+				// TLS 1.3 的客户端不会重复使用同一个 ticket, 不续发的话下一次重连只能完整握手.
+				if (SSL_version(ssl) == TLS1_3_VERSION)
+					ret = 2;
+			}
+			else if (std::memcmp(key_name, self->previous_key_.name.data(), 16) == 0)
+			{
+				key = self->previous_key_;
+				ret = 2;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+
+		OSSL_PARAM params[] = {
+			OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key.data(), key.hmac_key.size()),
+			OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0),
+			OSSL_PARAM_construct_end(),
+		};
+
+		if (enc)
+		{
+			std::memcpy(key_name, key.name.data(), 16);
+			if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1
+				|| EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key.aes_key.data(), iv) != 1)
+				ret = -1;
+		}
+		else
+		{
+			if (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key.aes_key.data(), iv) != 1)
+				ret = -1;
+		}
+
+		if (ret > 0 && EVP_MAC_CTX_set_params(mac_ctx, params) != 1)
+			ret = -1;
+
+		OPENSSL_cleanse(&key, sizeof(key));
+		return ret;
+	}
+
+	void tls_session_manager::info_callback(const SSL* ssl, int where, int)
+	{
+		if (!(where & SSL_CB_HANDSHAKE_DONE))
+			return;
+
+		tls_session_manager* self = from_ssl(ssl);
+		if (!self || SSL_get_ex_data(ssl, ssl_counted_ex_index()))
+			return;
+
+		SSL_set_ex_data(const_cast<SSL*>(ssl), ssl_counted_ex_index(), self);
+
+		if (SSL_session_reused(ssl))
+			++self->resumed_handshakes_;
+		else
+			++self->full_handshakes_;
+	}
+}
@@ -0,0 +1,21 @@
+#include "httpd/ws_loop.hpp"
+
+namespace httpd {
+
+	boost::json::value parse_json_message(std::string_view data, boost::system::error_code& ec, boost::json::storage_ptr sp)
+	{
+		thread_local unsigned char parser_temp[4096];
+		thread_local boost::json::stream_parser parser({}, { 64, false, false, true }, parser_temp, sizeof(parser_temp));
+
+		boost::json::value jv;
+		parser.reset(std::move(sp));
+		parser.write(data.data(), data.size(), ec);
+		if (!ec)
+			parser.finish(ec);
+		if (!ec)
+			jv = parser.release();
+		// 不再引用这条消息的 sp, 让它跟着 jv 走.
+		parser.reset();
+		return jv;
+	}
+}
@@ -0,0 +1,135 @@
+
+// 对比静态资源响应路径上, 旧写法 (std::map 头 + string_body + strftime) 和
+// request_arena + response_fields + cached_http_date 的每请求内存分配次数和耗时.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "httpd/arena.hpp"
+#include "httpd/header_helper.hpp"
+#include "httpd/http_misc_helper.hpp"
+
+static std::atomic_size_t allocation_count{ 0 };
+
+void* operator new(std::size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace http = boost::beast::http;
+
+// 把整个响应序列化一遍, 但不做 IO, 模拟 async_write 访问 buffer 的过程.
+template <typename Serializer>
+static std::size_t drain(Serializer& sr)
+{
+	std::size_t total = 0;
+	boost::system::error_code ec;
+	while (!sr.is_done())
+	{
+		std::size_t n = 0;
+		sr.next(ec, [&n](boost::system::error_code&, auto const& buffers)
+		{
+			n = boost::beast::buffer_bytes(buffers);
+		});
+		if (ec)
+			break;
+		sr.consume(n);
+		total += n;
+	}
+	return total;
+}
+
+static std::string strftime_date(std::time_t t)
+{
+	tm* gmt = gmtime(&t);
+	char time_buf[512] = { 0 };
+	strftime(time_buf, 200, "%a, %d %b %Y %H:%M:%S GMT", gmt);
+	return time_buf;
+}
+
+static std::size_t old_path(const std::string& body)
+{
+	std::map<http::field, std::string> headers;
+	headers.insert({ http::field::accept_ranges, "bytes" });
+	headers.insert({ http::field::expires, strftime_date(std::time(0) + 60) });
+	headers.insert({ http::field::content_type, "image/png" });
+
+	http::response<http::string_body> res{ http::status::ok, 11 };
+	res.set(http::field::server, "cmall1.0");
+	for (auto h : headers)
+		res.set(h.first, h.second);
+	res.keep_alive(true);
+	res.body() = body;
+	res.prepare_payload();
+
+	http::response_serializer<http::string_body, http::fields> sr{ res };
+	return drain(sr);
+}
+
+static std::size_t new_path(httpd::request_arena& arena, const std::string& body)
+{
+	using span_body = http::span_body<const char>;
+
+	arena.reset();
+
+	httpd::response_fields headers{ arena.resource() };
+	headers.set(http::field::accept_ranges, "bytes");
+	headers.set(http::field::expires, httpd::cached_http_date(std::time(0) + 60));
+	headers.set(http::field::content_type, httpd::get_mime_type_from_path("images/a.png"));
+
+	http::response<span_body, httpd::response_fields> res{ http::status::ok, 11,
+		span_body::value_type{ body.data(), body.size() }, std::move(headers) };
+	res.set(http::field::server, "cmall1.0");
+	res.keep_alive(true);
+	res.prepare_payload();
+
+	http::response_serializer<span_body, httpd::response_fields> sr{ res };
+	return drain(sr);
+}
+
+int main(int argc, char** argv)
+{
+	const int iterations = argc > 1 ? std::atoi(argv[1]) : 200000;
+	const std::string body(16 * 1024, 'x');
+	httpd::request_arena arena;
+
+	// 预热, 让 thread_local 的日期缓存等初始化完毕.
+	old_path(body);
+	new_path(arena, body);
+
+	auto run = [&](const char* name, auto&& fn)
+	{
+		std::size_t bytes = 0;
+		auto allocs_before = allocation_count.load();
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+			bytes += fn();
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		auto allocs = allocation_count.load() - allocs_before;
+
+		std::cout << name << ": "
+			<< static_cast<double>(allocs) / iterations << " allocations/request, "
+			<< std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / iterations << " ns/request, "
+			<< bytes / iterations << " bytes/request\n";
+	};
+
+	run("map + string_body + strftime", [&]{ return old_path(body); });
+	run("arena + span_body + cached date", [&]{ return new_path(arena, body); });
+
+	return 0;
+}
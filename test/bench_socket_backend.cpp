@@ -0,0 +1,187 @@
+// 在 loopback 上对比 socket I/O 后端 (epoll / io_uring) 的延迟和每请求的上下文切换.
+// 后端在编译期选定, 分别用 -DENABLE_IOURING_SOCKETS=OFF/ON 编译后运行对比.
+//
+// asset: keep-alive 的 HTTP GET, 返回 16KiB 的静态资源.
+// rpc:   websocket 上一问一答的小 JSON 消息.
+//
+// 每请求的系统调用数用 perf 统计, 除以输出的请求总数:
+//   perf stat -e raw_syscalls:sys_enter ./bench_socket_backend
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+
+#include "httpd/detail/config.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+using tcp = boost::asio::ip::tcp;
+namespace http = boost::beast::http;
+namespace websocket = boost::beast::websocket;
+
+static const std::string asset_body(16 * 1024, 'x');
+static const std::string rpc_reply = R"({"jsonrpc":"2.0","id":1,"result":{"ok":true}})";
+
+static awaitable<void> serve(tcp::socket socket)
+{
+	boost::beast::tcp_stream stream(std::move(socket));
+	boost::beast::flat_buffer buffer;
+	boost::system::error_code ec;
+
+	http::request<http::string_body> req;
+	co_await http::async_read(stream, buffer, req, boost::asio::redirect_error(use_awaitable, ec));
+	if (ec)
+		co_return;
+
+	if (websocket::is_upgrade(req))
+	{
+		websocket::stream<boost::beast::tcp_stream> ws(std::move(stream));
+		co_await ws.async_accept(req, use_awaitable);
+		for (;;)
+		{
+			boost::beast::flat_buffer msg;
+			co_await ws.async_read(msg, boost::asio::redirect_error(use_awaitable, ec));
+			if (ec)
+				co_return;
+			ws.text(true);
+			co_await ws.async_write(boost::asio::buffer(rpc_reply), use_awaitable);
+		}
+	}
+
+	for (;;)
+	{
+		http::response<http::string_body> res{ http::status::ok, req.version() };
+		res.set(http::field::content_type, "application/javascript");
+		res.body() = asset_body;
+		res.prepare_payload();
+		co_await http::async_write(stream, res, use_awaitable);
+
+		req = {};
+		co_await http::async_read(stream, buffer, req, boost::asio::redirect_error(use_awaitable, ec));
+		if (ec)
+			co_return;
+	}
+}
+
+static awaitable<void> accept_loop(tcp::acceptor& acceptor)
+{
+	for (;;)
+	{
+		auto socket = co_await acceptor.async_accept(use_awaitable);
+		socket.set_option(tcp::no_delay(true));
+		boost::asio::co_spawn(acceptor.get_executor(), serve(std::move(socket)), boost::asio::detached);
+	}
+}
+
+static awaitable<void> asset_client(tcp::endpoint endp, int requests, std::vector<double>& latency_us)
+{
+	boost::beast::tcp_stream stream(co_await boost::asio::this_coro::executor);
+	co_await stream.async_connect(endp, use_awaitable);
+	stream.socket().set_option(tcp::no_delay(true));
+
+	boost::beast::flat_buffer buffer;
+	http::request<http::empty_body> req{ http::verb::get, "/assets/index.js", 11 };
+	req.set(http::field::host, "localhost");
+
+	for (int i = 0; i < requests; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		co_await http::async_write(stream, req, use_awaitable);
+		http::response<http::string_body> res;
+		co_await http::async_read(stream, buffer, res, use_awaitable);
+		latency_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+}
+
+static awaitable<void> rpc_client(tcp::endpoint endp, int requests, std::vector<double>& latency_us)
+{
+	websocket::stream<boost::beast::tcp_stream> ws(co_await boost::asio::this_coro::executor);
+	co_await boost::beast::get_lowest_layer(ws).async_connect(endp, use_awaitable);
+	boost::beast::get_lowest_layer(ws).socket().set_option(tcp::no_delay(true));
+	co_await ws.async_handshake("localhost", "/api", use_awaitable);
+	ws.text(true);
+
+	const std::string call = R"({"jsonrpc":"2.0","id":1,"method":"cart.list","params":{"page":0,"page_size":20}})";
+	for (int i = 0; i < requests; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		co_await ws.async_write(boost::asio::buffer(call), use_awaitable);
+		boost::beast::flat_buffer msg;
+		co_await ws.async_read(msg, use_awaitable);
+		latency_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	co_await ws.async_close(websocket::close_code::normal, use_awaitable);
+}
+
+static long context_switches()
+{
+	rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+template <typename Client>
+static void run(const char* name, tcp::endpoint endp, int connections, int requests, Client client)
+{
+	boost::asio::io_context ioc(1);
+	std::vector<std::vector<double>> latencies(connections);
+
+	long csw = context_switches();
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < connections; i++)
+	{
+		latencies[i].reserve(requests);
+		boost::asio::co_spawn(ioc, client(endp, requests, latencies[i]),
+			[](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+	}
+	ioc.run();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	csw = context_switches() - csw;
+
+	std::vector<double> all;
+	for (auto& l : latencies)
+		all.insert(all.end(), l.begin(), l.end());
+	std::sort(all.begin(), all.end());
+
+	auto total = all.size();
+	std::cout << name << ": " << total << " requests, "
+		<< static_cast<long>(total / seconds) << " req/s, "
+		<< "p50 " << all[total / 2] << " us, "
+		<< "p99 " << all[total * 99 / 100] << " us, "
+		<< static_cast<double>(csw) / total << " context switches/req\n";
+}
+
+int main(int argc, char** argv)
+{
+	int connections = argc > 1 ? std::atoi(argv[1]) : 32;
+	int requests = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+	std::cout << "socket I/O backend: " << httpd::socket_io_backend() << "\n";
+
+	boost::asio::io_context server_ioc(1);
+	tcp::acceptor acceptor(server_ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	auto endp = acceptor.local_endpoint();
+	boost::asio::co_spawn(server_ioc, accept_loop(acceptor), boost::asio::detached);
+	std::thread server([&] { server_ioc.run(); });
+
+	run("asset", endp, connections, requests, asset_client);
+	run("rpc", endp, connections, requests, rpc_client);
+
+	server_ioc.stop();
+	server.join();
+	return 0;
+}
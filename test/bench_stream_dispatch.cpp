@@ -0,0 +1,138 @@
+// 对比直接在具体 stream 上读写, 和经过 httpd::http_stream (variant) 读写的开销.
+// 用 beast 的内存 stream, 没有系统调用, 差别就是 variant 分发和类型擦除的 handler.
+//
+// read/write: 一对 async_write_some/async_read_some, 每次 64 字节.
+// websocket:  websocket::stream<S&> 上一写一读一条 64 字节的消息, 相当于 do_ws_read/do_ws_write.
+//
+// 输出每次操作的平均 ns. 用 Release 编译才有意义.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/beast/_experimental/test/stream.hpp>
+
+#include "httpd/http_stream.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+using namespace boost::asio::experimental::awaitable_operators;
+namespace websocket = boost::beast::websocket;
+
+template <typename TeardownHandler>
+static void teardown_test_stream(boost::beast::role_type role, boost::beast::test::stream& s, TeardownHandler&& handler)
+{
+	async_teardown(role, s, std::forward<TeardownHandler>(handler));
+}
+
+// test::stream 的 teardown 只能通过 ADL 找到, http_stream 找的是成员函数, websocket 找的是
+// 派生类自己的重载, 这里都补上.
+struct mem_stream : boost::beast::test::stream
+{
+	using boost::beast::test::stream::stream;
+
+	template <typename TeardownHandler>
+	void async_teardown(boost::beast::role_type role, TeardownHandler&& handler)
+	{
+		teardown_test_stream(role, *this, std::forward<TeardownHandler>(handler));
+	}
+};
+
+template <typename TeardownHandler>
+static void async_teardown(boost::beast::role_type role, mem_stream& s, TeardownHandler&& handler)
+{
+	teardown_test_stream(role, s, std::forward<TeardownHandler>(handler));
+}
+
+// 和 http_any_stream 一样多的分支, 实际用的是内存 stream.
+using any_mem_stream = httpd::http_stream<mem_stream, boost::beast::tcp_stream,
+	boost::beast::ssl_stream<boost::beast::tcp_stream>, httpd::unix_stream, httpd::ktls_stream>;
+
+static const std::string payload(64, 'x');
+
+template <typename Stream>
+static awaitable<void> read_write_loop(Stream& writer, Stream& reader, int iterations)
+{
+	char buf[64];
+	for (int i = 0; i < iterations; i++)
+	{
+		co_await writer.async_write_some(boost::asio::buffer(payload), use_awaitable);
+		co_await reader.async_read_some(boost::asio::buffer(buf), use_awaitable);
+	}
+}
+
+template <typename Stream>
+static awaitable<void> websocket_loop(Stream& client_stream, Stream& server_stream, int iterations)
+{
+	websocket::stream<Stream&> client(client_stream);
+	websocket::stream<Stream&> server(server_stream);
+
+	co_await (client.async_handshake("localhost", "/api", use_awaitable)
+		&& server.async_accept(use_awaitable));
+
+	boost::beast::flat_buffer buffer;
+	for (int i = 0; i < iterations; i++)
+	{
+		co_await client.async_write(boost::asio::buffer(payload), use_awaitable);
+		co_await server.async_read(buffer, use_awaitable);
+		buffer.consume(buffer.size());
+	}
+}
+
+template <typename MakeStreams, typename Loop>
+static double run(int iterations, MakeStreams make_streams, Loop loop)
+{
+	boost::asio::io_context ioc(1);
+	auto [a, b] = make_streams(ioc);
+
+	auto start = std::chrono::steady_clock::now();
+	boost::asio::co_spawn(ioc, loop(*a, *b, iterations),
+		[](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+	ioc.run();
+
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static auto direct_streams(boost::asio::io_context& ioc)
+{
+	auto a = std::make_unique<mem_stream>(ioc);
+	auto b = std::make_unique<mem_stream>(ioc);
+	a->connect(*b);
+	return std::make_pair(std::move(a), std::move(b));
+}
+
+static auto variant_streams(boost::asio::io_context& ioc)
+{
+	auto a = std::make_unique<any_mem_stream>(boost::variant2::in_place_type<mem_stream>, ioc);
+	auto b = std::make_unique<any_mem_stream>(boost::variant2::in_place_type<mem_stream>, ioc);
+	boost::variant2::get<mem_stream>(*a).connect(boost::variant2::get<mem_stream>(*b));
+	return std::make_pair(std::move(a), std::move(b));
+}
+
+int main(int argc, char** argv)
+{
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+
+	// 两种交替跑几轮, 取最好的一轮, 减少其他进程和 CPU 频率的干扰.
+	double rw_direct = 1e12, rw_variant = 1e12, ws_direct = 1e12, ws_variant = 1e12;
+	for (int i = 0; i < rounds; i++)
+	{
+		rw_direct = std::min(rw_direct, run(iterations, direct_streams, read_write_loop<mem_stream>));
+		rw_variant = std::min(rw_variant, run(iterations, variant_streams, read_write_loop<any_mem_stream>));
+		ws_direct = std::min(ws_direct, run(iterations, direct_streams, websocket_loop<mem_stream>));
+		ws_variant = std::min(ws_variant, run(iterations, variant_streams, websocket_loop<any_mem_stream>));
+	}
+
+	std::cout << "read/write direct:  " << rw_direct << " ns\n";
+	std::cout << "read/write variant: " << rw_variant << " ns\n";
+	std::cout << "websocket direct:   " << ws_direct << " ns\n";
+	std::cout << "websocket variant:  " << ws_variant << " ns\n";
+	return 0;
+}
@@ -0,0 +1,179 @@
+// 对比几组 permessage-deflate 参数下每个 websocket 连接常驻的内存, 压缩的 CPU 时间和压缩率.
+// 连接建立在内存里的 test::stream 上, 每个连接收发几轮典型的应答和推送, 期间全部保持打开,
+// 用 RSS 的增量除以连接数.
+//
+//   ./bench_ws_deflate [connections] [rounds]
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+#include <boost/beast/_experimental/test/stream.hpp>
+#include <boost/beast/websocket.hpp>
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+namespace websocket = boost::beast::websocket;
+using test_stream = boost::beast::test::stream;
+
+struct ws_pair
+{
+	explicit ws_pair(boost::asio::io_context& ioc)
+		: server_stream(ioc), client_stream(ioc), server(server_stream), client(client_stream)
+	{
+		server_stream.connect(client_stream);
+	}
+
+	test_stream server_stream;
+	test_stream client_stream;
+	websocket::stream<test_stream&> server;
+	websocket::stream<test_stream&> client;
+};
+
+static std::vector<std::string> make_messages()
+{
+	std::vector<std::string> messages;
+	messages.push_back(R"({"jsonrpc":"2.0","id":17,"result":"pong"})");
+	messages.push_back(R"({"jsonrpc":"2.0","method":"cart_changed","params":{"version":42,"merchant_id":3,"goods_id":"apple","count":2}})");
+
+	std::string goods = R"({"jsonrpc":"2.0","id":18,"result":[)";
+	for (int i = 0; i < 40; i++)
+	{
+		if (i)
+			goods += ",";
+		goods += R"({"merchant_id":3,"merchant_name":"水果店","goods_id":"goods)" + std::to_string(i)
+			+ R"(","title":"新鲜水果","price":"12.50","picture":"/repos/3/pics/goods)" + std::to_string(i) + R"(.jpg"})";
+	}
+	goods += "]}";
+	messages.push_back(goods);
+	return messages;
+}
+
+static long rss_bytes()
+{
+	std::ifstream statm("/proc/self/statm");
+	long size = 0, resident = 0;
+	statm >> size >> resident;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void run_one(const char* name, websocket::permessage_deflate pmd, int connections, int rounds)
+{
+	boost::asio::io_context ioc;
+	const auto messages = make_messages();
+
+	long rss = rss_bytes();
+
+	std::vector<std::unique_ptr<ws_pair>> pairs;
+	for (int i = 0; i < connections; i++)
+	{
+		auto& p = *pairs.emplace_back(std::make_unique<ws_pair>(ioc));
+		p.server.set_option(pmd);
+		p.client.set_option(pmd);
+
+		boost::asio::co_spawn(ioc, [&p]() -> awaitable<void>
+		{
+			co_await p.server.async_accept(use_awaitable);
+		}, boost::asio::detached);
+		boost::asio::co_spawn(ioc, [&p]() -> awaitable<void>
+		{
+			co_await p.client.async_handshake("localhost", "/api", use_awaitable);
+		}, boost::asio::detached);
+	}
+	ioc.run();
+
+	std::size_t payload = 0, wire_before = 0;
+	for (auto& p : pairs)
+		wire_before += p->client_stream.nread_bytes();
+
+	auto cpu = std::clock();
+	auto start = std::chrono::steady_clock::now();
+
+	for (int r = 0; r < rounds; r++)
+	{
+		for (auto& p : pairs)
+		{
+			boost::asio::co_spawn(ioc, [&p = *p, &messages, &payload]() -> awaitable<void>
+			{
+				for (auto& m : messages)
+				{
+					co_await p.server.async_write(boost::asio::buffer(m), use_awaitable);
+					payload += m.size();
+				}
+			}, boost::asio::detached);
+			boost::asio::co_spawn(ioc, [&p = *p, &messages]() -> awaitable<void>
+			{
+				boost::beast::flat_buffer buffer;
+				for (std::size_t i = 0; i < messages.size(); i++)
+				{
+					co_await p.client.async_read(buffer, use_awaitable);
+					buffer.consume(buffer.size());
+				}
+			}, boost::asio::detached);
+		}
+		ioc.restart();
+		ioc.run();
+	}
+
+	double cpu_ms = 1000.0 * (std::clock() - cpu) / CLOCKS_PER_SEC;
+	double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::size_t wire = 0;
+	for (auto& p : pairs)
+		wire += p->client_stream.nread_bytes();
+	wire -= wire_before;
+
+	long per_connection = (rss_bytes() - rss) / connections;
+
+	std::cout << name << ": " << per_connection / 1024 << " KiB/connection, "
+		<< cpu_ms << " ms cpu (" << wall_ms << " ms wall) for " << payload / 1024 << " KiB, "
+		<< "wire/payload " << static_cast<double>(wire) / payload << "\n";
+}
+
+// 每组参数在单独的子进程里跑, 免得前一组释放的内存被后一组复用, RSS 算不准.
+static void run(const char* name, websocket::permessage_deflate pmd, int connections, int rounds)
+{
+	std::cout.flush();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		run_one(name, pmd, connections, rounds);
+		std::cout.flush();
+		_exit(0);
+	}
+	waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, char** argv)
+{
+	int connections = argc > 1 ? std::atoi(argv[1]) : 2000;
+	int rounds = argc > 2 ? std::atoi(argv[2]) : 10;
+
+	websocket::permessage_deflate off;
+	run("no deflate", off, connections, rounds);
+
+	websocket::permessage_deflate pmd;
+	pmd.server_enable = pmd.client_enable = true;
+	run("deflate, window 15, memLevel 4 (old default)", pmd, connections, rounds);
+
+	pmd.msg_size_threshold = 256;
+	run("deflate, window 15, memLevel 4, min 256", pmd, connections, rounds);
+
+	pmd.server_max_window_bits = pmd.client_max_window_bits = 10;
+	pmd.memLevel = 2;
+	run("deflate, window 10, memLevel 2, min 256", pmd, connections, rounds);
+
+	pmd.server_no_context_takeover = pmd.client_no_context_takeover = true;
+	run("deflate, window 10, memLevel 2, min 256, no context takeover", pmd, connections, rounds);
+
+	return 0;
+}
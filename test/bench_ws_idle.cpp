@@ -0,0 +1,333 @@
+
+// 测量空闲 websocket 连接常驻的用户态内存, 不含 socket 缓冲.
+//
+// 按 cmall 处理连接的结构搭: 读 HTTP 升级请求, 握手后 websocket::stream<write_coalescing_stream<>>
+// 加上 send_queue, inflight_limit 和一读一写两个协程. json 解析, 读缓冲回收, 握手后的清理和写协程
+// 用的是 httpd/ws_loop.hpp 里和 cmall 共用的实现, 这里只补上业务部分 (按 id 回一个固定的应答).
+// 每个连接先收发几轮请求/应答, 再收一批推送, 然后全部空闲. 空闲时记下堆的用量, 再把服务端拆掉 (留着底下的 test::stream, 相当于内核的 socket 缓冲),
+// 两次之差除以连接数就是每个空闲连接的开销.
+//
+// baseline 是之前的布局, 单独写在这里: 请求 arena 和 json parser 放在协程帧里, 升级请求和 HTTP parser
+// 一直留着, 读缓冲超过 64K 才释放, 写协程的批次数组不收缩. write_coalescing_stream 两种布局用的都是现在的版本.
+//
+//   ./bench_ws_idle [connections] [budget_bytes]
+//
+// 不开 deflate 时, 空闲连接的开销超过 budget_bytes (默认 16K) 返回 1.
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <malloc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/beast/_experimental/test/stream.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/json.hpp>
+
+#include "httpd/arena.hpp"
+#include "httpd/coalescing_stream.hpp"
+#include "httpd/inflight_limit.hpp"
+#include "httpd/send_queue.hpp"
+#include "httpd/ws_loop.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+namespace http = boost::beast::http;
+namespace websocket = boost::beast::websocket;
+using test_stream = boost::beast::test::stream;
+using namespace boost::asio::experimental::awaitable_operators;
+
+static std::size_t heap_in_use()
+{
+	auto mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+}
+
+// 对应 websocket_connection 和 client_connection 里跟 websocket 有关的成员.
+struct server_state
+{
+	server_state(boost::asio::any_io_executor executor, const httpd::send_queue_config& config, httpd::send_queue_counters& counters)
+		: send_queue(executor, config, &counters)
+		, inflight(executor, 8)
+	{}
+
+	httpd::send_queue send_queue;
+	httpd::inflight_limit inflight;
+	bool disable_ping = false;
+	std::optional<int> binary_format;
+	std::string baseurl = "https://shop.example.com";
+	std::map<std::uint64_t, std::shared_ptr<boost::asio::cancellation_signal>> cancel_signals;
+};
+
+struct connection
+{
+	explicit connection(boost::asio::io_context& ioc)
+		: stream(ioc), client_stream(ioc), client(client_stream)
+	{
+		stream.connect(client_stream);
+	}
+
+	test_stream stream;
+	test_stream client_stream;
+	websocket::stream<test_stream&> client;
+	std::unique_ptr<server_state> server;
+};
+
+// baseline 时放在读协程帧里的 parser.
+struct frame_parser
+{
+	unsigned char temp[4096];
+	boost::json::stream_parser parser{ {}, { 64, false, false, true }, temp, sizeof(temp) };
+};
+
+static std::string make_goods_list()
+{
+	std::string goods = R"({"jsonrpc":"2.0","id":2,"result":[)";
+	for (int i = 0; i < 40; i++)
+	{
+		if (i)
+			goods += ",";
+		goods += R"({"merchant_id":3,"merchant_name":"水果店","goods_id":"goods)" + std::to_string(i)
+			+ R"(","title":"新鲜水果","price":"12.50","picture":"/repos/3/pics/goods)" + std::to_string(i) + R"(.jpg"})";
+	}
+	return goods + "]}";
+}
+
+template <bool Baseline, typename Ws>
+static awaitable<void> read_loop(connection& c, Ws& ws, const std::string& goods_list)
+{
+	boost::beast::flat_buffer buffer{ 6 * 1024 * 1024 };
+	[[maybe_unused]] std::conditional_t<Baseline, frame_parser, std::monostate> local;
+
+	for (;;)
+	{
+		co_await ws.async_read(buffer, use_awaitable);
+
+		auto arena = boost::json::make_shared_resource<boost::json::monotonic_resource>(buffer.size() * 2 + 256);
+		std::string_view data(static_cast<const char*>(buffer.data().data()), buffer.size());
+
+		boost::system::error_code ec;
+		boost::json::value jv;
+		if constexpr (Baseline)
+		{
+			local.parser.reset(arena);
+			local.parser.write(data.data(), data.size(), ec);
+			if (!ec)
+				local.parser.finish(ec);
+			if (!ec)
+				jv = local.parser.release();
+
+			buffer.consume(buffer.size());
+			if (buffer.capacity() > 64 * 1024)
+				buffer.shrink_to_fit();
+		}
+		else
+		{
+			jv = httpd::parse_json_message(data, ec, arena);
+			httpd::recycle_read_buffer(buffer);
+		}
+		if (ec)
+			co_return;
+
+		auto id = jv.as_object().at("id").as_int64();
+		c.server->send_queue.push(id == 2 ? goods_list : R"({"jsonrpc":"2.0","id":)" + std::to_string(id) + R"(,"result":true})");
+	}
+}
+
+template <bool Baseline, typename Ws>
+static awaitable<void> write_loop(connection& c, Ws& ws)
+{
+	auto& queue = c.server->send_queue;
+	if constexpr (!Baseline)
+	{
+		co_await httpd::ws_write_loop(ws, queue);
+		co_return;
+	}
+
+	std::vector<httpd::shared_message> batch;
+	for (;;)
+	{
+		batch.clear();
+		if (!co_await queue.async_pop(batch))
+			break;
+
+		if (batch.size() == 1)
+		{
+			co_await ws.async_write(boost::asio::buffer(*batch.front()), use_awaitable);
+			continue;
+		}
+
+		ws.next_layer().begin_batch();
+		for (auto& message : batch)
+			co_await ws.async_write(boost::asio::buffer(*message), use_awaitable);
+		co_await ws.next_layer().async_flush(use_awaitable);
+	}
+}
+
+// 对应 serve_http1 里处理升级请求的那一段.
+template <bool Baseline>
+static awaitable<void> serve(connection& c, websocket::permessage_deflate pmd, const std::string& goods_list)
+{
+	boost::beast::flat_buffer buffer;
+	std::optional<http::request_parser<http::string_body>> parser;
+	[[maybe_unused]] std::conditional_t<Baseline, httpd::request_arena, std::unique_ptr<httpd::request_arena>> arena;
+
+	parser.emplace();
+	parser->body_limit(2000);
+	co_await http::async_read(c.stream, buffer, *parser, use_awaitable);
+	auto req = parser->release();
+
+	websocket::stream<httpd::write_coalescing_stream<test_stream&>> ws(c.stream);
+	ws.set_option(pmd);
+	auto timeout_opt = websocket::stream_base::timeout::suggested(boost::beast::role_type::server);
+	timeout_opt.idle_timeout = std::chrono::seconds(45);
+	ws.set_option(timeout_opt);
+
+	co_await ws.async_accept(req, use_awaitable);
+	c.server->disable_ping = req["x-tencent-ua"] == "Qcloud";
+
+	if constexpr (!Baseline)
+		httpd::release_upgrade_request(req, parser, buffer);
+
+	co_await (read_loop<Baseline>(c, ws, goods_list) || write_loop<Baseline>(c, ws));
+}
+
+static awaitable<void> client(connection& c)
+{
+	c.client.set_option(websocket::stream_base::decorator([](websocket::request_type& req)
+	{
+		req.set(http::field::user_agent, "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36");
+		req.set(http::field::cookie, "Session=0123456789abcdef0123456789abcdef; _ga=GA1.1.123456789.1700000000");
+		req.set(http::field::sec_websocket_protocol, "request_cookie");
+	}));
+	co_await c.client.async_handshake("shop.example.com", "/api", use_awaitable);
+
+	boost::beast::flat_buffer buffer;
+	const char* requests[] = {
+		R"({"jsonrpc":"2.0","id":1,"method":"recover_session","params":{"sessionid":"0123456789abcdef0123456789abcdef"}})",
+		R"({"jsonrpc":"2.0","id":2,"method":"goods_list","params":{"merchant":"3"}})",
+		R"({"jsonrpc":"2.0","id":3,"method":"cart_list","params":{"page":0,"page_size":20}})",
+	};
+	for (auto r : requests)
+	{
+		co_await c.client.async_write(boost::asio::buffer(std::string_view(r)), use_awaitable);
+		co_await c.client.async_read(buffer, use_awaitable);
+		buffer.consume(buffer.size());
+	}
+
+	// 一批推送, 服务端合并成一次写.
+	for (int i = 0; i < 5; i++)
+		c.server->send_queue.push(std::string(R"({"topic":"cart_changed","version":)") + std::to_string(i) + "}");
+	for (int i = 0; i < 5; i++)
+	{
+		co_await c.client.async_read(buffer, use_awaitable);
+		buffer.consume(buffer.size());
+	}
+}
+
+template <bool Baseline>
+static std::size_t run_one(websocket::permessage_deflate pmd, int connections)
+{
+	boost::asio::io_context ioc;
+	httpd::send_queue_config config;
+	httpd::send_queue_counters counters;
+	const auto goods_list = make_goods_list();
+
+	std::vector<std::unique_ptr<connection>> conns;
+	int clients_done = 0, servers_done = 0;
+	for (int i = 0; i < connections; i++)
+	{
+		auto& c = *conns.emplace_back(std::make_unique<connection>(ioc));
+		c.client.set_option(pmd);
+		c.server = std::make_unique<server_state>(ioc.get_executor(), config, counters);
+		boost::asio::co_spawn(ioc, serve<Baseline>(c, pmd, goods_list), [&](std::exception_ptr) { servers_done++; });
+		boost::asio::co_spawn(ioc, client(c), [&](std::exception_ptr e)
+		{
+			if (e)
+				std::rethrow_exception(e);
+			clients_done++;
+		});
+	}
+
+	while (clients_done < connections)
+		ioc.run_one();
+	ioc.poll();
+
+	auto idle = heap_in_use();
+
+	// 拆掉服务端, 客户端和底下的 stream 留着.
+	for (auto& c : conns)
+	{
+		c->server->send_queue.close();
+		c->stream.close();
+	}
+	while (servers_done < connections)
+		ioc.run_one();
+	for (auto& c : conns)
+		c->server.reset();
+	malloc_trim(0);
+
+	return (idle - heap_in_use()) / connections;
+}
+
+// 每组在单独的子进程里跑, 前一组留下的空闲内存不影响后一组.
+static std::size_t run(const char* name, websocket::permessage_deflate pmd, int connections, bool baseline)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		std::exit(2);
+	std::cout.flush();
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		std::size_t n = baseline ? run_one<true>(pmd, connections) : run_one<false>(pmd, connections);
+		if (write(fds[1], &n, sizeof(n)) != sizeof(n))
+			_exit(2);
+		_exit(0);
+	}
+	close(fds[1]);
+	std::size_t n = 0;
+	if (read(fds[0], &n, sizeof(n)) != sizeof(n))
+		std::exit(2);
+	close(fds[0]);
+	waitpid(pid, nullptr, 0);
+
+	std::cout << name << (baseline ? " (baseline)" : "") << ": " << n << " bytes/connection\n";
+	return n;
+}
+
+int main(int argc, char** argv)
+{
+	int connections = argc > 1 ? std::atoi(argv[1]) : 2000;
+	std::size_t budget = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16 * 1024;
+
+	websocket::permessage_deflate off;
+	run("no deflate", off, connections, true);
+	auto idle = run("no deflate", off, connections, false);
+
+	// cmall 的默认参数. 压缩上下文是 context takeover 要求留着的, 不算在预算里.
+	websocket::permessage_deflate pmd;
+	pmd.server_enable = pmd.client_enable = true;
+	pmd.msg_size_threshold = 256;
+	run("deflate, window 15, memLevel 4, min 256", pmd, connections, true);
+	run("deflate, window 15, memLevel 4, min 256", pmd, connections, false);
+
+	if (idle > budget)
+	{
+		std::cout << "idle connection costs " << idle << " bytes, over budget " << budget << "\n";
+		return 1;
+	}
+	std::cout << "within budget " << budget << " bytes\n";
+	return 0;
+}
@@ -0,0 +1,240 @@
+
+// admission_control: 全局和单 IP 上限, 超出时 reject 回 503 + Retry-After,
+// 名额随 ticket 析构归还, 积压超过水位线时 wait_for_capacity 暂停直到降到 low 以下,
+// 暂停前已经在 accept 的连接由 admit 拒绝. loopback 不按 IP 计.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "httpd/admission.hpp"
+#include "test_util.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+using tcp = boost::asio::ip::tcp;
+
+static void test_limits()
+{
+	httpd::admission_config config;
+	config.max_connections = 3;
+	config.max_connections_per_ip = 2;
+	httpd::admission_control ac(config);
+	CHECK(ac.enabled());
+
+	auto a = boost::asio::ip::make_address("10.0.0.1");
+	auto b = boost::asio::ip::make_address("10.0.0.2");
+	auto c = boost::asio::ip::make_address("10.0.0.3");
+
+	auto t1 = ac.admit(a);
+	auto t2 = ac.admit(a);
+	CHECK(t1 && t2);
+	CHECK(!ac.admit(a));
+
+	auto t3 = ac.admit(b);
+	CHECK(t3);
+	CHECK(!ac.admit(c));
+
+	// 归还一个 a 的名额后, a 和全局都有空位了.
+	t1 = {};
+	auto t4 = ac.admit(a);
+	CHECK(t4);
+
+	auto stats = ac.stats();
+	CHECK(stats.live_connections == 3);
+	CHECK(stats.admitted == 4);
+	CHECK(stats.rejected_per_ip == 1);
+	CHECK(stats.rejected_global == 1);
+
+	t2 = {};
+	t3 = {};
+	t4 = {};
+	CHECK(ac.stats().live_connections == 0);
+	CHECK(!httpd::admission_control().enabled());
+}
+
+static void test_loopback_not_per_ip()
+{
+	httpd::admission_config config;
+	config.max_connections_per_ip = 1;
+	httpd::admission_control ac(config);
+
+	// 本机的反向代理不受单 IP 上限约束, v4-mapped 的也一样.
+	auto proxy = boost::asio::ip::make_address("127.0.0.1");
+	auto mapped = boost::asio::ip::make_address("::ffff:127.0.0.1");
+	auto t1 = ac.admit(proxy);
+	auto t2 = ac.admit(proxy);
+	auto t3 = ac.admit(mapped);
+	auto t4 = ac.admit(boost::asio::ip::make_address("::1"));
+	CHECK(t1 && t2 && t3 && t4);
+
+	auto remote = boost::asio::ip::make_address("10.0.0.1");
+	auto t5 = ac.admit(remote);
+	CHECK(t5);
+	CHECK(!ac.admit(remote));
+}
+
+static void test_reject()
+{
+	httpd::admission_config config;
+	config.max_connections = 1;
+	config.retry_after = std::chrono::seconds(7);
+	httpd::admission_control ac(config);
+
+	boost::asio::io_context ioc;
+	tcp::acceptor acceptor(ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	tcp::socket client(ioc);
+	client.connect(acceptor.local_endpoint());
+	tcp::socket server = acceptor.accept();
+
+	auto occupied = ac.admit(server.remote_endpoint().address());
+	CHECK(occupied);
+	auto ticket = ac.admit(server.remote_endpoint().address());
+	CHECK(!ticket);
+	ac.reject(server);
+
+	std::string response;
+	boost::system::error_code ec;
+	boost::asio::read(client, boost::asio::dynamic_buffer(response), ec);
+	CHECK(ec == boost::asio::error::eof);
+	CHECK(response.starts_with("HTTP/1.1 503 "));
+	CHECK(response.find("Retry-After: 7\r\n") != std::string::npos);
+}
+
+static void test_watermark()
+{
+	httpd::admission_config config;
+	config.pending_work_high = 10;
+	config.pending_work_low = 4;
+	httpd::admission_control ac(config);
+
+	std::atomic_size_t pending{ 3 };
+	ac.set_pending_work_probe([&]() -> std::size_t { return pending; });
+
+	boost::asio::io_context ioc;
+	bool resumed = false;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		// 低于 high 直接通过.
+		co_await ac.wait_for_capacity();
+		CHECK(ac.stats().accept_pauses == 0);
+
+		pending = 12;
+		co_await ac.wait_for_capacity();
+		resumed = true;
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::steady_timer timer(ioc);
+
+		// 降到 high 以下但还没到 low, 不能恢复.
+		timer.expires_after(std::chrono::milliseconds(120));
+		co_await timer.async_wait(use_awaitable);
+		pending = 6;
+		timer.expires_after(std::chrono::milliseconds(120));
+		co_await timer.async_wait(use_awaitable);
+		CHECK(!resumed);
+
+		pending = 3;
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	ioc.run();
+	CHECK(resumed);
+	CHECK(ac.stats().accept_pauses == 1);
+}
+
+static void test_watermark_high_one()
+{
+	// high 为 1 时 low 取 1, 积压清空就恢复.
+	httpd::admission_config config;
+	config.pending_work_high = 1;
+	httpd::admission_control ac(config);
+
+	std::atomic_size_t pending{ 1 };
+	ac.set_pending_work_probe([&]() -> std::size_t { return pending; });
+
+	boost::asio::io_context ioc;
+	bool resumed = false;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		co_await ac.wait_for_capacity();
+		resumed = true;
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::steady_timer timer(ioc);
+		timer.expires_after(std::chrono::milliseconds(120));
+		co_await timer.async_wait(use_awaitable);
+		CHECK(!resumed);
+		pending = 0;
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	ioc.run();
+	CHECK(resumed);
+	CHECK(ac.stats().accept_pauses == 1);
+}
+
+static void test_overload_reject()
+{
+	// 暂停之前已经在 accept 的协程拿到连接时积压已经超了, admit 要拒绝.
+	httpd::admission_config config;
+	config.pending_work_high = 10;
+	httpd::admission_control ac(config);
+
+	std::atomic_size_t pending{ 3 };
+	ac.set_pending_work_probe([&]() -> std::size_t { return pending; });
+
+	auto addr = boost::asio::ip::make_address("10.0.0.1");
+	auto t1 = ac.admit(addr);
+	CHECK(t1);
+
+	pending = 10;
+	CHECK(!ac.admit(addr));
+	CHECK(!ac.admit());
+	CHECK(ac.stats().rejected_overload == 2);
+	CHECK(ac.stats().live_connections == 1);
+
+	pending = 9;
+	auto t2 = ac.admit();
+	CHECK(t2);
+}
+
+static void test_bad_watermark()
+{
+	httpd::admission_config config;
+	config.pending_work_high = 4;
+	config.pending_work_low = 4;
+	bool thrown = false;
+	try
+	{
+		httpd::admission_control ac(config);
+	}
+	catch (const std::invalid_argument&)
+	{
+		thrown = true;
+	}
+	CHECK(thrown);
+}
+
+int main()
+{
+	test_limits();
+	test_loopback_not_per_ip();
+	test_reject();
+	test_watermark();
+	test_watermark_high_one();
+	test_overload_reject();
+	test_bad_watermark();
+
+	std::cout << "all passed\n";
+	return 0;
+}
@@ -0,0 +1,161 @@
+
+// binary_json: MessagePack 和 CBOR 与 boost::json::value 互转.
+// 对照规范里的例子检查编码, 往返后值不变, 截断, 嵌套过深和 JSON 表达不了的类型要报错.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "httpd/binary_json.hpp"
+#include "test_util.hpp"
+
+using httpd::binary_json::format;
+
+static std::string bytes(std::initializer_list<unsigned char> b)
+{
+	return std::string(b.begin(), b.end());
+}
+
+static std::string encode(format f, const boost::json::value& jv)
+{
+	std::string out;
+	httpd::binary_json::encode(f, jv, out);
+	return out;
+}
+
+static boost::json::value decode(format f, const std::string& data, boost::system::error_code& ec)
+{
+	return httpd::binary_json::decode(f, data, ec);
+}
+
+static boost::json::value decode(format f, const std::string& data)
+{
+	boost::system::error_code ec;
+	auto jv = decode(f, data, ec);
+	CHECK(!ec);
+	return jv;
+}
+
+static void test_round_trip()
+{
+	auto jv = boost::json::parse(R"({
+		"jsonrpc": "2.0", "id": 42, "method": "cart_list",
+		"params": { "page": 0, "page_size": 20, "neg": -1, "neg8": -100, "neg16": -1000, "neg32": -100000,
+			"neg64": -10000000000, "big": 18446744073709551615, "u16": 60000, "u32": 4000000000,
+			"price": 12.5, "ok": true, "no": false, "nothing": null, "name": "水果店",
+			"long": "0123456789012345678901234567890123456789",
+			"list": [1, 2, 3, [4, 5, { "x": "y" }], [], {}] }
+	})");
+
+	for (auto f : { format::msgpack, format::cbor })
+	{
+		auto data = encode(f, jv);
+		CHECK(decode(f, data) == jv);
+
+		// object 和 array 的重载编出一样的字节.
+		std::string from_object;
+		httpd::binary_json::encode(f, jv.as_object(), from_object);
+		CHECK(from_object == data);
+
+		auto& list = jv.at("params").at("list");
+		std::string from_array;
+		httpd::binary_json::encode(f, list.as_array(), from_array);
+		CHECK(from_array == encode(f, list));
+
+		// 截断在任何位置都要报错.
+		for (std::size_t n = 0; n < data.size(); n++)
+		{
+			boost::system::error_code ec;
+			decode(f, data.substr(0, n), ec);
+			CHECK(ec);
+		}
+
+		boost::system::error_code ec;
+		decode(f, data + '\0', ec);
+		CHECK(ec == boost::json::error::extra_data);
+	}
+
+	// 能放进 int64 的整数解码成 int64, 和 JSON parser 一样.
+	CHECK(decode(format::msgpack, encode(format::msgpack, boost::json::value(std::uint64_t(7)))).is_int64());
+	CHECK(decode(format::cbor, encode(format::cbor, boost::json::value(std::uint64_t(7)))).is_int64());
+}
+
+static void test_msgpack()
+{
+	CHECK(encode(format::msgpack, boost::json::parse(R"({"a":1})")) == bytes({ 0x81, 0xa1, 'a', 0x01 }));
+	CHECK(encode(format::msgpack, boost::json::value(-32)) == bytes({ 0xe0 }));
+	CHECK(encode(format::msgpack, boost::json::value(-33)) == bytes({ 0xd0, 0xdf }));
+	CHECK(encode(format::msgpack, boost::json::value(200)) == bytes({ 0xcc, 0xc8 }));
+	CHECK(encode(format::msgpack, boost::json::value(1.5)) == bytes({ 0xcb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0 }));
+
+	// 编码器不会产生, 但别人可能发过来的形式.
+	CHECK(decode(format::msgpack, bytes({ 0xca, 0x3f, 0xc0, 0, 0 })) == 1.5);
+	CHECK(decode(format::msgpack, bytes({ 0xd9, 0x02, 'h', 'i' })) == "hi");
+	CHECK(decode(format::msgpack, bytes({ 0xc4, 0x02, 'h', 'i' })) == "hi");
+	CHECK(decode(format::msgpack, bytes({ 0xd1, 0xff, 0x38 })) == -200);
+
+	boost::system::error_code ec;
+	// ext.
+	decode(format::msgpack, bytes({ 0xd4, 0x01, 0x00 }), ec);
+	CHECK(ec == boost::json::error::syntax);
+	// key 不是字符串.
+	decode(format::msgpack, bytes({ 0x81, 0x01, 0x01 }), ec);
+	CHECK(ec == boost::json::error::syntax);
+	// 假长度.
+	decode(format::msgpack, bytes({ 0xdd, 0xff, 0xff, 0xff, 0xff }), ec);
+	CHECK(ec == boost::json::error::incomplete);
+
+	std::string deep(100, '\x91');
+	deep.push_back('\x01');
+	decode(format::msgpack, deep, ec);
+	CHECK(ec == boost::json::error::too_deep);
+}
+
+static void test_cbor()
+{
+	// RFC 8949 附录 A 的例子.
+	CHECK(encode(format::cbor, boost::json::parse(R"([1,-1,"a"])")) == bytes({ 0x83, 0x01, 0x20, 0x61, 'a' }));
+	CHECK(encode(format::cbor, boost::json::value(1000)) == bytes({ 0x19, 0x03, 0xe8 }));
+	CHECK(encode(format::cbor, boost::json::value(-1000)) == bytes({ 0x39, 0x03, 0xe7 }));
+	CHECK(encode(format::cbor, boost::json::value(nullptr)) == bytes({ 0xf6 }));
+
+	CHECK(decode(format::cbor, bytes({ 0xf9, 0x3c, 0x00 })) == 1.0);
+	CHECK(decode(format::cbor, bytes({ 0xf9, 0xc4, 0x00 })) == -4.0);
+	CHECK(decode(format::cbor, bytes({ 0xfa, 0x47, 0xc3, 0x50, 0x00 })) == 100000.0);
+	CHECK(decode(format::cbor, bytes({ 0xf7 })).is_null());
+	CHECK(decode(format::cbor, bytes({ 0x9f, 0x01, 0x82, 0x02, 0x03, 0xff })) == boost::json::parse("[1,[2,3]]"));
+	CHECK(decode(format::cbor, bytes({ 0xbf, 0x61, 'a', 0x01, 0xff })) == boost::json::parse(R"({"a":1})"));
+	CHECK(decode(format::cbor, bytes({ 0x7f, 0x62, 's', 't', 0x61, 'r', 0xff })) == "str");
+	// tag 1 (epoch 时间) 只取里面的值.
+	CHECK(decode(format::cbor, bytes({ 0xc1, 0x1a, 0x51, 0x4b, 0x67, 0xb0 })) == 1363896240);
+	CHECK(decode(format::cbor, bytes({ 0x3b, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff })).as_int64() == std::numeric_limits<std::int64_t>::min());
+
+	boost::system::error_code ec;
+	// 放不进 int64 的负数.
+	decode(format::cbor, bytes({ 0x3b, 0x80, 0, 0, 0, 0, 0, 0, 0 }), ec);
+	CHECK(ec == boost::json::error::syntax);
+	// 单独的 break.
+	decode(format::cbor, bytes({ 0xff }), ec);
+	CHECK(ec == boost::json::error::syntax);
+	// 不定长字符串里混了别的类型.
+	decode(format::cbor, bytes({ 0x7f, 0x01, 0xff }), ec);
+	CHECK(ec == boost::json::error::syntax);
+	// 不定长数组没有 break.
+	decode(format::cbor, bytes({ 0x9f, 0x01 }), ec);
+	CHECK(ec == boost::json::error::incomplete);
+
+	std::string deep(100, '\x81');
+	deep.push_back('\x01');
+	decode(format::cbor, deep, ec);
+	CHECK(ec == boost::json::error::too_deep);
+}
+
+int main()
+{
+	test_round_trip();
+	test_msgpack();
+	test_cbor();
+
+	std::cout << "all passed\n";
+	return 0;
+}
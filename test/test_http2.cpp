@@ -0,0 +1,432 @@
+
+// HPACK 用 RFC 7541 附录 C 的例子校验, 然后在 loopback 上用 h2c 跑一个完整的请求/响应.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+
+#include "httpd/http2/connection.hpp"
+#include "httpd/httpd.hpp"
+#include "test_util.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+using namespace httpd::http2;
+
+static std::string from_hex(std::string_view hex)
+{
+	std::string out;
+	for (std::size_t i = 0; i + 1 < hex.size(); i += 2)
+		out.push_back(static_cast<char>(std::stoi(std::string(hex.substr(i, 2)), nullptr, 16)));
+	return out;
+}
+
+static void test_hpack()
+{
+	// C.4 带 huffman 编码的三个连续请求, 共用一个动态表.
+	hpack_decoder decoder;
+	std::vector<header_field> fields;
+
+	CHECK(decoder.decode(from_hex("828684418cf1e3c2e5f23a6ba0ab90f4ff"), fields, 16384));
+	CHECK(fields.size() == 4);
+	CHECK(fields[3].name == ":authority" && fields[3].value == "www.example.com");
+	CHECK(decoder.table_size() == 57);
+
+	fields.clear();
+	CHECK(decoder.decode(from_hex("828684be5886a8eb10649cbf"), fields, 16384));
+	CHECK(fields.size() == 5);
+	CHECK(fields[3].value == "www.example.com");
+	CHECK(fields[4].name == "cache-control" && fields[4].value == "no-cache");
+	CHECK(decoder.table_size() == 110);
+
+	fields.clear();
+	CHECK(decoder.decode(from_hex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"), fields, 16384));
+	CHECK(fields.size() == 5);
+	CHECK(fields[1].value == "https" && fields[2].value == "/index.html");
+	CHECK(fields[4].name == "custom-key" && fields[4].value == "custom-value");
+	CHECK(decoder.table_size() == 164);
+
+	// 超出头部列表大小限制, 以及不存在的索引.
+	fields.clear();
+	CHECK(!hpack_decoder{}.decode(from_hex("828684418cf1e3c2e5f23a6ba0ab90f4ff"), fields, 64));
+	CHECK(!hpack_decoder{}.decode(from_hex("ff00"), fields, 16384));
+
+	std::string encoded;
+	huffman_encode("www.example.com", encoded);
+	CHECK(encoded == from_hex("f1e3c2e5f23a6ba0ab90f4ff"));
+
+	// 编码再解码.
+	hpack_encoder encoder;
+	std::string block;
+	encoder.encode(block, ":status", "200");
+	encoder.encode(block, "content-type", "text/html; charset=utf-8");
+	encoder.encode(block, "x-custom", std::string(300, 'a'));
+	fields.clear();
+	CHECK(hpack_decoder{}.decode(block, fields, 16384));
+	CHECK(fields.size() == 3);
+	CHECK(block[0] == static_cast<char>(0x88));
+	CHECK(fields[1].value == "text/html; charset=utf-8");
+	CHECK(fields[2].name == "x-custom" && fields[2].value == std::string(300, 'a'));
+}
+
+struct client_frame
+{
+	frame_header header;
+	std::string payload;
+};
+
+static awaitable<client_frame> read_frame(boost::asio::ip::tcp::socket& s)
+{
+	char head[frame_header_length];
+	co_await boost::asio::async_read(s, boost::asio::buffer(head), use_awaitable);
+	client_frame f{ parse_frame_header(head), {} };
+	f.payload.resize(f.header.length);
+	co_await boost::asio::async_read(s, boost::asio::buffer(f.payload), use_awaitable);
+	co_return f;
+}
+
+static awaitable<void> run_client(boost::asio::ip::tcp::endpoint endp, std::string& body, std::string& status)
+{
+	boost::asio::ip::tcp::socket s(co_await boost::asio::this_coro::executor);
+	co_await s.async_connect(endp, use_awaitable);
+
+	std::string out(client_preface);
+	append_frame_header(out, 0, frame_type::settings, 0, 0);
+
+	// 两个并发的 stream.
+	for (std::uint32_t id : { 1u, 3u })
+	{
+		hpack_encoder encoder;
+		std::string block;
+		encoder.encode(block, ":method", "GET");
+		encoder.encode(block, ":scheme", "http");
+		encoder.encode(block, ":path", id == 1 ? "/big" : "/small");
+		encoder.encode(block, ":authority", "localhost");
+		append_frame_header(out, static_cast<std::uint32_t>(block.size()), frame_type::headers, flags::end_headers | flags::end_stream, id);
+		out += block;
+	}
+	co_await boost::asio::async_write(s, boost::asio::buffer(out), use_awaitable);
+
+	hpack_decoder decoder;
+	int finished = 0;
+	std::uint32_t received = 0;
+
+	while (finished < 2)
+	{
+		auto f = co_await read_frame(s);
+		if (f.header.type == frame_type::headers)
+		{
+			std::vector<header_field> fields;
+			CHECK(decoder.decode(f.payload, fields, 16384));
+			CHECK(fields[0].name == ":status");
+			for (auto& field : fields)
+				CHECK(field.name != "connection" && field.name != "transfer-encoding");
+			if (f.header.stream_id == 1)
+				status = fields[0].value;
+		}
+		else if (f.header.type == frame_type::data)
+		{
+			if (f.header.stream_id == 1)
+				body += f.payload;
+			received += f.header.length;
+
+			// 大响应超过默认的 64K 窗口, 必须补窗口才能收完.
+			if (received >= 32768)
+			{
+				std::string wu;
+				append_frame_header(wu, 4, frame_type::window_update, 0, 0);
+				append_uint32(wu, received);
+				append_frame_header(wu, 4, frame_type::window_update, 0, 1);
+				append_uint32(wu, received);
+				co_await boost::asio::async_write(s, boost::asio::buffer(wu), use_awaitable);
+				received = 0;
+			}
+		}
+
+		if ((f.header.type == frame_type::data || f.header.type == frame_type::headers) && (f.header.flags & flags::end_stream))
+			finished++;
+	}
+}
+
+static void test_h2c()
+{
+	boost::asio::io_context ioc;
+	boost::asio::ip::tcp::acceptor acceptor(ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	const std::string big(200000, 'x');
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		httpd::http_any_stream stream(boost::variant2::in_place_type<boost::beast::tcp_stream>, ioc.get_executor());
+		co_await acceptor.async_accept(stream.socket(), use_awaitable);
+
+		boost::beast::flat_buffer buffer;
+		CHECK(co_await is_http2_connection(stream, buffer));
+
+		auto conn = std::make_shared<server_connection>(stream, buffer);
+		co_await conn->run([&big](request& req, httpd::http_any_stream& s) -> awaitable<void>
+		{
+			CHECK(req[boost::beast::http::field::host] == "localhost");
+			httpd::request_arena arena;
+			httpd::response_fields headers{ arena.resource() };
+			headers.set(boost::beast::http::field::content_type, "text/plain");
+			co_await httpd::send_string_response_body(s, req.target() == "/big" ? std::string_view(big) : "ok",
+				std::move(headers), req.version(), true);
+		});
+	}, boost::asio::detached);
+
+	std::string body, status;
+	boost::asio::co_spawn(ioc, run_client(acceptor.local_endpoint(), body, status), [&](std::exception_ptr e)
+	{
+		CHECK(!e);
+		ioc.stop();
+	});
+
+	ioc.run();
+
+	CHECK(status == "200");
+	CHECK(body == big);
+}
+
+static void test_idle_timeout()
+{
+	boost::asio::io_context ioc;
+	boost::asio::make_service<httpd::timer_wheel>(ioc, std::chrono::milliseconds(10), 64);
+	boost::asio::ip::tcp::acceptor acceptor(ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	bool server_done = false;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		httpd::http_any_stream stream(boost::variant2::in_place_type<boost::beast::tcp_stream>, ioc.get_executor());
+		co_await acceptor.async_accept(stream.socket(), use_awaitable);
+
+		boost::beast::flat_buffer buffer;
+		CHECK(co_await is_http2_connection(stream, buffer));
+
+		settings s;
+		s.idle_timeout = std::chrono::milliseconds(100);
+		auto conn = std::make_shared<server_connection>(stream, buffer, s);
+		co_await conn->run([](request&, httpd::http_any_stream&) -> awaitable<void> { co_return; });
+		server_done = true;
+	}, boost::asio::detached);
+
+	// 只发序言, 不开 stream, 服务端应该在空闲超时后关掉连接.
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration closed_after{};
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::ip::tcp::socket s(co_await boost::asio::this_coro::executor);
+		co_await s.async_connect(acceptor.local_endpoint(), use_awaitable);
+
+		std::string out(client_preface);
+		append_frame_header(out, 0, frame_type::settings, 0, 0);
+		co_await boost::asio::async_write(s, boost::asio::buffer(out), use_awaitable);
+
+		boost::system::error_code ec;
+		char discard[256];
+		while (!ec)
+			co_await s.async_read_some(boost::asio::buffer(discard), boost::asio::redirect_error(use_awaitable, ec));
+		closed_after = std::chrono::steady_clock::now() - start;
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	ioc.run();
+
+	CHECK(server_done);
+	CHECK(closed_after >= std::chrono::milliseconds(100));
+	CHECK(closed_after < std::chrono::seconds(2));
+}
+
+// 普通请求的 body 限制很小, 上传路径按 stream_body_limit 放开.
+static void test_stream_body_limit()
+{
+	boost::asio::io_context ioc;
+	boost::asio::ip::tcp::acceptor acceptor(ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	std::size_t uploaded = 0;
+	int handled = 0;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		httpd::http_any_stream stream(boost::variant2::in_place_type<boost::beast::tcp_stream>, ioc.get_executor());
+		co_await acceptor.async_accept(stream.socket(), use_awaitable);
+
+		boost::beast::flat_buffer buffer;
+		CHECK(co_await is_http2_connection(stream, buffer));
+
+		settings s;
+		s.body_limit = 2000;
+		s.stream_body_limit = [](const request& req) -> std::size_t { return req.target() == "/api/upload" ? 100000 : 2000; };
+		auto conn = std::make_shared<server_connection>(stream, buffer, s);
+		co_await conn->run([&](request& req, httpd::http_any_stream& s) -> awaitable<void>
+		{
+			handled++;
+			uploaded = req.body().size();
+			httpd::request_arena arena;
+			httpd::response_fields headers{ arena.resource() };
+			co_await httpd::send_string_response_body(s, "ok", std::move(headers), req.version(), true);
+		});
+	}, boost::asio::detached);
+
+	bool upload_done = false, other_reset = false;
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::ip::tcp::socket s(co_await boost::asio::this_coro::executor);
+		co_await s.async_connect(acceptor.local_endpoint(), use_awaitable);
+
+		std::string out(client_preface);
+		append_frame_header(out, 0, frame_type::settings, 0, 0);
+
+		// stream 1 上传 50000 字节, stream 3 往普通路径发 3000 字节.
+		for (auto [id, path, size] : { std::tuple{ 1u, "/api/upload", 50000 }, std::tuple{ 3u, "/other", 3000 } })
+		{
+			hpack_encoder encoder;
+			std::string block;
+			encoder.encode(block, ":method", "POST");
+			encoder.encode(block, ":scheme", "http");
+			encoder.encode(block, ":path", path);
+			encoder.encode(block, ":authority", "localhost");
+			append_frame_header(out, static_cast<std::uint32_t>(block.size()), frame_type::headers, flags::end_headers, id);
+			out += block;
+
+			for (int sent = 0; sent < size; sent += 10000)
+			{
+				int n = std::min(10000, size - sent);
+				append_frame_header(out, n, frame_type::data, sent + n == size ? flags::end_stream : 0, id);
+				out.append(n, 'u');
+			}
+		}
+		co_await boost::asio::async_write(s, boost::asio::buffer(out), use_awaitable);
+
+		while (!upload_done || !other_reset)
+		{
+			auto f = co_await read_frame(s);
+			if (f.header.stream_id == 1 && (f.header.flags & flags::end_stream)
+				&& (f.header.type == frame_type::data || f.header.type == frame_type::headers))
+				upload_done = true;
+			if (f.header.stream_id == 3 && f.header.type == frame_type::rst_stream)
+				other_reset = true;
+		}
+	}, [&](std::exception_ptr e)
+	{
+		CHECK(!e);
+		ioc.stop();
+	});
+
+	ioc.run();
+
+	CHECK(upload_done);
+	CHECK(other_reset);
+	CHECK(handled == 1);
+	CHECK(uploaded == 50000);
+}
+
+// shutdown 发 GOAWAY, 已有的 stream 照常做完, 之后开的 stream 被拒绝, 然后连接关闭.
+static void test_shutdown()
+{
+	boost::asio::io_context ioc;
+	boost::asio::make_service<httpd::timer_wheel>(ioc, std::chrono::milliseconds(10), 64);
+	boost::asio::ip::tcp::acceptor acceptor(ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	int handled = 0;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		httpd::http_any_stream stream(boost::variant2::in_place_type<boost::beast::tcp_stream>, ioc.get_executor());
+		co_await acceptor.async_accept(stream.socket(), use_awaitable);
+
+		boost::beast::flat_buffer buffer;
+		CHECK(co_await is_http2_connection(stream, buffer));
+
+		auto conn = std::make_shared<server_connection>(stream, buffer);
+		co_await conn->run([&](request& req, httpd::http_any_stream& s) -> awaitable<void>
+		{
+			handled++;
+			conn->shutdown();
+
+			// 响应在 GOAWAY 之后才写.
+			boost::asio::steady_timer t(co_await boost::asio::this_coro::executor, std::chrono::milliseconds(20));
+			co_await t.async_wait(use_awaitable);
+			httpd::request_arena arena;
+			httpd::response_fields headers{ arena.resource() };
+			co_await httpd::send_string_response_body(s, "ok", std::move(headers), req.version(), true);
+		});
+	}, boost::asio::detached);
+
+	bool goaway = false, response_done = false, refused = false, closed = false;
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::ip::tcp::socket s(co_await boost::asio::this_coro::executor);
+		co_await s.async_connect(acceptor.local_endpoint(), use_awaitable);
+
+		auto open_stream = [](std::string& out, std::uint32_t id)
+		{
+			hpack_encoder encoder;
+			std::string block;
+			encoder.encode(block, ":method", "GET");
+			encoder.encode(block, ":scheme", "http");
+			encoder.encode(block, ":path", "/");
+			encoder.encode(block, ":authority", "localhost");
+			append_frame_header(out, static_cast<std::uint32_t>(block.size()), frame_type::headers, flags::end_headers | flags::end_stream, id);
+			out += block;
+		};
+
+		std::string out(client_preface);
+		append_frame_header(out, 0, frame_type::settings, 0, 0);
+		open_stream(out, 1);
+		co_await boost::asio::async_write(s, boost::asio::buffer(out), use_awaitable);
+
+		for (;;)
+		{
+			char head[frame_header_length];
+			boost::system::error_code ec;
+			co_await boost::asio::async_read(s, boost::asio::buffer(head), boost::asio::redirect_error(use_awaitable, ec));
+			if (ec)
+			{
+				closed = true;
+				break;
+			}
+			auto h = parse_frame_header(head);
+			std::string payload(h.length, '\0');
+			co_await boost::asio::async_read(s, boost::asio::buffer(payload), use_awaitable);
+
+			if (h.type == frame_type::goaway && !goaway)
+			{
+				goaway = true;
+				// GOAWAY 里的 last stream id 是 1, 再开的 stream 3 不会被处理.
+				CHECK(static_cast<unsigned char>(payload[3]) == 1);
+				std::string more;
+				open_stream(more, 3);
+				co_await boost::asio::async_write(s, boost::asio::buffer(more), use_awaitable);
+			}
+			if (h.stream_id == 1 && (h.flags & flags::end_stream))
+				response_done = true;
+			if (h.stream_id == 3 && h.type == frame_type::rst_stream)
+				refused = true;
+		}
+	}, [&](std::exception_ptr e)
+	{
+		CHECK(!e);
+		ioc.stop();
+	});
+
+	ioc.run();
+
+	CHECK(goaway);
+	CHECK(response_done);
+	CHECK(refused);
+	CHECK(closed);
+	CHECK(handled == 1);
+}
+
+int main()
+{
+	test_hpack();
+	test_h2c();
+	test_idle_timeout();
+	test_stream_body_limit();
+	test_shutdown();
+	std::cout << "all passed\n";
+	return 0;
+}
@@ -0,0 +1,82 @@
+
+// inflight_limit: 额度用完时 async_acquire 挂起, release 之后按开销放行.
+// 超过上限的开销被折算成上限, 要等其他请求都结束.
+
+#include <cstdlib>
+#include <iostream>
+
+#include <boost/asio.hpp>
+
+#include "httpd/inflight_limit.hpp"
+#include "test_util.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+
+int main()
+{
+	boost::asio::io_context ioc;
+	httpd::inflight_limit limit(ioc.get_executor(), 4);
+
+	CHECK(limit.clamp(1) == 1);
+	CHECK(limit.clamp(10) == 4);
+
+	int acquired = 0;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		co_await limit.async_acquire(2);
+		co_await limit.async_acquire(2);
+		acquired = 2;
+		CHECK(limit.in_use() == 4);
+		CHECK(limit.waits() == 0);
+
+		// 满了, 等到释放出 3 个额度.
+		co_await limit.async_acquire(3);
+		acquired = 3;
+
+		// 独占整个额度.
+		co_await limit.async_acquire(limit.clamp(100));
+		acquired = 4;
+	}, [](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+
+	ioc.poll();
+	CHECK(acquired == 2);
+	CHECK(limit.waits() == 1);
+
+	// 释放 2 个还不够 3 个.
+	limit.release(2);
+	ioc.poll();
+	CHECK(acquired == 2);
+
+	limit.release(2);
+	ioc.poll();
+	CHECK(acquired == 3);
+	CHECK(limit.in_use() == 3);
+
+	limit.release(3);
+	ioc.poll();
+	CHECK(acquired == 4);
+	CHECK(limit.in_use() == 4);
+	CHECK(limit.waits() == 2);
+
+	limit.release(4);
+	CHECK(limit.in_use() == 0);
+
+	// 不限制.
+	httpd::inflight_limit unlimited(ioc.get_executor(), 0);
+	CHECK(unlimited.clamp(1000) == 1000);
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		co_await unlimited.async_acquire(1000);
+		co_await unlimited.async_acquire(1000);
+		acquired = 5;
+	}, [](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+	ioc.restart();
+	ioc.poll();
+	CHECK(acquired == 5);
+	CHECK(unlimited.waits() == 0);
+
+	std::cout << "all passed\n";
+	return 0;
+}
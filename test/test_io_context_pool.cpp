@@ -0,0 +1,57 @@
+// io_context_pool: 一个 io 线程一直占着 CPU 时, load() 里它的 busy 不为 0, 挑选时会避开它.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+#include "io_context_pool.hpp"
+#include "test_util.hpp"
+
+int main()
+{
+#ifdef __linux__
+	io_context_pool pool(2);
+	std::thread runner([&] { pool.run(); });
+
+	// 等 io 线程都起来, 拿到各自的 CPU 时钟.
+	std::atomic<int> started{ 0 };
+	for (std::size_t i = 0; i < 2; i++)
+		boost::asio::post(pool.get_io_context(i), [&] { started++; });
+	while (started < 2)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::atomic<bool> spinning{ true };
+	boost::asio::post(pool.get_io_context(0), [&]
+	{
+		while (spinning.load(std::memory_order_relaxed))
+			;
+	});
+
+	double busy = 0, idle = 1;
+	for (int i = 0; i < 10; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(120));
+		auto load = pool.load();
+		busy = load[0].busy;
+		idle = load[1].busy;
+	}
+	spinning = false;
+
+	CHECK(busy > 0.5);
+	CHECK(idle < 0.5);
+
+	// 两个里挑一个, 总是挑空闲的那个.
+	for (int i = 0; i < 10; i++)
+		CHECK(&pool.get_io_context() == &pool.get_io_context(1));
+
+	pool.stop();
+	runner.join();
+#endif
+
+	std::cout << "all passed\n";
+	return 0;
+}
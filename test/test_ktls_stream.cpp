@@ -0,0 +1,123 @@
+
+// ktls_stream 和普通的 asio ssl 客户端在 loopback 上互通. 内核不支持 kTLS 时走的是用户态的 fallback,
+// 两种情况下结果必须一样. 输出里会说明这次实际走的是哪条路.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "httpd/ktls_stream.hpp"
+#include "test_util.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+
+// 现场生成一个自签名证书.
+static void use_self_signed_cert(boost::asio::ssl::context& ctx)
+{
+	EVP_PKEY* pkey = EVP_EC_gen("P-256");
+	CHECK(pkey);
+
+	X509* cert = X509_new();
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, pkey);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+		reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(cert, X509_get_subject_name(cert));
+	CHECK(X509_sign(cert, pkey, EVP_sha256()));
+
+	CHECK(SSL_CTX_use_certificate(ctx.native_handle(), cert) == 1);
+	CHECK(SSL_CTX_use_PrivateKey(ctx.native_handle(), pkey) == 1);
+
+	X509_free(cert);
+	EVP_PKEY_free(pkey);
+}
+
+int main()
+{
+	boost::asio::io_context ioc;
+
+	boost::asio::ssl::context server_ctx(boost::asio::ssl::context::tls_server);
+	use_self_signed_cert(server_ctx);
+	boost::asio::ssl::context client_ctx(boost::asio::ssl::context::tls_client);
+
+	boost::asio::ip::tcp::acceptor acceptor(ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	const std::string payload(1024 * 1024, 'k');
+
+	bool ktls_send = false, ktls_recv = false;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		httpd::ktls_stream stream(ioc.get_executor(), server_ctx);
+		co_await acceptor.async_accept(stream.next_layer().socket(), use_awaitable);
+		co_await stream.async_handshake(use_awaitable);
+
+		ktls_send = stream.ktls_send();
+		ktls_recv = stream.ktls_recv();
+
+		std::string request(5, '\0');
+		co_await boost::asio::async_read(stream, boost::asio::buffer(request), use_awaitable);
+		CHECK(request == "hello");
+
+		co_await boost::asio::async_write(stream, boost::asio::buffer(payload), use_awaitable);
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	std::string received;
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::ssl::stream<boost::asio::ip::tcp::socket> client(ioc, client_ctx);
+		co_await client.next_layer().async_connect(acceptor.local_endpoint(), use_awaitable);
+		co_await client.async_handshake(boost::asio::ssl::stream_base::client, use_awaitable);
+		co_await boost::asio::async_write(client, boost::asio::buffer("hello", 5), use_awaitable);
+
+		received.resize(payload.size());
+		co_await boost::asio::async_read(client, boost::asio::buffer(received), use_awaitable);
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	ioc.run();
+	CHECK(received == payload);
+
+	// 客户端连上后什么都不发, expires_after 到期后服务端的读必须出错返回, 而不是一直挂着.
+	bool timed_out = false;
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		httpd::ktls_stream stream(ioc.get_executor(), server_ctx);
+		co_await acceptor.async_accept(stream.next_layer().socket(), use_awaitable);
+		co_await stream.async_handshake(use_awaitable);
+
+		stream.expires_after(std::chrono::milliseconds(50));
+		char c;
+		boost::system::error_code ec;
+		co_await stream.async_read_some(boost::asio::buffer(&c, 1), boost::asio::redirect_error(use_awaitable, ec));
+		timed_out = !!ec;
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::ssl::stream<boost::asio::ip::tcp::socket> client(ioc, client_ctx);
+		co_await client.next_layer().async_connect(acceptor.local_endpoint(), use_awaitable);
+		co_await client.async_handshake(boost::asio::ssl::stream_base::client, use_awaitable);
+
+		char c;
+		boost::system::error_code ec;
+		co_await client.async_read_some(boost::asio::buffer(&c, 1), boost::asio::redirect_error(use_awaitable, ec));
+		CHECK(ec);
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	ioc.restart();
+	ioc.run();
+	CHECK(timed_out);
+
+	std::cout << "ktls send: " << (ktls_send ? "kernel" : "userspace")
+		<< ", ktls recv: " << (ktls_recv ? "kernel" : "userspace") << "\nall passed\n";
+	return 0;
+}
@@ -0,0 +1,94 @@
+
+// 监听 fd 交接: 按地址认出监听 socket, 通过 unix socket 传给另一端以后,
+// 另一端 assign 进 acceptor 还能接着 accept, 原来 backlog 里排队的连接也还在.
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+
+#include "httpd/listen_fds.hpp"
+#include "test_util.hpp"
+
+using tcp = boost::asio::ip::tcp;
+using local = boost::asio::local::stream_protocol;
+
+int main()
+{
+	boost::asio::io_context ioc;
+	boost::system::error_code ec;
+
+	// 不是 systemd 启动的, 什么都拿不到, 环境变量也要清掉.
+	setenv("LISTEN_PID", "1", 1);
+	setenv("LISTEN_FDS", "2", 1);
+	CHECK(httpd::take_systemd_listen_fds().empty());
+	CHECK(!std::getenv("LISTEN_PID") && !std::getenv("LISTEN_FDS"));
+
+	tcp::acceptor listener(ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	auto port = std::to_string(listener.local_endpoint().port());
+	CHECK(httpd::is_tcp_listener_on(listener.native_handle(), "127.0.0.1:" + port));
+	CHECK(!httpd::is_tcp_listener_on(listener.native_handle(), "127.0.0.1:1"));
+	CHECK(!httpd::is_tcp_listener_on(listener.native_handle(), "[::1]:" + port));
+
+	auto unix_path = (std::filesystem::temp_directory_path() / "test_listen_fds.sock").string();
+	std::filesystem::remove(unix_path);
+	local::acceptor unix_listener(ioc, local::endpoint(unix_path));
+	CHECK(httpd::is_unix_listener_on(unix_listener.native_handle(), unix_path));
+	CHECK(!httpd::is_unix_listener_on(unix_listener.native_handle(), unix_path + ".other"));
+	CHECK(!httpd::is_unix_listener_on(listener.native_handle(), unix_path));
+
+	// 交接前就连上来的客户端, 交接后要能被新的 acceptor 接到.
+	tcp::socket early_client(ioc);
+	early_client.connect(listener.local_endpoint());
+
+	int sv[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	httpd::send_listen_fds(sv[0], { listener.native_handle(), unix_listener.native_handle() }, ec);
+	CHECK(!ec);
+	auto fds = httpd::receive_listen_fds(sv[1], ec);
+	CHECK(!ec);
+	CHECK(fds.size() == 2);
+	close(sv[0]);
+	close(sv[1]);
+
+	// 旧进程那边关掉自己的副本, 监听队列不受影响.
+	listener.close();
+	unix_listener.close();
+
+	tcp::acceptor adopted(ioc);
+	adopted.assign(tcp::v4(), fds[0], ec);
+	CHECK(!ec);
+	CHECK(httpd::is_tcp_listener_on(adopted.native_handle(), "127.0.0.1:" + port));
+
+	tcp::socket accepted(ioc);
+	adopted.accept(accepted, ec);
+	CHECK(!ec);
+	CHECK(accepted.remote_endpoint() == early_client.local_endpoint());
+
+	tcp::socket late_client(ioc);
+	late_client.connect(adopted.local_endpoint(), ec);
+	CHECK(!ec);
+	tcp::socket late_accepted(ioc);
+	adopted.accept(late_accepted, ec);
+	CHECK(!ec);
+
+	local::acceptor adopted_unix(ioc);
+	adopted_unix.assign(local(), fds[1], ec);
+	CHECK(!ec);
+	local::socket unix_client(ioc);
+	unix_client.connect(local::endpoint(unix_path), ec);
+	CHECK(!ec);
+	local::socket unix_accepted(ioc);
+	adopted_unix.accept(unix_accepted, ec);
+	CHECK(!ec);
+
+	std::filesystem::remove(unix_path);
+
+	std::cout << "all passed\n";
+	return 0;
+}
@@ -0,0 +1,122 @@
+
+// notify_bus: 两个实例 LISTEN 同一个频道, 一边发的通知另一边收到, 自己发的不回来.
+// 数据库重启后两边都能重连, 之后的通知照常送达.
+//
+// 用 initdb/pg_ctl 在临时目录里起一个只监听 unix socket 的 PostgreSQL,
+// PATH 里找不到 initdb 时跳过.
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+
+#include "services/notify_bus.hpp"
+#include "test_util.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+
+static int run_command(const std::string& cmd)
+{
+	return std::system((cmd + " > /dev/null 2>&1").c_str());
+}
+
+// 最多等 5 秒.
+static awaitable<bool> wait_until(std::function<bool()> cond)
+{
+	boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+	for (int i = 0; i < 500; i++)
+	{
+		if (cond())
+			co_return true;
+		timer.expires_after(std::chrono::milliseconds(10));
+		co_await timer.async_wait(use_awaitable);
+	}
+	co_return cond();
+}
+
+int main()
+{
+	if (run_command("initdb --version") != 0)
+	{
+		std::cout << "skipped: initdb not found in PATH\n";
+		return 0;
+	}
+
+	auto dir = std::filesystem::temp_directory_path() / ("test_notify_bus." + std::to_string(::getpid()));
+	std::filesystem::create_directories(dir);
+	auto data = (dir / "data").string();
+	auto pg_ctl = "pg_ctl -w -D " + data + " -l " + (dir / "log").string();
+
+	CHECK(run_command("initdb -A trust -U postgres -D " + data) == 0);
+	CHECK(run_command(pg_ctl + " -o \"-k " + dir.string() + " -c listen_addresses=''\" start") == 0);
+
+	services::notify_bus_config config;
+	config.host = dir.string();
+	config.dbname = "postgres";
+	config.user = "postgres";
+	config.channel = "test_notify_bus";
+	config.reconnect_delay = std::chrono::seconds(1);
+
+	boost::asio::io_context ioc;
+	std::vector<std::string> got_a, got_b;
+	services::notify_bus a(ioc.get_executor(), config, [&](std::string_view p) { got_a.emplace_back(p); });
+	services::notify_bus b(ioc.get_executor(), config, [&](std::string_view p) { got_b.emplace_back(p); });
+
+	boost::asio::co_spawn(ioc, a.run(), [](std::exception_ptr e) { CHECK(!e); });
+	boost::asio::co_spawn(ioc, b.run(), [](std::exception_ptr e) { CHECK(!e); });
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		CHECK(co_await wait_until([&] { return a.stats().connected && b.stats().connected; }));
+
+		a.publish("hello");
+		CHECK(co_await wait_until([&] { return got_b.size() == 1; }));
+		CHECK(got_b[0] == "hello");
+
+		// 一批攒着的通知合并发送, 顺序不变.
+		for (int i = 0; i < 100; i++)
+			b.publish(std::to_string(i));
+		CHECK(co_await wait_until([&] { return got_a.size() == 100; }));
+		for (int i = 0; i < 100; i++)
+			CHECK(got_a[i] == std::to_string(i));
+
+		// 自己发的不回给自己.
+		CHECK(got_b.size() == 1);
+
+		// 超过 8000 字节的直接丢弃.
+		a.publish(std::string(8000, 'x'));
+		CHECK(a.stats().dropped == 1);
+
+		// 重启数据库, 两边都要重连上.
+		CHECK(run_command(pg_ctl + " -m fast -o \"-k " + dir.string() + " -c listen_addresses=''\" restart") == 0);
+		CHECK(co_await wait_until([&] { return a.stats().reconnects > 0 && b.stats().reconnects > 0; }));
+		CHECK(co_await wait_until([&] { return a.stats().connected && b.stats().connected; }));
+
+		a.publish("after restart");
+		CHECK(co_await wait_until([&] { return got_b.size() == 2; }));
+		CHECK(got_b[1] == "after restart");
+
+		auto stats = a.stats();
+		CHECK(stats.published == 2);
+		CHECK(stats.received == 100);
+
+		a.stop();
+		b.stop();
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	ioc.run();
+
+	run_command(pg_ctl + " -m fast stop");
+	std::filesystem::remove_all(dir);
+
+	std::cout << "all passed\n";
+	return 0;
+}
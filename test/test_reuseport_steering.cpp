@@ -0,0 +1,106 @@
+
+// attach_reuseport_cpu_steering: 客户端线程绑在一个 CPU 上连 loopback,
+// 连接要落到 SO_REUSEPORT 组里对应这个 CPU 的 socket 上, 同一个 CPU 对应多个 socket 时随机分.
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <sched.h>
+
+#include <boost/asio.hpp>
+
+#include "httpd/detail/config.hpp"
+#include "test_util.hpp"
+
+using tcp = boost::asio::ip::tcp;
+
+// 连一次, 返回接到连接的 acceptor 下标.
+static int connect_once(boost::asio::io_context& ioc, std::vector<tcp::acceptor>& group)
+{
+	tcp::socket client(ioc);
+	client.connect(group[0].local_endpoint());
+
+	for (int retry = 0; retry < 100; retry++)
+	{
+		for (std::size_t i = 0; i < group.size(); i++)
+		{
+			boost::system::error_code ec;
+			tcp::socket s = group[i].accept(ec);
+			if (!ec)
+				return static_cast<int>(i);
+		}
+		usleep(1000);
+	}
+	return -1;
+}
+
+int main()
+{
+	if constexpr (!httpd::has_reuseport_cbpf())
+	{
+		std::cout << "SO_ATTACH_REUSEPORT_CBPF not supported, skipped\n";
+		return 0;
+	}
+
+	int cpu = sched_getcpu();
+	CHECK(cpu >= 0);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	CHECK(sched_setaffinity(0, sizeof(set), &set) == 0);
+
+	boost::asio::io_context ioc;
+	std::vector<tcp::acceptor> group;
+	unsigned short port = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		tcp::acceptor& a = group.emplace_back(ioc);
+		a.open(tcp::v4());
+		a.set_option(httpd::socket_options::reuse_port(true));
+		a.bind({ boost::asio::ip::make_address("127.0.0.1"), port });
+		a.listen();
+		a.non_blocking(true);
+		port = a.local_endpoint().port();
+	}
+
+	// 不存在的 CPU 排在前面, 命中表的话一定落到 1 号, 取模的话会落到 cpu % 2.
+	boost::system::error_code ec;
+	httpd::attach_reuseport_cpu_steering(group[0].native_handle(), { 100000, cpu }, ec);
+	CHECK(!ec);
+	for (int i = 0; i < 8; i++)
+		CHECK(connect_once(ioc, group) == 1);
+
+	httpd::attach_reuseport_cpu_steering(group[1].native_handle(), { cpu, 100000 }, ec);
+	CHECK(!ec);
+	for (int i = 0; i < 8; i++)
+		CHECK(connect_once(ioc, group) == 0);
+
+	// 表里没有的 CPU 取模.
+	httpd::attach_reuseport_cpu_steering(group[0].native_handle(), { 100000, 100001 }, ec);
+	CHECK(!ec);
+	for (int i = 0; i < 8; i++)
+		CHECK(connect_once(ioc, group) == cpu % 2);
+
+	// 一个 CPU 上绑了两个线程 (1 号和 2 号), 两个 socket 都要能接到连接.
+	tcp::acceptor& third = group.emplace_back(ioc);
+	third.open(tcp::v4());
+	third.set_option(httpd::socket_options::reuse_port(true));
+	third.bind({ boost::asio::ip::make_address("127.0.0.1"), port });
+	third.listen();
+	third.non_blocking(true);
+
+	httpd::attach_reuseport_cpu_steering(group[0].native_handle(), { 100000, cpu, cpu }, ec);
+	CHECK(!ec);
+	int hits[3] = {};
+	for (int i = 0; i < 64; i++)
+	{
+		int index = connect_once(ioc, group);
+		CHECK(index == 1 || index == 2);
+		hits[index]++;
+	}
+	CHECK(hits[1] > 0 && hits[2] > 0);
+
+	std::cout << "all passed\n";
+	return 0;
+}
@@ -0,0 +1,378 @@
+
+// send_queue: 按批取出, 超过水位线时 disconnect 关闭队列, drop_oldest 丢掉最早的消息.
+// write_coalescing_stream: 一批 websocket 消息只写一次, 对方照样能逐条读出来.
+// 合并写还在写的时候, websocket 自己发的控制帧排在后面, 不会和它同时写.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/beast/_experimental/test/stream.hpp>
+#include <boost/beast/websocket.hpp>
+
+#include "httpd/coalescing_stream.hpp"
+#include "httpd/send_queue.hpp"
+#include "test_util.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+namespace websocket = boost::beast::websocket;
+
+static void run(boost::asio::io_context& ioc, awaitable<void> coro)
+{
+	boost::asio::co_spawn(ioc, std::move(coro), [](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+	ioc.restart();
+	ioc.run();
+}
+
+static void test_batching()
+{
+	boost::asio::io_context ioc;
+	httpd::send_queue_config config;
+	config.max_batch_bytes = 10;
+	httpd::send_queue_counters counters;
+	httpd::send_queue q(ioc.get_executor(), config, &counters);
+
+	run(ioc, [&]() -> awaitable<void>
+	{
+		CHECK(q.push("aaaa"));
+		CHECK(q.push("bbbb"));
+		CHECK(q.push("cccc"));
+		CHECK(q.pending_bytes() == 12);
+
+		// 第三条放不进 10 字节的批.
+		std::vector<httpd::shared_message> batch;
+		CHECK(co_await q.async_pop(batch));
+		CHECK(batch.size() == 2 && *batch[0] == "aaaa" && *batch[1] == "bbbb");
+
+		batch.clear();
+		CHECK(co_await q.async_pop(batch));
+		CHECK(batch.size() == 1 && *batch[0] == "cccc");
+
+		// 超过批大小的单条消息也能取出来.
+		CHECK(q.push(std::string(100, 'x')));
+		batch.clear();
+		CHECK(co_await q.async_pop(batch));
+		CHECK(batch.size() == 1 && batch[0]->size() == 100);
+		CHECK(q.pending_bytes() == 0);
+	}());
+
+	// 空队列上等待, 另一个线程 push 后醒来.
+	run(ioc, [&]() -> awaitable<void>
+	{
+		std::thread producer([&] { q.push("late"); });
+		std::vector<httpd::shared_message> batch;
+		CHECK(co_await q.async_pop(batch));
+		CHECK(batch.size() == 1 && *batch[0] == "late");
+		producer.join();
+
+		q.close();
+		CHECK(!q.push("closed"));
+		batch.clear();
+		CHECK(!co_await q.async_pop(batch));
+	}());
+
+	// 广播: 两个队列排的是同一块缓冲.
+	run(ioc, [&]() -> awaitable<void>
+	{
+		httpd::send_queue a(ioc.get_executor(), config), b(ioc.get_executor(), config);
+		auto message = std::make_shared<const std::string>("shared");
+		CHECK(a.push(message) && b.push(message));
+		CHECK(message.use_count() == 3);
+
+		std::vector<httpd::shared_message> from_a, from_b;
+		CHECK(co_await a.async_pop(from_a));
+		CHECK(co_await b.async_pop(from_b));
+		CHECK(from_a[0] == message && from_b[0] == message);
+	}());
+
+	auto stats = counters.stats();
+	CHECK(stats.queued_messages == 5);
+	CHECK(stats.sent_messages == 5);
+	CHECK(stats.coalesced_writes == 1);
+}
+
+// shutdown 之后排着的消息照常取完, 然后带着 close code 结束.
+static void test_shutdown()
+{
+	boost::asio::io_context ioc;
+	httpd::send_queue q(ioc.get_executor(), {});
+
+	run(ioc, [&]() -> awaitable<void>
+	{
+		CHECK(q.push("aaaa"));
+		CHECK(q.push("bbbb"));
+		q.shutdown(1012);
+		CHECK(!q.push("late"));
+		CHECK(q.close_code() == 1012);
+
+		std::vector<httpd::shared_message> batch;
+		CHECK(co_await q.async_pop(batch));
+		CHECK(batch.size() == 2 && *batch[1] == "bbbb");
+		batch.clear();
+		CHECK(!co_await q.async_pop(batch));
+		CHECK(!q.overflowed());
+	}());
+
+	// 空队列上等着的写协程也要被叫醒.
+	httpd::send_queue idle(ioc.get_executor(), {});
+	bool popped = true;
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		std::vector<httpd::shared_message> batch;
+		popped = co_await idle.async_pop(batch);
+	}, boost::asio::detached);
+	boost::asio::post(ioc, [&] { idle.shutdown(1012); });
+	ioc.restart();
+	ioc.run();
+	CHECK(!popped);
+}
+
+static void test_overflow()
+{
+	boost::asio::io_context ioc;
+	httpd::send_queue_counters counters;
+
+	httpd::send_queue_config config;
+	config.high_water_bytes = 10;
+	config.policy = httpd::overflow_policy::drop_oldest;
+	httpd::send_queue dropping(ioc.get_executor(), config, &counters);
+
+	// 空队列时单条消息不受水位线限制.
+	CHECK(dropping.push(std::string(20, 'a')));
+	CHECK(dropping.push("bbbb"));
+	CHECK(dropping.push("cccc"));
+	CHECK(dropping.push("dddd"));
+	CHECK(dropping.pending_bytes() == 8);
+	CHECK(!dropping.overflowed());
+
+	run(ioc, [&]() -> awaitable<void>
+	{
+		std::vector<httpd::shared_message> batch;
+		CHECK(co_await dropping.async_pop(batch));
+		CHECK(batch.size() == 2 && *batch[0] == "cccc" && *batch[1] == "dddd");
+	}());
+
+	auto stats = counters.stats();
+	CHECK(stats.dropped_messages == 2);
+	CHECK(stats.dropped_bytes == 24);
+
+	config.policy = httpd::overflow_policy::disconnect;
+	httpd::send_queue disconnecting(ioc.get_executor(), config, &counters);
+	CHECK(disconnecting.push("aaaaaaaa"));
+	CHECK(!disconnecting.push("bbbb"));
+	CHECK(disconnecting.overflowed());
+	CHECK(!disconnecting.push("c"));
+
+	run(ioc, [&]() -> awaitable<void>
+	{
+		std::vector<httpd::shared_message> batch;
+		CHECK(!co_await disconnecting.async_pop(batch));
+	}());
+
+	CHECK(counters.stats().overflow_disconnects == 1);
+}
+
+static void test_coalescing()
+{
+	boost::asio::io_context ioc;
+	boost::beast::test::stream server_stream(ioc);
+	boost::beast::test::stream client_stream(ioc);
+	server_stream.connect(client_stream);
+
+	websocket::stream<httpd::write_coalescing_stream<boost::beast::test::stream&>> server(server_stream);
+	websocket::stream<boost::beast::test::stream&> client(client_stream);
+
+	const std::vector<std::string> messages = { "one", "two", std::string(1000, 'x'), "four" };
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		co_await server.async_accept(use_awaitable);
+
+		auto writes = server_stream.nwrite();
+		server.next_layer().begin_batch();
+		for (auto& m : messages)
+			co_await server.async_write(boost::asio::buffer(m), use_awaitable);
+		CHECK(server_stream.nwrite() == writes);
+		CHECK(server.next_layer().buffered_bytes() > 1000);
+
+		co_await server.next_layer().async_flush(use_awaitable);
+		CHECK(server_stream.nwrite() == writes + 1);
+		CHECK(server.next_layer().buffered_bytes() == 0);
+
+		// 不在批里的时候直接透传.
+		co_await server.async_write(boost::asio::buffer(messages[0]), use_awaitable);
+		CHECK(server_stream.nwrite() == writes + 2);
+
+		co_await server.async_close(websocket::close_code::normal, use_awaitable);
+	}, [](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		co_await client.async_handshake("localhost", "/api", use_awaitable);
+
+		for (auto& m : messages)
+		{
+			boost::beast::flat_buffer buffer;
+			co_await client.async_read(buffer, use_awaitable);
+			CHECK(boost::beast::buffers_to_string(buffer.data()) == m);
+		}
+
+		boost::beast::flat_buffer buffer;
+		co_await client.async_read(buffer, use_awaitable);
+		CHECK(boost::beast::buffers_to_string(buffer.data()) == messages[0]);
+
+		boost::system::error_code ec;
+		co_await client.async_read(buffer, boost::asio::redirect_error(use_awaitable, ec));
+		CHECK(ec == websocket::error::closed);
+	}, [](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+
+	ioc.run();
+}
+
+// 每次写都拖一会儿才写下去, 记下同时在写的操作数.
+class slow_stream
+{
+public:
+	using executor_type = boost::beast::test::stream::executor_type;
+
+	explicit slow_stream(boost::beast::test::stream& next)
+		: next_(next)
+	{}
+
+	executor_type get_executor() noexcept
+	{
+		return next_.get_executor();
+	}
+
+	boost::beast::test::stream& next_layer() noexcept
+	{
+		return next_;
+	}
+
+	template <typename MutableBufferSequence, typename ReadHandler>
+	auto async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+	{
+		return next_.async_read_some(buffers, std::forward<ReadHandler>(handler));
+	}
+
+	template <typename ConstBufferSequence, typename WriteHandler>
+	auto async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+	{
+		return boost::asio::async_initiate<WriteHandler, void(boost::system::error_code, std::size_t)>(
+			[this](auto handler, const ConstBufferSequence& buffers)
+			{
+				max_in_flight = std::max(max_in_flight, ++in_flight);
+				auto data = std::make_shared<std::string>(boost::beast::buffers_to_string(buffers));
+				auto timer = std::make_shared<boost::asio::steady_timer>(next_.get_executor(), std::chrono::milliseconds(20));
+				timer->async_wait([this, data, timer, handler = std::move(handler)](boost::system::error_code) mutable
+				{
+					in_flight--;
+					next_.async_write_some(boost::asio::buffer(*data), std::move(handler));
+				});
+			}, handler, buffers);
+	}
+
+	int in_flight = 0;
+	int max_in_flight = 0;
+
+private:
+	boost::beast::test::stream& next_;
+};
+
+template <typename TeardownHandler>
+void async_teardown(boost::beast::role_type role, slow_stream& stream, TeardownHandler&& handler)
+{
+	async_teardown(role, stream.next_layer(), std::forward<TeardownHandler>(handler));
+}
+
+// 合并写还没写完的时候 websocket 发 ping, ping 要排在这一批后面, 不能同时写.
+static void test_control_frame_during_flush()
+{
+	boost::asio::io_context ioc;
+	boost::beast::test::stream server_stream(ioc);
+	boost::beast::test::stream client_stream(ioc);
+	server_stream.connect(client_stream);
+	slow_stream slow(server_stream);
+
+	websocket::stream<httpd::write_coalescing_stream<slow_stream&>> server(slow);
+	websocket::stream<boost::beast::test::stream&> client(client_stream);
+
+	const std::vector<std::string> messages = { "one", "two", "three" };
+	bool got_ping = false;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		co_await server.async_accept(use_awaitable);
+
+		server.next_layer().begin_batch();
+		for (auto& m : messages)
+			co_await server.async_write(boost::asio::buffer(m), use_awaitable);
+
+		bool flushed = false;
+		boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+		{
+			co_await server.next_layer().async_flush(use_awaitable);
+			flushed = true;
+		}, [](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+
+		// flush 已经开始写, ping 不拿合并写的锁.
+		co_await boost::asio::post(ioc, use_awaitable);
+		CHECK(slow.in_flight == 1);
+		co_await server.async_ping({}, use_awaitable);
+		// ping 写完的时候那一批也一定写完了.
+		CHECK(slow.in_flight == 0);
+
+		boost::asio::steady_timer timer(ioc, std::chrono::milliseconds(1));
+		while (!flushed)
+		{
+			co_await timer.async_wait(use_awaitable);
+			timer.expires_after(std::chrono::milliseconds(1));
+		}
+		CHECK(slow.max_in_flight == 1);
+
+		co_await server.async_close(websocket::close_code::normal, use_awaitable);
+	}, [](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		client.control_callback([&](websocket::frame_type kind, boost::beast::string_view)
+		{
+			if (kind == websocket::frame_type::ping)
+				got_ping = true;
+		});
+		co_await client.async_handshake("localhost", "/api", use_awaitable);
+
+		for (auto& m : messages)
+		{
+			boost::beast::flat_buffer buffer;
+			co_await client.async_read(buffer, use_awaitable);
+			CHECK(boost::beast::buffers_to_string(buffer.data()) == m);
+			CHECK(!got_ping);
+		}
+
+		boost::beast::flat_buffer buffer;
+		boost::system::error_code ec;
+		co_await client.async_read(buffer, boost::asio::redirect_error(use_awaitable, ec));
+		CHECK(ec == websocket::error::closed);
+		CHECK(got_ping);
+	}, [](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+
+	ioc.run();
+}
+
+int main()
+{
+	test_batching();
+	test_shutdown();
+	test_overflow();
+	test_coalescing();
+	test_control_frame_during_flush();
+
+	std::cout << "all passed\n";
+	return 0;
+}
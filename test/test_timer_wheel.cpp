@@ -0,0 +1,152 @@
+
+// timer_wheel: 到期时间落在 [d, d + 2 tick] 内, 轮子转到一半时挂上的也不会提前, 重新调度会推迟, 取消不触发,
+// 超过一圈的超时按圈数触发, handler 里可以析构别的 deadline.
+// 最后挂 10 万个 deadline 反复刷新, 看看 O(1) 的更新开销, 并且没有 deadline 时 run() 能退出.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "httpd/timer_wheel.hpp"
+#include "test_util.hpp"
+
+using namespace std::chrono_literals;
+using clock_type = std::chrono::steady_clock;
+
+static void test_basic()
+{
+	boost::asio::io_context ioc;
+	// 20ms 一个 tick, 8 个槽转一圈 160ms.
+	auto& wheel = boost::asio::make_service<httpd::timer_wheel>(ioc, 20ms, 8);
+
+	auto start = clock_type::now();
+	clock_type::time_point fired_short, fired_long, fired_pushed;
+	bool fired_cancelled = false;
+
+	httpd::deadline short_d(ioc.get_executor());
+	short_d.on_expire([&] { fired_short = clock_type::now(); });
+	short_d.expires_after(50ms);
+
+	// 跨过两圈多.
+	httpd::deadline long_d(ioc.get_executor());
+	long_d.on_expire([&] { fired_long = clock_type::now(); });
+	long_d.expires_after(390ms);
+
+	httpd::deadline cancelled(ioc.get_executor());
+	cancelled.on_expire([&] { fired_cancelled = true; });
+	cancelled.expires_after(30ms);
+	cancelled.cancel();
+
+	// 40ms 后把它推迟到 100ms 之后.
+	httpd::deadline pushed(ioc.get_executor());
+	pushed.on_expire([&] { fired_pushed = clock_type::now(); });
+	pushed.expires_after(60ms);
+	boost::asio::steady_timer t(ioc, 40ms);
+	t.async_wait([&](boost::system::error_code) { pushed.expires_after(100ms); });
+
+	CHECK(wheel.size() == 3);
+	ioc.run();
+	CHECK(wheel.size() == 0);
+
+	auto ms = [&](clock_type::time_point tp) { return std::chrono::duration_cast<std::chrono::milliseconds>(tp - start).count(); };
+	CHECK(ms(fired_short) >= 50 && ms(fired_short) < 50 + 2 * 20 + 30);
+	CHECK(ms(fired_long) >= 390 && ms(fired_long) < 390 + 2 * 20 + 30);
+	CHECK(ms(fired_pushed) >= 140 && ms(fired_pushed) < 140 + 2 * 20 + 30);
+	CHECK(!fired_cancelled);
+}
+
+static void test_not_early()
+{
+	boost::asio::io_context ioc;
+	boost::asio::make_service<httpd::timer_wheel>(ioc, 20ms, 8);
+
+	// 让轮子先转起来.
+	httpd::deadline anchor(ioc.get_executor());
+	anchor.expires_after(200ms);
+
+	// 在两个 tick 中间挂一个 20ms 的, 下一个 tick 10ms 后就到, 不能那时候触发.
+	clock_type::time_point scheduled, fired;
+	httpd::deadline d(ioc.get_executor());
+	d.on_expire([&] { fired = clock_type::now(); anchor.cancel(); });
+	boost::asio::steady_timer t(ioc, 30ms);
+	t.async_wait([&](boost::system::error_code)
+	{
+		scheduled = clock_type::now();
+		d.expires_after(20ms);
+	});
+
+	ioc.run();
+	CHECK(fired - scheduled >= 20ms);
+	CHECK(fired - scheduled < 20ms + 2 * 20ms + 30ms);
+}
+
+static void test_destroy_in_handler()
+{
+	boost::asio::io_context ioc;
+	boost::asio::make_service<httpd::timer_wheel>(ioc, 10ms, 4);
+
+	// 同一个 tick 到期的两个, 先触发的那个析构掉另一个.
+	auto a = std::make_unique<httpd::deadline>(ioc.get_executor());
+	auto b = std::make_unique<httpd::deadline>(ioc.get_executor());
+	int fired = 0;
+	a->on_expire([&] { fired++; b.reset(); a.reset(); });
+	b->on_expire([&] { fired++; a.reset(); b.reset(); });
+	a->expires_after(10ms);
+	b->expires_after(10ms);
+
+	ioc.run();
+	CHECK(fired == 1);
+}
+
+static void test_many()
+{
+	boost::asio::io_context ioc;
+	auto& wheel = httpd::timer_wheel::of(ioc.get_executor());
+
+	constexpr int count = 100000;
+	std::vector<std::unique_ptr<httpd::deadline>> deadlines;
+	deadlines.reserve(count);
+	int fired = 0;
+	for (int i = 0; i < count; i++)
+	{
+		auto& d = deadlines.emplace_back(std::make_unique<httpd::deadline>(ioc.get_executor()));
+		d->on_expire([&fired] { fired++; });
+		d->expires_after(std::chrono::seconds(30 + i % 60));
+	}
+
+	// 模拟每个连接收到数据后刷新超时.
+	auto start = clock_type::now();
+	for (int round = 0; round < 10; round++)
+		for (int i = 0; i < count; i++)
+			deadlines[i]->expires_after(std::chrono::seconds(30 + (i + round) % 60));
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+	std::cout << "reschedule: " << ns / (10 * count) << " ns per update, " << wheel.size() << " pending\n";
+	CHECK(wheel.size() == count);
+
+	// 一半提前到期, 另一半取消, 之后 run() 应该退出.
+	for (int i = 0; i < count; i++)
+	{
+		if (i % 2)
+			deadlines[i]->expires_after(1ms);
+		else
+			deadlines[i]->cancel();
+	}
+	ioc.run();
+	CHECK(fired == count / 2);
+	CHECK(wheel.size() == 0);
+}
+
+int main()
+{
+	test_basic();
+	test_not_early();
+	test_destroy_in_handler();
+	test_many();
+
+	std::cout << "all passed\n";
+	return 0;
+}
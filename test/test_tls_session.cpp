@@ -0,0 +1,152 @@
+
+// tls_session_manager: 第二次连接用第一次拿到的 session 恢复, 计数要对.
+// 轮换一次密钥后旧 ticket 还能用, 轮换两次后只能走完整握手.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "httpd/tls_session.hpp"
+#include "test_util.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+
+static void use_self_signed_cert(boost::asio::ssl::context& ctx)
+{
+	EVP_PKEY* pkey = EVP_EC_gen("P-256");
+	CHECK(pkey);
+
+	X509* cert = X509_new();
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, pkey);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+		reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(cert, X509_get_subject_name(cert));
+	CHECK(X509_sign(cert, pkey, EVP_sha256()));
+
+	CHECK(SSL_CTX_use_certificate(ctx.native_handle(), cert) == 1);
+	CHECK(SSL_CTX_use_PrivateKey(ctx.native_handle(), pkey) == 1);
+
+	X509_free(cert);
+	EVP_PKEY_free(pkey);
+}
+
+// 连一次, 带上 session 的话尝试恢复. 返回这次连接拿到的 session, 是否恢复通过 reused 给出.
+static SSL_SESSION* connect_once(boost::asio::ssl::context& server_ctx, boost::asio::ssl::context& client_ctx, SSL_SESSION* session, bool& reused)
+{
+	boost::asio::io_context ioc;
+	boost::asio::ip::tcp::acceptor acceptor(ioc, { boost::asio::ip::make_address("127.0.0.1"), 0 });
+	SSL_SESSION* new_session = nullptr;
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::ssl::stream<boost::asio::ip::tcp::socket> server(ioc, server_ctx);
+		co_await acceptor.async_accept(server.next_layer(), use_awaitable);
+		co_await server.async_handshake(boost::asio::ssl::stream_base::server, use_awaitable);
+		co_await boost::asio::async_write(server, boost::asio::buffer("ok", 2), use_awaitable);
+
+		char c;
+		boost::system::error_code ec;
+		co_await server.async_read_some(boost::asio::buffer(&c, 1), boost::asio::redirect_error(use_awaitable, ec));
+		co_await server.async_shutdown(boost::asio::redirect_error(use_awaitable, ec));
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	boost::asio::co_spawn(ioc, [&]() -> awaitable<void>
+	{
+		boost::asio::ssl::stream<boost::asio::ip::tcp::socket> client(ioc, client_ctx);
+		if (session)
+			SSL_set_session(client.native_handle(), session);
+		co_await client.next_layer().async_connect(acceptor.local_endpoint(), use_awaitable);
+		co_await client.async_handshake(boost::asio::ssl::stream_base::client, use_awaitable);
+
+		// TLS 1.3 的 ticket 在握手之后才发过来, 读到数据的时候已经处理过了.
+		std::string reply(2, '\0');
+		co_await boost::asio::async_read(client, boost::asio::buffer(reply), use_awaitable);
+		CHECK(reply == "ok");
+
+		reused = SSL_session_reused(client.native_handle());
+		new_session = SSL_get1_session(client.native_handle());
+
+		// 不发 close_notify 就关掉的连接, OpenSSL 会把它的 session 标记为不可恢复 (两端都是).
+		boost::system::error_code ec;
+		co_await client.async_shutdown(boost::asio::redirect_error(use_awaitable, ec));
+	}, [](std::exception_ptr e) { CHECK(!e); });
+
+	ioc.run();
+	return new_session;
+}
+
+static void run(httpd::tls_session_config config)
+{
+	boost::asio::ssl::context server_ctx(boost::asio::ssl::context::tls_server);
+	use_self_signed_cert(server_ctx);
+	boost::asio::ssl::context client_ctx(boost::asio::ssl::context::tls_client);
+	SSL_CTX_set_session_cache_mode(client_ctx.native_handle(), SSL_SESS_CACHE_CLIENT);
+
+	httpd::tls_session_manager manager(config);
+	manager.apply(server_ctx);
+
+	bool reused = false;
+	SSL_SESSION* session = connect_once(server_ctx, client_ctx, nullptr, reused);
+	CHECK(session && !reused);
+
+	SSL_SESSION* resumed_session = connect_once(server_ctx, client_ctx, session, reused);
+	CHECK(reused);
+	SSL_SESSION_free(session);
+	session = resumed_session;
+
+	auto stats = manager.stats();
+	CHECK(stats.full_handshakes == 1);
+	CHECK(stats.resumed_handshakes == 1);
+
+	if (config.session_tickets)
+	{
+		// 上一个密钥还认.
+		manager.rotate_ticket_key();
+		resumed_session = connect_once(server_ctx, client_ctx, session, reused);
+		CHECK(reused);
+		SSL_SESSION_free(session);
+		session = resumed_session;
+
+		// 拿到的是新密钥加密的 ticket, 之后连着轮换两次, 这个 ticket 就失效了.
+		manager.rotate_ticket_key();
+		manager.rotate_ticket_key();
+		resumed_session = connect_once(server_ctx, client_ctx, session, reused);
+		CHECK(!reused);
+		SSL_SESSION_free(resumed_session);
+
+		stats = manager.stats();
+		CHECK(stats.full_handshakes == 2);
+		CHECK(stats.resumed_handshakes == 2);
+		CHECK(stats.ticket_key_rotations == 3);
+	}
+
+	SSL_SESSION_free(session);
+}
+
+int main()
+{
+	httpd::tls_session_config config;
+
+	// 无状态 ticket.
+	config.session_cache_size = 0;
+	run(config);
+
+	// 只用服务端的 session cache.
+	config.session_cache_size = 1024;
+	config.session_tickets = false;
+	run(config);
+
+	std::cout << "all passed\n";
+	return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// 测试里用的断言, 不受 NDEBUG 影响, 失败时打印位置并退出.
+#define CHECK(expr) do { if (!(expr)) { std::cerr << __FILE__ << ":" << __LINE__ << " CHECK failed: " #expr "\n"; std::exit(1); } } while (0)